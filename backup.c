@@ -0,0 +1,210 @@
+#include "backup.h"
+#include "header.h"
+#include "checksum.h"
+#include "constants.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+/**
+ *
+ * Every page carries the change sequence number it was last written in. A backup advances the
+ * number, flushes the header so that the new value is durable, and takes a snapshot, so every
+ * page written from then on is stamped higher than anything the backup holds. The backup keeps
+ * the advanced number in its own header as its high-water mark, and the next backup into the
+ * same file copies only the pages stamped at or above it.
+ *
+ * The header of the backup is written last. A backup that is interrupted leaves the previous
+ * mark in place, and the next one copies every page it may have missed.
+ *
+ */
+
+// Pages stamped at or above the returned number are copied, 0 when path holds no usable backup
+static uint64_t backup_copy_from(int file_descriptor, uint64_t database_id, uint64_t change_seq) {
+    uint8_t* header = malloc(PAGE_SIZE);
+    uint64_t copy_from = 0;
+
+    if (header != NULL && pread(file_descriptor, header, PAGE_SIZE, 0) == (ssize_t)PAGE_SIZE &&
+        page_checksum_matches(DB_HEADER_PAGE_NUM, header) && is_valid_db_header(header) &&
+        (*db_header_flags(header) & DB_FLAG_BACKUP) != 0 && *db_header_database_id(header) == database_id &&
+        *db_header_change_seq(header) <= change_seq) {
+        copy_from = *db_header_change_seq(header);
+    }
+
+    free(header);
+    return copy_from;
+}
+
+// Called with the pager lock held, returns the snapshot the backup copies
+static PagerSnapshot* backup_begin(Pager* pager, uint32_t* num_pages, uint64_t* database_id, DbError* error) {
+    if (pager->error.code != SIMPLESQLITE_OK) {
+        *error = pager->error;
+        return NULL;
+    }
+    if (pager->in_transaction) {
+        set_db_error(error, SIMPLESQLITE_MISUSE, "Error: Cannot back up inside a transaction.");
+        return NULL;
+    }
+
+    jmp_buf error_handler;
+    if (setjmp(error_handler) != 0) {
+        pager->error_handler = NULL;
+        *error = pager->error;
+        return NULL;
+    }
+    pager->error_handler = &error_handler;
+
+    uint8_t* header = get_page_for_write(pager, DB_HEADER_PAGE_NUM);
+    pager->change_seq++;
+    *db_header_change_seq(header) = pager->change_seq;
+    *database_id = *db_header_database_id(header);
+    // Otherwise a crash could bring back the old number after a backup has recorded the new one
+    pager_commit(pager);
+    PagerSnapshot* snapshot = pager_take_snapshot(pager);
+    *num_pages = pager->num_pages;
+
+    pager->error_handler = NULL;
+    return snapshot;
+}
+
+/**
+ *
+ * Copies the pages in [first_page_num, end_page_num) stamped at or above copy_from, as the
+ * snapshot sees them. The pager lock is held for one chunk at a time, so statements carry on
+ * between chunks while the snapshot keeps the pages the backup has not reached yet.
+ *
+ */
+static bool backup_read_chunk(Pager* pager, PagerSnapshot* snapshot, uint32_t first_page_num, uint32_t end_page_num,
+                              uint64_t copy_from, uint32_t* page_nums, uint8_t* pages, uint32_t* num_copied,
+                              DbError* error) {
+    pager_lock(pager);
+    jmp_buf error_handler;
+    if (setjmp(error_handler) != 0) {
+        pager->error_handler = NULL;
+        *error = pager->error;
+        pager_unlock(pager);
+        return false;
+    }
+    pager->error_handler = &error_handler;
+    pager->read_snapshot = snapshot;
+
+    *num_copied = 0;
+    for (uint32_t page_num = first_page_num; page_num < end_page_num; page_num++) {
+        uint8_t* page = get_page(pager, page_num);
+        if (page_num != DB_HEADER_PAGE_NUM && *page_change_seq(page) < copy_from) {
+            continue;
+        }
+        page_nums[*num_copied] = page_num;
+        memcpy(pages + (size_t)*num_copied * PAGE_SIZE, page, PAGE_SIZE);
+        (*num_copied)++;
+    }
+
+    pager->read_snapshot = NULL;
+    pager->error_handler = NULL;
+    pager_unlock(pager);
+    return true;
+}
+
+static bool backup_write_page(int file_descriptor, uint32_t page_num, uint8_t* page, DbError* error) {
+    set_page_checksum(page_num, page);
+    if (pwrite(file_descriptor, page, PAGE_SIZE, (off_t)page_num * PAGE_SIZE) != (ssize_t)PAGE_SIZE) {
+        set_db_error(error, SIMPLESQLITE_IO_ERROR, "Error writing backup: %d", errno);
+        return false;
+    }
+    return true;
+}
+
+static bool backup_sync(int file_descriptor, DbError* error) {
+    if (fsync(file_descriptor) == -1) {
+        set_db_error(error, SIMPLESQLITE_IO_ERROR, "Error syncing backup: %d", errno);
+        return false;
+    }
+    return true;
+}
+
+// The pages are written uncompressed, the backup of a compressed database is a plain file
+static bool backup_copy_pages(Pager* pager, PagerSnapshot* snapshot, int file_descriptor, uint64_t copy_from,
+                              BackupStats* stats, DbError* error) {
+    uint32_t* page_nums = malloc(sizeof(uint32_t) * BACKUP_CHUNK_PAGES);
+    uint8_t* pages = malloc((size_t)PAGE_SIZE * BACKUP_CHUNK_PAGES);
+    uint8_t* header = malloc(PAGE_SIZE);
+    bool copied = page_nums != NULL && pages != NULL && header != NULL;
+    if (!copied) {
+        set_db_error(error, SIMPLESQLITE_NO_MEMORY, "Out of memory");
+    }
+
+    for (uint32_t page_num = 0; copied && page_num < stats->num_pages; page_num += BACKUP_CHUNK_PAGES) {
+        uint32_t end_page_num = stats->num_pages - page_num > BACKUP_CHUNK_PAGES ? page_num + BACKUP_CHUNK_PAGES : stats->num_pages;
+        uint32_t num_copied;
+        copied = backup_read_chunk(pager, snapshot, page_num, end_page_num, copy_from, page_nums, pages, &num_copied, error);
+
+        for (uint32_t i = 0; copied && i < num_copied; i++) {
+            uint8_t* page = pages + (size_t)i * PAGE_SIZE;
+            if (page_nums[i] == DB_HEADER_PAGE_NUM) {
+                memcpy(header, page, PAGE_SIZE);
+            } else {
+                copied = backup_write_page(file_descriptor, page_nums[i], page, error);
+            }
+            stats->pages_copied++;
+        }
+    }
+
+    if (copied && ftruncate(file_descriptor, (off_t)stats->num_pages * PAGE_SIZE) == -1) {
+        set_db_error(error, SIMPLESQLITE_IO_ERROR, "Error truncating backup: %d", errno);
+        copied = false;
+    }
+    // The pages are durable before the header that makes them part of the backup
+    copied = copied && backup_sync(file_descriptor, error);
+    if (copied) {
+        *db_header_flags(header) = (*db_header_flags(header) & ~DB_FLAG_COMPRESSED) | DB_FLAG_BACKUP;
+        copied = backup_write_page(file_descriptor, DB_HEADER_PAGE_NUM, header, error) &&
+                 backup_sync(file_descriptor, error);
+    }
+
+    free(page_nums);
+    free(pages);
+    free(header);
+    return copied;
+}
+
+bool backup_database(Pager* pager, const char* path, BackupStats* stats, DbError* error) {
+    int file_descriptor = open(path, O_RDWR | O_CREAT, S_IWUSR | S_IRUSR);
+    if (file_descriptor == -1) {
+        set_db_error(error, SIMPLESQLITE_CANT_OPEN, "Unable to open backup file");
+        return false;
+    }
+
+    struct stat backup_stat;
+    struct stat database_stat;
+    if (fstat(file_descriptor, &backup_stat) == 0 && fstat(pager->file_descriptor, &database_stat) == 0 &&
+        backup_stat.st_dev == database_stat.st_dev && backup_stat.st_ino == database_stat.st_ino) {
+        set_db_error(error, SIMPLESQLITE_MISUSE, "Error: Cannot back up a database onto itself.");
+        close(file_descriptor);
+        return false;
+    }
+
+    uint64_t database_id;
+    pager_lock(pager);
+    PagerSnapshot* snapshot = backup_begin(pager, &stats->num_pages, &database_id, error);
+    stats->change_seq = pager->change_seq;
+    pager_unlock(pager);
+    if (snapshot == NULL) {
+        close(file_descriptor);
+        return false;
+    }
+
+    uint64_t copy_from = backup_copy_from(file_descriptor, database_id, stats->change_seq);
+    stats->pages_copied = 0;
+    stats->incremental = copy_from != 0;
+    bool copied = backup_copy_pages(pager, snapshot, file_descriptor, copy_from, stats, error);
+
+    pager_lock(pager);
+    pager_release_snapshot(pager, snapshot);
+    pager_unlock(pager);
+    close(file_descriptor);
+
+    return copied;
+}
@@ -0,0 +1,14 @@
+#ifndef BACKUP_H
+#define BACKUP_H
+
+#include "table.h"
+#include "db_error.h"
+#include <stdbool.h>
+
+#define BACKUP_CHUNK_PAGES 64
+
+typedef SimpleSqliteBackupStats BackupStats;
+
+bool backup_database(Pager* pager, const char* path, BackupStats* stats, DbError* error);
+
+#endif
@@ -0,0 +1,504 @@
+#include "table.h"
+#include "statement.h"
+#include "cursor.h"
+#include "node.h"
+#include "constants.h"
+#include "stats.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/**
+ *
+ * Benchmark
+ *
+ * Drives the engine below the statement parser, the way execute_statement does, so that what
+ * is measured is the tree and the pager. Every operation takes the pager lock like a step
+ * would. Each workload prints one line of JSON:
+ *
+ *   {"workload": "point_lookup", "ops": 10000, "ops_per_sec": ..., "p50_ns": ..., ...}
+ *
+ * pages_touched counts get_page calls, hits and misses, made by the workload. file_bytes is
+ * the size of the database once the workload is over, counting pages not written out yet.
+ * disk_bytes is what the file takes on disk, which is less with --compress.
+ *
+ */
+
+typedef struct {
+    uint32_t rows;
+    uint32_t ops;
+    uint32_t scan_rows;
+    uint32_t read_percent;
+    uint32_t open_close_runs;
+    uint32_t batch_keys;
+    uint64_t seed;
+    DbConfig config;
+} BenchOptions;
+
+typedef struct {
+    const char* name;
+    uint64_t ops;
+    uint64_t rows_seen;
+    uint64_t start_ns;
+    uint64_t pages_touched;
+    uint64_t file_bytes;
+    uint64_t disk_bytes;
+    LatencyHistogram latencies;
+} Workload;
+
+static uint64_t random_state;
+
+// xorshift64*, the same sequence for the same seed on every platform
+static uint64_t next_random(void) {
+    random_state ^= random_state >> 12;
+    random_state ^= random_state << 25;
+    random_state ^= random_state >> 27;
+    return random_state * 2685821657736338717ULL;
+}
+
+static uint64_t random_key(uint32_t rows) {
+    return next_random() % rows + 1;
+}
+
+void print_usage(void) {
+    printf("Usage: simpleSQLiteBench [options] <scratch directory>\n");
+    printf("  --rows <n>              rows loaded before the read workloads (default 10000)\n");
+    printf("  --ops <n>               operations per read and mixed workload (default 10000)\n");
+    printf("  --scan-rows <n>         rows read by every range scan (default 100)\n");
+    printf("  --read-percent <n>      lookups among the mixed operations, the rest are inserts (default 90)\n");
+    printf("  --open-close-runs <n>   times the loaded database is opened and closed (default 20)\n");
+    printf("  --batch-keys <n>        keys per batched lookup, at most 1024 (default 100)\n");
+    printf("  --seed <n>              seed for the random keys (default 1)\n");
+    printf("  -k 32|64                key width in bits (default 32)\n");
+    printf("  --flush-pages <n>       background flush once n pages are dirty, 0 disables it (default 64)\n");
+    printf("  --compress              compress the pages on disk\n");
+}
+
+static bool parse_uint32(const char* text, uint32_t* value) {
+    char* end;
+    unsigned long parsed = strtoul(text, &end, 10);
+    if (text[0] == '\0' || text[0] == '-' || *end != '\0' || parsed > UINT32_MAX) {
+        return false;
+    }
+    *value = (uint32_t)parsed;
+    return true;
+}
+
+static bool parse_bench_arguments(int argc, char* argv[], BenchOptions* options) {
+    static struct option long_options[] = {
+        {"rows", required_argument, NULL, 'n'},
+        {"ops", required_argument, NULL, 'o'},
+        {"scan-rows", required_argument, NULL, 'c'},
+        {"read-percent", required_argument, NULL, 'r'},
+        {"open-close-runs", required_argument, NULL, 'x'},
+        {"batch-keys", required_argument, NULL, 'b'},
+        {"seed", required_argument, NULL, 's'},
+        {"flush-pages", required_argument, NULL, 'p'},
+        {"compress", no_argument, NULL, 'z'},
+        {NULL, 0, NULL, 0}
+    };
+
+    options->rows = 10000;
+    options->ops = 10000;
+    options->scan_rows = 100;
+    options->read_percent = 90;
+    options->open_close_runs = 20;
+    options->batch_keys = 100;
+    options->seed = 1;
+    initialize_db_config(&options->config);
+
+    int option;
+    uint32_t seed;
+    while ((option = getopt_long(argc, argv, "k:", long_options, NULL)) != -1) {
+        bool valid;
+        switch (option) {
+            case 'k':
+                valid = strcmp(optarg, "32") == 0 || strcmp(optarg, "64") == 0;
+                options->config.key_size = strcmp(optarg, "64") == 0 ? WIDE_KEY_SIZE : NARROW_KEY_SIZE;
+                break;
+            case 'n':
+                valid = parse_uint32(optarg, &options->rows) && options->rows > 0;
+                break;
+            case 'o':
+                valid = parse_uint32(optarg, &options->ops);
+                break;
+            case 'c':
+                valid = parse_uint32(optarg, &options->scan_rows);
+                break;
+            case 'r':
+                valid = parse_uint32(optarg, &options->read_percent) && options->read_percent <= 100;
+                break;
+            case 'x':
+                valid = parse_uint32(optarg, &options->open_close_runs);
+                break;
+            case 'b':
+                valid = parse_uint32(optarg, &options->batch_keys) && options->batch_keys > 0 &&
+                        options->batch_keys <= MAX_KEY_LIST;
+                break;
+            case 's':
+                valid = parse_uint32(optarg, &seed) && seed > 0;
+                options->seed = seed;
+                break;
+            case 'p':
+                valid = parse_uint32(optarg, &options->config.flush_dirty_pages);
+                break;
+            case 'z':
+                options->config.compress = true;
+                valid = true;
+                break;
+            default:
+                valid = false;
+                break;
+        }
+        if (!valid) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static Table* open_or_exit(const char* filename, const DbConfig* config) {
+    DbError error;
+    Table* table = db_open(filename, config, &error);
+    if (table == NULL) {
+        printf("%s\n", error.message);
+        exit(EXIT_FAILURE);
+    }
+    return table;
+}
+
+static void close_or_exit(Table* table) {
+    DbError error;
+    if (!db_close(table, &error)) {
+        printf("%s\n", error.message);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static uint64_t pages_touched(Pager* pager) {
+    return pager->stats.cache_hits + pager->stats.cache_misses;
+}
+
+static uint64_t file_bytes(Table* table) {
+    return (uint64_t)table->pager->num_pages * PAGE_SIZE;
+}
+
+static uint64_t disk_bytes(const char* filename) {
+    struct stat file_stat;
+    return stat(filename, &file_stat) == 0 ? (uint64_t)file_stat.st_size : 0;
+}
+
+static uint64_t open_disk_bytes(Table* table) {
+    struct stat file_stat;
+    return fstat(table->pager->file_descriptor, &file_stat) == 0 ? (uint64_t)file_stat.st_size : 0;
+}
+
+static bool key_exists(Table* table, uint64_t key) {
+    Cursor* cursor = table_find(table, key);
+    uint8_t* node = get_page(table->pager, cursor->page_num);
+    bool exists = cursor->cell_num < *leaf_node_num_cells(node) && leaf_node_key(node, cursor->cell_num) == key;
+    free(cursor);
+    return exists;
+}
+
+static void start_workload(Workload* workload, const char* name) {
+    memset(workload, 0, sizeof(Workload));
+    workload->name = name;
+    workload->start_ns = monotonic_time_ns();
+}
+
+static void record_op(Workload* workload, uint64_t op_start_ns) {
+    record_latency(&workload->latencies, monotonic_time_ns() - op_start_ns);
+    workload->ops++;
+}
+
+static void finish_workload(Workload* workload) {
+    double seconds = (monotonic_time_ns() - workload->start_ns) / 1e9;
+
+    LatencyHistogram* latencies = &workload->latencies;
+    printf("{\"workload\": \"%s\", \"ops\": %" PRIu64 ", \"rows_seen\": %" PRIu64 ", \"seconds\": %.6f"
+           ", \"ops_per_sec\": %.1f, \"mean_ns\": %" PRIu64 ", \"p50_ns\": %" PRIu64 ", \"p99_ns\": %" PRIu64
+           ", \"p999_ns\": %" PRIu64 ", \"max_ns\": %" PRIu64 ", \"pages_touched\": %" PRIu64
+           ", \"pages_per_op\": %.2f, \"file_bytes\": %" PRIu64 ", \"disk_bytes\": %" PRIu64 ", \"page_size\": %" PRIu32 "}\n",
+           workload->name, workload->ops, workload->rows_seen, seconds,
+           seconds > 0 ? workload->ops / seconds : 0.0,
+           latencies->count > 0 ? latencies->total_ns / latencies->count : 0,
+           latency_percentile(latencies, 500), latency_percentile(latencies, 990),
+           latency_percentile(latencies, 999), latencies->max_ns, workload->pages_touched,
+           workload->ops > 0 ? (double)workload->pages_touched / workload->ops : 0.0, workload->file_bytes,
+           workload->disk_bytes, PAGE_SIZE);
+    fflush(stdout);
+}
+
+static void insert_row(Table* table, Statement* statement, uint64_t key) {
+    statement->row_to_insert.id = key;
+    snprintf(statement->row_to_insert.username, sizeof(statement->row_to_insert.username), "user%" PRIu64, key);
+    snprintf(statement->row_to_insert.email, sizeof(statement->row_to_insert.email), "person%" PRIu64 "@example.com", key);
+
+    ExecuteResult result = execute_statement(statement, table, NULL);
+    if (result != EXECUTE_SUCCESS && result != EXECUTE_DUPLICATE_KEY) {
+        printf("Insert of %" PRIu64 " failed.\n", key);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void run_inserts(const char* name, const char* filename, const BenchOptions* options, uint64_t* keys) {
+    unlink(filename);
+    Table* table = open_or_exit(filename, &options->config);
+
+    Statement statement;
+    memset(&statement, 0, sizeof(statement));
+    statement.type = STATEMENT_INSERT;
+
+    Workload workload;
+    start_workload(&workload, name);
+    for (uint32_t i = 0; i < options->rows; i++) {
+        uint64_t op_start_ns = monotonic_time_ns();
+        pager_lock(table->pager);
+        insert_row(table, &statement, keys[i]);
+        pager_unlock(table->pager);
+        record_op(&workload, op_start_ns);
+    }
+    workload.pages_touched = pages_touched(table->pager);
+    workload.file_bytes = file_bytes(table);
+
+    // Writing the pages out is part of loading them
+    close_or_exit(table);
+    workload.disk_bytes = disk_bytes(filename);
+    finish_workload(&workload);
+}
+
+static void run_point_lookups(Table* table, const BenchOptions* options) {
+    Workload workload;
+    start_workload(&workload, "point_lookup");
+    uint64_t pages_before = pages_touched(table->pager);
+
+    for (uint32_t i = 0; i < options->ops; i++) {
+        uint64_t key = random_key(options->rows);
+        uint64_t op_start_ns = monotonic_time_ns();
+        pager_lock(table->pager);
+        if (key_exists(table, key)) {
+            workload.rows_seen++;
+        }
+        pager_unlock(table->pager);
+        record_op(&workload, op_start_ns);
+    }
+
+    workload.pages_touched = pages_touched(table->pager) - pages_before;
+    workload.file_bytes = file_bytes(table);
+    workload.disk_bytes = open_disk_bytes(table);
+    finish_workload(&workload);
+}
+
+static int compare_keys(const void* left, const void* right) {
+    uint64_t left_key = *(const uint64_t*)left;
+    uint64_t right_key = *(const uint64_t*)right;
+    return left_key < right_key ? -1 : left_key > right_key;
+}
+
+// The same number of random keys as point_lookup, looked up --batch-keys at a time
+static void run_batched_lookups(Table* table, const BenchOptions* options) {
+    Workload workload;
+    start_workload(&workload, "batched_lookup");
+    uint64_t pages_before = pages_touched(table->pager);
+
+    uint64_t* keys = malloc(sizeof(uint64_t) * options->batch_keys);
+    Cursor* found = malloc(sizeof(Cursor) * options->batch_keys);
+    for (uint32_t i = 0; i < options->ops; i += options->batch_keys) {
+        // Sorted and without repeats, as a select with a key list has them
+        uint32_t num_keys = 0;
+        for (uint32_t j = 0; j < options->batch_keys; j++) {
+            keys[j] = random_key(options->rows);
+        }
+        qsort(keys, options->batch_keys, sizeof(uint64_t), compare_keys);
+        for (uint32_t j = 0; j < options->batch_keys; j++) {
+            if (num_keys == 0 || keys[num_keys - 1] != keys[j]) {
+                keys[num_keys++] = keys[j];
+            }
+        }
+
+        uint64_t op_start_ns = monotonic_time_ns();
+        pager_lock(table->pager);
+        uint32_t num_found;
+        if (!table_find_many(table, keys, num_keys, found, &num_found)) {
+            printf("Out of memory\n");
+            exit(EXIT_FAILURE);
+        }
+        workload.rows_seen += num_found;
+        pager_unlock(table->pager);
+        record_op(&workload, op_start_ns);
+    }
+    free(keys);
+    free(found);
+
+    workload.pages_touched = pages_touched(table->pager) - pages_before;
+    workload.file_bytes = file_bytes(table);
+    workload.disk_bytes = open_disk_bytes(table);
+    finish_workload(&workload);
+}
+
+static void run_range_scans(Table* table, const BenchOptions* options) {
+    Workload workload;
+    start_workload(&workload, "range_scan");
+    uint64_t pages_before = pages_touched(table->pager);
+
+    for (uint32_t i = 0; i < options->ops; i++) {
+        uint64_t key = random_key(options->rows);
+        uint64_t op_start_ns = monotonic_time_ns();
+        pager_lock(table->pager);
+        Cursor* cursor = table_find(table, key);
+        cursor->end_of_table = false;
+        for (uint32_t j = 0; j < options->scan_rows && !cursor->end_of_table; j++) {
+            workload.rows_seen++;
+            cursor_advance(cursor);
+        }
+        free(cursor);
+        pager_unlock(table->pager);
+        record_op(&workload, op_start_ns);
+    }
+
+    workload.pages_touched = pages_touched(table->pager) - pages_before;
+    workload.file_bytes = file_bytes(table);
+    workload.disk_bytes = open_disk_bytes(table);
+    finish_workload(&workload);
+}
+
+// One op is one pass over every row
+static void run_full_scans(Table* table) {
+    Workload workload;
+    start_workload(&workload, "full_scan");
+    uint64_t pages_before = pages_touched(table->pager);
+
+    for (uint32_t i = 0; i < 10; i++) {
+        uint64_t op_start_ns = monotonic_time_ns();
+        pager_lock(table->pager);
+        Cursor* cursor = table_start(table);
+        while (!cursor->end_of_table) {
+            workload.rows_seen++;
+            cursor_advance(cursor);
+        }
+        free(cursor);
+        pager_unlock(table->pager);
+        record_op(&workload, op_start_ns);
+    }
+
+    workload.pages_touched = pages_touched(table->pager) - pages_before;
+    workload.file_bytes = file_bytes(table);
+    workload.disk_bytes = open_disk_bytes(table);
+    finish_workload(&workload);
+}
+
+// Lookups of loaded keys mixed with inserts of new keys past them
+static void run_mixed(Table* table, const BenchOptions* options) {
+    Workload workload;
+    start_workload(&workload, "mixed");
+    uint64_t pages_before = pages_touched(table->pager);
+
+    Statement statement;
+    memset(&statement, 0, sizeof(statement));
+    statement.type = STATEMENT_INSERT;
+    uint64_t next_key = (uint64_t)options->rows + 1;
+
+    for (uint32_t i = 0; i < options->ops; i++) {
+        bool read = next_random() % 100 < options->read_percent;
+        uint64_t key = random_key(options->rows);
+        uint64_t op_start_ns = monotonic_time_ns();
+        pager_lock(table->pager);
+        if (read) {
+            if (key_exists(table, key)) {
+                workload.rows_seen++;
+            }
+        } else {
+            insert_row(table, &statement, next_key++);
+        }
+        pager_unlock(table->pager);
+        record_op(&workload, op_start_ns);
+    }
+
+    workload.pages_touched = pages_touched(table->pager) - pages_before;
+    workload.file_bytes = file_bytes(table);
+    workload.disk_bytes = open_disk_bytes(table);
+    finish_workload(&workload);
+}
+
+// Opening reads the header and the root, closing writes back whatever is dirty
+static void run_open_close(const char* filename, const BenchOptions* options) {
+    Workload workload;
+    start_workload(&workload, "open_close");
+
+    for (uint32_t i = 0; i < options->open_close_runs; i++) {
+        uint64_t op_start_ns = monotonic_time_ns();
+        Table* table = open_or_exit(filename, &options->config);
+        pager_lock(table->pager);
+        key_exists(table, random_key(options->rows));
+        workload.pages_touched += pages_touched(table->pager);
+        workload.file_bytes = file_bytes(table);
+        workload.disk_bytes = open_disk_bytes(table);
+        pager_unlock(table->pager);
+        close_or_exit(table);
+        record_op(&workload, op_start_ns);
+    }
+
+    finish_workload(&workload);
+}
+
+static char* scratch_filename(const char* directory, const char* name) {
+    char* filename = malloc(strlen(directory) + strlen(name) + 2);
+    sprintf(filename, "%s/%s", directory, name);
+    return filename;
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+    if (!parse_bench_arguments(argc, argv, &options) || argc - optind != 1) {
+        print_usage();
+        exit(EXIT_FAILURE);
+    }
+    random_state = options.seed;
+
+    char* sequential_filename = scratch_filename(argv[optind], "bench-sequential.db");
+    char* random_filename = scratch_filename(argv[optind], "bench-random.db");
+
+    uint64_t* keys = malloc(sizeof(uint64_t) * options.rows);
+    for (uint32_t i = 0; i < options.rows; i++) {
+        keys[i] = i + 1;
+    }
+    run_inserts("sequential_insert", sequential_filename, &options, keys);
+
+    for (uint32_t i = options.rows - 1; i > 0; i--) {
+        uint32_t j = next_random() % (i + 1);
+        uint64_t key = keys[i];
+        keys[i] = keys[j];
+        keys[j] = key;
+    }
+    run_inserts("random_insert", random_filename, &options, keys);
+    free(keys);
+
+    Table* table = open_or_exit(sequential_filename, &options.config);
+    run_point_lookups(table, &options);
+    run_batched_lookups(table, &options);
+    run_range_scans(table, &options);
+    run_full_scans(table);
+    close_or_exit(table);
+
+    run_open_close(sequential_filename, &options);
+
+    // Last, since it grows the table past the loaded rows
+    table = open_or_exit(sequential_filename, &options.config);
+    run_mixed(table, &options);
+    close_or_exit(table);
+
+    unlink(sequential_filename);
+    unlink(random_filename);
+    free(sequential_filename);
+    free(random_filename);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,141 @@
+#include "capture.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+static const char CAPTURE_MAGIC[] = "simple-sqlite-trace";
+static const uint32_t CAPTURE_FORMAT_VERSION = 1;
+
+// NULL is written as empty text
+static void write_text(FILE* file, const char* text) {
+    size_t length = text != NULL ? strlen(text) : 0;
+    write_varint(file, length);
+    fwrite(text, 1, length, file);
+}
+
+Capture* capture_open(const char* path, DbError* error) {
+    Capture* capture = malloc(sizeof(Capture));
+    if (capture == NULL) {
+        set_db_error(error, SIMPLESQLITE_NO_MEMORY, "Out of memory");
+        return NULL;
+    }
+    capture->file = fopen(path, "wb");
+    if (capture->file == NULL) {
+        set_db_error(error, SIMPLESQLITE_CANT_OPEN, "Unable to open capture file");
+        free(capture);
+        return NULL;
+    }
+    setvbuf(capture->file, NULL, _IOFBF, CAPTURE_BUFFER_SIZE);
+    capture->start_ns = monotonic_time_ns();
+    capture->failed = false;
+
+    fwrite(CAPTURE_MAGIC, 1, sizeof(CAPTURE_MAGIC), capture->file);
+    write_varint(capture->file, CAPTURE_FORMAT_VERSION);
+    return capture;
+}
+
+// Buffered, so capturing costs a few hundred nanoseconds per statement until the buffer fills
+void capture_write(Capture* capture, const CaptureRecord* record) {
+    FILE* file = capture->file;
+    write_varint(file, record->start_ns);
+    write_varint(file, record->elapsed_ns);
+    write_varint(file, record->session);
+    write_varint(file, record->result);
+    write_varint(file, record->rows);
+    write_text(file, record->sql);
+    write_varint(file, record->num_parameters);
+    for (uint32_t i = 0; i < record->num_parameters; i++) {
+        write_text(file, record->parameters[i]);
+    }
+    if (ferror(file)) {
+        capture->failed = true;
+    }
+}
+
+bool capture_close(Capture* capture, DbError* error) {
+    bool closed = fclose(capture->file) == 0 && !capture->failed;
+    if (!closed) {
+        set_db_error(error, SIMPLESQLITE_IO_ERROR, "Error writing capture: %d", errno);
+    }
+    free(capture);
+    return closed;
+}
+
+FILE* capture_reader_open(const char* path, DbError* error) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        set_db_error(error, SIMPLESQLITE_CANT_OPEN, "Unable to open trace file");
+        return NULL;
+    }
+    setvbuf(file, NULL, _IOFBF, CAPTURE_BUFFER_SIZE);
+
+    char magic[sizeof(CAPTURE_MAGIC)];
+    uint64_t version;
+    if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) || memcmp(magic, CAPTURE_MAGIC, sizeof(magic)) != 0 ||
+        !read_varint(file, &version) || version != CAPTURE_FORMAT_VERSION) {
+        set_db_error(error, SIMPLESQLITE_CORRUPT, "File is not a simple-sqlite trace.");
+        fclose(file);
+        return NULL;
+    }
+    return file;
+}
+
+static char* read_text(FILE* file) {
+    uint64_t length;
+    if (!read_varint(file, &length) || length > CAPTURE_MAX_TEXT_LENGTH) {
+        return NULL;
+    }
+    char* text = malloc(length + 1);
+    if (text == NULL || fread(text, 1, length, file) != length) {
+        free(text);
+        return NULL;
+    }
+    text[length] = '\0';
+    return text;
+}
+
+bool capture_read(FILE* file, CaptureRecord* record, DbError* error) {
+    memset(record, 0, sizeof(CaptureRecord));
+    clear_db_error(error);
+
+    uint64_t start_ns;
+    if (!read_varint(file, &start_ns)) {
+        // A trace ends between two records, anything else is a record cut short
+        if (ferror(file)) {
+            set_db_error(error, SIMPLESQLITE_IO_ERROR, "Error reading trace: %d", errno);
+        }
+        return false;
+    }
+
+    uint64_t session = 0;
+    uint64_t result = 0;
+    uint64_t num_parameters = 0;
+    bool read = read_varint(file, &record->elapsed_ns) && read_varint(file, &session) &&
+                read_varint(file, &result) && read_varint(file, &record->rows) &&
+                (record->sql = read_text(file)) != NULL && read_varint(file, &num_parameters) &&
+                num_parameters <= MAX_PARAMETERS;
+    record->start_ns = start_ns;
+    record->session = (uint32_t)session;
+    record->result = (SimpleSqliteResult)result;
+    for (uint32_t i = 0; read && i < num_parameters; i++) {
+        record->parameters[i] = read_text(file);
+        read = record->parameters[i] != NULL;
+        record->num_parameters = i + 1;
+    }
+
+    if (!read) {
+        capture_record_free(record);
+        set_db_error(error, SIMPLESQLITE_CORRUPT, "Trace ends in the middle of a record.");
+    }
+    return read;
+}
+
+void capture_record_free(CaptureRecord* record) {
+    free(record->sql);
+    for (uint32_t i = 0; i < record->num_parameters; i++) {
+        free(record->parameters[i]);
+    }
+    record->sql = NULL;
+    record->num_parameters = 0;
+}
@@ -0,0 +1,53 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include "db_error.h"
+#include "statement.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define CAPTURE_BUFFER_SIZE (1 << 20)
+#define CAPTURE_MAX_TEXT_LENGTH (64 * 1024) // Longest statement or parameter a trace may hold
+
+/**
+ *
+ * Trace Layout
+ *
+ * MAGIC | FORMAT VERSION | RECORD...
+ *
+ * with each RECORD being START NS | ELAPSED NS | SESSION | RESULT | ROWS | SQL LENGTH | SQL |
+ * NUM PARAMETERS | (LENGTH | VALUE)... Every number is an unsigned LEB128 varint, so a typical
+ * record takes a dozen bytes on top of its text. Records are appended as statements finish.
+ *
+ */
+
+// One executed statement
+typedef struct {
+    uint64_t start_ns; // First step, counted from when the capture began
+    uint64_t elapsed_ns; // Time spent executing, like the statement latencies in the statistics
+    uint32_t session; // Who issued the statement, the server's connection or 0
+    SimpleSqliteResult result; // SIMPLESQLITE_DONE or the error the statement failed with
+    uint64_t rows;
+    char* sql;
+    uint32_t num_parameters;
+    char* parameters[MAX_PARAMETERS]; // Text of the bound values, in order
+} CaptureRecord;
+
+typedef struct {
+    FILE* file;
+    uint64_t start_ns;
+    bool failed; // A write failed, reported when the capture is closed
+} Capture;
+
+Capture* capture_open(const char* path, DbError* error);
+void capture_write(Capture* capture, const CaptureRecord* record);
+bool capture_close(Capture* capture, DbError* error);
+
+// Reads the next record into record, which is freed with capture_record_free. At the end of the
+// trace returns false with error->code SIMPLESQLITE_OK
+FILE* capture_reader_open(const char* path, DbError* error);
+bool capture_read(FILE* file, CaptureRecord* record, DbError* error);
+void capture_record_free(CaptureRecord* record);
+
+#endif
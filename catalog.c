@@ -0,0 +1,144 @@
+#include "catalog.h"
+#include "header.h"
+#include "node.h"
+#include "constants.h"
+#include <stdio.h>
+#include <string.h>
+
+/**
+ *
+ * The catalog is one page that maps table names to the root page and the key width of each
+ * named table. The header points to it once the first table is created. The default table
+ * is not in it: its root is the one in the header, and statements without a table name use it.
+ *
+ */
+
+uint32_t* catalog_num_tables(uint8_t* page) {
+    return (uint32_t*)(page + CATALOG_NUM_TABLES_OFFSET);
+}
+
+uint8_t* catalog_entry(uint8_t* page, uint32_t entry_num) {
+    return page + CATALOG_HEADER_SIZE + entry_num * CATALOG_ENTRY_SIZE;
+}
+
+char* catalog_entry_name(uint8_t* entry) {
+    return (char*)(entry + CATALOG_ENTRY_NAME_OFFSET);
+}
+
+uint32_t* catalog_entry_root_page_num(uint8_t* entry) {
+    return (uint32_t*)(entry + CATALOG_ENTRY_ROOT_PAGE_NUM_OFFSET);
+}
+
+uint32_t* catalog_entry_key_size(uint8_t* entry) {
+    return (uint32_t*)(entry + CATALOG_ENTRY_KEY_SIZE_OFFSET);
+}
+
+// 0 while no table has been created
+static uint32_t catalog_page_num(Pager* pager) {
+    return *db_header_catalog_page_num(get_page(pager, DB_HEADER_PAGE_NUM));
+}
+
+// Returns the number of tables when there is no table with that name
+static uint32_t catalog_find_entry(uint8_t* catalog, const char* name) {
+    uint32_t num_tables = *catalog_num_tables(catalog);
+    for (uint32_t i = 0; i < num_tables; i++) {
+        if (strncmp(catalog_entry_name(catalog_entry(catalog, i)), name, CATALOG_ENTRY_NAME_SIZE) == 0) {
+            return i;
+        }
+    }
+    return num_tables;
+}
+
+// Called with the pager lock held. The view shares the pager of the default table
+bool catalog_find_table(Table* database, const char* name, Table* table) {
+    uint32_t page_num = catalog_page_num(database->pager);
+    if (page_num == 0) {
+        return false;
+    }
+
+    uint8_t* catalog = get_page(database->pager, page_num);
+    uint32_t entry_num = catalog_find_entry(catalog, name);
+    if (entry_num == *catalog_num_tables(catalog)) {
+        return false;
+    }
+
+    uint8_t* entry = catalog_entry(catalog, entry_num);
+    *table = *database;
+    table->root_page_num = *catalog_entry_root_page_num(entry);
+    table->key_size = *catalog_entry_key_size(entry);
+    table->flusher = NULL;
+    return true;
+}
+
+// New tables take the key width the database was created with
+ExecuteResult catalog_create_table(Table* database, const char* name) {
+    Pager* pager = database->pager;
+
+    uint32_t page_num = catalog_page_num(pager);
+    if (page_num == 0) {
+        page_num = get_unused_page_num(pager);
+        uint8_t* catalog = get_page_for_write(pager, page_num);
+        *catalog_num_tables(catalog) = 0;
+        *db_header_catalog_page_num(get_page_for_write(pager, DB_HEADER_PAGE_NUM)) = page_num;
+    }
+
+    uint8_t* catalog = get_page(pager, page_num);
+    uint32_t num_tables = *catalog_num_tables(catalog);
+    if (catalog_find_entry(catalog, name) < num_tables) {
+        return EXECUTE_TABLE_EXISTS;
+    }
+    if (num_tables >= CATALOG_MAX_TABLES) {
+        return EXECUTE_CATALOG_FULL;
+    }
+
+    uint32_t root_page_num = get_unused_page_num(pager);
+    uint8_t* root = get_page_for_write(pager, root_page_num);
+    initialize_leaf_node(root, database->key_size);
+    set_node_root(root, true);
+
+    catalog = get_page_for_write(pager, page_num);
+    uint8_t* entry = catalog_entry(catalog, num_tables);
+    memset(catalog_entry_name(entry), 0, CATALOG_ENTRY_NAME_SIZE);
+    strncpy(catalog_entry_name(entry), name, MAX_TABLE_NAME_LENGTH);
+    *catalog_entry_root_page_num(entry) = root_page_num;
+    *catalog_entry_key_size(entry) = database->key_size;
+    *catalog_num_tables(catalog) = num_tables + 1;
+
+    return EXECUTE_SUCCESS;
+}
+
+// Only the entry goes, the pages of the table stay in the file unused
+ExecuteResult catalog_drop_table(Table* database, const char* name) {
+    Pager* pager = database->pager;
+
+    uint32_t page_num = catalog_page_num(pager);
+    if (page_num == 0) {
+        return EXECUTE_NO_SUCH_TABLE;
+    }
+
+    uint8_t* catalog = get_page(pager, page_num);
+    uint32_t num_tables = *catalog_num_tables(catalog);
+    uint32_t entry_num = catalog_find_entry(catalog, name);
+    if (entry_num == num_tables) {
+        return EXECUTE_NO_SUCH_TABLE;
+    }
+
+    catalog = get_page_for_write(pager, page_num);
+    memmove(catalog_entry(catalog, entry_num), catalog_entry(catalog, entry_num + 1),
+            (num_tables - entry_num - 1) * CATALOG_ENTRY_SIZE);
+    *catalog_num_tables(catalog) = num_tables - 1;
+
+    return EXECUTE_SUCCESS;
+}
+
+void print_catalog(Table* database) {
+    uint32_t page_num = catalog_page_num(database->pager);
+    if (page_num == 0) {
+        return;
+    }
+
+    uint8_t* catalog = get_page(database->pager, page_num);
+    for (uint32_t i = 0; i < *catalog_num_tables(catalog); i++) {
+        printf("%s\n", catalog_entry_name(catalog_entry(catalog, i)));
+    }
+}
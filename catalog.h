@@ -0,0 +1,20 @@
+#ifndef CATALOG_H
+#define CATALOG_H
+
+#include "table.h"
+#include "statement.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+uint32_t* catalog_num_tables(uint8_t* page);
+uint8_t* catalog_entry(uint8_t* page, uint32_t entry_num);
+char* catalog_entry_name(uint8_t* entry);
+uint32_t* catalog_entry_root_page_num(uint8_t* entry);
+uint32_t* catalog_entry_key_size(uint8_t* entry);
+
+bool catalog_find_table(Table* database, const char* name, Table* table);
+ExecuteResult catalog_create_table(Table* database, const char* name);
+ExecuteResult catalog_drop_table(Table* database, const char* name);
+void print_catalog(Table* database);
+
+#endif
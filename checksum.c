@@ -0,0 +1,233 @@
+#include "checksum.h"
+#include "constants.h"
+#include "page_map.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/**
+ *
+ * Page checksums
+ *
+ * The last 4 bytes of every page hold a CRC32C of the page number and the rest of the page.
+ * It is set on the copy that is written out and checked whenever a page is read back, so a
+ * torn write, a bit flip or a page written to the wrong place fails loudly instead of being
+ * used. The SSE4.2 crc32 instruction does the work when the CPU has it, a table does otherwise.
+ *
+ */
+
+#define VERIFY_CHUNK_PAGES 64
+#define VERIFY_MAX_THREADS 8
+
+static uint32_t crc32c_table[256];
+static bool crc32c_hardware_available;
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <nmmintrin.h>
+#define HAVE_CRC32C_HARDWARE
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hardware(uint32_t crc, const uint8_t* data, size_t length) {
+    uint64_t wide_crc = crc;
+    while (length >= sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        wide_crc = _mm_crc32_u64(wide_crc, word);
+        data += sizeof(word);
+        length -= sizeof(word);
+    }
+
+    crc = (uint32_t)wide_crc;
+    while (length > 0) {
+        crc = _mm_crc32_u8(crc, *data);
+        data++;
+        length--;
+    }
+    return crc;
+}
+#endif
+
+static void initialize_crc32c(void) {
+    // Reflected Castagnoli polynomial
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (uint32_t bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0x82F63B78u & (0u - (crc & 1)));
+        }
+        crc32c_table[i] = crc;
+    }
+
+#ifdef HAVE_CRC32C_HARDWARE
+    crc32c_hardware_available = __builtin_cpu_supports("sse4.2");
+#else
+    crc32c_hardware_available = false;
+#endif
+}
+
+// Continues a CRC32C, start with 0
+uint32_t crc32c(uint32_t crc, const uint8_t* data, size_t length) {
+    pthread_once(&crc32c_once, initialize_crc32c);
+
+    crc = ~crc;
+#ifdef HAVE_CRC32C_HARDWARE
+    if (crc32c_hardware_available) {
+        return ~crc32c_hardware(crc, data, length);
+    }
+#endif
+    for (size_t i = 0; i < length; i++) {
+        crc = crc32c_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static uint32_t page_checksum(uint32_t page_num, const uint8_t* page) {
+    uint32_t crc = crc32c(0, (const uint8_t*)&page_num, sizeof(page_num));
+    return crc32c(crc, page, PAGE_CHECKSUM_OFFSET);
+}
+
+void set_page_checksum(uint32_t page_num, uint8_t* page) {
+    uint32_t checksum = page_checksum(page_num, page);
+    memcpy(page + PAGE_CHECKSUM_OFFSET, &checksum, PAGE_CHECKSUM_SIZE);
+}
+
+bool page_checksum_matches(uint32_t page_num, const uint8_t* page) {
+    uint32_t checksum;
+    memcpy(&checksum, page + PAGE_CHECKSUM_OFFSET, PAGE_CHECKSUM_SIZE);
+    return checksum == page_checksum(page_num, page);
+}
+
+typedef struct {
+    int file_descriptor;
+    const PageMap* map;
+    uint32_t first_page_num;
+    uint32_t end_page_num;
+    int error_number; // errno of a failed read, 0 if every read worked
+    VerifyResult result;
+} VerifyRange;
+
+static void* verify_range(void* argument) {
+    VerifyRange* range = argument;
+    uint8_t* pages = malloc((size_t)VERIFY_CHUNK_PAGES * PAGE_SIZE);
+    if (pages == NULL) {
+        range->error_number = ENOMEM;
+        return NULL;
+    }
+
+    for (uint32_t page_num = range->first_page_num; page_num < range->end_page_num; page_num += VERIFY_CHUNK_PAGES) {
+        uint32_t num_pages = range->end_page_num - page_num;
+        if (num_pages > VERIFY_CHUNK_PAGES) {
+            num_pages = VERIFY_CHUNK_PAGES;
+        }
+
+        if (range->map != NULL) {
+            // Compressed pages are scattered, so they are read one at a time
+            for (uint32_t i = 0; i < num_pages && range->error_number == 0; i++) {
+                PageLocation location = page_map_location(range->map, page_num + i);
+                if (read_mapped_page(range->file_descriptor, location, pages + (size_t)i * PAGE_SIZE) == -1) {
+                    range->error_number = errno;
+                }
+            }
+            if (range->error_number != 0) {
+                break;
+            }
+        } else {
+            size_t length = (size_t)num_pages * PAGE_SIZE;
+            ssize_t bytes_read = pread(range->file_descriptor, pages, length, (off_t)page_num * PAGE_SIZE);
+            if (bytes_read != (ssize_t)length) {
+                range->error_number = bytes_read == -1 ? errno : EIO;
+                break;
+            }
+        }
+
+        for (uint32_t i = 0; i < num_pages; i++) {
+            if (!page_checksum_matches(page_num + i, pages + (size_t)i * PAGE_SIZE)) {
+                if (range->result.num_corrupt_pages < MAX_REPORTED_CORRUPT_PAGES) {
+                    range->result.corrupt_pages[range->result.num_corrupt_pages] = page_num + i;
+                }
+                range->result.num_corrupt_pages++;
+            }
+        }
+        range->result.pages_checked += num_pages;
+    }
+
+    free(pages);
+    return NULL;
+}
+
+/**
+ *
+ * Reads every page in the file and checks its checksum, splitting the file into one range
+ * per thread. A compressed file is walked through its map instead, page by logical page.
+ * Only what is on disk is checked, pages still dirty in the cache are not.
+ * The caller holds the io lock so that no write lands halfway through.
+ *
+ */
+bool verify_database_file(int file_descriptor, const PageMap* map, VerifyResult* result, DbError* error) {
+    memset(result, 0, sizeof(VerifyResult));
+
+    uint32_t num_pages;
+    if (map != NULL) {
+        num_pages = map->num_pages;
+    } else {
+        struct stat file_stat;
+        if (fstat(file_descriptor, &file_stat) == -1) {
+            set_db_error(error, SIMPLESQLITE_IO_ERROR, "Error reading file: %d", errno);
+            return false;
+        }
+        num_pages = file_stat.st_size / PAGE_SIZE;
+    }
+
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t num_threads = num_cpus > 0 ? (uint32_t)num_cpus : 1;
+    if (num_threads > VERIFY_MAX_THREADS) {
+        num_threads = VERIFY_MAX_THREADS;
+    }
+    uint32_t num_chunks = (num_pages + VERIFY_CHUNK_PAGES - 1) / VERIFY_CHUNK_PAGES;
+    if (num_threads > num_chunks) {
+        num_threads = num_chunks > 0 ? num_chunks : 1;
+    }
+
+    VerifyRange ranges[VERIFY_MAX_THREADS];
+    pthread_t threads[VERIFY_MAX_THREADS];
+    bool started[VERIFY_MAX_THREADS];
+    uint32_t pages_per_thread = (num_pages + num_threads - 1) / num_threads;
+    for (uint32_t i = 0; i < num_threads; i++) {
+        memset(&ranges[i], 0, sizeof(VerifyRange));
+        ranges[i].file_descriptor = file_descriptor;
+        ranges[i].map = map;
+        ranges[i].first_page_num = i * pages_per_thread < num_pages ? i * pages_per_thread : num_pages;
+        ranges[i].end_page_num = (i + 1) * pages_per_thread < num_pages ? (i + 1) * pages_per_thread : num_pages;
+
+        // The first range runs on the calling thread, as does any range whose thread could not start
+        started[i] = i > 0 && pthread_create(&threads[i], NULL, verify_range, &ranges[i]) == 0;
+    }
+    for (uint32_t i = 0; i < num_threads; i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        } else {
+            verify_range(&ranges[i]);
+        }
+    }
+
+    for (uint32_t i = 0; i < num_threads; i++) {
+        if (ranges[i].error_number != 0) {
+            set_db_error(error, SIMPLESQLITE_IO_ERROR, "Error reading file: %d", ranges[i].error_number);
+            return false;
+        }
+
+        VerifyResult* range_result = &ranges[i].result;
+        for (uint64_t j = 0; j < range_result->num_corrupt_pages && j < MAX_REPORTED_CORRUPT_PAGES; j++) {
+            if (result->num_corrupt_pages + j < MAX_REPORTED_CORRUPT_PAGES) {
+                result->corrupt_pages[result->num_corrupt_pages + j] = range_result->corrupt_pages[j];
+            }
+        }
+        result->num_corrupt_pages += range_result->num_corrupt_pages;
+        result->pages_checked += range_result->pages_checked;
+    }
+
+    return true;
+}
@@ -0,0 +1,28 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include "db_error.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MAX_REPORTED_CORRUPT_PAGES 10
+
+typedef struct {
+    uint64_t pages_checked;
+    uint64_t num_corrupt_pages;
+    uint32_t corrupt_pages[MAX_REPORTED_CORRUPT_PAGES]; // The first ones found, in page order
+} VerifyResult;
+
+uint32_t crc32c(uint32_t crc, const uint8_t* data, size_t length);
+
+void set_page_checksum(uint32_t page_num, uint8_t* page);
+
+bool page_checksum_matches(uint32_t page_num, const uint8_t* page);
+
+struct PageMap;
+
+// Pass the page map of a compressed database, NULL otherwise
+bool verify_database_file(int file_descriptor, const struct PageMap* map, VerifyResult* result, DbError* error);
+
+#endif
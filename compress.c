@@ -0,0 +1,177 @@
+#include "compress.h"
+#include <string.h>
+
+/**
+ *
+ * Page codec
+ *
+ * A small LZ77 in the style of LZ4. The output is a list of sequences:
+ *
+ *   TOKEN | EXTRA LITERAL LENGTH | LITERALS | OFFSET | EXTRA MATCH LENGTH
+ *
+ * The high nibble of TOKEN is the literal count and the low nibble the match length minus 4.
+ * A nibble of 15 means more length follows in bytes, each 255 meaning yet another byte. OFFSET
+ * is 2 bytes back from the current output position and may overlap the match, which is how a
+ * run of zero padding becomes a single sequence. The last sequence has literals only.
+ *
+ */
+
+#define MIN_MATCH 4
+#define HASH_BITS 12
+
+static uint32_t read32(const uint8_t* data) {
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+static uint32_t hash32(uint32_t value) {
+    return (value * 2654435761u) >> (32 - HASH_BITS);
+}
+
+// Writes the bytes of a length past its nibble, returns false when out of room
+static bool write_length(uint8_t** out, const uint8_t* out_end, uint32_t length) {
+    for (; length >= 255; length -= 255) {
+        if (*out >= out_end) {
+            return false;
+        }
+        *(*out)++ = 255;
+    }
+    if (*out >= out_end) {
+        return false;
+    }
+    *(*out)++ = (uint8_t)length;
+    return true;
+}
+
+static bool write_sequence(uint8_t** out, const uint8_t* out_end, const uint8_t* literals, uint32_t num_literals,
+                           uint32_t offset, uint32_t match_length) {
+    if (*out >= out_end) {
+        return false;
+    }
+    uint8_t* token = (*out)++;
+    *token = (uint8_t)((num_literals < 15 ? num_literals : 15) << 4);
+    if (num_literals >= 15 && !write_length(out, out_end, num_literals - 15)) {
+        return false;
+    }
+
+    if ((uint32_t)(out_end - *out) < num_literals) {
+        return false;
+    }
+    memcpy(*out, literals, num_literals);
+    *out += num_literals;
+
+    if (match_length == 0) {
+        return true;
+    }
+
+    if (out_end - *out < 2) {
+        return false;
+    }
+    *(*out)++ = (uint8_t)(offset & 0xFF);
+    *(*out)++ = (uint8_t)(offset >> 8);
+
+    uint32_t extra = match_length - MIN_MATCH;
+    *token |= (uint8_t)(extra < 15 ? extra : 15);
+    return extra < 15 || write_length(out, out_end, extra - 15);
+}
+
+uint32_t compress_page(const uint8_t* input, uint32_t length, uint8_t* output, uint32_t capacity) {
+    // Positions are stored plus one, so that zero means empty
+    uint16_t table[1 << HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    uint8_t* out = output;
+    const uint8_t* out_end = output + capacity;
+    uint32_t anchor = 0;
+    uint32_t position = 0;
+
+    while (position + MIN_MATCH <= length) {
+        uint32_t value = read32(input + position);
+        uint32_t hash = hash32(value);
+        uint32_t candidate = table[hash];
+        table[hash] = (uint16_t)(position + 1);
+
+        if (candidate == 0 || position - (candidate - 1) > 0xFFFF || read32(input + candidate - 1) != value) {
+            position++;
+            continue;
+        }
+
+        uint32_t match_start = candidate - 1;
+        uint32_t match_length = MIN_MATCH;
+        while (position + match_length < length && input[match_start + match_length] == input[position + match_length]) {
+            match_length++;
+        }
+
+        if (!write_sequence(&out, out_end, input + anchor, position - anchor, position - match_start, match_length)) {
+            return 0;
+        }
+        position += match_length;
+        anchor = position;
+    }
+
+    if (!write_sequence(&out, out_end, input + anchor, length - anchor, 0, 0)) {
+        return 0;
+    }
+    return (uint32_t)(out - output);
+}
+
+static bool read_length(const uint8_t** in, const uint8_t* in_end, uint32_t* length) {
+    uint8_t byte;
+    do {
+        if (*in >= in_end) {
+            return false;
+        }
+        byte = *(*in)++;
+        *length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+bool decompress_page(const uint8_t* input, uint32_t input_length, uint8_t* output, uint32_t length) {
+    const uint8_t* in = input;
+    const uint8_t* in_end = input + input_length;
+    uint32_t written = 0;
+
+    while (in < in_end) {
+        uint8_t token = *in++;
+
+        uint32_t num_literals = token >> 4;
+        if (num_literals == 15 && !read_length(&in, in_end, &num_literals)) {
+            return false;
+        }
+        if (num_literals > (uint32_t)(in_end - in) || num_literals > length - written) {
+            return false;
+        }
+        memcpy(output + written, in, num_literals);
+        in += num_literals;
+        written += num_literals;
+
+        if (in == in_end) {
+            break;
+        }
+
+        if (in_end - in < 2) {
+            return false;
+        }
+        uint32_t offset = in[0] | ((uint32_t)in[1] << 8);
+        in += 2;
+
+        uint32_t match_length = token & 0x0F;
+        if (match_length == 15 && !read_length(&in, in_end, &match_length)) {
+            return false;
+        }
+        match_length += MIN_MATCH;
+        if (offset == 0 || offset > written || match_length > length - written) {
+            return false;
+        }
+
+        // Byte by byte, since the match may overlap the bytes it is producing
+        for (uint32_t i = 0; i < match_length; i++) {
+            output[written + i] = output[written - offset + i];
+        }
+        written += match_length;
+    }
+
+    return written == length;
+}
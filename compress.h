@@ -0,0 +1,13 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Returns the compressed length, or 0 when the output would not fit in capacity
+uint32_t compress_page(const uint8_t* input, uint32_t length, uint8_t* output, uint32_t capacity);
+
+// Fails on input that does not decode to exactly length bytes
+bool decompress_page(const uint8_t* input, uint32_t input_length, uint8_t* output, uint32_t length);
+
+#endif
@@ -1,21 +1,67 @@
 #include "constants.h"
 #include "row.h"
+#include "catalog.h"
 #include <stdlib.h>
 
-const uint32_t TABLE_MAX_PAGES = 400;
+// Page numbers are stored as uint32_t on disk, and UINT32_MAX marks an invalid page
+const uint32_t TABLE_MAX_PAGES = UINT32_MAX;
 const uint32_t PAGE_SIZE = 4096;
+// Every page ends with a checksum of the rest of the page, nodes and the header live in front of it
+const uint32_t PAGE_CHECKSUM_SIZE = sizeof(uint32_t);
+const uint32_t PAGE_CHECKSUM_OFFSET = PAGE_SIZE - PAGE_CHECKSUM_SIZE;
+// and before the checksum, the change sequence number the page was last written in
+const uint32_t PAGE_CHANGE_SEQ_SIZE = sizeof(uint64_t);
+const uint32_t PAGE_CHANGE_SEQ_OFFSET = PAGE_CHECKSUM_OFFSET - PAGE_CHANGE_SEQ_SIZE;
 
-#define size_of_attribute(Struct, Attribute) sizeof(((Struct*) 0)->Attribute)
-const uint32_t ID_SIZE = size_of_attribute(Row, id);
-const uint32_t USERNAME_SIZE = size_of_attribute(Row, username);
-const uint32_t EMAIL_SIZE = size_of_attribute(Row, email);
-const uint32_t ID_OFFSET = 0;
-const uint32_t USERNAME_OFFSET = ID_OFFSET + ID_SIZE;
-const uint32_t EMAIL_OFFSET = USERNAME_OFFSET + USERNAME_SIZE;
-const uint32_t ROW_SIZE = ID_SIZE + USERNAME_SIZE + EMAIL_SIZE;
+const uint32_t NARROW_KEY_SIZE = sizeof(uint32_t);
+const uint32_t WIDE_KEY_SIZE = sizeof(uint64_t);
 
-const uint32_t COLUMN_USERNAME_LENGTH = USERNAME_SIZE - 1;
-const uint32_t COLUMN_EMAIL_LENGTH = EMAIL_SIZE - 1;
+/**
+ *
+ * Database Header Layout
+ *
+ */
+
+const uint32_t DB_HEADER_PAGE_NUM = 0;
+const char DB_HEADER_MAGIC[] = "simple-sqlite";
+const uint32_t DB_FORMAT_VERSION = 3;
+const uint32_t DB_HEADER_MAGIC_SIZE = sizeof(DB_HEADER_MAGIC);
+const uint32_t DB_HEADER_MAGIC_OFFSET = 0;
+const uint32_t DB_HEADER_VERSION_SIZE = sizeof(uint32_t);
+const uint32_t DB_HEADER_VERSION_OFFSET = DB_HEADER_MAGIC_OFFSET + DB_HEADER_MAGIC_SIZE;
+const uint32_t DB_HEADER_KEY_SIZE_SIZE = sizeof(uint32_t);
+const uint32_t DB_HEADER_KEY_SIZE_OFFSET = DB_HEADER_VERSION_OFFSET + DB_HEADER_VERSION_SIZE;
+const uint32_t DB_HEADER_ROOT_PAGE_NUM_SIZE = sizeof(uint32_t);
+const uint32_t DB_HEADER_ROOT_PAGE_NUM_OFFSET = DB_HEADER_KEY_SIZE_OFFSET + DB_HEADER_KEY_SIZE_SIZE;
+const uint32_t DB_HEADER_FLAGS_SIZE = sizeof(uint32_t);
+const uint32_t DB_HEADER_FLAGS_OFFSET = DB_HEADER_ROOT_PAGE_NUM_OFFSET + DB_HEADER_ROOT_PAGE_NUM_SIZE;
+const uint32_t DB_HEADER_CATALOG_PAGE_NUM_SIZE = sizeof(uint32_t);
+const uint32_t DB_HEADER_CATALOG_PAGE_NUM_OFFSET = DB_HEADER_FLAGS_OFFSET + DB_HEADER_FLAGS_SIZE;
+const uint32_t DB_HEADER_CHANGE_SEQ_SIZE = sizeof(uint64_t);
+const uint32_t DB_HEADER_CHANGE_SEQ_OFFSET = DB_HEADER_CATALOG_PAGE_NUM_OFFSET + DB_HEADER_CATALOG_PAGE_NUM_SIZE;
+const uint32_t DB_HEADER_DATABASE_ID_SIZE = sizeof(uint64_t);
+const uint32_t DB_HEADER_DATABASE_ID_OFFSET = DB_HEADER_CHANGE_SEQ_OFFSET + DB_HEADER_CHANGE_SEQ_SIZE;
+const uint32_t DB_HEADER_SIZE = DB_HEADER_DATABASE_ID_OFFSET + DB_HEADER_DATABASE_ID_SIZE;
+const uint32_t DB_FLAG_COMPRESSED = 1; // Pages other than the header are compressed and found through the page map
+const uint32_t DB_FLAG_BACKUP = 2; // Written by a backup and not opened since, so later backups can add to it
+
+/**
+ *
+ * Catalog Page Layout
+ *
+ */
+
+const uint32_t CATALOG_NUM_TABLES_SIZE = sizeof(uint32_t);
+const uint32_t CATALOG_NUM_TABLES_OFFSET = 0;
+const uint32_t CATALOG_HEADER_SIZE = CATALOG_NUM_TABLES_OFFSET + CATALOG_NUM_TABLES_SIZE;
+const uint32_t CATALOG_ENTRY_NAME_SIZE = MAX_TABLE_NAME_LENGTH + 1;
+const uint32_t CATALOG_ENTRY_NAME_OFFSET = 0;
+const uint32_t CATALOG_ENTRY_ROOT_PAGE_NUM_SIZE = sizeof(uint32_t);
+const uint32_t CATALOG_ENTRY_ROOT_PAGE_NUM_OFFSET = CATALOG_ENTRY_NAME_OFFSET + CATALOG_ENTRY_NAME_SIZE;
+const uint32_t CATALOG_ENTRY_KEY_SIZE_SIZE = sizeof(uint32_t);
+const uint32_t CATALOG_ENTRY_KEY_SIZE_OFFSET = CATALOG_ENTRY_ROOT_PAGE_NUM_OFFSET + CATALOG_ENTRY_ROOT_PAGE_NUM_SIZE;
+const uint32_t CATALOG_ENTRY_SIZE = CATALOG_ENTRY_KEY_SIZE_OFFSET + CATALOG_ENTRY_KEY_SIZE_SIZE;
+const uint32_t CATALOG_MAX_TABLES = (PAGE_CHANGE_SEQ_OFFSET - CATALOG_HEADER_SIZE) / CATALOG_ENTRY_SIZE;
 
 /**
  * 
@@ -49,12 +95,12 @@ const uint32_t LEAF_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE + LEAF_NODE_NUM_C
  *  
  */
 
-const uint32_t LEAF_NODE_KEY_SIZE = sizeof(uint32_t);
+const uint32_t LEAF_NODE_KEY_SIZE = NARROW_KEY_SIZE; // Nodes flagged for wide keys use WIDE_KEY_SIZE instead
 const uint32_t LEAF_NODE_KEY_OFFSET = 0;
 const uint32_t LEAF_NODE_VALUE_SIZE = ROW_SIZE;
 const uint32_t LEAF_NODE_VALUE_OFFSET = LEAF_NODE_KEY_OFFSET + LEAF_NODE_KEY_SIZE;
 const uint32_t LEAF_NODE_CELL_SIZE = LEAF_NODE_KEY_SIZE + LEAF_NODE_VALUE_SIZE;
-const uint32_t LEAF_NODE_SPACE_FOR_CELLS = PAGE_SIZE - LEAF_NODE_HEADER_SIZE;
+const uint32_t LEAF_NODE_SPACE_FOR_CELLS = PAGE_CHANGE_SEQ_OFFSET - LEAF_NODE_HEADER_SIZE;
 const uint32_t LEAF_NODE_MAX_CELLS = LEAF_NODE_SPACE_FOR_CELLS / LEAF_NODE_CELL_SIZE;
 const uint32_t LEAF_NODE_RIGHT_SPLIT_COUNT = (LEAF_NODE_MAX_CELLS + 1) / 2;
 const uint32_t LEAF_NODE_LEFT_SPLIT_COUNT = (LEAF_NODE_MAX_CELLS + 1) - LEAF_NODE_RIGHT_SPLIT_COUNT; // There are LEAF_NODE_MAX_CELLS + 1 cells to split between right and left
@@ -79,7 +125,7 @@ const uint32_t INTERNAL_NODE_HEADER_SIZE = COMMON_NODE_HEADER_SIZE + INTERNAL_NO
 
 const uint32_t INTERNAL_NODE_CHILD_SIZE = sizeof(uint32_t);
 const uint32_t INTERNAL_NODE_CHILD_OFFSET = 0;
-const uint32_t INTERNAL_NODE_KEY_SIZE = sizeof(uint32_t);
+const uint32_t INTERNAL_NODE_KEY_SIZE = NARROW_KEY_SIZE; // Nodes flagged for wide keys use WIDE_KEY_SIZE instead
 const uint32_t INTERNAL_NODE_KEY_OFFSET = INTERNAL_NODE_CHILD_OFFSET + INTERNAL_NODE_CHILD_SIZE;
 const uint32_t INTERNAL_NODE_CELL_SIZE = INTERNAL_NODE_CHILD_SIZE + INTERNAL_NODE_KEY_SIZE;
 const uint32_t INTERNAL_NODE_MAX_KEYS = 3;
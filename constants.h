@@ -5,17 +5,60 @@
 
 extern const uint32_t TABLE_MAX_PAGES;
 extern const uint32_t PAGE_SIZE;
+extern const uint32_t PAGE_CHECKSUM_SIZE;
+extern const uint32_t PAGE_CHECKSUM_OFFSET;
+extern const uint32_t PAGE_CHANGE_SEQ_SIZE;
+extern const uint32_t PAGE_CHANGE_SEQ_OFFSET;
 
-extern const uint32_t ID_SIZE;
-extern const uint32_t USERNAME_SIZE;
-extern const uint32_t EMAIL_SIZE;
-extern const uint32_t ID_OFFSET;
-extern const uint32_t USERNAME_OFFSET;
-extern const uint32_t EMAIL_OFFSET;
-extern const uint32_t ROW_SIZE;
+extern const uint32_t NARROW_KEY_SIZE;
+extern const uint32_t WIDE_KEY_SIZE;
 
-extern const uint32_t COLUMN_USERNAME_LENGTH;
-extern const uint32_t COLUMN_EMAIL_LENGTH;
+/**
+ *
+ * Database Header Layout
+ *
+ */
+
+extern const uint32_t DB_HEADER_PAGE_NUM;
+extern const char DB_HEADER_MAGIC[];
+extern const uint32_t DB_FORMAT_VERSION;
+extern const uint32_t DB_HEADER_MAGIC_SIZE;
+extern const uint32_t DB_HEADER_MAGIC_OFFSET;
+extern const uint32_t DB_HEADER_VERSION_SIZE;
+extern const uint32_t DB_HEADER_VERSION_OFFSET;
+extern const uint32_t DB_HEADER_KEY_SIZE_SIZE;
+extern const uint32_t DB_HEADER_KEY_SIZE_OFFSET;
+extern const uint32_t DB_HEADER_ROOT_PAGE_NUM_SIZE;
+extern const uint32_t DB_HEADER_ROOT_PAGE_NUM_OFFSET;
+extern const uint32_t DB_HEADER_FLAGS_SIZE;
+extern const uint32_t DB_HEADER_FLAGS_OFFSET;
+extern const uint32_t DB_HEADER_CATALOG_PAGE_NUM_SIZE;
+extern const uint32_t DB_HEADER_CATALOG_PAGE_NUM_OFFSET;
+extern const uint32_t DB_HEADER_CHANGE_SEQ_SIZE;
+extern const uint32_t DB_HEADER_CHANGE_SEQ_OFFSET;
+extern const uint32_t DB_HEADER_DATABASE_ID_SIZE;
+extern const uint32_t DB_HEADER_DATABASE_ID_OFFSET;
+extern const uint32_t DB_HEADER_SIZE;
+extern const uint32_t DB_FLAG_COMPRESSED;
+extern const uint32_t DB_FLAG_BACKUP;
+
+/**
+ *
+ * Catalog Page Layout
+ *
+ */
+
+extern const uint32_t CATALOG_NUM_TABLES_SIZE;
+extern const uint32_t CATALOG_NUM_TABLES_OFFSET;
+extern const uint32_t CATALOG_HEADER_SIZE;
+extern const uint32_t CATALOG_ENTRY_NAME_SIZE;
+extern const uint32_t CATALOG_ENTRY_NAME_OFFSET;
+extern const uint32_t CATALOG_ENTRY_ROOT_PAGE_NUM_SIZE;
+extern const uint32_t CATALOG_ENTRY_ROOT_PAGE_NUM_OFFSET;
+extern const uint32_t CATALOG_ENTRY_KEY_SIZE_SIZE;
+extern const uint32_t CATALOG_ENTRY_KEY_SIZE_OFFSET;
+extern const uint32_t CATALOG_ENTRY_SIZE;
+extern const uint32_t CATALOG_MAX_TABLES;
 
 /**
  * 
@@ -39,8 +82,8 @@ extern const uint8_t COMMON_NODE_HEADER_SIZE;
 
 extern const uint32_t LEAF_NODE_NUM_CELLS_SIZE;
 extern const uint32_t LEAF_NODE_NUM_CELLS_OFFSET;
-const uint32_t LEAF_NODE_NEXT_LEAF_SIZE;
-const uint32_t LEAF_NODE_NEXT_LEAF_OFFSET;
+extern const uint32_t LEAF_NODE_NEXT_LEAF_SIZE;
+extern const uint32_t LEAF_NODE_NEXT_LEAF_OFFSET;
 extern const uint32_t LEAF_NODE_HEADER_SIZE;
 
 /**
@@ -56,8 +99,8 @@ extern const uint32_t LEAF_NODE_VALUE_OFFSET;
 extern const uint32_t LEAF_NODE_CELL_SIZE;
 extern const uint32_t LEAF_NODE_SPACE_FOR_CELLS;
 extern const uint32_t LEAF_NODE_MAX_CELLS;
-const uint32_t LEAF_NODE_RIGHT_SPLIT_COUNT;
-const uint32_t LEAF_NODE_LEFT_SPLIT_COUNT;
+extern const uint32_t LEAF_NODE_RIGHT_SPLIT_COUNT;
+extern const uint32_t LEAF_NODE_LEFT_SPLIT_COUNT;
 
 /**
  * 
@@ -65,11 +108,11 @@ const uint32_t LEAF_NODE_LEFT_SPLIT_COUNT;
  * 
  */
 
-const uint32_t INTERNAL_NODE_NUM_KEYS_SIZE;
-const uint32_t INTERNAL_NODE_NUM_KEYS_OFFSET;
-const uint32_t INTERNAL_NODE_RIGHT_CHILD_SIZE;
-const uint32_t INTERNAL_NODE_RIGHT_CHILD_OFFSET;
-const uint32_t INTERNAL_NODE_HEADER_SIZE;
+extern const uint32_t INTERNAL_NODE_NUM_KEYS_SIZE;
+extern const uint32_t INTERNAL_NODE_NUM_KEYS_OFFSET;
+extern const uint32_t INTERNAL_NODE_RIGHT_CHILD_SIZE;
+extern const uint32_t INTERNAL_NODE_RIGHT_CHILD_OFFSET;
+extern const uint32_t INTERNAL_NODE_HEADER_SIZE;
 
 /**
  * 
@@ -77,11 +120,11 @@ const uint32_t INTERNAL_NODE_HEADER_SIZE;
  * 
  */
 
-const uint32_t INTERNAL_NODE_CHILD_SIZE;
-const uint32_t INTERNAL_NODE_CHILD_OFFSET;
-const uint32_t INTERNAL_NODE_KEY_SIZE;
-const uint32_t INTERNAL_NODE_KEY_OFFSET;
-const uint32_t INTERNAL_NODE_CELL_SIZE;
-const uint32_t INTERNAL_NODE_MAX_KEYS;
+extern const uint32_t INTERNAL_NODE_CHILD_SIZE;
+extern const uint32_t INTERNAL_NODE_CHILD_OFFSET;
+extern const uint32_t INTERNAL_NODE_KEY_SIZE;
+extern const uint32_t INTERNAL_NODE_KEY_OFFSET;
+extern const uint32_t INTERNAL_NODE_CELL_SIZE;
+extern const uint32_t INTERNAL_NODE_MAX_KEYS;
 
 #endif
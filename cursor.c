@@ -1,8 +1,24 @@
 #include "cursor.h"
 #include "node.h"
+#include "hash_index.h"
 #include <stdlib.h>
 #include <stdio.h>
 
+// Every lookup builds its cursor here, end_of_table is only set by table_start and cursor_advance
+static Cursor* new_cursor(Table* table, uint32_t page_num, uint32_t cell_num) {
+    Cursor* cursor = malloc(sizeof(Cursor));
+    cursor->table = table;
+    cursor->page_num = page_num;
+    cursor->cell_num = cell_num;
+    cursor->end_of_table = false;
+    return cursor;
+}
+
+uint64_t cursor_key(Cursor* cursor) {
+    uint8_t* page = get_page(cursor->table->pager, cursor->page_num);
+    return leaf_node_key(page, cursor->cell_num);
+}
+
 uint8_t* cursor_value(Cursor* cursor) {
     uint8_t* page = get_page(cursor->table->pager, cursor->page_num);
     return leaf_node_value(page, cursor->cell_num);
@@ -11,6 +27,7 @@ uint8_t* cursor_value(Cursor* cursor) {
 void cursor_advance(Cursor* cursor) {
     uint32_t page_num = cursor->page_num;
     uint8_t* node = get_page(cursor->table->pager, page_num);
+    cursor->table->pager->tree_stats.cursor_advances++;
     cursor->cell_num += 1;
     if (cursor->cell_num >= (*leaf_node_num_cells(node))) {
         uint32_t next_page_num = *leaf_node_next_leaf_page_num(node);
@@ -33,30 +50,224 @@ Cursor* table_start(Table* table) {
     return cursor;
 }
 
-Cursor* table_find(Table* table, uint32_t key) {
-    uint32_t root_page_num = table->root_page_num;
-    uint8_t* root_node = get_page(table->pager, root_page_num);
+static bool finger_level_holds(FingerLevel* level, uint64_t key) {
+    return (!level->has_low || key > level->low) && (!level->has_high || key <= level->high);
+}
 
-    if (get_node_type(root_node) == NODE_LEAF) {
-        return leaf_node_find(table, root_page_num, key);
-    } else {
-        return internal_node_find(table, root_page_num, key);
+// An entry is only a hint, the cell it points to must still hold the key
+static bool hash_index_entry_holds(Pager* pager, HashIndexEntry* entry, uint64_t key) {
+    if (entry->page_num >= pager->num_pages) {
+        return false;
     }
+    uint8_t* node = get_page(pager, entry->page_num);
+    return get_node_type(node) == NODE_LEAF && entry->cell_num < *leaf_node_num_cells(node) &&
+           leaf_node_key(node, entry->cell_num) == key;
 }
 
-Cursor* leaf_node_find(Table* table, uint32_t page_num, uint32_t key) {
-    uint8_t* node = get_page(table->pager, page_num);
+/**
+ *
+ * A lookup starts where the last one in the same table ended: it climbs the path to that leaf
+ * only until it reaches a node whose key range holds the key, and descends from there, so runs
+ * of nearby keys skip the internal nodes above their leaf. A split or a rollback anywhere in the
+ * file makes every finger stale. A snapshot reader always starts at the root, since the pages it
+ * sees can be older than the path, and leaves the finger alone.
+ *
+ * Before any of that, a hot key is looked up in the hash index, which for the same reason
+ * snapshot readers skip as well.
+ *
+ */
+Cursor* table_find(Table* table, uint64_t key) {
+    Pager* pager = table->pager;
+    TreeFinger* finger = &pager->fingers[table->root_page_num % NUM_FINGERS];
+    bool use_finger = pager->read_snapshot == NULL;
+
+    bool use_hash_index = use_finger && pager->hash_index != NULL && hash_index_begin_lookup(pager->hash_index);
+    if (use_hash_index) {
+        HashIndexEntry* entry = hash_index_find(pager->hash_index, table->root_page_num, key);
+        if (entry != NULL && hash_index_entry_holds(pager, entry, key)) {
+            hash_index_hit(pager->hash_index, entry);
+            pager->tree_stats.hash_index_hits++;
+            return new_cursor(table, entry->page_num, entry->cell_num);
+        }
+    }
+
+    FingerLevel level = { .page_num = table->root_page_num };
+    uint32_t depth = 0;
+    if (use_finger && finger->depth > 0 && finger->root_page_num == table->root_page_num &&
+        finger->generation == pager->tree_generation) {
+        depth = finger->depth - 1;
+        while (depth > 0 && !finger_level_holds(&finger->path[depth], key)) {
+            depth--;
+        }
+        level = finger->path[depth];
+        if (depth > 0) {
+            pager->tree_stats.finger_hits++;
+        }
+    }
+
+    uint8_t* node = get_page(pager, level.page_num);
+    while (get_node_type(node) == NODE_INTERNAL) {
+        if (use_finger && depth < FINGER_MAX_DEPTH) {
+            finger->path[depth] = level;
+        }
+
+        uint32_t child_index = internal_node_find_child(node, key);
+        if (child_index > 0) {
+            level.has_low = true;
+            level.low = internal_node_key(node, child_index - 1);
+        }
+        if (child_index < *internal_node_num_keys(node)) {
+            level.has_high = true;
+            level.high = internal_node_key(node, child_index);
+        }
+        level.page_num = *internal_node_child_page_num(node, child_index);
+        depth++;
+        node = get_page(pager, level.page_num);
+    }
+
+    if (use_finger) {
+        finger->root_page_num = table->root_page_num;
+        finger->generation = pager->tree_generation;
+        finger->depth = 0;
+        if (depth < FINGER_MAX_DEPTH) {
+            finger->path[depth] = level;
+            finger->depth = depth + 1;
+        }
+    }
+
+    Cursor* cursor = leaf_node_find(table, level.page_num, key);
+    if (use_hash_index && cursor->cell_num < *leaf_node_num_cells(node) && leaf_node_key(node, cursor->cell_num) == key) {
+        hash_index_record(pager->hash_index, table->root_page_num, key, cursor->page_num, cursor->cell_num);
+    }
+    return cursor;
+}
+
+// Nodes read ahead of the one being searched in a batched lookup
+#define BATCH_PREFETCH_DISTANCE 8
+
+// A node and the run of sorted keys that descend through it
+typedef struct {
+    uint32_t page_num;
+    uint32_t begin;
+    uint32_t end;
+} KeyGroup;
+
+// The cursors of the keys in the group that the leaf holds, in key order
+static void leaf_node_find_group(Table* table, KeyGroup* group, const uint64_t* keys, Cursor* found,
+                                 uint32_t* num_found) {
+    uint8_t* node = get_page(table->pager, group->page_num);
     uint32_t num_cells = *leaf_node_num_cells(node);
 
-    Cursor* cursor = malloc(sizeof(Cursor));
-    cursor->table = table;
-    cursor->page_num = page_num;
+    // The keys are ascending, so each search starts where the previous one ended
+    uint32_t l_index = 0;
+    for (uint32_t i = group->begin; i < group->end; i++) {
+        uint32_t r_index = num_cells;
+        while (l_index < r_index) {
+            uint32_t index = l_index + (r_index - l_index) / 2;
+            if (leaf_node_key(node, index) < keys[i]) {
+                l_index = index + 1;
+            } else {
+                r_index = index;
+            }
+        }
+        if (l_index < num_cells && leaf_node_key(node, l_index) == keys[i]) {
+            Cursor* cursor = &found[(*num_found)++];
+            cursor->table = table;
+            cursor->page_num = group->page_num;
+            cursor->cell_num = l_index;
+            cursor->end_of_table = false;
+        }
+    }
+}
+
+/**
+ *
+ * Looks up many keys in one descent. The keys must be ascending and distinct. Instead of one
+ * walk from the root per key, the tree is descended a level at a time: every node on the level
+ * splits its run of keys among its children, so a node that several keys pass through is read
+ * once, and the children become the next level's groups. While a node is searched, the node a
+ * few groups ahead is prefetched, so its page is on its way into the cache or from the disk by
+ * the time the search gets there. The cursors of the keys that exist go to found, in key order.
+ * Like a snapshot reader, the batch leaves the fingers and the hash index alone.
+ *
+ * Returns false when there is no memory for the groups.
+ *
+ */
+bool table_find_many(Table* table, const uint64_t* keys, uint32_t num_keys, Cursor* found, uint32_t* num_found) {
+    *num_found = 0;
+    if (num_keys == 0) {
+        return true;
+    }
+
+    // Every group holds at least one key, so a level never has more groups than keys
+    KeyGroup* groups = malloc(sizeof(KeyGroup) * num_keys);
+    KeyGroup* next_groups = malloc(sizeof(KeyGroup) * num_keys);
+    if (groups == NULL || next_groups == NULL) {
+        free(groups);
+        free(next_groups);
+        return false;
+    }
+
+    Pager* pager = table->pager;
+    pager->tree_stats.batched_keys += num_keys;
+    groups[0] = (KeyGroup){table->root_page_num, 0, num_keys};
+    uint32_t num_groups = 1;
+    while (num_groups > 0) {
+        for (uint32_t i = 0; i < num_groups && i < BATCH_PREFETCH_DISTANCE; i++) {
+            pager_prefetch(pager, groups[i].page_num);
+        }
+
+        uint32_t num_next_groups = 0;
+        for (uint32_t i = 0; i < num_groups; i++) {
+            if (i + BATCH_PREFETCH_DISTANCE < num_groups) {
+                pager_prefetch(pager, groups[i + BATCH_PREFETCH_DISTANCE].page_num);
+            }
+
+            KeyGroup* group = &groups[i];
+            uint8_t* node = get_page(pager, group->page_num);
+            pager->tree_stats.batched_node_visits++;
+            if (get_node_type(node) == NODE_LEAF) {
+                leaf_node_find_group(table, group, keys, found, num_found);
+                continue;
+            }
+
+            // Same rule as internal_node_find_child: a key goes left of the first key not below it
+            uint32_t num_node_keys = *internal_node_num_keys(node);
+            uint32_t child_index = 0;
+            for (uint32_t k = group->begin; k < group->end; k++) {
+                while (child_index < num_node_keys && internal_node_key(node, child_index) < keys[k]) {
+                    child_index++;
+                }
+                uint32_t child_page_num = *internal_node_child_page_num(node, child_index);
+                if (num_next_groups > 0 && next_groups[num_next_groups - 1].page_num == child_page_num &&
+                    next_groups[num_next_groups - 1].end == k) {
+                    next_groups[num_next_groups - 1].end = k + 1;
+                } else {
+                    next_groups[num_next_groups++] = (KeyGroup){child_page_num, k, k + 1};
+                }
+            }
+        }
+
+        KeyGroup* level = groups;
+        groups = next_groups;
+        next_groups = level;
+        num_groups = num_next_groups;
+    }
+
+    free(groups);
+    free(next_groups);
+    return true;
+}
+
+Cursor* leaf_node_find(Table* table, uint32_t page_num, uint64_t key) {
+    uint8_t* node = get_page(table->pager, page_num);
+    uint32_t num_cells = *leaf_node_num_cells(node);
 
     uint32_t l_index = 0;
     uint32_t r_index = num_cells;
     while (l_index < r_index) {
         uint32_t index = l_index + (r_index - l_index) / 2;
-        uint32_t key_at_index = *leaf_node_key(node, index);
+        uint64_t key_at_index = leaf_node_key(node, index);
 
         if (key_at_index < key) {
             l_index = index + 1;
@@ -65,20 +276,5 @@ Cursor* leaf_node_find(Table* table, uint32_t page_num, uint32_t key) {
         }
     }
 
-    cursor->cell_num = l_index;
-    return cursor;
-}
-
-Cursor* internal_node_find(Table* table, uint32_t page_num, uint32_t key) {
-    uint8_t* node = get_page(table->pager, page_num);
-
-    uint32_t child_index = internal_node_find_child(node, key);
-    uint32_t child_page_num = *internal_node_child_page_num(node, child_index);
-    uint8_t* child_page = get_page(table->pager, child_page_num);
-    switch (get_node_type(child_page)) {
-        case NODE_LEAF:
-            return leaf_node_find(table, child_page_num, key);
-        case NODE_INTERNAL:
-            return internal_node_find(table, child_page_num, key);
-    }
+    return new_cursor(table, page_num, l_index);
 }
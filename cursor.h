@@ -12,11 +12,12 @@ typedef struct {
     bool end_of_table; // Indicates a position past the last element
 } Cursor;
 
+uint64_t cursor_key(Cursor* cursor);
 uint8_t* cursor_value(Cursor* cursor);
 void cursor_advance(Cursor* cursor);
 Cursor* table_start(Table* table);
-Cursor* table_find(Table* table, uint32_t key);
-Cursor* leaf_node_find(Table* table, uint32_t page_num, uint32_t key);
-Cursor* internal_node_find(Table* table, uint32_t page_num, uint32_t key);
+Cursor* table_find(Table* table, uint64_t key);
+bool table_find_many(Table* table, const uint64_t* keys, uint32_t num_keys, Cursor* found, uint32_t* num_found);
+Cursor* leaf_node_find(Table* table, uint32_t page_num, uint64_t key);
 
 #endif
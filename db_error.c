@@ -0,0 +1,19 @@
+#include "db_error.h"
+#include <stdio.h>
+
+void clear_db_error(DbError* error) {
+    error->code = SIMPLESQLITE_OK;
+    error->message[0] = '\0';
+}
+
+void set_db_error(DbError* error, SimpleSqliteResult code, const char* format, ...) {
+    va_list arguments;
+    va_start(arguments, format);
+    set_db_error_v(error, code, format, arguments);
+    va_end(arguments);
+}
+
+void set_db_error_v(DbError* error, SimpleSqliteResult code, const char* format, va_list arguments) {
+    error->code = code;
+    vsnprintf(error->message, sizeof(error->message), format, arguments);
+}
@@ -0,0 +1,16 @@
+#ifndef DB_ERROR_H
+#define DB_ERROR_H
+
+#include "simplesqlite.h"
+#include <stdarg.h>
+
+typedef struct {
+    SimpleSqliteResult code; // SIMPLESQLITE_OK until something fails
+    char message[1024];
+} DbError;
+
+void clear_db_error(DbError* error);
+void set_db_error(DbError* error, SimpleSqliteResult code, const char* format, ...);
+void set_db_error_v(DbError* error, SimpleSqliteResult code, const char* format, va_list arguments);
+
+#endif
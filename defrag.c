@@ -0,0 +1,361 @@
+#include "defrag.h"
+#include "node.h"
+#include "catalog.h"
+#include "header.h"
+#include "hash_index.h"
+#include "constants.h"
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+/**
+ *
+ * Defragmentation
+ *
+ * Pages are only ever appended, so after enough splits the leaf chain jumps back and forth
+ * through the file and a full scan reads it in random order. The layout puts each table in key
+ * order: its leaves first, then its internal nodes level by level from the bottom up, the tables
+ * one after the other in catalog order and the pages no tree uses anymore at the end. The
+ * header, the catalog and the roots keep their pages, since the header and the catalog point at
+ * them by number.
+ *
+ * The plan walks every tree and records for each node its parent and the leaf before it, which
+ * are the only pages that point at it. Pages are then placed one position at a time: the page
+ * planned for the position is swapped with the one occupying it, and the pointers to both, in
+ * their parents, in the leaves before them and in their children, are rewritten. Each call runs
+ * under the pager lock like a statement; a split, a rollback or a new table in between leaves
+ * the plan stale, and the next call plans again and passes over the pages already in place.
+ *
+ */
+
+#define DEFRAG_NONE UINT32_MAX
+#define DEFRAG_FIXED (UINT32_MAX - 1) // In entry_of, the header and the catalog
+#define DEFRAG_MAX_HEIGHT 64
+
+typedef struct {
+    uint32_t page_num; // Where the node is now
+    uint32_t parent; // Entry of the parent, DEFRAG_NONE for a root and for a page no tree uses
+    uint32_t previous_leaf; // Entry of the leaf before it in key order, DEFRAG_NONE for the first
+    bool live; // Part of a tree. A page no tree uses is moved but nothing in it is rewritten
+} DefragEntry;
+
+struct Defrag {
+    uint64_t tree_generation; // Of the tree the plan was made for
+    uint32_t num_pages; // Pages in the file then
+    uint32_t num_entries;
+    DefragEntry* entries;
+    uint32_t* entry_of; // Entry of the node on each page
+    uint32_t num_slots;
+    uint32_t* slots; // The pages that are laid out, ascending
+    uint32_t* order; // Entry planned for each slot
+    uint32_t next_slot; // Slots before it hold their planned entry
+    uint32_t pages_moved;
+    uint8_t* swap_page;
+};
+
+void defrag_free(Defrag* defrag) {
+    if (defrag == NULL) {
+        return;
+    }
+    free(defrag->entries);
+    free(defrag->entry_of);
+    free(defrag->slots);
+    free(defrag->order);
+    free(defrag->swap_page);
+    free(defrag);
+}
+
+static uint32_t add_entry(Defrag* defrag, Pager* pager, uint32_t page_num, uint32_t parent, bool live) {
+    if (page_num >= defrag->num_pages || defrag->entry_of[page_num] != DEFRAG_NONE) {
+        pager_fail(pager, SIMPLESQLITE_CORRUPT, "Error: Page %" PRIu32 " is not a node of its own.", page_num);
+    }
+    uint32_t entry_num = defrag->num_entries++;
+    defrag->entries[entry_num] = (DefragEntry){page_num, parent, DEFRAG_NONE, live};
+    defrag->entry_of[page_num] = entry_num;
+    return entry_num;
+}
+
+// Walks the tree level by level, each level in key order, and appends its layout to the order
+static void plan_table(Defrag* defrag, Pager* pager, uint32_t root_page_num, uint32_t* num_ordered) {
+    uint32_t level_begin[DEFRAG_MAX_HEIGHT + 1];
+    uint32_t height = 0;
+    level_begin[0] = defrag->num_entries;
+    add_entry(defrag, pager, root_page_num, DEFRAG_NONE, true);
+
+    while (true) {
+        uint32_t begin = level_begin[height];
+        uint32_t end = defrag->num_entries;
+        NodeType type = get_node_type(get_page(pager, defrag->entries[begin].page_num));
+        height++;
+        if (type == NODE_LEAF) {
+            for (uint32_t i = begin + 1; i < end; i++) {
+                defrag->entries[i].previous_leaf = i - 1;
+            }
+            break;
+        }
+        if (height == DEFRAG_MAX_HEIGHT) {
+            pager_fail(pager, SIMPLESQLITE_CORRUPT, "Error: Tree rooted at page %" PRIu32 " is too deep.",
+                       root_page_num);
+        }
+
+        level_begin[height] = end;
+        for (uint32_t i = begin; i < end; i++) {
+            uint8_t* node = get_page(pager, defrag->entries[i].page_num);
+            if (get_node_type(node) != type) {
+                pager_fail(pager, SIMPLESQLITE_CORRUPT, "Error: Leaves at different depths under page %" PRIu32 ".",
+                           root_page_num);
+            }
+            uint32_t num_keys = *internal_node_num_keys(node);
+            for (uint32_t child = 0; child <= num_keys; child++) {
+                add_entry(defrag, pager, *internal_node_child_page_num(node, child), i, true);
+            }
+        }
+    }
+
+    // Leaves first, then the internal levels upwards. The root is level 0 and stays put
+    level_begin[height] = defrag->num_entries;
+    for (uint32_t level = height; level-- > 1;) {
+        for (uint32_t i = level_begin[level]; i < level_begin[level + 1]; i++) {
+            defrag->order[(*num_ordered)++] = i;
+        }
+    }
+}
+
+static bool allocate_plan(Defrag* defrag, uint32_t num_pages) {
+    free(defrag->entries);
+    free(defrag->entry_of);
+    free(defrag->slots);
+    free(defrag->order);
+    defrag->entries = malloc(sizeof(DefragEntry) * num_pages);
+    defrag->entry_of = malloc(sizeof(uint32_t) * num_pages);
+    defrag->slots = malloc(sizeof(uint32_t) * num_pages);
+    defrag->order = malloc(sizeof(uint32_t) * num_pages);
+    if (defrag->swap_page == NULL) {
+        defrag->swap_page = malloc(PAGE_SIZE);
+    }
+    return defrag->entries != NULL && defrag->entry_of != NULL && defrag->slots != NULL &&
+           defrag->order != NULL && defrag->swap_page != NULL;
+}
+
+// Called with the pager lock held and an error handler installed
+static bool plan_layout(Defrag* defrag, Table* database) {
+    Pager* pager = database->pager;
+    if (!allocate_plan(defrag, pager->num_pages)) {
+        return false;
+    }
+    defrag->tree_generation = pager->tree_generation;
+    defrag->num_pages = pager->num_pages;
+    defrag->num_entries = 0;
+    for (uint32_t i = 0; i < defrag->num_pages; i++) {
+        defrag->entry_of[i] = DEFRAG_NONE;
+    }
+
+    uint32_t num_ordered = 0;
+    uint8_t* header = get_page(pager, DB_HEADER_PAGE_NUM);
+    uint32_t catalog_page_num = *db_header_catalog_page_num(header);
+    defrag->entry_of[DB_HEADER_PAGE_NUM] = DEFRAG_FIXED;
+    if (catalog_page_num != 0) {
+        defrag->entry_of[catalog_page_num] = DEFRAG_FIXED;
+    }
+    plan_table(defrag, pager, database->root_page_num, &num_ordered);
+    if (catalog_page_num != 0) {
+        uint8_t* catalog = get_page(pager, catalog_page_num);
+        uint32_t num_tables = *catalog_num_tables(catalog);
+        for (uint32_t i = 0; i < num_tables; i++) {
+            plan_table(defrag, pager, *catalog_entry_root_page_num(catalog_entry(catalog, i)), &num_ordered);
+        }
+    }
+
+    // Pages of dropped tables
+    for (uint32_t page_num = 0; page_num < defrag->num_pages; page_num++) {
+        if (defrag->entry_of[page_num] == DEFRAG_NONE) {
+            defrag->order[num_ordered++] = add_entry(defrag, pager, page_num, DEFRAG_NONE, false);
+        }
+    }
+
+    defrag->num_slots = 0;
+    for (uint32_t page_num = 0; page_num < defrag->num_pages; page_num++) {
+        uint32_t entry_num = defrag->entry_of[page_num];
+        if (entry_num != DEFRAG_FIXED &&
+            (!defrag->entries[entry_num].live || defrag->entries[entry_num].parent != DEFRAG_NONE)) {
+            defrag->slots[defrag->num_slots++] = page_num;
+        }
+    }
+    // Pages an earlier plan placed are mostly still in place and cost nothing to pass over
+    defrag->next_slot = 0;
+    return true;
+}
+
+static uint32_t swapped(uint32_t page_num, uint32_t a, uint32_t b) {
+    return page_num == a ? b : page_num == b ? a : page_num;
+}
+
+static void swap_pointers(Pager* pager, uint32_t page_num, uint32_t a, uint32_t b) {
+    uint8_t* node = get_page_for_write(pager, page_num);
+    if (get_node_type(node) == NODE_LEAF) {
+        uint32_t* next_leaf = leaf_node_next_leaf_page_num(node);
+        *next_leaf = swapped(*next_leaf, a, b);
+        return;
+    }
+    uint32_t num_keys = *internal_node_num_keys(node);
+    for (uint32_t i = 0; i <= num_keys; i++) {
+        uint32_t* child = internal_node_child_page_num(node, i);
+        *child = swapped(*child, a, b);
+    }
+}
+
+static void adopt_children(Defrag* defrag, Pager* pager, uint32_t entry_num) {
+    DefragEntry* entry = &defrag->entries[entry_num];
+    uint8_t* node = get_page_for_write(pager, entry->page_num);
+    if (entry->parent != DEFRAG_NONE) {
+        *node_parent_page_num(node) = defrag->entries[entry->parent].page_num;
+    }
+    if (get_node_type(node) == NODE_LEAF) {
+        return;
+    }
+    uint32_t num_keys = *internal_node_num_keys(node);
+    for (uint32_t i = 0; i <= num_keys; i++) {
+        *node_parent_page_num(get_page_for_write(pager, *internal_node_child_page_num(node, i))) = entry->page_num;
+    }
+}
+
+static void swap_pages(Defrag* defrag, Pager* pager, uint32_t a, uint32_t b) {
+    uint8_t* page_a = get_page_for_write(pager, a);
+    uint8_t* page_b = get_page_for_write(pager, b);
+    memcpy(defrag->swap_page, page_a, PAGE_SIZE);
+    memcpy(page_a, page_b, PAGE_SIZE);
+    memcpy(page_b, defrag->swap_page, PAGE_SIZE);
+
+    uint32_t entry_a = defrag->entry_of[a];
+    uint32_t entry_b = defrag->entry_of[b];
+    defrag->entries[entry_a].page_num = b;
+    defrag->entries[entry_b].page_num = a;
+    defrag->entry_of[a] = entry_b;
+    defrag->entry_of[b] = entry_a;
+
+    // Parents and previous leaves are the only pages pointing at a node, rewrite each one once
+    uint32_t referrers[4];
+    uint32_t num_referrers = 0;
+    uint32_t moved[2] = {entry_a, entry_b};
+    for (uint32_t i = 0; i < 2; i++) {
+        DefragEntry* entry = &defrag->entries[moved[i]];
+        if (!entry->live) {
+            continue;
+        }
+        uint32_t candidates[2] = {entry->parent, entry->previous_leaf};
+        for (uint32_t j = 0; j < 2; j++) {
+            if (candidates[j] == DEFRAG_NONE) {
+                continue;
+            }
+            uint32_t page_num = defrag->entries[candidates[j]].page_num;
+            bool seen = false;
+            for (uint32_t k = 0; k < num_referrers; k++) {
+                seen = seen || referrers[k] == page_num;
+            }
+            if (!seen) {
+                referrers[num_referrers++] = page_num;
+            }
+        }
+    }
+    for (uint32_t i = 0; i < num_referrers; i++) {
+        swap_pointers(pager, referrers[i], a, b);
+    }
+    for (uint32_t i = 0; i < 2; i++) {
+        if (defrag->entries[moved[i]].live) {
+            adopt_children(defrag, pager, moved[i]);
+        }
+    }
+}
+
+// Called with the pager lock held. Returns false when a plan could not be allocated
+static bool defrag_step(Defrag* defrag, Table* database, uint32_t max_pages) {
+    Pager* pager = database->pager;
+    if (defrag->entries == NULL || defrag->tree_generation != pager->tree_generation ||
+        defrag->num_pages != pager->num_pages) {
+        if (!plan_layout(defrag, database)) {
+            return false;
+        }
+    }
+
+    uint32_t moved = 0;
+    while (defrag->next_slot < defrag->num_slots && (max_pages == 0 || moved < max_pages)) {
+        uint32_t page_num = defrag->slots[defrag->next_slot];
+        uint32_t current_page_num = defrag->entries[defrag->order[defrag->next_slot]].page_num;
+        if (current_page_num != page_num) {
+            swap_pages(defrag, pager, current_page_num, page_num);
+            moved++;
+        }
+        defrag->next_slot++;
+    }
+
+    if (moved > 0) {
+        // Fingers and the hash index remember pages by number
+        if (pager->hash_index != NULL) {
+            hash_index_clear(pager->hash_index);
+        }
+        pager->tree_generation++;
+        defrag->tree_generation = pager->tree_generation;
+        defrag->pages_moved += moved;
+    }
+    return true;
+}
+
+bool defrag_run(Table* database, Defrag** defrag, uint32_t max_pages, DefragStats* stats, DbError* error) {
+    memset(stats, 0, sizeof(DefragStats));
+    if (*defrag == NULL) {
+        *defrag = calloc(1, sizeof(Defrag));
+        if (*defrag == NULL) {
+            set_db_error(error, SIMPLESQLITE_NO_MEMORY, "Out of memory");
+            return false;
+        }
+    }
+
+    Pager* pager = database->pager;
+    pager_lock(pager);
+    // A compressed file places each page wherever its sectors fit when it is written, so swapping
+    // page numbers would not put the leaves next to each other on disk
+    if (pager->error.code != SIMPLESQLITE_OK || pager->in_transaction || pager->page_map != NULL) {
+        if (pager->error.code != SIMPLESQLITE_OK) {
+            *error = pager->error;
+        } else if (pager->in_transaction) {
+            set_db_error(error, SIMPLESQLITE_MISUSE, "Error: Cannot defragment inside a transaction.");
+        } else {
+            set_db_error(error, SIMPLESQLITE_MISUSE, "Error: Cannot defragment a compressed database.");
+        }
+        pager_unlock(pager);
+        defrag_free(*defrag);
+        *defrag = NULL;
+        return false;
+    }
+
+    jmp_buf error_handler;
+    if (setjmp(error_handler) != 0) {
+        pager->error_handler = NULL;
+        *error = pager->error;
+        pager_unlock(pager);
+        defrag_free(*defrag);
+        *defrag = NULL;
+        return false;
+    }
+    pager->error_handler = &error_handler;
+    bool stepped = defrag_step(*defrag, database, max_pages);
+    pager->error_handler = NULL;
+    pager_unlock(pager);
+
+    if (!stepped) {
+        set_db_error(error, SIMPLESQLITE_NO_MEMORY, "Out of memory");
+        defrag_free(*defrag);
+        *defrag = NULL;
+        return false;
+    }
+
+    stats->num_pages = (*defrag)->num_slots;
+    stats->pages_placed = (*defrag)->next_slot;
+    stats->pages_moved = (*defrag)->pages_moved;
+    stats->done = (*defrag)->next_slot == (*defrag)->num_slots;
+    if (stats->done) {
+        defrag_free(*defrag);
+        *defrag = NULL;
+    }
+    return true;
+}
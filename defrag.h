@@ -0,0 +1,19 @@
+#ifndef DEFRAG_H
+#define DEFRAG_H
+
+#include "table.h"
+#include "db_error.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef SimpleSqliteDefragStats DefragStats;
+
+// The plan and how far it got, kept between calls
+typedef struct Defrag Defrag;
+
+// *defrag is NULL before the first call, and is freed and set back to NULL once the layout is
+// done or a call fails. max_pages 0 moves every page that is out of place
+bool defrag_run(Table* database, Defrag** defrag, uint32_t max_pages, DefragStats* stats, DbError* error);
+void defrag_free(Defrag* defrag);
+
+#endif
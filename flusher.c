@@ -0,0 +1,143 @@
+#include "flusher.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <time.h>
+
+/**
+ *
+ * Background flusher
+ *
+ * Wakes up every FLUSHER_TICK_NS and writes the dirty pages out once there are enough of them
+ * or the oldest one is old enough. The pages are copied under the pager lock, between two
+ * statements, and written under the io lock only, so the foreground is held up for the copy
+ * of a threshold-sized batch rather than for the I/O. Pages written by an open transaction
+ * are left alone until it commits.
+ *
+ */
+
+static const uint64_t FLUSHER_TICK_NS = 50 * 1000 * 1000;
+
+static struct timespec deadline_after(uint64_t delay_ns) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    uint64_t nanoseconds = (uint64_t)deadline.tv_nsec + delay_ns;
+    deadline.tv_sec += nanoseconds / 1000000000;
+    deadline.tv_nsec = nanoseconds % 1000000000;
+    return deadline;
+}
+
+static bool flusher_is_due(Flusher* flusher, Pager* pager) {
+    if (pager->in_transaction || pager->num_dirty_pages == 0 || pager->error.code != SIMPLESQLITE_OK) {
+        return false;
+    }
+    if (pager->num_dirty_pages >= flusher->dirty_pages_threshold) {
+        return true;
+    }
+    return monotonic_time_ns() - pager->dirty_since_ns >= flusher->max_age_ns;
+}
+
+static uint32_t flusher_flush_once(Flusher* flusher) {
+    Pager* pager = flusher->pager;
+
+    pager_lock(pager);
+    if (!flusher_is_due(flusher, pager)) {
+        pager_unlock(pager);
+        return 0;
+    }
+
+    // A batch that cannot be copied leaves its error for the next statement, like a failed write
+    jmp_buf error_handler;
+    if (setjmp(error_handler) != 0) {
+        pager->error_handler = NULL;
+        pager_unlock(pager);
+        return 0;
+    }
+    pager->error_handler = &error_handler;
+    DirtyBatch* batch = pager_collect_dirty(pager);
+    pager->error_handler = NULL;
+    uint32_t num_pages = batch->num_pages;
+
+    // Taking the io lock before releasing the pager lock keeps later commits ordered after this batch
+    DbError error;
+    pthread_mutex_lock(&pager->io_lock);
+    pager_unlock(pager);
+    bool written = pager_write_batch(pager, batch, &error);
+    pthread_mutex_unlock(&pager->io_lock);
+
+    // The pages were marked clean when they were collected, so the failure is left for the next statement
+    if (!written) {
+        pager_lock(pager);
+        if (pager->error.code == SIMPLESQLITE_OK) {
+            pager->error = error;
+        }
+        pager_unlock(pager);
+        return 0;
+    }
+
+    return num_pages;
+}
+
+static void* flusher_run(void* argument) {
+    Flusher* flusher = (Flusher*)argument;
+    uint64_t delay_ns = FLUSHER_TICK_NS;
+
+    pthread_mutex_lock(&flusher->mutex);
+    while (!flusher->stopping) {
+        struct timespec deadline = deadline_after(delay_ns);
+        pthread_cond_timedwait(&flusher->wakeup, &flusher->mutex, &deadline);
+        if (flusher->stopping) {
+            break;
+        }
+        pthread_mutex_unlock(&flusher->mutex);
+
+        uint32_t pages_written = flusher_flush_once(flusher);
+
+        // Stay under the write rate by resting in proportion to what was just written
+        delay_ns = FLUSHER_TICK_NS;
+        if (pages_written > 0 && flusher->pages_per_second > 0) {
+            uint64_t rest_ns = (uint64_t)pages_written * 1000000000 / flusher->pages_per_second;
+            if (rest_ns > delay_ns) {
+                delay_ns = rest_ns;
+            }
+        }
+
+        pthread_mutex_lock(&flusher->mutex);
+    }
+    pthread_mutex_unlock(&flusher->mutex);
+
+    return NULL;
+}
+
+Flusher* flusher_start(Pager* pager, const DbConfig* config, DbError* error) {
+    Flusher* flusher = malloc(sizeof(Flusher));
+    flusher->pager = pager;
+    flusher->stopping = false;
+    flusher->dirty_pages_threshold = config->flush_dirty_pages;
+    flusher->max_age_ns = (uint64_t)config->flush_max_age_ms * 1000 * 1000;
+    flusher->pages_per_second = config->flush_pages_per_second;
+    pthread_mutex_init(&flusher->mutex, NULL);
+    pthread_cond_init(&flusher->wakeup, NULL);
+
+    if (pthread_create(&flusher->thread, NULL, flusher_run, flusher) != 0) {
+        set_db_error(error, SIMPLESQLITE_NO_MEMORY, "Unable to start background flusher");
+        pthread_mutex_destroy(&flusher->mutex);
+        pthread_cond_destroy(&flusher->wakeup);
+        free(flusher);
+        return NULL;
+    }
+
+    return flusher;
+}
+
+void flusher_stop(Flusher* flusher) {
+    pthread_mutex_lock(&flusher->mutex);
+    flusher->stopping = true;
+    pthread_cond_signal(&flusher->wakeup);
+    pthread_mutex_unlock(&flusher->mutex);
+
+    pthread_join(flusher->thread, NULL);
+
+    pthread_cond_destroy(&flusher->wakeup);
+    pthread_mutex_destroy(&flusher->mutex);
+    free(flusher);
+}
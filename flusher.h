@@ -0,0 +1,22 @@
+#ifndef FLUSHER_H
+#define FLUSHER_H
+
+#include "table.h"
+#include <pthread.h>
+#include <stdbool.h>
+
+typedef struct Flusher {
+    Pager* pager;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t wakeup;
+    bool stopping;
+    uint32_t dirty_pages_threshold;
+    uint64_t max_age_ns;
+    uint32_t pages_per_second;
+} Flusher;
+
+Flusher* flusher_start(Pager* pager, const DbConfig* config, DbError* error);
+void flusher_stop(Flusher* flusher);
+
+#endif
@@ -0,0 +1,138 @@
+#include "hash_index.h"
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ *
+ * Adaptive Hash Index
+ *
+ * Maps hot keys straight to the leaf cell they were last found in, so a lookup that hits costs
+ * one probe and one page instead of a descent. Entries are hints: the caller checks that the
+ * cell still holds the key, and a lookup that finds a stale entry descends as usual and records
+ * the key's new place. Splits patch the entries of the cells they move.
+ *
+ * The index learns from lookups. A key found by a descent takes an empty slot of its set, or the
+ * slot of an entry whose hit count has decayed to zero. Otherwise it only decays the coldest
+ * entry of the set, so a key has to come back before it displaces a hotter one. Every hit counts
+ * up to HASH_INDEX_MAX_HITS. When fewer than HASH_INDEX_MIN_HIT_PERCENT of a window of lookups
+ * hit, as under an insert-heavy load or uniform keys, the index pauses itself for a while and
+ * then samples the hit rate again.
+ *
+ */
+
+HashIndex* hash_index_create(uint32_t budget_kb) {
+    uint64_t num_sets = (uint64_t)budget_kb * 1024 / (sizeof(HashIndexEntry) * HASH_INDEX_WAYS);
+    if (num_sets == 0) {
+        return NULL;
+    }
+    // Rounded down to a power of two, so a set is picked with a mask
+    while ((num_sets & (num_sets - 1)) != 0) {
+        num_sets &= num_sets - 1;
+    }
+
+    HashIndex* index = malloc(sizeof(HashIndex));
+    if (index == NULL) {
+        return NULL;
+    }
+    index->entries = calloc(num_sets * HASH_INDEX_WAYS, sizeof(HashIndexEntry));
+    if (index->entries == NULL) {
+        free(index);
+        return NULL;
+    }
+    index->num_sets = (uint32_t)num_sets;
+    index->window_lookups = 0;
+    index->window_hits = 0;
+    index->paused_lookups = 0;
+    return index;
+}
+
+void hash_index_free(HashIndex* index) {
+    if (index == NULL) {
+        return;
+    }
+    free(index->entries);
+    free(index);
+}
+
+void hash_index_clear(HashIndex* index) {
+    memset(index->entries, 0, sizeof(HashIndexEntry) * index->num_sets * HASH_INDEX_WAYS);
+}
+
+// Counts a lookup, returns false while the index is paused
+bool hash_index_begin_lookup(HashIndex* index) {
+    if (index->paused_lookups > 0) {
+        index->paused_lookups--;
+        return false;
+    }
+
+    if (++index->window_lookups == HASH_INDEX_WINDOW) {
+        if (index->window_hits * 100 < HASH_INDEX_WINDOW * HASH_INDEX_MIN_HIT_PERCENT) {
+            index->paused_lookups = HASH_INDEX_PAUSE_LOOKUPS;
+        }
+        index->window_lookups = 0;
+        index->window_hits = 0;
+    }
+    return true;
+}
+
+static HashIndexEntry* hash_index_set(HashIndex* index, uint32_t root_page_num, uint64_t key) {
+    uint64_t hash = (key ^ ((uint64_t)root_page_num * 0x9E3779B97F4A7C15ULL)) * 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 32;
+    return index->entries + (size_t)(hash & (index->num_sets - 1)) * HASH_INDEX_WAYS;
+}
+
+HashIndexEntry* hash_index_find(HashIndex* index, uint32_t root_page_num, uint64_t key) {
+    HashIndexEntry* set = hash_index_set(index, root_page_num, key);
+    for (uint32_t i = 0; i < HASH_INDEX_WAYS; i++) {
+        if (set[i].key == key && set[i].root_page_num == root_page_num) {
+            return &set[i];
+        }
+    }
+    return NULL;
+}
+
+// Called once the caller has checked that the entry's cell still holds its key
+void hash_index_hit(HashIndex* index, HashIndexEntry* entry) {
+    if (entry->hits < HASH_INDEX_MAX_HITS) {
+        entry->hits++;
+    }
+    index->window_hits++;
+}
+
+// Called after a descent found the key at page_num and cell_num
+void hash_index_record(HashIndex* index, uint32_t root_page_num, uint64_t key, uint32_t page_num, uint32_t cell_num) {
+    HashIndexEntry* set = hash_index_set(index, root_page_num, key);
+    HashIndexEntry* coldest = &set[0];
+    for (uint32_t i = 0; i < HASH_INDEX_WAYS; i++) {
+        if (set[i].key == key && set[i].root_page_num == root_page_num) {
+            set[i].page_num = page_num;
+            set[i].cell_num = cell_num;
+            if (set[i].hits < HASH_INDEX_MAX_HITS) {
+                set[i].hits++;
+            }
+            return;
+        }
+        if (set[i].root_page_num == 0 || (coldest->root_page_num != 0 && set[i].hits < coldest->hits)) {
+            coldest = &set[i];
+        }
+    }
+
+    if (coldest->root_page_num != 0 && coldest->hits > 0) {
+        coldest->hits--;
+        return;
+    }
+    coldest->key = key;
+    coldest->root_page_num = root_page_num;
+    coldest->page_num = page_num;
+    coldest->cell_num = cell_num;
+    coldest->hits = 0;
+}
+
+// Moves the entry of a key whose cell was moved, keys without one are left out
+void hash_index_patch(HashIndex* index, uint32_t root_page_num, uint64_t key, uint32_t page_num, uint32_t cell_num) {
+    HashIndexEntry* entry = hash_index_find(index, root_page_num, key);
+    if (entry != NULL) {
+        entry->page_num = page_num;
+        entry->cell_num = cell_num;
+    }
+}
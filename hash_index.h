@@ -0,0 +1,41 @@
+#ifndef HASH_INDEX_H
+#define HASH_INDEX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define HASH_INDEX_WAYS 4 // Slots a key can live in, the coldest of them is the one replaced
+#define HASH_INDEX_MAX_HITS 15 // Hit counts saturate here, so a key that went cold ages out
+#define HASH_INDEX_WINDOW 1024 // Lookups over which the hit rate is measured
+#define HASH_INDEX_MIN_HIT_PERCENT 5 // Below this the index pauses itself
+#define HASH_INDEX_PAUSE_LOOKUPS (16 * HASH_INDEX_WINDOW)
+
+// Where a key was last found. root_page_num 0 marks an empty slot, page 0 is never a root
+typedef struct {
+    uint64_t key;
+    uint32_t root_page_num;
+    uint32_t page_num;
+    uint32_t cell_num;
+    uint32_t hits;
+} HashIndexEntry;
+
+typedef struct HashIndex {
+    HashIndexEntry* entries;
+    uint32_t num_sets; // A power of two, each set holds HASH_INDEX_WAYS entries
+    uint32_t window_lookups;
+    uint32_t window_hits;
+    uint32_t paused_lookups; // Lookups left before the index samples the hit rate again
+} HashIndex;
+
+// NULL when the budget does not hold one set
+HashIndex* hash_index_create(uint32_t budget_kb);
+void hash_index_free(HashIndex* index);
+void hash_index_clear(HashIndex* index);
+
+bool hash_index_begin_lookup(HashIndex* index);
+HashIndexEntry* hash_index_find(HashIndex* index, uint32_t root_page_num, uint64_t key);
+void hash_index_hit(HashIndex* index, HashIndexEntry* entry);
+void hash_index_record(HashIndex* index, uint32_t root_page_num, uint64_t key, uint32_t page_num, uint32_t cell_num);
+void hash_index_patch(HashIndex* index, uint32_t root_page_num, uint64_t key, uint32_t page_num, uint32_t cell_num);
+
+#endif
@@ -0,0 +1,74 @@
+#include "header.h"
+#include "constants.h"
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+uint8_t* db_header_magic(uint8_t* page) {
+    return page + DB_HEADER_MAGIC_OFFSET;
+}
+
+uint32_t* db_header_version(uint8_t* page) {
+    return (uint32_t*)(page + DB_HEADER_VERSION_OFFSET);
+}
+
+uint32_t* db_header_key_size(uint8_t* page) {
+    return (uint32_t*)(page + DB_HEADER_KEY_SIZE_OFFSET);
+}
+
+uint32_t* db_header_root_page_num(uint8_t* page) {
+    return (uint32_t*)(page + DB_HEADER_ROOT_PAGE_NUM_OFFSET);
+}
+
+uint32_t* db_header_flags(uint8_t* page) {
+    return (uint32_t*)(page + DB_HEADER_FLAGS_OFFSET);
+}
+
+// 0 until the first create table, page 0 is always the header
+uint32_t* db_header_catalog_page_num(uint8_t* page) {
+    return (uint32_t*)(page + DB_HEADER_CATALOG_PAGE_NUM_OFFSET);
+}
+
+// Advanced by every backup, pages are stamped with the value current when they were written
+uint64_t* db_header_change_seq(uint8_t* page) {
+    return (uint64_t*)(page + DB_HEADER_CHANGE_SEQ_OFFSET);
+}
+
+// Tells the backups of one database apart from those of another
+uint64_t* db_header_database_id(uint8_t* page) {
+    return (uint64_t*)(page + DB_HEADER_DATABASE_ID_OFFSET);
+}
+
+// Unique enough to tell databases apart, it is not meant to be unguessable
+uint64_t new_database_id(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return ((uint64_t)now.tv_sec << 32) ^ (uint64_t)now.tv_nsec ^ ((uint64_t)getpid() << 20);
+}
+
+void initialize_db_header(uint8_t* page, uint32_t key_size, uint32_t flags) {
+    memcpy(db_header_magic(page), DB_HEADER_MAGIC, DB_HEADER_MAGIC_SIZE);
+    *db_header_version(page) = DB_FORMAT_VERSION;
+    *db_header_key_size(page) = key_size;
+    *db_header_root_page_num(page) = DB_HEADER_PAGE_NUM + 1;
+    *db_header_flags(page) = flags;
+    *db_header_catalog_page_num(page) = 0;
+    *db_header_change_seq(page) = 1;
+    *db_header_database_id(page) = new_database_id();
+}
+
+bool is_valid_db_header(uint8_t* page) {
+    if (memcmp(db_header_magic(page), DB_HEADER_MAGIC, DB_HEADER_MAGIC_SIZE) != 0) {
+        return false;
+    }
+    if (*db_header_version(page) != DB_FORMAT_VERSION) {
+        return false;
+    }
+
+    if ((*db_header_flags(page) & ~(DB_FLAG_COMPRESSED | DB_FLAG_BACKUP)) != 0) {
+        return false;
+    }
+
+    uint32_t key_size = *db_header_key_size(page);
+    return key_size == NARROW_KEY_SIZE || key_size == WIDE_KEY_SIZE;
+}
@@ -0,0 +1,29 @@
+#ifndef HEADER_H
+#define HEADER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+uint8_t* db_header_magic(uint8_t* page);
+
+uint32_t* db_header_version(uint8_t* page);
+
+uint32_t* db_header_key_size(uint8_t* page);
+
+uint32_t* db_header_root_page_num(uint8_t* page);
+
+uint32_t* db_header_flags(uint8_t* page);
+
+uint32_t* db_header_catalog_page_num(uint8_t* page);
+
+uint64_t* db_header_change_seq(uint8_t* page);
+
+uint64_t* db_header_database_id(uint8_t* page);
+
+uint64_t new_database_id(void);
+
+void initialize_db_header(uint8_t* page, uint32_t key_size, uint32_t flags);
+
+bool is_valid_db_header(uint8_t* page);
+
+#endif
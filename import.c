@@ -0,0 +1,585 @@
+#include "import.h"
+#include "node.h"
+#include "cursor.h"
+#include "catalog.h"
+#include "statement.h"
+#include "sort.h"
+#include "constants.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+/**
+ *
+ * Import
+ *
+ * Rows are read into a chunk until it holds the sort memory budget. The keys of a full chunk
+ * are radix sorted on one thread per CPU and the chunk is written out as a sorted run, and the
+ * runs are merged once the file is read. When the whole file fits in one chunk it is sorted and
+ * read from in place. The sort is stable and earlier runs hold earlier rows, so of the rows that
+ * share a key the first one in the file comes out first; the rest are skipped as duplicates,
+ * which is what inserting the rows one by one would do.
+ *
+ * An empty table is built bottom-up in one pass: the rows fill leaves on consecutive new pages,
+ * then each level of internal nodes is written above the one below it, and the root page takes
+ * the top level, so nothing ever splits. A table that already holds rows gets the sorted rows
+ * inserted in key order, where the fingers keep every lookup on the leaf the last one ended in.
+ *
+ */
+
+// Run record layout: KEY (uint64_t) | VALUE (ROW_SIZE bytes)
+static const uint32_t RUN_RECORD_KEY_SIZE = sizeof(uint64_t);
+static const uint32_t RUN_RECORD_SIZE = sizeof(uint64_t) + ROW_SIZE;
+
+typedef struct {
+    uint32_t capacity; // Rows held at once, from the sort memory budget
+    uint32_t num_rows;
+    uint8_t* values; // Serialized rows in the order they were read
+    SortKey* keys; // Indexed into values
+    SortKey* scratch;
+    SortKey* sorted; // keys or scratch, whichever the sort left the result in
+} ImportChunk;
+
+// The rows in key order, without the ones whose key an earlier row already had
+typedef struct {
+    ImportChunk* chunk; // Read from in place when the file fit in it, NULL when there are runs
+    uint32_t next_row;
+    FILE** runs;
+    uint32_t num_runs;
+    uint8_t* run_records; // The current record of every run
+    uint32_t* heap; // Runs with a record left, the smallest key on top and earlier runs first on ties
+    uint32_t heap_size;
+    bool refill; // The record on top was returned, its run has to move on first
+    bool failed; // A run could not be read back
+    bool has_last_key;
+    uint64_t last_key;
+    uint64_t duplicate_keys;
+} ImportStream;
+
+// A node the build wrote and the largest key below it
+typedef struct {
+    uint32_t page_num;
+    uint64_t max_key;
+} BuiltNode;
+
+static uint32_t import_threads(void) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus > 0 ? (uint32_t)cpus : 1;
+}
+
+static bool initialize_chunk(ImportChunk* chunk, uint64_t memory_budget, DbError* error) {
+    uint64_t capacity = memory_budget / (ROW_SIZE + 2 * sizeof(SortKey));
+    if (capacity == 0) {
+        capacity = 1;
+    }
+    if (capacity > UINT32_MAX) {
+        capacity = UINT32_MAX;
+    }
+    chunk->capacity = (uint32_t)capacity;
+    chunk->num_rows = 0;
+    chunk->values = calloc(capacity, ROW_SIZE);
+    chunk->keys = malloc(sizeof(SortKey) * capacity);
+    chunk->scratch = malloc(sizeof(SortKey) * capacity);
+    chunk->sorted = chunk->keys;
+    if (chunk->values == NULL || chunk->keys == NULL || chunk->scratch == NULL) {
+        set_db_error(error, SIMPLESQLITE_NO_MEMORY, "Out of memory");
+        return false;
+    }
+    return true;
+}
+
+static void free_chunk(ImportChunk* chunk) {
+    free(chunk->values);
+    free(chunk->keys);
+    free(chunk->scratch);
+    chunk->values = NULL;
+    chunk->keys = NULL;
+    chunk->scratch = NULL;
+}
+
+static void sort_chunk(ImportChunk* chunk) {
+    chunk->sorted = radix_sort_keys(chunk->keys, chunk->scratch, chunk->num_rows, import_threads());
+}
+
+static bool spill_chunk(ImportChunk* chunk, ImportStream* stream, DbError* error) {
+    sort_chunk(chunk);
+
+    FILE* run = tmpfile();
+    bool spilled = run != NULL;
+    for (uint32_t i = 0; spilled && i < chunk->num_rows; i++) {
+        SortKey* sorted = &chunk->sorted[i];
+        spilled = fwrite(&sorted->key, RUN_RECORD_KEY_SIZE, 1, run) == 1 &&
+                  fwrite(chunk->values + (size_t)sorted->index * ROW_SIZE, ROW_SIZE, 1, run) == 1;
+    }
+
+    FILE** runs = spilled ? realloc(stream->runs, sizeof(FILE*) * (stream->num_runs + 1)) : NULL;
+    if (runs == NULL) {
+        if (run != NULL) {
+            fclose(run);
+        }
+        set_db_error(error, SIMPLESQLITE_IO_ERROR, "Error: Unable to sort, out of memory or temporary space.");
+        return false;
+    }
+    stream->runs = runs;
+    stream->runs[stream->num_runs++] = run;
+    chunk->num_rows = 0;
+    return true;
+}
+
+static void set_line_error(DbError* error, uint64_t line_num, SimpleSqliteResult code, const char* message) {
+    set_db_error(error, code, "Error: line %" PRIu64 ": %s", line_num, message);
+}
+
+// Any row that cannot be inserted fails the import before the table is touched
+static bool check_row(PrepareResult result, Row* row, uint32_t key_size, uint64_t line_num, DbError* error) {
+    switch (result) {
+        case (PREPARE_SUCCESS):
+            break;
+        case (PREPARE_STRING_TOO_LONG):
+            set_line_error(error, line_num, SIMPLESQLITE_TOO_BIG, "String is too long.");
+            return false;
+        case (PREPARE_NEGATIVE_ID):
+            set_line_error(error, line_num, SIMPLESQLITE_RANGE, "ID must be positive.");
+            return false;
+        default:
+            set_line_error(error, line_num, SIMPLESQLITE_ERROR, "Syntax error. Could not parse row.");
+            return false;
+    }
+    if (key_size == NARROW_KEY_SIZE && row->id > UINT32_MAX) {
+        set_line_error(error, line_num, SIMPLESQLITE_RANGE, "Key out of range.");
+        return false;
+    }
+    return true;
+}
+
+static bool read_rows(FILE* input, uint32_t key_size, ImportChunk* chunk, ImportStream* stream, ImportStats* stats,
+                      DbError* error) {
+    char* line = NULL;
+    size_t line_capacity = 0;
+    ssize_t length;
+    uint64_t line_num = 0;
+    bool read = true;
+
+    while (read && (length = getline(&line, &line_capacity, input)) != -1) {
+        line_num++;
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r')) {
+            line[--length] = '\0';
+        }
+        if (length == 0) {
+            continue;
+        }
+
+        Row row;
+        read = check_row(prepare_row(line, &row), &row, key_size, line_num, error);
+        if (read && chunk->num_rows == chunk->capacity) {
+            read = spill_chunk(chunk, stream, error);
+        }
+        if (read) {
+            serialize_row(&row, (char*)chunk->values + (size_t)chunk->num_rows * ROW_SIZE);
+            chunk->keys[chunk->num_rows].key = row.id;
+            chunk->keys[chunk->num_rows].index = chunk->num_rows;
+            chunk->num_rows++;
+            stats->rows_read++;
+        }
+    }
+
+    if (read && ferror(input)) {
+        set_db_error(error, SIMPLESQLITE_IO_ERROR, "Error reading import file.");
+        read = false;
+    }
+    free(line);
+    return read;
+}
+
+static uint64_t run_key(ImportStream* stream, uint32_t run) {
+    uint64_t key;
+    memcpy(&key, stream->run_records + (size_t)run * RUN_RECORD_SIZE, RUN_RECORD_KEY_SIZE);
+    return key;
+}
+
+static bool run_comes_first(ImportStream* stream, uint32_t left, uint32_t right) {
+    uint64_t left_key = run_key(stream, left);
+    uint64_t right_key = run_key(stream, right);
+    return left_key < right_key || (left_key == right_key && left < right);
+}
+
+static void sift_down(ImportStream* stream, uint32_t index) {
+    while (true) {
+        uint32_t left_child = 2 * index + 1;
+        uint32_t right_child = left_child + 1;
+        uint32_t top = index;
+
+        if (left_child < stream->heap_size && run_comes_first(stream, stream->heap[left_child], stream->heap[top])) {
+            top = left_child;
+        }
+        if (right_child < stream->heap_size && run_comes_first(stream, stream->heap[right_child], stream->heap[top])) {
+            top = right_child;
+        }
+        if (top == index) {
+            return;
+        }
+
+        uint32_t swap = stream->heap[index];
+        stream->heap[index] = stream->heap[top];
+        stream->heap[top] = swap;
+        index = top;
+    }
+}
+
+static bool read_run_record(ImportStream* stream, uint32_t run) {
+    if (fread(stream->run_records + (size_t)run * RUN_RECORD_SIZE, RUN_RECORD_SIZE, 1, stream->runs[run]) == 1) {
+        return true;
+    }
+    if (ferror(stream->runs[run])) {
+        stream->failed = true;
+    }
+    return false;
+}
+
+static bool begin_merge(ImportStream* stream, DbError* error) {
+    stream->run_records = malloc((size_t)stream->num_runs * RUN_RECORD_SIZE);
+    stream->heap = malloc(sizeof(uint32_t) * stream->num_runs);
+    if (stream->run_records == NULL || stream->heap == NULL) {
+        set_db_error(error, SIMPLESQLITE_NO_MEMORY, "Out of memory");
+        return false;
+    }
+
+    for (uint32_t i = 0; i < stream->num_runs; i++) {
+        rewind(stream->runs[i]);
+        if (read_run_record(stream, i)) {
+            stream->heap[stream->heap_size++] = i;
+        }
+    }
+    for (uint32_t i = stream->heap_size / 2; i > 0; i--) {
+        sift_down(stream, i - 1);
+    }
+    return true;
+}
+
+// The value stays valid until the next call
+static bool stream_pop(ImportStream* stream, uint64_t* key, uint8_t** value) {
+    if (stream->chunk != NULL) {
+        if (stream->next_row >= stream->chunk->num_rows) {
+            return false;
+        }
+        SortKey* sorted = &stream->chunk->sorted[stream->next_row++];
+        *key = sorted->key;
+        *value = stream->chunk->values + (size_t)sorted->index * ROW_SIZE;
+        return true;
+    }
+
+    if (stream->refill) {
+        stream->refill = false;
+        if (!read_run_record(stream, stream->heap[0])) {
+            stream->heap[0] = stream->heap[--stream->heap_size];
+        }
+        sift_down(stream, 0);
+    }
+    if (stream->heap_size == 0) {
+        return false;
+    }
+
+    stream->refill = true;
+    *key = run_key(stream, stream->heap[0]);
+    *value = stream->run_records + (size_t)stream->heap[0] * RUN_RECORD_SIZE + RUN_RECORD_KEY_SIZE;
+    return true;
+}
+
+static bool stream_next(ImportStream* stream, uint64_t* key, uint8_t** value) {
+    while (stream_pop(stream, key, value)) {
+        if (stream->has_last_key && *key == stream->last_key) {
+            stream->duplicate_keys++;
+            continue;
+        }
+        stream->has_last_key = true;
+        stream->last_key = *key;
+        return true;
+    }
+    return false;
+}
+
+static void free_stream(ImportStream* stream) {
+    for (uint32_t i = 0; i < stream->num_runs; i++) {
+        fclose(stream->runs[i]);
+    }
+    free(stream->runs);
+    free(stream->run_records);
+    free(stream->heap);
+}
+
+/**
+ *
+ * Fills leaves in key order. The first one is the root, for as long as every row fits in it;
+ * the row that does not moves its cells to a leaf of their own, as create_new_root would.
+ * Every full leaf goes into leaves, the last one is left to the caller.
+ *
+ */
+static uint32_t build_leaves(Table* table, ImportStream* stream, BuiltNode* leaves, uint32_t* num_leaves,
+                             ImportStats* stats) {
+    Pager* pager = table->pager;
+    uint8_t* root = get_page_for_write(pager, table->root_page_num);
+    uint32_t key_size = node_key_size(root);
+    uint32_t max_cells = leaf_node_max_cells(root);
+
+    uint32_t leaf_page_num = table->root_page_num;
+    uint8_t* leaf = root;
+    uint64_t key;
+    uint8_t* value;
+    while (stream_next(stream, &key, &value)) {
+        uint32_t num_cells = *leaf_node_num_cells(leaf);
+        if (num_cells == max_cells) {
+            if (leaf_page_num == table->root_page_num) {
+                leaf_page_num = get_unused_page_num(pager);
+                leaf = get_page_for_write(pager, leaf_page_num);
+                memcpy(leaf, root, PAGE_SIZE);
+                set_node_root(leaf, false);
+            }
+            leaves[*num_leaves].page_num = leaf_page_num;
+            leaves[*num_leaves].max_key = leaf_node_key(leaf, num_cells - 1);
+            (*num_leaves)++;
+
+            leaf_page_num = get_unused_page_num(pager);
+            *leaf_node_next_leaf_page_num(leaf) = leaf_page_num;
+            leaf = get_page_for_write(pager, leaf_page_num);
+            initialize_leaf_node(leaf, key_size);
+            num_cells = 0;
+        }
+
+        set_leaf_node_key(leaf, num_cells, key);
+        memcpy(leaf_node_value(leaf, num_cells), value, ROW_SIZE);
+        *leaf_node_num_cells(leaf) = num_cells + 1;
+        stats->rows_imported++;
+    }
+    return leaf_page_num;
+}
+
+// The last leaf takes cells from the full one before it until it holds at least half of both
+static void balance_last_leaves(Pager* pager, BuiltNode* left_node, BuiltNode* right_node) {
+    uint8_t* left = get_page_for_write(pager, left_node->page_num);
+    uint8_t* right = get_page_for_write(pager, right_node->page_num);
+    uint32_t left_cells = *leaf_node_num_cells(left);
+    uint32_t right_cells = *leaf_node_num_cells(right);
+    uint32_t right_target = (left_cells + right_cells) / 2;
+    if (right_cells >= right_target) {
+        return;
+    }
+
+    uint32_t moved = right_target - right_cells;
+    uint32_t cell_size = leaf_node_cell_size(left);
+    memmove(leaf_node_cell(right, moved), leaf_node_cell(right, 0), (size_t)right_cells * cell_size);
+    memcpy(leaf_node_cell(right, 0), leaf_node_cell(left, left_cells - moved), (size_t)moved * cell_size);
+    *leaf_node_num_cells(left) = left_cells - moved;
+    *leaf_node_num_cells(right) = right_cells + moved;
+    left_node->max_key = leaf_node_key(left, left_cells - moved - 1);
+}
+
+static void write_internal_node(Pager* pager, uint32_t page_num, BuiltNode* children, uint32_t num_children,
+                                uint32_t key_size) {
+    uint8_t* node = get_page_for_write(pager, page_num);
+    initialize_internal_node(node, key_size);
+    *internal_node_num_keys(node) = num_children - 1;
+    for (uint32_t i = 0; i + 1 < num_children; i++) {
+        *internal_node_cell(node, i) = children[i].page_num;
+        set_internal_node_key(node, i, children[i].max_key);
+    }
+    *internal_node_right_child_page_num(node) = children[num_children - 1].page_num;
+
+    for (uint32_t i = 0; i < num_children; i++) {
+        *node_parent_page_num(get_page_for_write(pager, children[i].page_num)) = page_num;
+    }
+}
+
+/**
+ *
+ * Groups the nodes of a level under new internal nodes, spread evenly so that none is left
+ * with a single child, until the root can take the whole level. Each level is written over
+ * the one below it in nodes, a group is always written after its children are read.
+ *
+ */
+static void build_internal_levels(Table* table, BuiltNode* nodes, uint32_t num_nodes, uint32_t key_size) {
+    Pager* pager = table->pager;
+    uint32_t fanout = INTERNAL_NODE_MAX_KEYS + 1;
+
+    while (num_nodes > fanout) {
+        uint32_t num_groups = (num_nodes + fanout - 1) / fanout;
+        for (uint32_t group = 0; group < num_groups; group++) {
+            uint32_t begin = (uint32_t)((uint64_t)num_nodes * group / num_groups);
+            uint32_t end = (uint32_t)((uint64_t)num_nodes * (group + 1) / num_groups);
+            uint64_t max_key = nodes[end - 1].max_key;
+            uint32_t page_num = get_unused_page_num(pager);
+            write_internal_node(pager, page_num, nodes + begin, end - begin, key_size);
+            nodes[group].page_num = page_num;
+            nodes[group].max_key = max_key;
+        }
+        num_nodes = num_groups;
+    }
+
+    write_internal_node(pager, table->root_page_num, nodes, num_nodes, key_size);
+    set_node_root(get_page_for_write(pager, table->root_page_num), true);
+}
+
+static void build_table(Table* table, ImportStream* stream, BuiltNode* leaves, ImportStats* stats) {
+    Pager* pager = table->pager;
+    uint32_t key_size = node_key_size(get_page(pager, table->root_page_num));
+
+    uint32_t num_leaves = 0;
+    uint32_t last_page_num = build_leaves(table, stream, leaves, &num_leaves, stats);
+    if (last_page_num == table->root_page_num) {
+        return;
+    }
+
+    leaves[num_leaves].page_num = last_page_num;
+    leaves[num_leaves].max_key = stream->last_key;
+    num_leaves++;
+    balance_last_leaves(pager, &leaves[num_leaves - 2], &leaves[num_leaves - 1]);
+    build_internal_levels(table, leaves, num_leaves, key_size);
+}
+
+static void insert_rows(Table* table, ImportStream* stream, ImportStats* stats) {
+    uint64_t key;
+    uint8_t* value;
+    while (stream_next(stream, &key, &value)) {
+        Cursor* cursor = table_find(table, key);
+        uint8_t* node = get_page(table->pager, cursor->page_num);
+        if (cursor->cell_num < *leaf_node_num_cells(node) && leaf_node_key(node, cursor->cell_num) == key) {
+            stats->duplicate_keys++;
+        } else {
+            Row row;
+            deserialize_row((char*)value, &row);
+            row.id = key;
+            leaf_node_insert(cursor, key, &row);
+            stats->rows_imported++;
+        }
+        free(cursor);
+    }
+}
+
+// Called with the pager lock held
+static bool find_import_table(Table* database, const char* table_name, Table* table, DbError* error) {
+    Pager* pager = database->pager;
+    if (pager->error.code != SIMPLESQLITE_OK) {
+        *error = pager->error;
+        return false;
+    }
+    if (table_name == NULL) {
+        *table = *database;
+        return true;
+    }
+
+    jmp_buf error_handler;
+    if (setjmp(error_handler) != 0) {
+        pager->error_handler = NULL;
+        *error = pager->error;
+        return false;
+    }
+    pager->error_handler = &error_handler;
+    bool found = catalog_find_table(database, table_name, table);
+    pager->error_handler = NULL;
+
+    if (!found) {
+        set_db_error(error, SIMPLESQLITE_NOT_FOUND, "Error: No such table.");
+    }
+    return found;
+}
+
+// Called with the pager lock held, like a statement that inserts every row
+static bool import_sorted_rows(Table* table, ImportStream* stream, ImportStats* stats, DbError* error) {
+    Pager* pager = table->pager;
+    if (pager->error.code != SIMPLESQLITE_OK) {
+        *error = pager->error;
+        return false;
+    }
+
+    BuiltNode* leaves = NULL;
+    jmp_buf error_handler;
+    if (setjmp(error_handler) != 0) {
+        pager->error_handler = NULL;
+        free(leaves);
+        *error = pager->error;
+        return false;
+    }
+    pager->error_handler = &error_handler;
+
+    uint8_t* root = get_page(pager, table->root_page_num);
+    stats->built = get_node_type(root) == NODE_LEAF && *leaf_node_num_cells(root) == 0;
+    if (stats->built) {
+        // Full leaves and the last one, an upper bound since duplicates only come out as they are met
+        leaves = malloc(sizeof(BuiltNode) * (stats->rows_read / leaf_node_max_cells(root) + 1));
+        if (leaves == NULL) {
+            pager->error_handler = NULL;
+            set_db_error(error, SIMPLESQLITE_NO_MEMORY, "Out of memory");
+            return false;
+        }
+        build_table(table, stream, leaves, stats);
+        pager->tree_generation++;
+    } else {
+        insert_rows(table, stream, stats);
+    }
+    stats->duplicate_keys += stream->duplicate_keys;
+
+    pager->error_handler = NULL;
+    free(leaves);
+    if (stream->failed) {
+        set_db_error(error, SIMPLESQLITE_IO_ERROR, "Error: Unable to read back a sorted run.");
+        return false;
+    }
+    return true;
+}
+
+bool import_rows(Table* database, const char* path, const char* table_name, ImportStats* stats, DbError* error) {
+    memset(stats, 0, sizeof(ImportStats));
+    FILE* input = fopen(path, "r");
+    if (input == NULL) {
+        set_db_error(error, SIMPLESQLITE_CANT_OPEN, "Unable to open import file");
+        return false;
+    }
+
+    Pager* pager = database->pager;
+    Table table;
+    pager_lock(pager);
+    bool found = find_import_table(database, table_name, &table, error);
+    pager_unlock(pager);
+    if (!found) {
+        fclose(input);
+        return false;
+    }
+
+    // Read and sorted without the pager lock, statements and the flusher carry on meanwhile
+    ImportChunk chunk;
+    ImportStream stream;
+    memset(&stream, 0, sizeof(ImportStream));
+    bool imported = initialize_chunk(&chunk, database->sort_memory_bytes, error) &&
+                    read_rows(input, table.key_size, &chunk, &stream, stats, error);
+    fclose(input);
+
+    if (imported && stream.num_runs == 0) {
+        sort_chunk(&chunk);
+        stream.chunk = &chunk;
+    } else if (imported) {
+        imported = chunk.num_rows == 0 || spill_chunk(&chunk, &stream, error);
+        free_chunk(&chunk);
+        imported = imported && begin_merge(&stream, error);
+    }
+    stats->sorted_runs = stream.num_runs;
+
+    // The table may have been dropped while the lock was not held, the rows were checked against its key size
+    if (imported) {
+        pager_lock(pager);
+        Table current;
+        imported = find_import_table(database, table_name, &current, error);
+        if (imported && current.key_size != table.key_size) {
+            set_db_error(error, SIMPLESQLITE_NOT_FOUND, "Error: No such table.");
+            imported = false;
+        }
+        if (imported) {
+            imported = import_sorted_rows(&current, &stream, stats, error);
+        }
+        pager_unlock(pager);
+    }
+
+    free_stream(&stream);
+    free_chunk(&chunk);
+    return imported;
+}
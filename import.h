@@ -0,0 +1,13 @@
+#ifndef IMPORT_H
+#define IMPORT_H
+
+#include "table.h"
+#include "db_error.h"
+#include <stdbool.h>
+
+typedef SimpleSqliteImportStats ImportStats;
+
+// table_name NULL imports into the default table
+bool import_rows(Table* database, const char* path, const char* table_name, ImportStats* stats, DbError* error);
+
+#endif
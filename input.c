@@ -16,16 +16,20 @@ InputBuffer* new_input_buffer(void) {
     return input_buffer;
 }
 
-void read_input(InputBuffer* input_buffer) {
-    ssize_t bytes_read = getline(&(input_buffer->buffer), &(input_buffer->buffer_length), stdin);
+// Returns false at the end of the input. A last line without a newline is still read
+bool read_input(InputBuffer* input_buffer, FILE* input) {
+    ssize_t bytes_read = getline(&(input_buffer->buffer), &(input_buffer->buffer_length), input);
 
     if (bytes_read <= 0) {
-        printf("Error reading input\n");
-        exit(EXIT_FAILURE);
+        return false;
     }
 
-    input_buffer->input_length = bytes_read - 1;
-    input_buffer->buffer[bytes_read - 1] = 0;
+    if (input_buffer->buffer[bytes_read - 1] == '\n') {
+        bytes_read--;
+    }
+    input_buffer->input_length = bytes_read;
+    input_buffer->buffer[bytes_read] = 0;
+    return true;
 }
 
 #endif
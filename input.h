@@ -2,6 +2,7 @@
 #define INPUT_H
 
 #include <stdio.h>
+#include <stdbool.h>
 
 typedef struct {
     char* buffer;
@@ -11,6 +12,6 @@ typedef struct {
 
 void print_prompt(void);
 InputBuffer* new_input_buffer(void);
-void read_input(InputBuffer*);
+bool read_input(InputBuffer* input_buffer, FILE* input);
 
 #endif
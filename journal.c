@@ -0,0 +1,145 @@
+#include "journal.h"
+#include "constants.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+
+/**
+ *
+ * Rollback journal
+ *
+ * Before a commit overwrites pages in the database file, their on-disk contents are copied
+ * into "<db>-journal" and synced. A record holds one page-sized block and the byte offset it
+ * came from, since a compressed database keeps its map blocks at arbitrary sectors. The
+ * journal is deleted once the database file is synced, which is the commit point. A journal
+ * found at open time belongs to an interrupted commit, and replaying it puts the database file
+ * back to its state before that commit.
+ *
+ * Header: MAGIC | ORIGINAL FILE LENGTH | CHECKSUM
+ * Record: OFFSET | CHECKSUM | PAGE DATA
+ *
+ */
+
+static const char JOURNAL_MAGIC[8] = "ssqljn2";
+
+static uint32_t journal_checksum(uint32_t seed, const uint8_t* data, uint32_t size) {
+    // FNV-1a
+    uint32_t hash = 2166136261u ^ seed;
+    for (uint32_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static bool journal_write_all(int journal_descriptor, const void* data, size_t size, DbError* error) {
+    ssize_t bytes_written = write(journal_descriptor, data, size);
+    if (bytes_written != (ssize_t)size) {
+        set_db_error(error, SIMPLESQLITE_IO_ERROR, "Error writing journal: %d", errno);
+        return false;
+    }
+    return true;
+}
+
+char* journal_filename_for(const char* db_filename) {
+    const char* suffix = "-journal";
+    char* filename = malloc(strlen(db_filename) + strlen(suffix) + 1);
+    strcpy(filename, db_filename);
+    strcat(filename, suffix);
+    return filename;
+}
+
+int journal_open(const char* journal_filename, uint64_t original_file_length, DbError* error) {
+    int fd = open(journal_filename, O_RDWR | O_CREAT | O_TRUNC, S_IWUSR | S_IRUSR);
+    if (fd == -1) {
+        set_db_error(error, SIMPLESQLITE_IO_ERROR, "Unable to open journal file");
+        return -1;
+    }
+
+    uint32_t checksum = journal_checksum(0, (const uint8_t*)&original_file_length, sizeof(original_file_length));
+    if (!journal_write_all(fd, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC), error) ||
+        !journal_write_all(fd, &original_file_length, sizeof(original_file_length), error) ||
+        !journal_write_all(fd, &checksum, sizeof(checksum), error)) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static uint32_t record_checksum(uint64_t offset, const uint8_t* block) {
+    return journal_checksum((uint32_t)(offset ^ (offset >> 32)), block, PAGE_SIZE);
+}
+
+bool journal_append_block(int journal_descriptor, uint64_t offset, const uint8_t* block, DbError* error) {
+    uint32_t checksum = record_checksum(offset, block);
+    return journal_write_all(journal_descriptor, &offset, sizeof(offset), error) &&
+           journal_write_all(journal_descriptor, &checksum, sizeof(checksum), error) &&
+           journal_write_all(journal_descriptor, block, PAGE_SIZE, error);
+}
+
+bool journal_sync(int journal_descriptor, DbError* error) {
+    if (fsync(journal_descriptor) == -1) {
+        set_db_error(error, SIMPLESQLITE_IO_ERROR, "Error syncing journal: %d", errno);
+        return false;
+    }
+    return true;
+}
+
+bool journal_delete(int journal_descriptor, const char* journal_filename, DbError* error) {
+    close(journal_descriptor);
+    if (unlink(journal_filename) == -1) {
+        set_db_error(error, SIMPLESQLITE_IO_ERROR, "Error deleting journal: %d", errno);
+        return false;
+    }
+    return true;
+}
+
+bool journal_recover(int db_descriptor, const char* journal_filename, DbError* error) {
+    int fd = open(journal_filename, O_RDONLY);
+    if (fd == -1) {
+        return true;
+    }
+
+    char magic[sizeof(JOURNAL_MAGIC)];
+    uint64_t original_file_length;
+    uint32_t checksum;
+    bool valid_header =
+        read(fd, magic, sizeof(magic)) == sizeof(magic) &&
+        read(fd, &original_file_length, sizeof(original_file_length)) == sizeof(original_file_length) &&
+        read(fd, &checksum, sizeof(checksum)) == sizeof(checksum) &&
+        memcmp(magic, JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC)) == 0 &&
+        checksum == journal_checksum(0, (const uint8_t*)&original_file_length, sizeof(original_file_length));
+
+    // A torn header means the commit never reached the database file
+    if (valid_header) {
+        uint8_t* page = malloc(PAGE_SIZE);
+        uint64_t offset;
+
+        // Records past a torn one were never synced, so the database file was not touched yet
+        while (read(fd, &offset, sizeof(offset)) == sizeof(offset) &&
+               read(fd, &checksum, sizeof(checksum)) == sizeof(checksum) &&
+               read(fd, page, PAGE_SIZE) == PAGE_SIZE &&
+               checksum == record_checksum(offset, page)) {
+            if (pwrite(db_descriptor, page, PAGE_SIZE, (off_t)offset) != PAGE_SIZE) {
+                set_db_error(error, SIMPLESQLITE_IO_ERROR, "Error restoring page from journal: %d", errno);
+                free(page);
+                close(fd);
+                return false;
+            }
+        }
+        free(page);
+
+        if (ftruncate(db_descriptor, original_file_length) == -1 || fsync(db_descriptor) == -1) {
+            set_db_error(error, SIMPLESQLITE_IO_ERROR, "Error restoring database from journal: %d", errno);
+            close(fd);
+            return false;
+        }
+    }
+
+    // The journal is only deleted once the database file is back to its state before the commit
+    return journal_delete(fd, journal_filename, error);
+}
@@ -0,0 +1,22 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "db_error.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+char* journal_filename_for(const char* db_filename);
+
+// Returns -1 when the journal could not be created
+int journal_open(const char* journal_filename, uint64_t original_file_length, DbError* error);
+
+// Keeps the page-sized block found at offset, recovery writes it back there
+bool journal_append_block(int journal_descriptor, uint64_t offset, const uint8_t* block, DbError* error);
+
+bool journal_sync(int journal_descriptor, DbError* error);
+
+bool journal_delete(int journal_descriptor, const char* journal_filename, DbError* error);
+
+bool journal_recover(int db_descriptor, const char* journal_filename, DbError* error);
+
+#endif
@@ -1,66 +1,146 @@
+#include "simplesqlite.h"
 #include "input.h"
-#include "table.h"
 #include "meta_command.h"
-#include "statement.h"
-#include "constants.h"
+#include "options.h"
+#include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+// Read and write buffer for scripts, so a load is a few large reads instead of one per line
+#define BATCH_BUFFER_SIZE (1 << 20)
+
+void print_usage(void) {
+    printf("Usage: simpleSQLite [options] <filename>\n");
+    printf("  -f <script>             run the statements in script instead of reading stdin\n");
+    printf("  --interactive           prompt and acknowledge every statement even when input is piped\n");
+    print_config_usage();
+}
+
+void print_result_row(SimpleSqliteStmt* stmt) {
+    putchar('(');
+    for (uint32_t i = 0; i < simplesqlite_column_count(stmt); i++) {
+        if (i > 0) {
+            fputs(", ", stdout);
+        }
+        fputs(simplesqlite_column_text(stmt, i), stdout);
+    }
+    fputs(")\n", stdout);
+}
+
+// Errors in batch mode go to stderr with the script line they came from
+static void report_error(bool batch, uint64_t line_num, const char* format, ...) {
+    FILE* out = batch ? stderr : stdout;
+    if (batch) {
+        fprintf(out, "line %" PRIu64 ": ", line_num);
+    }
+    va_list arguments;
+    va_start(arguments, format);
+    vfprintf(out, format, arguments);
+    va_end(arguments);
+    fputc('\n', out);
+}
 
 int main(int argc, char* argv[]) {
-    if (argc < 2) {
+    SimpleSqliteConfig config;
+    ShellOptions shell;
+    if (!parse_shell_arguments(argc, argv, &config, &shell)) {
+        print_usage();
+        exit(EXIT_FAILURE);
+    }
+
+    if (optind >= argc) {
         printf("Must provide a database filename.\n");
         exit(EXIT_FAILURE);
     }
 
-    char* filename = argv[1];
-    Table* table = db_open(filename);
+    FILE* input = stdin;
+    if (shell.script_path != NULL) {
+        input = fopen(shell.script_path, "r");
+        if (input == NULL) {
+            fprintf(stderr, "Unable to open script '%s'.\n", shell.script_path);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // A script, or anything piped in, runs without prompts or acknowledgements
+    bool batch = !shell.interactive && (shell.script_path != NULL || !isatty(fileno(input)));
+    if (batch) {
+        setvbuf(input, NULL, _IOFBF, BATCH_BUFFER_SIZE);
+        setvbuf(stdout, NULL, _IOFBF, BATCH_BUFFER_SIZE);
+    }
+
+    char* filename = argv[optind];
+    SimpleSqlite* db;
+    if (simplesqlite_open(filename, &config, &db) != SIMPLESQLITE_OK) {
+        printf("%s\n", simplesqlite_errmsg(db));
+        simplesqlite_close(db);
+        exit(EXIT_FAILURE);
+    }
     
     InputBuffer* input_buffer = new_input_buffer();
+    uint64_t line_num = 0;
+    bool failed = false;
+    bool exited = false;
 
     while (true) {
-        print_prompt();
-        read_input(input_buffer);
+        if (!batch) {
+            print_prompt();
+        }
+        if (!read_input(input_buffer, input)) {
+            break;
+        }
+        line_num++;
+        if (batch && input_buffer->input_length == 0) {
+            continue;
+        }
 
         if (input_buffer->buffer[0] == '.') {
-            switch(do_meta_command(input_buffer, table)) {
-                case (META_COMMAND_SUCCESS):
-                    continue;
-                case (META_COMMAND_UNRECOGNIZED_COMMAND):
-                    printf("Unrecognized command '%s'\n", input_buffer->buffer);
-                    continue;
+            MetaCommandResult result = do_meta_command(input_buffer, db);
+            if (result == META_COMMAND_EXIT) {
+                exited = true;
+                break;
+            }
+            if (result == META_COMMAND_FAILED) {
+                report_error(batch, line_num, "%s", simplesqlite_errmsg(db));
+                failed = true;
+            } else if (result == META_COMMAND_UNRECOGNIZED_COMMAND) {
+                report_error(batch, line_num, "Unrecognized command '%s'", input_buffer->buffer);
+                failed = true;
             }
+            continue;
         }
 
-        Statement statement;
-        switch (prepare_statement(input_buffer, &statement)) {
-            case (PREPARE_SUCCESS):
-                break;
-            case (PREPARE_STRING_TOO_LONG):
-                printf("String is too long.\n");
-                continue;
-            case (PREPARE_NEGATIVE_ID):
-                printf("ID must be positive.\n");
-                continue;
-            case (PREPARE_SYNTAX_ERROR):
-                printf("Syntax error. Could not parse statement.\n");
-                continue;
-            case (PREPARE_UNRECOGNIZED_STATEMENT):
-                printf("Unrecognized keyword at start of '%s'.\n", input_buffer->buffer);
-                continue;
+        SimpleSqliteStmt* stmt;
+        if (simplesqlite_prepare(db, input_buffer->buffer, &stmt) != SIMPLESQLITE_OK) {
+            report_error(batch, line_num, "%s", simplesqlite_errmsg(db));
+            failed = true;
+            continue;
         }
 
-        switch (execute_statement(&statement, table)) {
-            case (EXECUTE_SUCCESS):
-                printf("Executed.\n");
-                break;
-            case (EXECUTE_DUPLICATE_KEY):
-                printf("Error: Duplicate key.\n");
-                break;
-            case (EXECUTE_TABLE_FULL):
-                printf("Error: Table full.\n");
-                break;
-            default:
-                break;
+        SimpleSqliteResult result;
+        while ((result = simplesqlite_step(stmt)) == SIMPLESQLITE_ROW) {
+            print_result_row(stmt);
+        }
+        if (result != SIMPLESQLITE_DONE) {
+            report_error(batch, line_num, "%s", simplesqlite_errmsg(db));
+            failed = true;
+        } else if (!batch) {
+            printf("Executed.\n");
         }
+        simplesqlite_finalize(stmt);
+    }
+
+    // The end of the input closes the database the same way .exit does
+    if (!batch && !exited) {
+        printf("\n");
+    }
+    if (simplesqlite_close(db) != SIMPLESQLITE_OK) {
+        fputs("Error closing db file.\n", batch ? stderr : stdout);
+        exit(EXIT_FAILURE);
     }
+    exit(batch && failed ? EXIT_FAILURE : EXIT_SUCCESS);
 }
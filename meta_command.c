@@ -1,22 +1,70 @@
 #include "meta_command.h"
 #include "input.h"
-#include "table.h"
-#include "node.h"
-#include "utils.h"
-#include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
+#include <inttypes.h>
 
-MetaCommandResult do_meta_command(InputBuffer* input_buffer, Table* table) {
+MetaCommandResult do_meta_command(InputBuffer* input_buffer, SimpleSqlite* db) {
     if (strcmp(input_buffer->buffer, ".exit") == 0) {
-        db_close(table);
-        exit(EXIT_SUCCESS);
+        return META_COMMAND_EXIT;
     } else if (strcmp(input_buffer->buffer, ".btree") == 0) {
         printf("Tree:\n");
-        print_tree(table->pager, 0);
+        return simplesqlite_print_tree(db) == SIMPLESQLITE_OK ? META_COMMAND_SUCCESS : META_COMMAND_FAILED;
+    } else if (strcmp(input_buffer->buffer, ".tables") == 0) {
+        return simplesqlite_print_tables(db) == SIMPLESQLITE_OK ? META_COMMAND_SUCCESS : META_COMMAND_FAILED;
+    } else if (strcmp(input_buffer->buffer, ".stats") == 0 || strcmp(input_buffer->buffer, ".stats json") == 0) {
+        simplesqlite_print_stats(db, stdout, strcmp(input_buffer->buffer, ".stats json") == 0);
+        return META_COMMAND_SUCCESS;
+    } else if (strcmp(input_buffer->buffer, ".stats tree") == 0 || strcmp(input_buffer->buffer, ".stats tree json") == 0) {
+        bool json = strcmp(input_buffer->buffer, ".stats tree json") == 0;
+        return simplesqlite_print_tree_shape(db, stdout, json) == SIMPLESQLITE_OK ? META_COMMAND_SUCCESS
+                                                                                   : META_COMMAND_FAILED;
+    } else if (strcmp(input_buffer->buffer, ".stats reset") == 0) {
+        simplesqlite_reset_stats(db);
+        printf("Statistics reset.\n");
+        return META_COMMAND_SUCCESS;
+    } else if (strcmp(input_buffer->buffer, ".verify") == 0) {
+        uint64_t pages_checked;
+        if (simplesqlite_verify(db, &pages_checked) != SIMPLESQLITE_OK) {
+            return META_COMMAND_FAILED;
+        }
+        printf("Verified %" PRIu64 " pages.\n", pages_checked);
+        return META_COMMAND_SUCCESS;
+    } else if (strncmp(input_buffer->buffer, ".backup ", strlen(".backup ")) == 0) {
+        SimpleSqliteBackupStats stats;
+        if (simplesqlite_backup(db, input_buffer->buffer + strlen(".backup "), &stats) != SIMPLESQLITE_OK) {
+            return META_COMMAND_FAILED;
+        }
+        printf("Backed up %" PRIu32 " of %" PRIu32 " pages%s.\n", stats.pages_copied, stats.num_pages,
+               stats.incremental ? ", changed since the last backup" : "");
+        return META_COMMAND_SUCCESS;
+    } else if (strncmp(input_buffer->buffer, ".import ", strlen(".import ")) == 0) {
+        // .import <path> [<table>]
+        char* path = strtok(input_buffer->buffer + strlen(".import "), " ");
+        char* table_name = strtok(NULL, " ");
+        SimpleSqliteImportStats stats;
+        if (path == NULL) {
+            return META_COMMAND_UNRECOGNIZED_COMMAND;
+        }
+        if (simplesqlite_import(db, path, table_name, &stats) != SIMPLESQLITE_OK) {
+            return META_COMMAND_FAILED;
+        }
+        printf("Imported %" PRIu64 " rows", stats.rows_imported);
+        if (stats.duplicate_keys > 0) {
+            printf(", skipped %" PRIu64 " duplicate keys", stats.duplicate_keys);
+        }
+        printf(".\n");
+        return META_COMMAND_SUCCESS;
+    } else if (strcmp(input_buffer->buffer, ".defrag") == 0) {
+        SimpleSqliteDefragStats stats;
+        if (simplesqlite_defrag(db, 0, &stats) != SIMPLESQLITE_OK) {
+            return META_COMMAND_FAILED;
+        }
+        printf("Moved %" PRIu32 " of %" PRIu32 " pages.\n", stats.pages_moved, stats.num_pages);
         return META_COMMAND_SUCCESS;
     } else if (strcmp(input_buffer->buffer, ".constants") == 0) {
         printf("Constants:\n");
-        print_constants();
+        simplesqlite_print_constants();
         return META_COMMAND_SUCCESS;
     } else {
         return META_COMMAND_UNRECOGNIZED_COMMAND;
@@ -2,13 +2,15 @@
 #define META_COMMAND_H
 
 #include "input.h"
-#include "table.h"
+#include "simplesqlite.h"
 
 typedef enum {
     META_COMMAND_SUCCESS,
+    META_COMMAND_FAILED, // simplesqlite_errmsg says why
+    META_COMMAND_EXIT,
     META_COMMAND_UNRECOGNIZED_COMMAND
 } MetaCommandResult;
 
-MetaCommandResult do_meta_command(InputBuffer* input_buffer, Table* table);
+MetaCommandResult do_meta_command(InputBuffer* input_buffer, SimpleSqlite* db);
 
 #endif
@@ -1,21 +1,65 @@
 #include "node.h"
 #include "constants.h"
+#include "hash_index.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 
 #define INVALID_PAGE_NUM UINT32_MAX
 
+// The high bit of the node type byte marks a node whose keys are WIDE_KEY_SIZE bytes
+#define NODE_TYPE_MASK 0x7F
+#define NODE_WIDE_KEYS_FLAG 0x80
+
 NodeType get_node_type(uint8_t* node) {
     uint8_t value = *((uint8_t*)(node + NODE_TYPE_OFFSET));
-    return (NodeType)value;
+    return (NodeType)(value & NODE_TYPE_MASK);
 }
 
 void set_node_type(uint8_t* node, NodeType type) {
+    uint8_t flags = *((uint8_t*)(node + NODE_TYPE_OFFSET)) & NODE_WIDE_KEYS_FLAG;
+    *((uint8_t*)(node + NODE_TYPE_OFFSET)) = flags | (uint8_t)type;
+}
+
+bool has_wide_keys(uint8_t* node) {
+    uint8_t value = *((uint8_t*)(node + NODE_TYPE_OFFSET));
+    return (value & NODE_WIDE_KEYS_FLAG) != 0;
+}
+
+uint32_t node_key_size(uint8_t* node) {
+    return has_wide_keys(node) ? WIDE_KEY_SIZE : NARROW_KEY_SIZE;
+}
+
+static void initialize_node_type(uint8_t* node, NodeType type, uint32_t key_size) {
     uint8_t value = type;
+    if (key_size == WIDE_KEY_SIZE) {
+        value |= NODE_WIDE_KEYS_FLAG;
+    }
     *((uint8_t*)(node + NODE_TYPE_OFFSET)) = value;
 }
 
+// Keys are not aligned inside cells, so they are always copied rather than dereferenced
+static uint64_t read_key(uint8_t* node, uint8_t* source) {
+    if (has_wide_keys(node)) {
+        uint64_t key;
+        memcpy(&key, source, WIDE_KEY_SIZE);
+        return key;
+    }
+
+    uint32_t key;
+    memcpy(&key, source, NARROW_KEY_SIZE);
+    return key;
+}
+
+static void write_key(uint8_t* node, uint8_t* destination, uint64_t key) {
+    if (has_wide_keys(node)) {
+        memcpy(destination, &key, WIDE_KEY_SIZE);
+    } else {
+        uint32_t narrow_key = (uint32_t)key;
+        memcpy(destination, &narrow_key, NARROW_KEY_SIZE);
+    }
+}
+
 bool is_node_root(uint8_t* node) {
     uint8_t value = *((uint8_t*)(node + IS_ROOT_OFFSET));
     return (bool)value;
@@ -38,20 +82,32 @@ uint32_t* leaf_node_next_leaf_page_num(uint8_t* node) {
     return (uint32_t*)(node + LEAF_NODE_NEXT_LEAF_OFFSET);
 }
 
-uint32_t* leaf_node_cell(uint8_t* node, uint32_t cell_num) {
-    return (uint32_t*)(node + LEAF_NODE_HEADER_SIZE + cell_num * LEAF_NODE_CELL_SIZE);
+uint32_t leaf_node_cell_size(uint8_t* node) {
+    return node_key_size(node) + LEAF_NODE_VALUE_SIZE;
 }
 
-uint32_t* leaf_node_key(uint8_t* node, uint32_t cell_num) {
-    return leaf_node_cell(node, cell_num);
+uint32_t leaf_node_max_cells(uint8_t* node) {
+    return LEAF_NODE_SPACE_FOR_CELLS / leaf_node_cell_size(node);
+}
+
+uint8_t* leaf_node_cell(uint8_t* node, uint32_t cell_num) {
+    return node + LEAF_NODE_HEADER_SIZE + cell_num * leaf_node_cell_size(node);
+}
+
+uint64_t leaf_node_key(uint8_t* node, uint32_t cell_num) {
+    return read_key(node, leaf_node_cell(node, cell_num));
+}
+
+void set_leaf_node_key(uint8_t* node, uint32_t cell_num, uint64_t key) {
+    write_key(node, leaf_node_cell(node, cell_num), key);
 }
 
 uint8_t* leaf_node_value(uint8_t* node, uint32_t cell_num) {
-    return (uint8_t*)leaf_node_cell(node, cell_num) + LEAF_NODE_KEY_SIZE;
+    return leaf_node_cell(node, cell_num) + node_key_size(node);
 }
 
-void initialize_leaf_node(uint8_t* node) {
-    set_node_type(node, NODE_LEAF);
+void initialize_leaf_node(uint8_t* node, uint32_t key_size) {
+    initialize_node_type(node, NODE_LEAF, key_size);
     set_node_root(node, false);
     *leaf_node_num_cells(node) = 0;
     *leaf_node_next_leaf_page_num(node) = 0;
@@ -61,79 +117,104 @@ uint32_t get_unused_page_num(Pager* pager) {
     return pager->num_pages; 
 }
 
-ExecuteResult leaf_node_insert(Cursor* cursor, uint32_t key, Row* value) {
-    uint8_t* node = get_page(cursor->table->pager, cursor->page_num);
+ExecuteResult leaf_node_insert(Cursor* cursor, uint64_t key, Row* value) {
+    uint8_t* node = get_page_for_write(cursor->table->pager, cursor->page_num);
 
     uint32_t num_cells = *leaf_node_num_cells(node);
-    if (num_cells >= LEAF_NODE_MAX_CELLS) {
+    if (num_cells >= leaf_node_max_cells(node)) {
         return leaf_node_split_and_insert(cursor, key, value);
     }
 
     if (cursor->cell_num < num_cells) {
         for (uint32_t i = num_cells; i > cursor->cell_num; i--) {
-            memcpy(leaf_node_cell(node, i), leaf_node_cell(node, i - 1), LEAF_NODE_CELL_SIZE);
+            memcpy(leaf_node_cell(node, i), leaf_node_cell(node, i - 1), leaf_node_cell_size(node));
         }
     }
 
     *(leaf_node_num_cells(node)) += 1;
-    *(leaf_node_key(node, cursor->cell_num)) = key;
+    set_leaf_node_key(node, cursor->cell_num, key);
     serialize_row(value, (char*)leaf_node_value(node, cursor->cell_num));
 
     return EXECUTE_SUCCESS;
 }
 
-ExecuteResult leaf_node_split_and_insert(Cursor* cursor, uint32_t key, Row* value) {
-    uint8_t* old_node = get_page(cursor->table->pager, cursor->page_num);
-    uint32_t old_node_max_key = get_node_max_key(cursor->table->pager, old_node);
+// Points the hash index entries of the keys in a leaf at their cells, after a split moved them
+static void patch_hash_index(Table* table, uint32_t page_num) {
+    HashIndex* index = table->pager->hash_index;
+    if (index == NULL) {
+        return;
+    }
+    uint8_t* node = get_page(table->pager, page_num);
+    for (uint32_t i = 0; i < *leaf_node_num_cells(node); i++) {
+        hash_index_patch(index, table->root_page_num, leaf_node_key(node, i), page_num, i);
+    }
+}
+
+ExecuteResult leaf_node_split_and_insert(Cursor* cursor, uint64_t key, Row* value) {
+    uint8_t* old_node = get_page_for_write(cursor->table->pager, cursor->page_num);
+    uint64_t old_node_max_key = get_node_max_key(cursor->table->pager, old_node);
     uint32_t new_page_num = get_unused_page_num(cursor->table->pager);
-    uint8_t* new_node = get_page(cursor->table->pager, new_page_num);
-    initialize_leaf_node(new_node);
+    uint8_t* new_node = get_page_for_write(cursor->table->pager, new_page_num);
+    initialize_leaf_node(new_node, node_key_size(old_node));
+    cursor->table->pager->tree_stats.leaf_splits++;
+    cursor->table->pager->tree_generation++;
     *node_parent_page_num(new_node) = *node_parent_page_num(old_node);
     *leaf_node_next_leaf_page_num(new_node) = *leaf_node_next_leaf_page_num(old_node);
     *leaf_node_next_leaf_page_num(old_node) = new_page_num;
 
-    // Process totally LEAF_NODE_MAX_CELLS + 1 cells
-    for (int32_t i = LEAF_NODE_MAX_CELLS; i >= 0; i--) {
+    // There are max_cells + 1 cells to split between left and right
+    uint32_t max_cells = leaf_node_max_cells(old_node);
+    uint32_t cell_size = leaf_node_cell_size(old_node);
+    uint32_t right_split_count = (max_cells + 1) / 2;
+    uint32_t left_split_count = (max_cells + 1) - right_split_count;
+
+    // Process totally max_cells + 1 cells
+    for (int32_t i = max_cells; i >= 0; i--) {
         uint8_t* destination_node;
-        if (i >= LEAF_NODE_LEFT_SPLIT_COUNT) {
+        if (i >= left_split_count) {
             destination_node = new_node;
         } else {
             destination_node = old_node;
         }
 
-        uint32_t index_within_node = i % LEAF_NODE_LEFT_SPLIT_COUNT;
-        uint32_t* destination = leaf_node_cell(destination_node, index_within_node);
+        uint32_t index_within_node = i % left_split_count;
+        uint8_t* destination = leaf_node_cell(destination_node, index_within_node);
 
         if (i == cursor->cell_num) {
             serialize_row(value, (char*)leaf_node_value(destination_node, index_within_node));
-            *leaf_node_key(destination_node, index_within_node) = key;
+            set_leaf_node_key(destination_node, index_within_node, key);
         } else if (i > cursor->cell_num) {
-            memcpy(destination, leaf_node_cell(old_node, i - 1), LEAF_NODE_CELL_SIZE);
+            memcpy(destination, leaf_node_cell(old_node, i - 1), cell_size);
         } else {
-            memcpy(destination, leaf_node_cell(old_node, i), LEAF_NODE_CELL_SIZE);
+            memcpy(destination, leaf_node_cell(old_node, i), cell_size);
         }
     }
 
-    *(leaf_node_num_cells(old_node)) = LEAF_NODE_LEFT_SPLIT_COUNT;
-    *(leaf_node_num_cells(new_node)) = LEAF_NODE_RIGHT_SPLIT_COUNT;
+    *(leaf_node_num_cells(old_node)) = left_split_count;
+    *(leaf_node_num_cells(new_node)) = right_split_count;
 
+    uint32_t old_page_num = cursor->page_num;
     if (is_node_root(old_node)) {
         create_new_root(cursor->table, new_page_num);
-        return EXECUTE_SUCCESS;
+        // The root keeps its page number, its cells moved on to a new left child
+        old_page_num = *internal_node_child_page_num(get_page(cursor->table->pager, cursor->table->root_page_num), 0);
     } else {
         uint32_t parent_page_num = *node_parent_page_num(old_node);
-        uint8_t* parent_node = get_page(cursor->table->pager, parent_page_num);
-        uint32_t old_node_max_key_new = get_node_max_key(cursor->table->pager, old_node);
+        uint8_t* parent_node = get_page_for_write(cursor->table->pager, parent_page_num);
+        uint64_t old_node_max_key_new = get_node_max_key(cursor->table->pager, old_node);
         update_internal_node_key(parent_node, old_node_max_key, old_node_max_key_new);
         internal_node_insert(cursor->table, parent_page_num, new_page_num);
-        return EXECUTE_SUCCESS;
     }
+
+    patch_hash_index(cursor->table, old_page_num);
+    patch_hash_index(cursor->table, new_page_num);
+    return EXECUTE_SUCCESS;
 }
 
 void internal_node_insert(Table* table, uint32_t parent_page_num, uint32_t child_page_num) {
-    uint8_t* parent = get_page(table->pager, parent_page_num);
+    uint8_t* parent = get_page_for_write(table->pager, parent_page_num);
     uint8_t* child = get_page(table->pager, child_page_num);
-    uint32_t child_max_key = get_node_max_key(table->pager, child);
+    uint64_t child_max_key = get_node_max_key(table->pager, child);
     uint32_t index = internal_node_find_child(parent, child_max_key);
 
     uint32_t parent_original_num_keys = *internal_node_num_keys(parent);
@@ -154,49 +235,51 @@ void internal_node_insert(Table* table, uint32_t parent_page_num, uint32_t child
 
     if (child_max_key > get_node_max_key(table->pager, right_child)) {
         *internal_node_child_page_num(parent, parent_original_num_keys) = right_child_page_num;
-        *internal_node_key(parent, parent_original_num_keys) = get_node_max_key(table->pager, right_child);
+        set_internal_node_key(parent, parent_original_num_keys, get_node_max_key(table->pager, right_child));
         *internal_node_right_child_page_num(parent) = child_page_num;
     } else {
         for (uint32_t i = parent_original_num_keys; i > index; i--) {
             uint32_t* destination = internal_node_cell(parent, i);
             uint32_t* source = internal_node_cell(parent, i - 1);
-            memcpy(destination, source, INTERNAL_NODE_CELL_SIZE);
+            memcpy(destination, source, internal_node_cell_size(parent));
         }
         *internal_node_child_page_num(parent, index) = child_page_num;
-        *internal_node_key(parent, index) = child_max_key;
+        set_internal_node_key(parent, index, child_max_key);
     }
 }
 
 void internal_node_split_and_insert(Table* table, uint32_t parent_page_num, uint32_t child_page_num) {
     // old_node is the node that we will split
     uint32_t old_page_num = parent_page_num;
-    uint8_t* old_node = get_page(table->pager, parent_page_num);
-    uint32_t old_node_max_key = get_node_max_key(table->pager, old_node);
+    uint8_t* old_node = get_page_for_write(table->pager, parent_page_num);
+    uint64_t old_node_max_key = get_node_max_key(table->pager, old_node);
 
-    uint8_t* child = get_page(table->pager, child_page_num); 
-    uint32_t child_max_key = get_node_max_key(table->pager, child);
+    uint8_t* child = get_page_for_write(table->pager, child_page_num); 
+    uint64_t child_max_key = get_node_max_key(table->pager, child);
 
     uint32_t new_page_num = get_unused_page_num(table->pager);
 
     bool splitting_root = is_node_root(old_node);
+    table->pager->tree_stats.internal_splits++;
+    table->pager->tree_generation++;
 
     uint8_t* parent;
     uint8_t* new_node;
     if (splitting_root) {
         create_new_root(table, new_page_num);
-        parent = get_page(table->pager, table->root_page_num);
+        parent = get_page_for_write(table->pager, table->root_page_num);
         old_page_num = *internal_node_child_page_num(parent, 0);
-        old_node = get_page(table->pager, old_page_num);
+        old_node = get_page_for_write(table->pager, old_page_num);
     } else {
-        parent = get_page(table->pager, *node_parent_page_num(old_node));
-        new_node = get_page(table->pager, new_page_num);
-        initialize_internal_node(new_node);
+        parent = get_page_for_write(table->pager, *node_parent_page_num(old_node));
+        new_node = get_page_for_write(table->pager, new_page_num);
+        initialize_internal_node(new_node, node_key_size(old_node));
     }
     
     uint32_t* old_node_num_keys = internal_node_num_keys(old_node);
 
     uint32_t cur_page_num = *internal_node_right_child_page_num(old_node);
-    uint8_t* cur_node = get_page(table->pager, cur_page_num);
+    uint8_t* cur_node = get_page_for_write(table->pager, cur_page_num);
 
     internal_node_insert(table, new_page_num, cur_page_num);
     *node_parent_page_num(cur_node) = new_page_num;
@@ -204,7 +287,7 @@ void internal_node_split_and_insert(Table* table, uint32_t parent_page_num, uint
 
     for (int i = INTERNAL_NODE_MAX_KEYS - 1; i > INTERNAL_NODE_MAX_KEYS / 2; i--) {
         cur_page_num = *internal_node_child_page_num(old_node, i);
-        cur_node = get_page(table->pager, cur_page_num);
+        cur_node = get_page_for_write(table->pager, cur_page_num);
 
         internal_node_insert(table, new_page_num, cur_page_num);
         *node_parent_page_num(cur_node) = new_page_num;
@@ -215,7 +298,7 @@ void internal_node_split_and_insert(Table* table, uint32_t parent_page_num, uint
     *internal_node_right_child_page_num(old_node) = *internal_node_child_page_num(old_node, *old_node_num_keys - 1);
     (*old_node_num_keys)--;
 
-    uint32_t max_after_split = get_node_max_key(table->pager, old_node);
+    uint64_t max_after_split = get_node_max_key(table->pager, old_node);
 
     uint32_t destination_page_num = child_max_key < max_after_split ? old_page_num : new_page_num;
 
@@ -225,8 +308,9 @@ void internal_node_split_and_insert(Table* table, uint32_t parent_page_num, uint
     update_internal_node_key(parent, old_node_max_key, get_node_max_key(table->pager, old_node));
 
     if (!splitting_root) {
-        internal_node_insert(table, *node_parent_page_num(old_node), new_page_num);
+        // Set before the insert, which moves new_node to another parent when the parent splits too
         *node_parent_page_num(new_node) = *node_parent_page_num(old_node);
+        internal_node_insert(table, *node_parent_page_num(old_node), new_page_num);
     }
 }
 
@@ -238,8 +322,12 @@ uint32_t* internal_node_right_child_page_num(uint8_t* node) {
     return (uint32_t*)(node + INTERNAL_NODE_RIGHT_CHILD_OFFSET);
 }
 
+uint32_t internal_node_cell_size(uint8_t* node) {
+    return INTERNAL_NODE_CHILD_SIZE + node_key_size(node);
+}
+
 uint32_t* internal_node_cell(uint8_t* node, uint32_t cell_num) {
-    return (uint32_t*)(node + INTERNAL_NODE_HEADER_SIZE + cell_num * INTERNAL_NODE_CELL_SIZE);
+    return (uint32_t*)(node + INTERNAL_NODE_HEADER_SIZE + cell_num * internal_node_cell_size(node));
 }
 
 uint32_t* internal_node_child_page_num(uint8_t* node, uint32_t child_num) {
@@ -265,20 +353,24 @@ uint32_t* internal_node_child_page_num(uint8_t* node, uint32_t child_num) {
     }
 }
 
-uint32_t* internal_node_key(uint8_t* node, uint32_t key_num) {
-    return (uint32_t*)((uint8_t*)internal_node_cell(node, key_num) + INTERNAL_NODE_KEY_OFFSET);
+uint64_t internal_node_key(uint8_t* node, uint32_t key_num) {
+    return read_key(node, (uint8_t*)internal_node_cell(node, key_num) + INTERNAL_NODE_KEY_OFFSET);
 }
 
-void initialize_internal_node(uint8_t* node) {
-    set_node_type(node, NODE_INTERNAL);
+void set_internal_node_key(uint8_t* node, uint32_t key_num, uint64_t key) {
+    write_key(node, (uint8_t*)internal_node_cell(node, key_num) + INTERNAL_NODE_KEY_OFFSET, key);
+}
+
+void initialize_internal_node(uint8_t* node, uint32_t key_size) {
+    initialize_node_type(node, NODE_INTERNAL, key_size);
     set_node_root(node, false);
     *internal_node_num_keys(node) = 0;
     *internal_node_right_child_page_num(node) = INVALID_PAGE_NUM;
 }
 
-void update_internal_node_key(uint8_t* node, uint32_t old_key, uint32_t new_key) {
+void update_internal_node_key(uint8_t* node, uint64_t old_key, uint64_t new_key) {
     uint32_t old_child_index = internal_node_find_child(node, old_key);
-    *internal_node_key(node, old_child_index) = new_key;
+    set_internal_node_key(node, old_child_index, new_key);
 }
 
 /**
@@ -288,7 +380,7 @@ void update_internal_node_key(uint8_t* node, uint32_t old_key, uint32_t new_key)
  * For each key, there is a child left to it which has keys less than or equal to this key,
  * 
  */
-uint32_t internal_node_find_child(uint8_t* node, uint32_t key) {
+uint32_t internal_node_find_child(uint8_t* node, uint64_t key) {
     uint32_t num_keys = *internal_node_num_keys(node);
 
     uint32_t l_index = 0;
@@ -296,7 +388,7 @@ uint32_t internal_node_find_child(uint8_t* node, uint32_t key) {
 
     while (l_index < r_index) {
         uint32_t index = l_index + (r_index - l_index) / 2;
-        uint32_t key_to_right = *internal_node_key(node, index);
+        uint64_t key_to_right = internal_node_key(node, index);
         if (key_to_right < key) {
             l_index = index + 1;
         } else {
@@ -307,9 +399,9 @@ uint32_t internal_node_find_child(uint8_t* node, uint32_t key) {
     return l_index;
 }
 
-uint32_t get_node_max_key(Pager* pager, uint8_t* node) {
+uint64_t get_node_max_key(Pager* pager, uint8_t* node) {
     if (get_node_type(node) == NODE_LEAF) {
-        return *leaf_node_key(node, *leaf_node_num_cells(node) - 1);
+        return leaf_node_key(node, *leaf_node_num_cells(node) - 1);
     }
 
     uint8_t* right_child = get_page(pager, *internal_node_right_child_page_num(node));
@@ -317,16 +409,20 @@ uint32_t get_node_max_key(Pager* pager, uint8_t* node) {
 }
 
 void create_new_root(Table* table, uint32_t right_child_page_num) {
-    uint8_t* root = get_page(table->pager, table->root_page_num);
-    uint8_t* right_child = get_page(table->pager, right_child_page_num);
+    uint8_t* root = get_page_for_write(table->pager, table->root_page_num);
+    uint8_t* right_child = get_page_for_write(table->pager, right_child_page_num);
 
     // Will move the old root to the left child
     uint32_t left_child_page_num = get_unused_page_num(table->pager);
-    uint8_t* left_child = get_page(table->pager, left_child_page_num);
+    uint8_t* left_child = get_page_for_write(table->pager, left_child_page_num);
+    table->pager->tree_stats.root_splits++;
+    table->pager->tree_generation++;
+
+    uint32_t key_size = node_key_size(root);
 
     if (get_node_type(root) == NODE_INTERNAL) {
-        initialize_internal_node(right_child);
-        initialize_internal_node(left_child);
+        initialize_internal_node(right_child, key_size);
+        initialize_internal_node(left_child, key_size);
     }
 
     memcpy(left_child, root, PAGE_SIZE);
@@ -336,19 +432,19 @@ void create_new_root(Table* table, uint32_t right_child_page_num) {
     if (get_node_type(left_child) == NODE_INTERNAL) {
         uint8_t* child;
         for (int i = 0; i < *internal_node_num_keys(left_child); i++) {
-            child = get_page(table->pager, *internal_node_child_page_num(left_child, i));
+            child = get_page_for_write(table->pager, *internal_node_child_page_num(left_child, i));
             *node_parent_page_num(child) = left_child_page_num;
         }
-        child = get_page(table->pager, *internal_node_right_child_page_num(left_child));
+        child = get_page_for_write(table->pager, *internal_node_right_child_page_num(left_child));
         *node_parent_page_num(child) = left_child_page_num;
     }
 
-    initialize_internal_node(root);
+    initialize_internal_node(root, key_size);
     set_node_root(root, true);
     *internal_node_num_keys(root) = 1;
     *internal_node_child_page_num(root, 0) = left_child_page_num;
-    uint32_t left_child_max_key = get_node_max_key(table->pager, left_child);
-    *internal_node_key(root, 0) = left_child_max_key;
+    uint64_t left_child_max_key = get_node_max_key(table->pager, left_child);
+    set_internal_node_key(root, 0, left_child_max_key);
     *internal_node_right_child_page_num(root) = right_child_page_num;
     *node_parent_page_num(left_child) = table->root_page_num;
     *node_parent_page_num(right_child) = table->root_page_num;
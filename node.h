@@ -14,6 +14,10 @@ typedef enum {
 
 NodeType get_node_type(uint8_t* node);
 
+bool has_wide_keys(uint8_t* node);
+
+uint32_t node_key_size(uint8_t* node);
+
 void set_node_type(uint8_t* node, NodeType type);
 
 bool is_node_root(uint8_t* node);
@@ -26,19 +30,25 @@ uint32_t* leaf_node_num_cells(uint8_t* node);
 
 uint32_t* leaf_node_next_leaf_page_num(uint8_t* node);
 
-uint32_t* leaf_node_cell(uint8_t* node, uint32_t cell_num);
+uint8_t* leaf_node_cell(uint8_t* node, uint32_t cell_num);
+
+uint32_t leaf_node_cell_size(uint8_t* node);
+
+uint32_t leaf_node_max_cells(uint8_t* node);
 
-uint32_t* leaf_node_key(uint8_t* node, uint32_t cell_num);
+uint64_t leaf_node_key(uint8_t* node, uint32_t cell_num);
+
+void set_leaf_node_key(uint8_t* node, uint32_t cell_num, uint64_t key);
 
 uint8_t* leaf_node_value(uint8_t* node, uint32_t cell_num);
 
-void initialize_leaf_node(uint8_t* node);
+void initialize_leaf_node(uint8_t* node, uint32_t key_size);
 
 uint32_t get_unused_page_num(Pager* pager);
 
-ExecuteResult leaf_node_insert(Cursor* cursor, uint32_t key, Row* value);
+ExecuteResult leaf_node_insert(Cursor* cursor, uint64_t key, Row* value);
 
-ExecuteResult leaf_node_split_and_insert(Cursor* cursor, uint32_t key, Row* value);
+ExecuteResult leaf_node_split_and_insert(Cursor* cursor, uint64_t key, Row* value);
 
 void internal_node_insert(Table* table, uint32_t parent_page_num, uint32_t child_page_num);
 
@@ -48,19 +58,23 @@ uint32_t* internal_node_num_keys(uint8_t* node);
 
 uint32_t* internal_node_right_child_page_num(uint8_t* node);
 
+uint32_t internal_node_cell_size(uint8_t* node);
+
 uint32_t* internal_node_cell(uint8_t* node, uint32_t cell_num);
 
 uint32_t* internal_node_child_page_num(uint8_t* node, uint32_t child_num);
 
-uint32_t* internal_node_key(uint8_t* node, uint32_t key_num);
+uint64_t internal_node_key(uint8_t* node, uint32_t key_num);
+
+void set_internal_node_key(uint8_t* node, uint32_t key_num, uint64_t key);
 
-void initialize_internal_node(uint8_t* node);
+void initialize_internal_node(uint8_t* node, uint32_t key_size);
 
-void update_internal_node_key(uint8_t* node, uint32_t old_key, uint32_t new_key);
+void update_internal_node_key(uint8_t* node, uint64_t old_key, uint64_t new_key);
 
-uint32_t internal_node_find_child(uint8_t* node, uint32_t key);
+uint32_t internal_node_find_child(uint8_t* node, uint64_t key);
 
-uint32_t get_node_max_key(Pager* pager, uint8_t* node);
+uint64_t get_node_max_key(Pager* pager, uint8_t* node);
 
 void create_new_root(Table* table, uint32_t right_child_page_num);
 
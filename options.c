@@ -0,0 +1,122 @@
+#include "options.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+void print_config_usage(void) {
+    printf("  -k 32|64                key width in bits for a new database (default 32)\n");
+    printf("  --flush-pages <n>       background flush once n pages are dirty, 0 disables it (default 64)\n");
+    printf("  --flush-age-ms <ms>     background flush once a dirty page is this old (default 1000)\n");
+    printf("  --flush-rate <pages/s>  upper bound on background writes, 0 is unlimited (default 0)\n");
+    printf("  --sort-memory-kb <kb>   memory for order by before spilling to disk (default 16384)\n");
+    printf("  --stats-json <path>     write statistics to path as JSON on exit\n");
+    printf("  --compress              compress the pages of a new database on disk\n");
+    printf("  --hash-index-kb <kb>    memory for the adaptive hash index over hot keys, 0 disables it (default 0)\n");
+    printf("  --capture <path>        append every statement executed to path as a binary trace\n");
+    printf("  --page-trace <path>     record every page fetched to path, see simpleSQLitePageReport\n");
+}
+
+static bool parse_uint32(const char* text, uint32_t* value) {
+    char* end;
+    unsigned long parsed = strtoul(text, &end, 10);
+    if (text[0] == '\0' || text[0] == '-' || *end != '\0' || parsed > UINT32_MAX) {
+        return false;
+    }
+    *value = (uint32_t)parsed;
+    return true;
+}
+
+/**
+ *
+ * Fills in the config, and the shell options when shell is not NULL, from the options in argv
+ * and leaves optind on the first positional argument. Returns false on an unknown option or a
+ * bad value.
+ *
+ */
+static bool parse_arguments(int argc, char* argv[], SimpleSqliteConfig* config, ShellOptions* shell) {
+    static struct option long_options[] = {
+        {"flush-pages", required_argument, NULL, 'p'},
+        {"flush-age-ms", required_argument, NULL, 'a'},
+        {"flush-rate", required_argument, NULL, 'r'},
+        {"sort-memory-kb", required_argument, NULL, 's'},
+        {"stats-json", required_argument, NULL, 'j'},
+        {"compress", no_argument, NULL, 'z'},
+        {"capture", required_argument, NULL, 'c'},
+        {"page-trace", required_argument, NULL, 't'},
+        {"hash-index-kb", required_argument, NULL, 'h'},
+        {"interactive", no_argument, NULL, 'i'},
+        {NULL, 0, NULL, 0}
+    };
+
+    simplesqlite_config_init(config);
+    if (shell != NULL) {
+        shell->script_path = NULL;
+        shell->interactive = false;
+    }
+
+    int option;
+    while ((option = getopt_long(argc, argv, shell != NULL ? "k:f:" : "k:", long_options, NULL)) != -1) {
+        switch (option) {
+            case 'k':
+                if (strcmp(optarg, "32") == 0) {
+                    config->key_size = sizeof(uint32_t);
+                } else if (strcmp(optarg, "64") == 0) {
+                    config->key_size = sizeof(uint64_t);
+                } else {
+                    return false;
+                }
+                break;
+            case 'p':
+            case 'a':
+            case 'r':
+            case 's':
+            case 'h': {
+                uint32_t* value = option == 'p' ? &config->flush_dirty_pages
+                    : option == 'a' ? &config->flush_max_age_ms
+                    : option == 'r' ? &config->flush_pages_per_second
+                    : option == 's' ? &config->sort_memory_kb
+                    : &config->hash_index_kb;
+                if (!parse_uint32(optarg, value)) {
+                    return false;
+                }
+                break;
+            }
+            case 'j':
+                config->stats_json_path = optarg;
+                break;
+            case 'z':
+                config->compress = true;
+                break;
+            case 'c':
+                config->capture_path = optarg;
+                break;
+            case 't':
+                config->page_trace_path = optarg;
+                break;
+            case 'f':
+            case 'i':
+                if (shell == NULL) {
+                    return false;
+                }
+                if (option == 'f') {
+                    shell->script_path = optarg;
+                } else {
+                    shell->interactive = true;
+                }
+                break;
+            default:
+                return false;
+        }
+    }
+
+    return true;
+}
+
+bool parse_config_arguments(int argc, char* argv[], SimpleSqliteConfig* config) {
+    return parse_arguments(argc, argv, config, NULL);
+}
+
+bool parse_shell_arguments(int argc, char* argv[], SimpleSqliteConfig* config, ShellOptions* shell) {
+    return parse_arguments(argc, argv, config, shell);
+}
@@ -0,0 +1,18 @@
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+#include "simplesqlite.h"
+#include <stdbool.h>
+
+// Options only the shell takes
+typedef struct {
+    const char* script_path; // Statements are read from here instead of stdin, NULL for stdin
+    bool interactive; // Prompt and acknowledge every statement even when the input is not a terminal
+} ShellOptions;
+
+// Database options shared by the shell and the server
+void print_config_usage(void);
+bool parse_config_arguments(int argc, char* argv[], SimpleSqliteConfig* config);
+bool parse_shell_arguments(int argc, char* argv[], SimpleSqliteConfig* config, ShellOptions* shell);
+
+#endif
@@ -0,0 +1,496 @@
+#include "page_map.h"
+#include "compress.h"
+#include "checksum.h"
+#include "journal.h"
+#include "constants.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+/**
+ *
+ * Page map
+ *
+ * A compressed database stores each page in as few 512-byte sectors as its compressed form
+ * needs, so pages no longer sit at page_num * PAGE_SIZE. The file is laid out as:
+ *
+ *   HEADER PAGE | MAP DIRECTORY | MAP BLOCKS AND COMPRESSED PAGES, IN ANY ORDER
+ *
+ * The header page is stored as is, so it can be read before the map is. The directory holds
+ * the sector of every map block, and a map block holds the sector and length of 511 pages.
+ * Both are page-sized and carry a checksum like a page does.
+ *
+ * A page that is written again always moves to free space, and the sectors it used are only
+ * freed once the batch is durable. So only the header, the directory and the map blocks are
+ * overwritten in place, and they are what the journal saves. Rolling back a batch restores
+ * them and truncates whatever was appended, which leaves the old map pointing at old pages
+ * that were never touched.
+ *
+ */
+
+static uint32_t sectors_for(uint32_t length) {
+    return (length + SECTOR_SIZE - 1) / SECTOR_SIZE;
+}
+
+static off_t sector_offset(uint32_t sector) {
+    return (off_t)sector * SECTOR_SIZE;
+}
+
+// NULL when out of memory
+PageMap* page_map_create(void) {
+    PageMap* map = malloc(sizeof(PageMap));
+    if (map == NULL) {
+        return NULL;
+    }
+    map->locations = NULL;
+    map->locations_capacity = 0;
+    map->num_pages = 1; // The header page is always there, outside the map
+    memset(map->directory, 0, sizeof(map->directory));
+    map->free_extents = NULL;
+    map->num_free_extents = 0;
+    map->free_extents_capacity = 0;
+    map->end_sector = PAGE_MAP_FIRST_DATA_SECTOR;
+    return map;
+}
+
+void page_map_free(PageMap* map) {
+    if (map == NULL) {
+        return;
+    }
+    free(map->locations);
+    free(map->free_extents);
+    free(map);
+}
+
+uint64_t page_map_file_length(const PageMap* map) {
+    return map->end_sector * SECTOR_SIZE;
+}
+
+static bool reserve_locations(PageMap* map, uint32_t num_locations) {
+    if (num_locations <= map->locations_capacity) {
+        return true;
+    }
+
+    uint32_t new_capacity = map->locations_capacity == 0 ? PAGE_MAP_ENTRIES_PER_BLOCK : map->locations_capacity;
+    while (new_capacity < num_locations) {
+        new_capacity *= 2;
+    }
+    PageLocation* locations = realloc(map->locations, sizeof(PageLocation) * new_capacity);
+    if (locations == NULL) {
+        return false;
+    }
+    map->locations = locations;
+    memset(map->locations + map->locations_capacity, 0, sizeof(PageLocation) * (new_capacity - map->locations_capacity));
+    map->locations_capacity = new_capacity;
+    return true;
+}
+
+PageLocation page_map_location(const PageMap* map, uint32_t page_num) {
+    PageLocation location = {0, 0, 0};
+    if (page_num == DB_HEADER_PAGE_NUM) {
+        location.length = PAGE_SIZE;
+    } else if (page_num < map->locations_capacity) {
+        location = map->locations[page_num];
+    }
+    return location;
+}
+
+/**
+ *
+ * Reads a page from where the map says it is and expands it. Returns the bytes read from the
+ * file, or -1 with errno set when the read failed. A page that is missing or does not decode
+ * comes back as zeros, which its checksum then rejects.
+ *
+ */
+ssize_t read_mapped_page(int file_descriptor, PageLocation location, uint8_t* page) {
+    if (location.length == 0) {
+        memset(page, 0, PAGE_SIZE);
+        return 0;
+    }
+    if (location.length == PAGE_SIZE) {
+        return pread(file_descriptor, page, PAGE_SIZE, sector_offset(location.sector));
+    }
+
+    uint8_t compressed[PAGE_SIZE];
+    ssize_t bytes_read = pread(file_descriptor, compressed, location.length, sector_offset(location.sector));
+    if (bytes_read == -1) {
+        return -1;
+    }
+    if (bytes_read != location.length || !decompress_page(compressed, location.length, page, PAGE_SIZE)) {
+        memset(page, 0, PAGE_SIZE);
+    }
+    return bytes_read;
+}
+
+// Inserts the extent in sector order and merges it with its neighbours, false leaves the map as it was
+static bool release_extent(PageMap* map, Extent extent) {
+    uint32_t index = 0;
+    while (index < map->num_free_extents && map->free_extents[index].sector < extent.sector) {
+        index++;
+    }
+
+    bool joins_previous = index > 0 &&
+        map->free_extents[index - 1].sector + map->free_extents[index - 1].num_sectors == extent.sector;
+    bool joins_next = index < map->num_free_extents &&
+        extent.sector + extent.num_sectors == map->free_extents[index].sector;
+
+    if (joins_previous && joins_next) {
+        map->free_extents[index - 1].num_sectors += extent.num_sectors + map->free_extents[index].num_sectors;
+        memmove(&map->free_extents[index], &map->free_extents[index + 1],
+                sizeof(Extent) * (map->num_free_extents - index - 1));
+        map->num_free_extents--;
+    } else if (joins_previous) {
+        map->free_extents[index - 1].num_sectors += extent.num_sectors;
+    } else if (joins_next) {
+        map->free_extents[index].sector = extent.sector;
+        map->free_extents[index].num_sectors += extent.num_sectors;
+    } else {
+        if (map->num_free_extents == map->free_extents_capacity) {
+            uint32_t new_capacity = map->free_extents_capacity == 0 ? 64 : map->free_extents_capacity * 2;
+            Extent* free_extents = realloc(map->free_extents, sizeof(Extent) * new_capacity);
+            if (free_extents == NULL) {
+                return false;
+            }
+            map->free_extents = free_extents;
+            map->free_extents_capacity = new_capacity;
+        }
+        memmove(&map->free_extents[index + 1], &map->free_extents[index],
+                sizeof(Extent) * (map->num_free_extents - index));
+        map->free_extents[index] = extent;
+        map->num_free_extents++;
+    }
+    return true;
+}
+
+// First fit among the gaps, otherwise the file grows
+static uint32_t allocate_sectors(PageMap* map, uint32_t num_sectors) {
+    for (uint32_t i = 0; i < map->num_free_extents; i++) {
+        Extent* extent = &map->free_extents[i];
+        if (extent->num_sectors < num_sectors) {
+            continue;
+        }
+
+        uint32_t sector = extent->sector;
+        extent->sector += num_sectors;
+        extent->num_sectors -= num_sectors;
+        if (extent->num_sectors == 0) {
+            memmove(extent, extent + 1, sizeof(Extent) * (map->num_free_extents - i - 1));
+            map->num_free_extents--;
+        }
+        return sector;
+    }
+
+    uint32_t sector = (uint32_t)map->end_sector;
+    map->end_sector += num_sectors;
+    return sector;
+}
+
+static bool read_map_block(int file_descriptor, uint32_t sector, uint8_t* block, DbError* error) {
+    ssize_t bytes_read = pread(file_descriptor, block, PAGE_SIZE, sector_offset(sector));
+    if (bytes_read == -1) {
+        set_db_error(error, SIMPLESQLITE_IO_ERROR, "Error reading file: %d", errno);
+        return false;
+    }
+    if (bytes_read != PAGE_SIZE || !page_checksum_matches(sector, block)) {
+        set_db_error(error, SIMPLESQLITE_CORRUPT, "Checksum mismatch on page map block at sector %" PRIu32 ".", sector);
+        return false;
+    }
+    return true;
+}
+
+static int compare_extents(const void* left, const void* right) {
+    uint32_t left_sector = ((const Extent*)left)->sector;
+    uint32_t right_sector = ((const Extent*)right)->sector;
+    return left_sector < right_sector ? -1 : left_sector > right_sector;
+}
+
+// Every sector past the directory that no map block and no page uses is free
+static bool rebuild_free_extents(PageMap* map, DbError* error) {
+    uint32_t num_used = 0;
+    Extent* used = malloc(sizeof(Extent) * ((size_t)map->num_pages + PAGE_MAP_DIRECTORY_ENTRIES));
+    if (used == NULL) {
+        set_db_error(error, SIMPLESQLITE_NO_MEMORY, "Out of memory");
+        return false;
+    }
+    for (uint32_t i = 0; i < PAGE_MAP_DIRECTORY_ENTRIES; i++) {
+        if (map->directory[i] != 0) {
+            used[num_used++] = (Extent){map->directory[i], sectors_for(PAGE_SIZE)};
+        }
+    }
+    for (uint32_t i = 0; i < map->num_pages && i < map->locations_capacity; i++) {
+        if (map->locations[i].sector != 0) {
+            used[num_used++] = (Extent){map->locations[i].sector, sectors_for(map->locations[i].length)};
+        }
+    }
+    qsort(used, num_used, sizeof(Extent), compare_extents);
+
+    uint64_t next_sector = PAGE_MAP_FIRST_DATA_SECTOR;
+    bool released = true;
+    for (uint32_t i = 0; released && i < num_used; i++) {
+        if (used[i].sector < next_sector || (uint64_t)used[i].sector + used[i].num_sectors > map->end_sector) {
+            free(used);
+            set_db_error(error, SIMPLESQLITE_CORRUPT, "Page map points outside the file or at overlapping pages.");
+            return false;
+        }
+        if (used[i].sector > next_sector) {
+            released = release_extent(map, (Extent){(uint32_t)next_sector, (uint32_t)(used[i].sector - next_sector)});
+        }
+        next_sector = (uint64_t)used[i].sector + used[i].num_sectors;
+    }
+    if (released && next_sector < map->end_sector) {
+        released = release_extent(map, (Extent){(uint32_t)next_sector, (uint32_t)(map->end_sector - next_sector)});
+    }
+
+    free(used);
+    if (!released) {
+        set_db_error(error, SIMPLESQLITE_NO_MEMORY, "Out of memory");
+    }
+    return released;
+}
+
+PageMap* page_map_load(int file_descriptor, uint64_t file_length, DbError* error) {
+    PageMap* map = page_map_create();
+    if (map == NULL) {
+        set_db_error(error, SIMPLESQLITE_NO_MEMORY, "Out of memory");
+        return NULL;
+    }
+    if (file_length % SECTOR_SIZE != 0 || file_length / SECTOR_SIZE > UINT32_MAX) {
+        set_db_error(error, SIMPLESQLITE_CORRUPT, "Compressed DB file is not a whole number of sectors. Corrupt file.");
+        page_map_free(map);
+        return NULL;
+    }
+
+    // Nothing past the header was written yet
+    if (file_length <= (uint64_t)PAGE_MAP_DIRECTORY_SECTOR * SECTOR_SIZE) {
+        return map;
+    }
+    map->end_sector = file_length / SECTOR_SIZE;
+
+    uint8_t* block = malloc(PAGE_SIZE);
+    if (block == NULL) {
+        set_db_error(error, SIMPLESQLITE_NO_MEMORY, "Out of memory");
+        page_map_free(map);
+        return NULL;
+    }
+    bool loaded = read_map_block(file_descriptor, PAGE_MAP_DIRECTORY_SECTOR, block, error);
+    if (loaded) {
+        memcpy(map->directory, block, sizeof(map->directory));
+    }
+
+    for (uint32_t i = 0; loaded && i < PAGE_MAP_DIRECTORY_ENTRIES; i++) {
+        if (map->directory[i] == 0) {
+            continue;
+        }
+        loaded = read_map_block(file_descriptor, map->directory[i], block, error);
+        if (!loaded) {
+            break;
+        }
+
+        uint32_t first_page_num = i * PAGE_MAP_ENTRIES_PER_BLOCK;
+        if (!reserve_locations(map, first_page_num + PAGE_MAP_ENTRIES_PER_BLOCK)) {
+            set_db_error(error, SIMPLESQLITE_NO_MEMORY, "Out of memory");
+            loaded = false;
+            break;
+        }
+        memcpy(&map->locations[first_page_num], block, sizeof(PageLocation) * PAGE_MAP_ENTRIES_PER_BLOCK);
+        for (uint32_t j = 0; j < PAGE_MAP_ENTRIES_PER_BLOCK; j++) {
+            if (map->locations[first_page_num + j].sector != 0 && first_page_num + j >= map->num_pages) {
+                map->num_pages = first_page_num + j + 1;
+            }
+        }
+    }
+    free(block);
+
+    if (!loaded || !rebuild_free_extents(map, error)) {
+        page_map_free(map);
+        return NULL;
+    }
+    return map;
+}
+
+static bool write_block(int file_descriptor, const uint8_t* block, uint32_t length, off_t offset, DbError* error) {
+    ssize_t bytes_written = pwrite(file_descriptor, block, length, offset);
+    if (bytes_written != (ssize_t)length) {
+        set_db_error(error, SIMPLESQLITE_IO_ERROR, "Error writing: %d", errno);
+        return false;
+    }
+    return true;
+}
+
+// Saves the block at offset in the journal, unless it lies past what the journal truncates back to
+static bool journal_block_at(int file_descriptor, int journal_descriptor, uint64_t original_file_length,
+                             off_t offset, uint8_t* scratch, IoStats* stats, DbError* error) {
+    if ((uint64_t)offset + PAGE_SIZE > original_file_length) {
+        return true;
+    }
+
+    ssize_t bytes_read = pread(file_descriptor, scratch, PAGE_SIZE, offset);
+    if (bytes_read == -1) {
+        set_db_error(error, SIMPLESQLITE_IO_ERROR, "Error reading file: %d", errno);
+        return false;
+    }
+    stats->bytes_read += bytes_read;
+    if (!journal_append_block(journal_descriptor, offset, scratch, error)) {
+        return false;
+    }
+    stats->journal_pages_written++;
+    stats->bytes_written += PAGE_SIZE;
+    return true;
+}
+
+static void fill_map_block(const PageMap* map, uint32_t block_num, uint8_t* block) {
+    memset(block, 0, PAGE_SIZE);
+    uint32_t first_page_num = block_num * PAGE_MAP_ENTRIES_PER_BLOCK;
+    for (uint32_t i = 0; i < PAGE_MAP_ENTRIES_PER_BLOCK && first_page_num + i < map->locations_capacity; i++) {
+        memcpy(block + i * sizeof(PageLocation), &map->locations[first_page_num + i], sizeof(PageLocation));
+    }
+    set_page_checksum(map->directory[block_num], block);
+}
+
+/**
+ *
+ * The compressed counterpart of writing a batch page by page. Pages are compressed and given
+ * new sectors, the blocks about to be overwritten in place go to the journal, which is synced,
+ * then everything is written and the file is synced once. Called with the io lock held.
+ *
+ */
+bool page_map_write_journaled(PageMap* map, int file_descriptor, DirtyBatch* batch, int journal_descriptor,
+                              IoStats* stats, DbError* error) {
+    uint64_t original_file_length = page_map_file_length(map);
+    uint8_t* compressed = malloc((size_t)PAGE_SIZE * batch->num_pages);
+    Extent* replaced = malloc(sizeof(Extent) * batch->num_pages);
+    uint32_t num_replaced = 0;
+    bool dirty_blocks[PAGE_MAP_DIRECTORY_ENTRIES] = {false};
+    bool directory_dirty = false;
+    uint8_t* header = NULL;
+    uint8_t* scratch = malloc(PAGE_SIZE);
+    bool written = false;
+    if (compressed == NULL || replaced == NULL || scratch == NULL) {
+        set_db_error(error, SIMPLESQLITE_NO_MEMORY, "Out of memory");
+        goto done;
+    }
+
+    for (uint32_t i = 0; i < batch->num_pages; i++) {
+        uint32_t page_num = batch->page_nums[i];
+        uint8_t* page = batch->pages + (size_t)i * PAGE_SIZE;
+        set_page_checksum(page_num, page);
+        if (page_num == DB_HEADER_PAGE_NUM) {
+            header = page;
+            continue;
+        }
+
+        uint32_t block_num = page_num / PAGE_MAP_ENTRIES_PER_BLOCK;
+        if (block_num >= PAGE_MAP_DIRECTORY_ENTRIES) {
+            set_db_error(error, SIMPLESQLITE_FULL, "Compressed database is full, the page map has no room for page %" PRIu32 ".", page_num);
+            goto done;
+        }
+        if (!reserve_locations(map, page_num + 1)) {
+            set_db_error(error, SIMPLESQLITE_NO_MEMORY, "Out of memory");
+            goto done;
+        }
+
+        // A page that would not save a sector is stored as is
+        uint8_t* output = compressed + (size_t)i * PAGE_SIZE;
+        uint32_t length = compress_page(page, PAGE_SIZE, output, PAGE_SIZE);
+        if (length == 0 || sectors_for(length) >= sectors_for(PAGE_SIZE)) {
+            memcpy(output, page, PAGE_SIZE);
+            length = PAGE_SIZE;
+        }
+
+        PageLocation* location = &map->locations[page_num];
+        if (location->sector != 0) {
+            replaced[num_replaced++] = (Extent){location->sector, sectors_for(location->length)};
+        }
+        location->sector = allocate_sectors(map, sectors_for(length));
+        location->length = (uint16_t)length;
+        if (page_num >= map->num_pages) {
+            map->num_pages = page_num + 1;
+        }
+
+        dirty_blocks[block_num] = true;
+        if (map->directory[block_num] == 0) {
+            map->directory[block_num] = allocate_sectors(map, sectors_for(PAGE_SIZE));
+            directory_dirty = true;
+        }
+    }
+
+    if (header != NULL &&
+        !journal_block_at(file_descriptor, journal_descriptor, original_file_length, 0, scratch, stats, error)) {
+        goto done;
+    }
+    if (directory_dirty &&
+        !journal_block_at(file_descriptor, journal_descriptor, original_file_length,
+                          sector_offset(PAGE_MAP_DIRECTORY_SECTOR), scratch, stats, error)) {
+        goto done;
+    }
+    for (uint32_t i = 0; i < PAGE_MAP_DIRECTORY_ENTRIES; i++) {
+        if (dirty_blocks[i] &&
+            !journal_block_at(file_descriptor, journal_descriptor, original_file_length,
+                              sector_offset(map->directory[i]), scratch, stats, error)) {
+            goto done;
+        }
+    }
+    if (!journal_sync(journal_descriptor, error)) {
+        goto done;
+    }
+    stats->syncs++;
+
+    for (uint32_t i = 0; i < batch->num_pages; i++) {
+        uint32_t page_num = batch->page_nums[i];
+        uint8_t* block = page_num == DB_HEADER_PAGE_NUM ? header : compressed + (size_t)i * PAGE_SIZE;
+        PageLocation location = page_map_location(map, page_num);
+        if (!write_block(file_descriptor, block, location.length, sector_offset(location.sector), error)) {
+            goto done;
+        }
+        stats->pages_written++;
+        stats->bytes_written += location.length;
+    }
+
+    for (uint32_t i = 0; i < PAGE_MAP_DIRECTORY_ENTRIES; i++) {
+        if (!dirty_blocks[i]) {
+            continue;
+        }
+        fill_map_block(map, i, scratch);
+        if (!write_block(file_descriptor, scratch, PAGE_SIZE, sector_offset(map->directory[i]), error)) {
+            goto done;
+        }
+        stats->bytes_written += PAGE_SIZE;
+    }
+
+    if (directory_dirty) {
+        memset(scratch, 0, PAGE_SIZE);
+        memcpy(scratch, map->directory, sizeof(map->directory));
+        set_page_checksum(PAGE_MAP_DIRECTORY_SECTOR, scratch);
+        if (!write_block(file_descriptor, scratch, PAGE_SIZE, sector_offset(PAGE_MAP_DIRECTORY_SECTOR), error)) {
+            goto done;
+        }
+        stats->bytes_written += PAGE_SIZE;
+    }
+
+    // Appending only to the map blocks would leave the end of the file short of the last page
+    if (ftruncate(file_descriptor, (off_t)page_map_file_length(map)) == -1) {
+        set_db_error(error, SIMPLESQLITE_IO_ERROR, "Error writing: %d", errno);
+        goto done;
+    }
+
+    if (fsync(file_descriptor) == -1) {
+        set_db_error(error, SIMPLESQLITE_IO_ERROR, "Error syncing db file: %d", errno);
+        goto done;
+    }
+    stats->syncs++;
+
+    // The old copies are garbage now, and only now may the next batch reuse their sectors. The
+    // batch is durable already, a gap that cannot be recorded is only lost until the next open
+    for (uint32_t i = 0; i < num_replaced; i++) {
+        release_extent(map, replaced[i]);
+    }
+    written = true;
+
+done:
+    free(compressed);
+    free(replaced);
+    free(scratch);
+    return written;
+}
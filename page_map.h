@@ -0,0 +1,47 @@
+#ifndef PAGE_MAP_H
+#define PAGE_MAP_H
+
+#include "table.h"
+#include "db_error.h"
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#define SECTOR_SIZE 512
+#define PAGE_MAP_DIRECTORY_SECTOR 8 // Right after the header page
+#define PAGE_MAP_FIRST_DATA_SECTOR 16
+#define PAGE_MAP_DIRECTORY_ENTRIES 1023 // Map block sectors, with the checksum after them
+#define PAGE_MAP_ENTRIES_PER_BLOCK 511 // Page locations, then 4 unused bytes and the checksum
+
+typedef struct {
+    uint32_t sector; // 0 while the page has never been written
+    uint16_t length; // Bytes of compressed page, PAGE_SIZE when it is stored as is
+    uint16_t unused;
+} PageLocation;
+
+typedef struct {
+    uint32_t sector;
+    uint32_t num_sectors;
+} Extent;
+
+typedef struct PageMap {
+    PageLocation* locations;
+    uint32_t locations_capacity;
+    uint32_t num_pages; // One past the highest page that is stored
+    uint32_t directory[PAGE_MAP_DIRECTORY_ENTRIES]; // Sector of each map block, 0 until it is needed
+    Extent* free_extents; // Gaps inside the file, in sector order
+    uint32_t num_free_extents;
+    uint32_t free_extents_capacity;
+    uint64_t end_sector; // The file ends here
+} PageMap;
+
+PageMap* page_map_create(void);
+PageMap* page_map_load(int file_descriptor, uint64_t file_length, DbError* error);
+void page_map_free(PageMap* map);
+uint64_t page_map_file_length(const PageMap* map);
+PageLocation page_map_location(const PageMap* map, uint32_t page_num);
+ssize_t read_mapped_page(int file_descriptor, PageLocation location, uint8_t* page);
+bool page_map_write_journaled(PageMap* map, int file_descriptor, DirtyBatch* batch, int journal_descriptor,
+                              IoStats* stats, DbError* error);
+
+#endif
@@ -0,0 +1,391 @@
+#include "page_trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <getopt.h>
+
+/**
+ *
+ * Page Report
+ *
+ * Reads a trace written with --page-trace and prints one line of JSON like the benchmark does:
+ *
+ *   {"accesses": 52110, "hits": 51230, "misses": 880, "pages": 902, ..., "lru_hit_percent": {...}, ...}
+ *
+ * The accesses are put in time order and every thread is followed on its own.
+ *
+ * pages is the working set of the whole trace, the distinct pages fetched. window_pages_* is
+ * the working set over every --window accesses in turn, statement_pages_* the pages one run of
+ * a statement fetched.
+ *
+ * The reuse distance of an access is the number of distinct other pages fetched since the
+ * same page was last fetched. A cache of n pages that evicts the least recently used one hits
+ * exactly the accesses with a distance below n, which is what lru_hit_percent is. cold counts
+ * first fetches, which miss in any cache.
+ *
+ * An access is sequential when its thread fetched the page before it last, repeated when it
+ * fetched the same page again and random otherwise. The miss_* counters look at only the pages
+ * read from the file, which is the order the disk saw them in.
+ *
+ */
+
+#define DEFAULT_WINDOW 1000
+#define COLD UINT32_MAX
+
+static const uint32_t LRU_CACHE_PAGES[] = {16, 64, 256, 1024, 4096, 16384, 65536};
+#define NUM_LRU_CACHE_SIZES (sizeof(LRU_CACHE_PAGES) / sizeof(LRU_CACHE_PAGES[0]))
+
+typedef struct {
+    PageAccess access;
+    uint64_t position; // In the file, keeps a thread's accesses in order when times tie
+} TracedAccess;
+
+typedef struct {
+    uint64_t accesses;
+    uint64_t misses;
+    uint64_t pages;
+} OperationCounts;
+
+// Sequential, random and repeated accesses, counted per thread
+typedef struct {
+    uint64_t sequential;
+    uint64_t random;
+    uint64_t repeated;
+} AccessPattern;
+
+void print_usage(void) {
+    printf("Usage: simpleSQLitePageReport [options] <page trace>\n");
+    printf("  --window <n>            accesses the working set is measured over (default %d)\n", DEFAULT_WINDOW);
+}
+
+static bool parse_uint32(const char* text, uint32_t* value) {
+    char* end;
+    unsigned long parsed = strtoul(text, &end, 10);
+    if (text[0] == '\0' || text[0] == '-' || *end != '\0' || parsed > UINT32_MAX) {
+        return false;
+    }
+    *value = (uint32_t)parsed;
+    return true;
+}
+
+static int compare_accesses(const void* a, const void* b) {
+    const TracedAccess* left = a;
+    const TracedAccess* right = b;
+    if (left->access.time_ns != right->access.time_ns) {
+        return left->access.time_ns < right->access.time_ns ? -1 : 1;
+    }
+    return left->position < right->position ? -1 : left->position > right->position;
+}
+
+static int compare_uint32(const void* a, const void* b) {
+    uint32_t left = *(const uint32_t*)a;
+    uint32_t right = *(const uint32_t*)b;
+    return left < right ? -1 : left > right;
+}
+
+// Pairs of a statement and a page it fetched
+static int compare_statement_pages(const void* a, const void* b) {
+    const uint64_t* left = a;
+    const uint64_t* right = b;
+    if (left[0] != right[0]) {
+        return left[0] < right[0] ? -1 : 1;
+    }
+    return left[1] < right[1] ? -1 : left[1] > right[1];
+}
+
+static bool load_trace(const char* path, TracedAccess** accesses, uint64_t* num_accesses) {
+    DbError error;
+    FILE* file = page_trace_reader_open(path, &error);
+    if (file == NULL) {
+        printf("%s\n", error.message);
+        return false;
+    }
+
+    uint64_t capacity = 4096;
+    *accesses = malloc(sizeof(TracedAccess) * capacity);
+    *num_accesses = 0;
+    while (*accesses != NULL && page_trace_read(file, &(*accesses)[*num_accesses].access, &error)) {
+        (*accesses)[*num_accesses].position = *num_accesses;
+        if (++*num_accesses == capacity) {
+            capacity *= 2;
+            TracedAccess* grown = realloc(*accesses, sizeof(TracedAccess) * capacity);
+            if (grown == NULL) {
+                free(*accesses);
+            }
+            *accesses = grown;
+        }
+    }
+    fclose(file);
+
+    if (*accesses == NULL) {
+        printf("Out of memory\n");
+        return false;
+    }
+    if (error.code != SIMPLESQLITE_OK) {
+        printf("%s\n", error.message);
+        free(*accesses);
+        return false;
+    }
+    qsort(*accesses, *num_accesses, sizeof(TracedAccess), compare_accesses);
+    return true;
+}
+
+// A Fenwick tree over positions in the trace, holding a 1 at the last access of every page
+static void fenwick_add(int64_t* tree, uint64_t size, uint64_t position, int64_t delta) {
+    for (uint64_t i = position + 1; i <= size; i += i & (~i + 1)) {
+        tree[i - 1] += delta;
+    }
+}
+
+// Sum over positions [0, position)
+static int64_t fenwick_prefix(const int64_t* tree, uint64_t position) {
+    int64_t sum = 0;
+    for (uint64_t i = position; i > 0; i -= i & (~i + 1)) {
+        sum += tree[i - 1];
+    }
+    return sum;
+}
+
+// One distance per access, COLD for the first access to a page
+static uint32_t* reuse_distances(const TracedAccess* accesses, uint64_t num_accesses, uint32_t max_page_num) {
+    uint32_t* distances = malloc(sizeof(uint32_t) * (num_accesses + 1));
+    int64_t* tree = calloc(num_accesses + 1, sizeof(int64_t));
+    uint64_t* last_position = malloc(sizeof(uint64_t) * ((uint64_t)max_page_num + 1));
+    if (distances == NULL || tree == NULL || last_position == NULL) {
+        free(distances);
+        free(tree);
+        free(last_position);
+        return NULL;
+    }
+    for (uint64_t page_num = 0; page_num <= max_page_num; page_num++) {
+        last_position[page_num] = UINT64_MAX;
+    }
+
+    for (uint64_t i = 0; i < num_accesses; i++) {
+        uint32_t page_num = accesses[i].access.page_num;
+        uint64_t last = last_position[page_num];
+        if (last == UINT64_MAX) {
+            distances[i] = COLD;
+        } else {
+            distances[i] = (uint32_t)(fenwick_prefix(tree, i) - fenwick_prefix(tree, last + 1));
+            fenwick_add(tree, num_accesses, last, -1);
+        }
+        fenwick_add(tree, num_accesses, i, 1);
+        last_position[page_num] = i;
+    }
+
+    free(tree);
+    free(last_position);
+    return distances;
+}
+
+static void count_pattern(AccessPattern* pattern, uint32_t* previous, bool* has_previous, uint32_t page_num) {
+    if (!*has_previous) {
+        pattern->random++;
+    } else if (page_num == *previous) {
+        pattern->repeated++;
+    } else if (page_num == *previous + 1) {
+        pattern->sequential++;
+    } else {
+        pattern->random++;
+    }
+    *previous = page_num;
+    *has_previous = true;
+}
+
+static double percent(uint64_t part, uint64_t whole) {
+    return whole > 0 ? 100.0 * part / whole : 0.0;
+}
+
+static void print_pattern(const char* prefix, const AccessPattern* pattern) {
+    printf(", \"%ssequential\": %" PRIu64 ", \"%srandom\": %" PRIu64 ", \"%srepeated\": %" PRIu64
+           ", \"%ssequential_percent\": %.1f",
+           prefix, pattern->sequential, prefix, pattern->random, prefix, pattern->repeated, prefix,
+           percent(pattern->sequential, pattern->sequential + pattern->random));
+}
+
+int main(int argc, char* argv[]) {
+    static struct option long_options[] = {
+        {"window", required_argument, NULL, 'w'},
+        {NULL, 0, NULL, 0}
+    };
+
+    uint32_t window = DEFAULT_WINDOW;
+    int option;
+    while ((option = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        if (option != 'w' || !parse_uint32(optarg, &window) || window == 0) {
+            print_usage();
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (argc - optind != 1) {
+        print_usage();
+        exit(EXIT_FAILURE);
+    }
+
+    TracedAccess* accesses;
+    uint64_t num_accesses;
+    if (!load_trace(argv[optind], &accesses, &num_accesses)) {
+        exit(EXIT_FAILURE);
+    }
+
+    uint32_t max_page_num = 0;
+    uint32_t num_threads = 0;
+    for (uint64_t i = 0; i < num_accesses; i++) {
+        if (accesses[i].access.page_num > max_page_num) {
+            max_page_num = accesses[i].access.page_num;
+        }
+        if (accesses[i].access.thread >= num_threads) {
+            num_threads = accesses[i].access.thread + 1;
+        }
+    }
+
+    uint64_t num_pages_slots = (uint64_t)max_page_num + 1;
+    uint32_t* distances = reuse_distances(accesses, num_accesses, max_page_num);
+    uint64_t* window_stamp = calloc(num_pages_slots, sizeof(uint64_t));
+    uint8_t* operation_pages = calloc(num_pages_slots, NUM_PAGE_OPERATIONS);
+    uint32_t* previous = calloc(num_threads + 1, 2 * sizeof(uint32_t));
+    bool* has_previous = calloc(num_threads + 1, 2 * sizeof(bool));
+    uint64_t* statement_pages = malloc(sizeof(uint64_t) * (num_accesses + 1) * 2);
+    if (distances == NULL || window_stamp == NULL || operation_pages == NULL || previous == NULL ||
+        has_previous == NULL || statement_pages == NULL) {
+        printf("Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    uint64_t kinds[NUM_PAGE_ACCESS_KINDS] = {0};
+    uint64_t page_types[NUM_PAGE_TYPES] = {0};
+    OperationCounts operations[NUM_PAGE_OPERATIONS];
+    memset(operations, 0, sizeof(operations));
+    AccessPattern pattern = {0, 0, 0};
+    AccessPattern miss_pattern = {0, 0, 0};
+    uint64_t pages = 0;
+    uint64_t num_windows = 0;
+    uint64_t window_pages = 0;
+    uint64_t window_pages_total = 0;
+    uint64_t window_pages_max = 0;
+    uint64_t num_statement_pages = 0;
+
+    for (uint64_t i = 0; i < num_accesses; i++) {
+        const PageAccess* access = &accesses[i].access;
+        kinds[access->kind]++;
+        page_types[access->page_type]++;
+
+        // Every page is stamped with the window it was last counted in, window n stamps n + 1
+        if (i % window == 0) {
+            num_windows++;
+            window_pages = 0;
+        }
+        if (window_stamp[access->page_num] != num_windows) {
+            window_stamp[access->page_num] = num_windows;
+            window_pages++;
+        }
+        if (i % window == window - 1 || i == num_accesses - 1) {
+            window_pages_total += window_pages;
+            if (window_pages > window_pages_max) {
+                window_pages_max = window_pages;
+            }
+        }
+
+        OperationCounts* counts = &operations[access->operation];
+        counts->accesses++;
+        counts->misses += access->kind == PAGE_ACCESS_MISS;
+        uint8_t* seen = &operation_pages[(uint64_t)access->page_num * NUM_PAGE_OPERATIONS + access->operation];
+        if (!*seen) {
+            *seen = 1;
+            counts->pages++;
+        }
+        pages += distances[i] == COLD;
+
+        count_pattern(&pattern, &previous[2 * access->thread], &has_previous[2 * access->thread], access->page_num);
+        if (access->kind == PAGE_ACCESS_MISS) {
+            count_pattern(&miss_pattern, &previous[2 * access->thread + 1], &has_previous[2 * access->thread + 1],
+                          access->page_num);
+        }
+
+        if (access->statement != 0) {
+            statement_pages[2 * num_statement_pages] = access->statement;
+            statement_pages[2 * num_statement_pages + 1] = access->page_num;
+            num_statement_pages++;
+        }
+    }
+
+    // Sorted as (statement, page) pairs, the distinct pairs of one statement are the pages it fetched
+    qsort(statement_pages, num_statement_pages, 2 * sizeof(uint64_t), compare_statement_pages);
+    uint64_t statements = 0;
+    uint64_t statement_pages_total = 0;
+    uint64_t statement_pages_max = 0;
+    uint64_t current_pages = 0;
+    for (uint64_t i = 0; i < num_statement_pages; i++) {
+        bool new_statement = i == 0 || statement_pages[2 * i] != statement_pages[2 * (i - 1)];
+        if (new_statement) {
+            statements++;
+            current_pages = 0;
+        }
+        if (new_statement || statement_pages[2 * i + 1] != statement_pages[2 * (i - 1) + 1]) {
+            current_pages++;
+            statement_pages_total++;
+        }
+        if (current_pages > statement_pages_max) {
+            statement_pages_max = current_pages;
+        }
+    }
+
+    // Cold accesses sort last, as COLD is the largest distance
+    qsort(distances, num_accesses, sizeof(uint32_t), compare_uint32);
+    uint64_t reused = num_accesses - pages;
+
+    printf("{\"accesses\": %" PRIu64 ", \"hits\": %" PRIu64 ", \"misses\": %" PRIu64 ", \"new_pages\": %" PRIu64
+           ", \"threads\": %" PRIu32 ", \"statements\": %" PRIu64 ", \"pages\": %" PRIu64,
+           num_accesses, kinds[PAGE_ACCESS_HIT], kinds[PAGE_ACCESS_MISS], kinds[PAGE_ACCESS_NEW], num_threads,
+           statements, pages);
+    printf(", \"window\": %" PRIu32 ", \"window_pages_mean\": %.1f, \"window_pages_max\": %" PRIu64
+           ", \"statement_pages_mean\": %.1f, \"statement_pages_max\": %" PRIu64,
+           window, num_windows > 0 ? (double)window_pages_total / num_windows : 0.0, window_pages_max,
+           statements > 0 ? (double)statement_pages_total / statements : 0.0, statement_pages_max);
+    printf(", \"cold\": %" PRIu64 ", \"reuse_p50\": %" PRIu32 ", \"reuse_p90\": %" PRIu32 ", \"reuse_p99\": %" PRIu32
+           ", \"reuse_max\": %" PRIu32,
+           pages, reused > 0 ? distances[reused * 50 / 100] : 0, reused > 0 ? distances[reused * 90 / 100] : 0,
+           reused > 0 ? distances[reused * 99 / 100] : 0, reused > 0 ? distances[reused - 1] : 0);
+
+    printf(", \"lru_hit_percent\": {");
+    uint64_t hits = 0;
+    for (uint32_t i = 0; i < NUM_LRU_CACHE_SIZES; i++) {
+        while (hits < reused && distances[hits] < LRU_CACHE_PAGES[i]) {
+            hits++;
+        }
+        printf("%s\"%" PRIu32 "\": %.1f", i > 0 ? ", " : "", LRU_CACHE_PAGES[i], percent(hits, num_accesses));
+    }
+    printf("}");
+
+    print_pattern("", &pattern);
+    print_pattern("miss_", &miss_pattern);
+
+    printf(", \"page_types\": {");
+    for (uint32_t i = 0; i < NUM_PAGE_TYPES; i++) {
+        printf("%s\"%s\": %" PRIu64, i > 0 ? ", " : "", page_type_name((PageType)i), page_types[i]);
+    }
+    printf("}, \"operations\": {");
+    bool first = true;
+    for (uint32_t i = 0; i < NUM_PAGE_OPERATIONS; i++) {
+        if (operations[i].accesses == 0) {
+            continue;
+        }
+        printf("%s\"%s\": {\"accesses\": %" PRIu64 ", \"misses\": %" PRIu64 ", \"pages\": %" PRIu64 "}",
+               first ? "" : ", ", page_operation_name((PageOperation)i), operations[i].accesses,
+               operations[i].misses, operations[i].pages);
+        first = false;
+    }
+    printf("}}\n");
+
+    free(accesses);
+    free(distances);
+    free(window_stamp);
+    free(operation_pages);
+    free(previous);
+    free(has_previous);
+    free(statement_pages);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,322 @@
+#include "page_trace.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+static const char PAGE_TRACE_MAGIC[] = "simple-sqlite-page-trace";
+static const uint32_t PAGE_TRACE_FORMAT_VERSION = 1;
+
+static const char* PAGE_OPERATION_NAMES[NUM_PAGE_OPERATIONS] = {
+    "open", "close", "insert", "select", "begin", "commit", "rollback", "update", "upsert",
+    "create_table", "drop_table", "backup", "import", "defrag", "inspect"
+};
+
+static const char* PAGE_TYPE_NAMES[NUM_PAGE_TYPES] = {"header", "catalog", "internal", "leaf", "unknown"};
+
+static void write_block(PageTrace* trace, PageTraceBlock* block) {
+    FILE* file = trace->file;
+    for (uint32_t i = 0; i < block->num_accesses; i++) {
+        PageAccess* access = &block->accesses[i];
+        write_varint(file, access->time_ns);
+        write_varint(file, access->statement);
+        write_varint(file, access->page_num);
+        write_varint(file, access->thread);
+        write_varint(file, access->kind);
+        write_varint(file, access->page_type);
+        write_varint(file, access->operation);
+    }
+}
+
+// Drains the queue until the trace is stopping and nothing is left in it
+static void* page_trace_writer(void* argument) {
+    PageTrace* trace = argument;
+    pthread_mutex_lock(&trace->lock);
+    while (true) {
+        while (trace->queue_head == NULL && !trace->stopping) {
+            pthread_cond_wait(&trace->queued, &trace->lock);
+        }
+        PageTraceBlock* block = trace->queue_head;
+        if (block == NULL) {
+            break;
+        }
+        trace->queue_head = block->next;
+        if (trace->queue_head == NULL) {
+            trace->queue_tail = NULL;
+        }
+        pthread_mutex_unlock(&trace->lock);
+
+        write_block(trace, block);
+        bool write_failed = ferror(trace->file) != 0;
+
+        pthread_mutex_lock(&trace->lock);
+        trace->failed = trace->failed || write_failed;
+        block->next = trace->free_blocks;
+        trace->free_blocks = block;
+        trace->num_queued--;
+        pthread_cond_broadcast(&trace->drained);
+    }
+    pthread_mutex_unlock(&trace->lock);
+    return NULL;
+}
+
+PageTrace* page_trace_open(const char* path, DbError* error) {
+    PageTrace* trace = malloc(sizeof(PageTrace));
+    if (trace == NULL) {
+        set_db_error(error, SIMPLESQLITE_NO_MEMORY, "Out of memory");
+        return NULL;
+    }
+    trace->file = fopen(path, "wb");
+    if (trace->file == NULL) {
+        set_db_error(error, SIMPLESQLITE_CANT_OPEN, "Unable to open page trace file");
+        free(trace);
+        return NULL;
+    }
+    if (pthread_key_create(&trace->buffer_key, NULL) != 0) {
+        set_db_error(error, SIMPLESQLITE_NO_MEMORY, "Out of memory");
+        fclose(trace->file);
+        free(trace);
+        return NULL;
+    }
+    pthread_mutex_init(&trace->lock, NULL);
+    pthread_cond_init(&trace->queued, NULL);
+    pthread_cond_init(&trace->drained, NULL);
+    trace->buffers = NULL;
+    trace->num_threads = 0;
+    trace->queue_head = NULL;
+    trace->queue_tail = NULL;
+    trace->num_queued = 0;
+    trace->free_blocks = NULL;
+    trace->stopping = false;
+    trace->start_ns = monotonic_time_ns();
+    trace->failed = false;
+
+    fwrite(PAGE_TRACE_MAGIC, 1, sizeof(PAGE_TRACE_MAGIC), trace->file);
+    write_varint(trace->file, PAGE_TRACE_FORMAT_VERSION);
+
+    if (pthread_create(&trace->writer, NULL, page_trace_writer, trace) != 0) {
+        set_db_error(error, SIMPLESQLITE_NO_MEMORY, "Unable to start the page trace writer");
+        pthread_key_delete(trace->buffer_key);
+        pthread_cond_destroy(&trace->drained);
+        pthread_cond_destroy(&trace->queued);
+        pthread_mutex_destroy(&trace->lock);
+        fclose(trace->file);
+        free(trace);
+        return NULL;
+    }
+    return trace;
+}
+
+// Called with the lock held, returns NULL when there is no memory for one
+static PageTraceBlock* take_free_block(PageTrace* trace) {
+    PageTraceBlock* block = trace->free_blocks;
+    if (block != NULL) {
+        trace->free_blocks = block->next;
+    } else {
+        block = malloc(sizeof(PageTraceBlock));
+    }
+    if (block == NULL) {
+        trace->failed = true;
+        return NULL;
+    }
+    block->num_accesses = 0;
+    return block;
+}
+
+// Called with the lock held
+static void queue_block(PageTrace* trace, PageTraceBlock* block) {
+    block->next = NULL;
+    if (trace->queue_tail == NULL) {
+        trace->queue_head = block;
+    } else {
+        trace->queue_tail->next = block;
+    }
+    trace->queue_tail = block;
+    trace->num_queued++;
+    pthread_cond_signal(&trace->queued);
+}
+
+// NULL when there is no memory for one, the thread's accesses then go unrecorded
+static PageTraceBuffer* thread_buffer(PageTrace* trace) {
+    PageTraceBuffer* buffer = pthread_getspecific(trace->buffer_key);
+    if (buffer != NULL) {
+        return buffer;
+    }
+
+    buffer = malloc(sizeof(PageTraceBuffer));
+    pthread_mutex_lock(&trace->lock);
+    if (buffer == NULL) {
+        trace->failed = true;
+        pthread_mutex_unlock(&trace->lock);
+        return NULL;
+    }
+    buffer->operation = PAGE_OPERATION_OPEN;
+    buffer->statement = 0;
+    buffer->block = take_free_block(trace);
+    buffer->thread = trace->num_threads++;
+    buffer->next = trace->buffers;
+    trace->buffers = buffer;
+    pthread_mutex_unlock(&trace->lock);
+
+    pthread_setspecific(trace->buffer_key, buffer);
+    return buffer;
+}
+
+// The writer cannot keep up when the queue is full, so the thread waits rather than let memory grow
+static void hand_over_block(PageTrace* trace, PageTraceBuffer* buffer) {
+    pthread_mutex_lock(&trace->lock);
+    while (trace->num_queued >= PAGE_TRACE_MAX_QUEUED) {
+        pthread_cond_wait(&trace->drained, &trace->lock);
+    }
+    queue_block(trace, buffer->block);
+    buffer->block = take_free_block(trace);
+    pthread_mutex_unlock(&trace->lock);
+}
+
+void page_trace_begin(PageTrace* trace, PageOperation operation, uint64_t statement) {
+    PageTraceBuffer* buffer = thread_buffer(trace);
+    if (buffer != NULL) {
+        buffer->operation = operation;
+        buffer->statement = statement;
+    }
+}
+
+// Costs a clock read and a store until the block fills, then a hand-over under the lock
+void page_trace_record(PageTrace* trace, uint32_t page_num, PageAccessKind kind, PageType page_type) {
+    PageTraceBuffer* buffer = thread_buffer(trace);
+    if (buffer == NULL || buffer->block == NULL) {
+        return;
+    }
+
+    PageTraceBlock* block = buffer->block;
+    PageAccess* access = &block->accesses[block->num_accesses++];
+    access->time_ns = monotonic_time_ns() - trace->start_ns;
+    access->statement = buffer->statement;
+    access->page_num = page_num;
+    access->thread = buffer->thread;
+    access->kind = kind;
+    access->page_type = page_type;
+    access->operation = buffer->operation;
+
+    if (block->num_accesses == PAGE_TRACE_BUFFER_ACCESSES) {
+        hand_over_block(trace, buffer);
+    }
+}
+
+// Every other thread is done with the trace by now, so their partly filled blocks can be queued
+bool page_trace_close(PageTrace* trace, DbError* error) {
+    pthread_mutex_lock(&trace->lock);
+    for (PageTraceBuffer* buffer = trace->buffers; buffer != NULL; buffer = buffer->next) {
+        if (buffer->block != NULL) {
+            queue_block(trace, buffer->block);
+        }
+    }
+    trace->stopping = true;
+    pthread_cond_signal(&trace->queued);
+    pthread_mutex_unlock(&trace->lock);
+    pthread_join(trace->writer, NULL);
+
+    PageTraceBuffer* buffer = trace->buffers;
+    while (buffer != NULL) {
+        PageTraceBuffer* next = buffer->next;
+        free(buffer);
+        buffer = next;
+    }
+    PageTraceBlock* block = trace->free_blocks;
+    while (block != NULL) {
+        PageTraceBlock* next = block->next;
+        free(block);
+        block = next;
+    }
+
+    bool closed = fclose(trace->file) == 0 && !trace->failed;
+    if (!closed && error != NULL) {
+        set_db_error(error, SIMPLESQLITE_IO_ERROR, "Error writing page trace: %d", errno);
+    }
+    pthread_key_delete(trace->buffer_key);
+    pthread_cond_destroy(&trace->drained);
+    pthread_cond_destroy(&trace->queued);
+    pthread_mutex_destroy(&trace->lock);
+    free(trace);
+    return closed;
+}
+
+PageOperation page_operation_for_statement(StatementType type) {
+    switch (type) {
+        case STATEMENT_INSERT:
+            return PAGE_OPERATION_INSERT;
+        case STATEMENT_SELECT:
+            return PAGE_OPERATION_SELECT;
+        case STATEMENT_BEGIN:
+            return PAGE_OPERATION_BEGIN;
+        case STATEMENT_COMMIT:
+            return PAGE_OPERATION_COMMIT;
+        case STATEMENT_ROLLBACK:
+            return PAGE_OPERATION_ROLLBACK;
+        case STATEMENT_UPDATE:
+            return PAGE_OPERATION_UPDATE;
+        case STATEMENT_UPSERT:
+            return PAGE_OPERATION_UPSERT;
+        case STATEMENT_CREATE_TABLE:
+            return PAGE_OPERATION_CREATE_TABLE;
+        case STATEMENT_DROP_TABLE:
+            return PAGE_OPERATION_DROP_TABLE;
+    }
+    return PAGE_OPERATION_INSPECT;
+}
+
+const char* page_operation_name(PageOperation operation) {
+    return operation < NUM_PAGE_OPERATIONS ? PAGE_OPERATION_NAMES[operation] : "unknown";
+}
+
+const char* page_type_name(PageType page_type) {
+    return page_type < NUM_PAGE_TYPES ? PAGE_TYPE_NAMES[page_type] : "unknown";
+}
+
+FILE* page_trace_reader_open(const char* path, DbError* error) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        set_db_error(error, SIMPLESQLITE_CANT_OPEN, "Unable to open page trace file");
+        return NULL;
+    }
+
+    char magic[sizeof(PAGE_TRACE_MAGIC)];
+    uint64_t version;
+    if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) || memcmp(magic, PAGE_TRACE_MAGIC, sizeof(magic)) != 0 ||
+        !read_varint(file, &version) || version != PAGE_TRACE_FORMAT_VERSION) {
+        set_db_error(error, SIMPLESQLITE_CORRUPT, "File is not a simple-sqlite page trace.");
+        fclose(file);
+        return NULL;
+    }
+    return file;
+}
+
+bool page_trace_read(FILE* file, PageAccess* access, DbError* error) {
+    clear_db_error(error);
+
+    uint64_t time_ns;
+    if (!read_varint(file, &time_ns)) {
+        // A trace ends between two accesses, anything else is an access cut short
+        if (ferror(file)) {
+            set_db_error(error, SIMPLESQLITE_IO_ERROR, "Error reading page trace: %d", errno);
+        }
+        return false;
+    }
+
+    uint64_t page_num, thread, kind, page_type, operation;
+    bool read = read_varint(file, &access->statement) && read_varint(file, &page_num) &&
+                read_varint(file, &thread) && read_varint(file, &kind) && read_varint(file, &page_type) &&
+                read_varint(file, &operation) && page_num <= UINT32_MAX && thread <= UINT32_MAX &&
+                kind < NUM_PAGE_ACCESS_KINDS && page_type < NUM_PAGE_TYPES && operation < NUM_PAGE_OPERATIONS;
+    if (!read) {
+        set_db_error(error, SIMPLESQLITE_CORRUPT, "Page trace ends in the middle of an access.");
+        return false;
+    }
+    access->time_ns = time_ns;
+    access->page_num = (uint32_t)page_num;
+    access->thread = (uint32_t)thread;
+    access->kind = (PageAccessKind)kind;
+    access->page_type = (PageType)page_type;
+    access->operation = (PageOperation)operation;
+    return true;
+}
@@ -0,0 +1,132 @@
+#ifndef PAGE_TRACE_H
+#define PAGE_TRACE_H
+
+#include "db_error.h"
+#include "statement.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#define PAGE_TRACE_BUFFER_ACCESSES 4096 // Accesses a thread collects before it hands them to the writer
+#define PAGE_TRACE_MAX_QUEUED 64 // Full blocks waiting for the writer before recording threads wait for it
+
+/**
+ *
+ * Page Trace Layout
+ *
+ * MAGIC | FORMAT VERSION | ACCESS...
+ *
+ * with each ACCESS being TIME NS | STATEMENT | PAGE NUM | THREAD | KIND | PAGE TYPE | OPERATION,
+ * every field an unsigned LEB128 varint. Each thread hands its accesses to a writer thread a
+ * block at a time, so the accesses of different threads interleave in blocks and are ordered
+ * by their times.
+ *
+ */
+
+typedef enum {
+    PAGE_ACCESS_HIT,
+    PAGE_ACCESS_MISS, // Read from the file
+    PAGE_ACCESS_NEW // Past the end of the file, allocated without a read
+} PageAccessKind;
+
+#define NUM_PAGE_ACCESS_KINDS (PAGE_ACCESS_NEW + 1)
+
+typedef enum {
+    PAGE_TYPE_HEADER,
+    PAGE_TYPE_CATALOG,
+    PAGE_TYPE_INTERNAL,
+    PAGE_TYPE_LEAF,
+    PAGE_TYPE_UNKNOWN // A new page, which gets its type after get_page returns it
+} PageType;
+
+#define NUM_PAGE_TYPES (PAGE_TYPE_UNKNOWN + 1)
+
+// What the pages were fetched for
+typedef enum {
+    PAGE_OPERATION_OPEN,
+    PAGE_OPERATION_CLOSE,
+    PAGE_OPERATION_INSERT,
+    PAGE_OPERATION_SELECT,
+    PAGE_OPERATION_BEGIN,
+    PAGE_OPERATION_COMMIT,
+    PAGE_OPERATION_ROLLBACK,
+    PAGE_OPERATION_UPDATE,
+    PAGE_OPERATION_UPSERT,
+    PAGE_OPERATION_CREATE_TABLE,
+    PAGE_OPERATION_DROP_TABLE,
+    PAGE_OPERATION_BACKUP,
+    PAGE_OPERATION_IMPORT,
+    PAGE_OPERATION_DEFRAG,
+    PAGE_OPERATION_INSPECT // Printing the tree, the tables or the statistics
+} PageOperation;
+
+#define NUM_PAGE_OPERATIONS (PAGE_OPERATION_INSPECT + 1)
+
+typedef struct {
+    uint64_t time_ns; // Counted from when the trace began
+    uint64_t statement; // Run of a statement the page was fetched for, 0 outside of one
+    uint32_t page_num;
+    uint32_t thread; // Threads are numbered in the order they first fetched a page
+    PageAccessKind kind;
+    PageType page_type;
+    PageOperation operation;
+} PageAccess;
+
+typedef struct PageTraceBlock {
+    uint32_t num_accesses;
+    PageAccess accesses[PAGE_TRACE_BUFFER_ACCESSES];
+    struct PageTraceBlock* next; // In the writer's queue or on the free list
+} PageTraceBlock;
+
+// Written only by the thread it belongs to, so recording an access takes no lock
+typedef struct PageTraceBuffer {
+    uint32_t thread;
+    PageOperation operation;
+    uint64_t statement;
+    PageTraceBlock* block; // NULL once there was no memory for one, the accesses then go unrecorded
+    struct PageTraceBuffer* next;
+} PageTraceBuffer;
+
+/**
+ *
+ * A thread whose block fills up queues it for the writer thread and takes an empty one from the
+ * free list, holding the lock only to move the two. The writer writes the queued blocks out and
+ * puts them back on the free list, so the threads fetching pages never wait for the file unless
+ * PAGE_TRACE_MAX_QUEUED blocks are already waiting.
+ *
+ */
+typedef struct PageTrace {
+    FILE* file; // Written by the writer thread only, until it is joined
+    pthread_mutex_t lock; // Guards the queue, the free list, the list of buffers and failed
+    pthread_cond_t queued; // The writer waits for a block or for stopping
+    pthread_cond_t drained; // Threads wait for room in the queue
+    pthread_t writer;
+    pthread_key_t buffer_key; // Finds the calling thread's buffer
+    PageTraceBuffer* buffers;
+    uint32_t num_threads;
+    PageTraceBlock* queue_head;
+    PageTraceBlock* queue_tail;
+    uint32_t num_queued;
+    PageTraceBlock* free_blocks;
+    bool stopping;
+    uint64_t start_ns;
+    bool failed; // A write or an allocation failed, reported when the trace is closed
+} PageTrace;
+
+PageTrace* page_trace_open(const char* path, DbError* error);
+// Pages the calling thread fetches from now on are recorded as fetched for operation and statement
+void page_trace_begin(PageTrace* trace, PageOperation operation, uint64_t statement);
+void page_trace_record(PageTrace* trace, uint32_t page_num, PageAccessKind kind, PageType page_type);
+// Writes out every thread's accesses and stops the writer, error may be NULL to close without reporting
+bool page_trace_close(PageTrace* trace, DbError* error);
+
+PageOperation page_operation_for_statement(StatementType type);
+const char* page_operation_name(PageOperation operation);
+const char* page_type_name(PageType page_type);
+
+// Reads the next access. At the end of the trace returns false with error->code SIMPLESQLITE_OK
+FILE* page_trace_reader_open(const char* path, DbError* error);
+bool page_trace_read(FILE* file, PageAccess* access, DbError* error);
+
+#endif
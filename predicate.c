@@ -0,0 +1,129 @@
+#define _GNU_SOURCE
+#include "predicate.h"
+#include "constants.h"
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/**
+ *
+ * String predicates are evaluated on the serialized value inside the page, so a row that does
+ * not match is rejected without being copied out. Text columns sit at fixed offsets and are
+ * zero terminated inside their slots, which lets equality, prefix and the length scan for
+ * suffix matching run 16 bytes at a time.
+ *
+ */
+
+static bool bytes_equal(const uint8_t* left, const uint8_t* right, uint32_t length) {
+    uint32_t i = 0;
+#ifdef __SSE2__
+    for (; i + 16 <= length; i += 16) {
+        __m128i left_chunk = _mm_loadu_si128((const __m128i*)(left + i));
+        __m128i right_chunk = _mm_loadu_si128((const __m128i*)(right + i));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(left_chunk, right_chunk)) != 0xFFFF) {
+            return false;
+        }
+    }
+#endif
+    return memcmp(left + i, right + i, length - i) == 0;
+}
+
+// The chunks never read past the end of the slot, a slot that is not a multiple of 16 ends bytewise
+static uint32_t field_length(const uint8_t* field, uint32_t size) {
+    uint32_t i = 0;
+#ifdef __SSE2__
+    __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= size; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(field + i));
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, zero));
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+#endif
+    return i + strnlen((const char*)field + i, size - i);
+}
+
+bool initialize_predicate(Predicate* predicate, Column column, const char* operator, const char* operand) {
+    if (!is_text_column(column)) {
+        return false;
+    }
+
+    // Quotes around the operand are optional
+    size_t length = strlen(operand);
+    if (length >= 2 && operand[0] == '\'' && operand[length - 1] == '\'') {
+        operand += 1;
+        length -= 2;
+    }
+
+    predicate->column = column;
+    predicate->offset = column_offset(column);
+    predicate->size = column_size(column);
+    if (strcmp(operator, "=") == 0) {
+        predicate->kind = MATCH_EQUALS;
+    } else if (strcmp(operator, "like") == 0) {
+        bool leading_wildcard = length > 0 && operand[0] == '%';
+        bool trailing_wildcard = length > 1 && operand[length - 1] == '%';
+        if (leading_wildcard) {
+            operand += 1;
+            length -= 1;
+        }
+        if (trailing_wildcard) {
+            length -= 1;
+        }
+
+        if (leading_wildcard && trailing_wildcard) {
+            predicate->kind = MATCH_CONTAINS;
+        } else if (leading_wildcard) {
+            predicate->kind = MATCH_SUFFIX;
+        } else if (trailing_wildcard) {
+            predicate->kind = MATCH_PREFIX;
+        } else {
+            predicate->kind = MATCH_EQUALS;
+        }
+
+        if (memchr(operand, '%', length) != NULL || memchr(operand, '_', length) != NULL) {
+            return false;
+        }
+    } else {
+        return false;
+    }
+
+    if (length > predicate->size - 1) {
+        return false;
+    }
+
+    predicate->length = length;
+    memset(predicate->pattern, 0, sizeof(predicate->pattern));
+    memcpy(predicate->pattern, operand, length);
+
+    return true;
+}
+
+bool predicate_matches(Predicate* predicate, uint8_t* value) {
+    const uint8_t* field = value + predicate->offset;
+    uint32_t size = predicate->size;
+
+    const uint8_t* pattern = (const uint8_t*)predicate->pattern;
+    uint32_t length = predicate->length;
+
+    switch (predicate->kind) {
+        case (MATCH_EQUALS):
+            // Comparing the terminator too rules out longer values with the same prefix
+            return bytes_equal(field, pattern, length + 1);
+        case (MATCH_PREFIX):
+            return bytes_equal(field, pattern, length);
+        case (MATCH_SUFFIX): {
+            uint32_t field_size = field_length(field, size);
+            return field_size >= length && bytes_equal(field + field_size - length, pattern, length);
+        }
+        case (MATCH_CONTAINS): {
+            uint32_t field_size = field_length(field, size);
+            return memmem(field, field_size, pattern, length) != NULL;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,28 @@
+#ifndef PREDICATE_H
+#define PREDICATE_H
+
+#include "row.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef enum {
+    MATCH_EQUALS,
+    MATCH_PREFIX,
+    MATCH_SUFFIX,
+    MATCH_CONTAINS
+} MatchKind;
+
+typedef struct {
+    Column column;
+    uint32_t offset; // Of the column in the serialized row
+    uint32_t size; // Of the column's slot
+    MatchKind kind;
+    uint32_t length;
+    char pattern[256];
+} Predicate;
+
+bool initialize_predicate(Predicate* predicate, Column column, const char* operator, const char* operand);
+
+bool predicate_matches(Predicate* predicate, uint8_t* value);
+
+#endif
@@ -0,0 +1,392 @@
+#include "simplesqlite.h"
+#include "capture.h"
+#include "stats.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <time.h>
+
+/**
+ *
+ * Replay
+ *
+ * Runs the statements of a trace written with --capture against a database, and prints one
+ * line of JSON like the benchmark does:
+ *
+ *   {"statements": 10000, "threads": 4, "seconds": ..., "statements_per_sec": ..., "p50_ns": ..., ...}
+ *
+ * Each session of the trace runs on one thread, session n on thread n % --threads, in the order
+ * its statements finished in the capture. A trace from the shell has one session and so keeps
+ * one thread busy. The threads share one handle and, like the server's connections, take turns
+ * a slice of rows at a time. Turns are tickets handed out in order: a thread that finishes a
+ * slice takes a new ticket behind every thread already waiting, so a long select cannot keep
+ * the handle. A session that opens a transaction has the database to itself until the
+ * transaction ends. Without --paced statements are issued as fast as the database takes them.
+ * With it, each one waits for the time it started at in the capture.
+ *
+ * Latencies run from when a statement was due to when its last row came back, so they include
+ * waiting for other threads. mismatches counts statements whose result or number of rows differs
+ * from the capture, which is how a replay against the wrong starting database shows up.
+ *
+ */
+
+#define ROWS_PER_SLICE 256
+
+typedef struct {
+    uint32_t threads;
+    bool paced;
+    SimpleSqliteConfig config;
+} ReplayOptions;
+
+typedef struct {
+    SimpleSqlite* db;
+    pthread_mutex_t lock; // Guards the turns and the transaction owner, not held while a statement runs
+    pthread_cond_t turn_over;
+    pthread_cond_t transaction_over;
+    uint64_t next_ticket;
+    uint64_t now_serving; // Ticket of the thread whose turn it is to use the handle
+    int64_t transaction_owner; // Thread whose transaction is open, -1 outside one
+    bool paced;
+    uint64_t start_ns;
+    uint32_t num_threads;
+    CaptureRecord* records;
+    uint64_t num_records;
+} Replay;
+
+typedef struct {
+    Replay* replay;
+    uint32_t thread_num;
+    pthread_t thread;
+    uint64_t statements;
+    uint64_t errors; // Statements that failed in the replay
+    uint64_t mismatches;
+    LatencyHistogram latencies;
+} ReplayThread;
+
+void print_usage(void) {
+    printf("Usage: simpleSQLiteReplay [options] <trace> <filename>\n");
+    printf("  --threads <n>           threads the sessions of the trace are spread over (default 1)\n");
+    printf("  --paced                 issue statements at the times they were captured at\n");
+    printf("  --stats-json <path>     write the database statistics to path as JSON on exit\n");
+    printf("  --page-trace <path>     record every page the replay fetches to path\n");
+    printf("  -k 32|64                key width in bits for a new database (default 32)\n");
+    printf("  --flush-pages <n>       background flush once n pages are dirty, 0 disables it (default 64)\n");
+    printf("  --compress              compress the pages of a new database on disk\n");
+}
+
+static bool parse_uint32(const char* text, uint32_t* value) {
+    char* end;
+    unsigned long parsed = strtoul(text, &end, 10);
+    if (text[0] == '\0' || text[0] == '-' || *end != '\0' || parsed > UINT32_MAX) {
+        return false;
+    }
+    *value = (uint32_t)parsed;
+    return true;
+}
+
+static bool parse_replay_arguments(int argc, char* argv[], ReplayOptions* options) {
+    static struct option long_options[] = {
+        {"threads", required_argument, NULL, 't'},
+        {"paced", no_argument, NULL, 'd'},
+        {"stats-json", required_argument, NULL, 'j'},
+        {"page-trace", required_argument, NULL, 'g'},
+        {"flush-pages", required_argument, NULL, 'p'},
+        {"compress", no_argument, NULL, 'z'},
+        {NULL, 0, NULL, 0}
+    };
+
+    options->threads = 1;
+    options->paced = false;
+    simplesqlite_config_init(&options->config);
+
+    int option;
+    while ((option = getopt_long(argc, argv, "k:", long_options, NULL)) != -1) {
+        bool valid;
+        switch (option) {
+            case 'k':
+                valid = strcmp(optarg, "32") == 0 || strcmp(optarg, "64") == 0;
+                options->config.key_size = strcmp(optarg, "64") == 0 ? sizeof(uint64_t) : sizeof(uint32_t);
+                break;
+            case 't':
+                valid = parse_uint32(optarg, &options->threads) && options->threads > 0;
+                break;
+            case 'd':
+                options->paced = true;
+                valid = true;
+                break;
+            case 'j':
+                options->config.stats_json_path = optarg;
+                valid = true;
+                break;
+            case 'g':
+                options->config.page_trace_path = optarg;
+                valid = true;
+                break;
+            case 'p':
+                valid = parse_uint32(optarg, &options->config.flush_dirty_pages);
+                break;
+            case 'z':
+                options->config.compress = true;
+                valid = true;
+                break;
+            default:
+                valid = false;
+                break;
+        }
+        if (!valid) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// The whole trace is read before the clock starts, so reading it is not measured
+static bool load_trace(const char* path, Replay* replay) {
+    DbError error;
+    FILE* file = capture_reader_open(path, &error);
+    if (file == NULL) {
+        printf("%s\n", error.message);
+        return false;
+    }
+
+    uint64_t capacity = 1024;
+    replay->records = malloc(sizeof(CaptureRecord) * capacity);
+    replay->num_records = 0;
+    bool out_of_memory = replay->records == NULL;
+    while (!out_of_memory && capture_read(file, &replay->records[replay->num_records], &error)) {
+        if (++replay->num_records == capacity) {
+            capacity *= 2;
+            CaptureRecord* grown = realloc(replay->records, sizeof(CaptureRecord) * capacity);
+            if (grown == NULL) {
+                out_of_memory = true;
+            } else {
+                replay->records = grown;
+            }
+        }
+    }
+    fclose(file);
+
+    if (out_of_memory || error.code != SIMPLESQLITE_OK) {
+        printf("%s\n", out_of_memory ? "Out of memory" : error.message);
+        for (uint64_t i = 0; i < replay->num_records; i++) {
+            capture_record_free(&replay->records[i]);
+        }
+        free(replay->records);
+        return false;
+    }
+    return true;
+}
+
+static void sleep_until_ns(uint64_t deadline_ns) {
+    struct timespec deadline;
+    deadline.tv_sec = deadline_ns / 1000000000;
+    deadline.tv_nsec = deadline_ns % 1000000000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) != 0) {
+    }
+}
+
+/**
+ *
+ * Waits for the thread's turn with the handle. While another thread's transaction is open the
+ * turn is passed on, and the thread queues again once the transaction is over.
+ *
+ */
+static void begin_turn(Replay* replay, uint32_t thread_num) {
+    pthread_mutex_lock(&replay->lock);
+    while (true) {
+        uint64_t ticket = replay->next_ticket++;
+        while (replay->now_serving != ticket) {
+            pthread_cond_wait(&replay->turn_over, &replay->lock);
+        }
+        if (replay->transaction_owner == -1 || replay->transaction_owner == thread_num) {
+            break;
+        }
+        replay->now_serving++;
+        pthread_cond_broadcast(&replay->turn_over);
+        while (replay->transaction_owner != -1 && replay->transaction_owner != thread_num) {
+            pthread_cond_wait(&replay->transaction_over, &replay->lock);
+        }
+    }
+    pthread_mutex_unlock(&replay->lock);
+}
+
+static void end_turn(Replay* replay) {
+    pthread_mutex_lock(&replay->lock);
+    replay->now_serving++;
+    pthread_cond_broadcast(&replay->turn_over);
+    pthread_mutex_unlock(&replay->lock);
+}
+
+// Called during the thread's turn, returns the result the statement ended with
+static SimpleSqliteResult replay_statement(Replay* replay, uint32_t thread_num, const CaptureRecord* record,
+                                           uint64_t* rows) {
+    SimpleSqliteStmt* stmt;
+    SimpleSqliteResult result = simplesqlite_prepare(replay->db, record->sql, &stmt);
+    for (uint32_t i = 0; i < record->num_parameters && result == SIMPLESQLITE_OK; i++) {
+        result = simplesqlite_bind_text(stmt, i + 1, record->parameters[i]);
+    }
+    if (result != SIMPLESQLITE_OK) {
+        simplesqlite_finalize(stmt);
+        return result;
+    }
+
+    while ((result = simplesqlite_step(stmt)) == SIMPLESQLITE_ROW) {
+        // Threads already waiting get their turns between two slices, the select reads its snapshot meanwhile
+        if (++*rows % ROWS_PER_SLICE == 0) {
+            end_turn(replay);
+            begin_turn(replay, thread_num);
+        }
+    }
+    simplesqlite_finalize(stmt);
+    return result;
+}
+
+// Called during the thread's turn, after every statement the thread runs
+static void update_transaction_owner(Replay* replay, int64_t thread_num) {
+    bool in_transaction = simplesqlite_in_transaction(replay->db);
+    pthread_mutex_lock(&replay->lock);
+    // A select finishing while another thread owns the transaction leaves it with that thread
+    if (replay->transaction_owner == -1 || replay->transaction_owner == thread_num) {
+        replay->transaction_owner = in_transaction ? thread_num : -1;
+        if (replay->transaction_owner == -1) {
+            pthread_cond_broadcast(&replay->transaction_over);
+        }
+    }
+    pthread_mutex_unlock(&replay->lock);
+}
+
+static void* replay_thread(void* argument) {
+    ReplayThread* thread = argument;
+    Replay* replay = thread->replay;
+
+    for (uint64_t i = 0; i < replay->num_records; i++) {
+        const CaptureRecord* record = &replay->records[i];
+        if (record->session % replay->num_threads != thread->thread_num) {
+            continue;
+        }
+
+        uint64_t start_ns = monotonic_time_ns();
+        if (replay->paced && replay->start_ns + record->start_ns > start_ns) {
+            start_ns = replay->start_ns + record->start_ns;
+            sleep_until_ns(start_ns);
+        }
+
+        begin_turn(replay, thread->thread_num);
+        uint64_t rows = 0;
+        SimpleSqliteResult result = replay_statement(replay, thread->thread_num, record, &rows);
+        update_transaction_owner(replay, thread->thread_num);
+        end_turn(replay);
+
+        record_latency(&thread->latencies, monotonic_time_ns() - start_ns);
+        thread->statements++;
+        if (result != SIMPLESQLITE_DONE) {
+            thread->errors++;
+        }
+        if (result != record->result || rows != record->rows) {
+            thread->mismatches++;
+        }
+    }
+
+    // A trace that ends inside a transaction would otherwise keep the other threads waiting
+    begin_turn(replay, thread->thread_num);
+    if (replay->transaction_owner == thread->thread_num) {
+        uint64_t rows = 0;
+        CaptureRecord rollback;
+        memset(&rollback, 0, sizeof(rollback));
+        rollback.sql = "rollback";
+        replay_statement(replay, thread->thread_num, &rollback, &rows);
+        update_transaction_owner(replay, thread->thread_num);
+    }
+    end_turn(replay);
+
+    return NULL;
+}
+
+static void merge_latencies(LatencyHistogram* total, const LatencyHistogram* latencies) {
+    total->count += latencies->count;
+    total->total_ns += latencies->total_ns;
+    if (latencies->max_ns > total->max_ns) {
+        total->max_ns = latencies->max_ns;
+    }
+    for (uint32_t i = 0; i < LATENCY_NUM_BUCKETS; i++) {
+        total->buckets[i] += latencies->buckets[i];
+    }
+}
+
+int main(int argc, char* argv[]) {
+    ReplayOptions options;
+    if (!parse_replay_arguments(argc, argv, &options) || argc - optind != 2) {
+        print_usage();
+        exit(EXIT_FAILURE);
+    }
+
+    Replay replay;
+    if (!load_trace(argv[optind], &replay)) {
+        exit(EXIT_FAILURE);
+    }
+    if (simplesqlite_open(argv[optind + 1], &options.config, &replay.db) != SIMPLESQLITE_OK) {
+        printf("%s\n", simplesqlite_errmsg(replay.db));
+        simplesqlite_close(replay.db);
+        exit(EXIT_FAILURE);
+    }
+    pthread_mutex_init(&replay.lock, NULL);
+    pthread_cond_init(&replay.turn_over, NULL);
+    pthread_cond_init(&replay.transaction_over, NULL);
+    replay.next_ticket = 0;
+    replay.now_serving = 0;
+    replay.transaction_owner = -1;
+    replay.paced = options.paced;
+    replay.num_threads = options.threads;
+
+    ReplayThread* threads = calloc(options.threads, sizeof(ReplayThread));
+    replay.start_ns = monotonic_time_ns();
+    for (uint32_t i = 0; i < options.threads; i++) {
+        threads[i].replay = &replay;
+        threads[i].thread_num = i;
+        pthread_create(&threads[i].thread, NULL, replay_thread, &threads[i]);
+    }
+
+    uint64_t statements = 0;
+    uint64_t errors = 0;
+    uint64_t mismatches = 0;
+    LatencyHistogram latencies;
+    memset(&latencies, 0, sizeof(latencies));
+    for (uint32_t i = 0; i < options.threads; i++) {
+        pthread_join(threads[i].thread, NULL);
+        statements += threads[i].statements;
+        errors += threads[i].errors;
+        mismatches += threads[i].mismatches;
+        merge_latencies(&latencies, &threads[i].latencies);
+    }
+    double seconds = (monotonic_time_ns() - replay.start_ns) / 1e9;
+
+    printf("{\"statements\": %" PRIu64 ", \"threads\": %" PRIu32 ", \"paced\": %s, \"seconds\": %.6f"
+           ", \"statements_per_sec\": %.1f, \"mean_ns\": %" PRIu64 ", \"p50_ns\": %" PRIu64 ", \"p99_ns\": %" PRIu64
+           ", \"p999_ns\": %" PRIu64 ", \"max_ns\": %" PRIu64 ", \"errors\": %" PRIu64 ", \"mismatches\": %" PRIu64 "}\n",
+           statements, options.threads, options.paced ? "true" : "false", seconds,
+           seconds > 0 ? statements / seconds : 0.0,
+           latencies.count > 0 ? latencies.total_ns / latencies.count : 0,
+           latency_percentile(&latencies, 500), latency_percentile(&latencies, 990),
+           latency_percentile(&latencies, 999), latencies.max_ns, errors, mismatches);
+
+    int status = EXIT_SUCCESS;
+    if (simplesqlite_close(replay.db) != SIMPLESQLITE_OK) {
+        printf("Error closing db file.\n");
+        status = EXIT_FAILURE;
+    }
+    for (uint64_t i = 0; i < replay.num_records; i++) {
+        capture_record_free(&replay.records[i]);
+    }
+    free(replay.records);
+    free(threads);
+    pthread_mutex_destroy(&replay.lock);
+    pthread_cond_destroy(&replay.turn_over);
+    pthread_cond_destroy(&replay.transaction_over);
+    return status;
+}
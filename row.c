@@ -1,20 +1,141 @@
 #include "row.h"
-#include "constants.h"
 #include <string.h>
 #include <stdio.h>
+#include <inttypes.h>
+
+/**
+ *
+ * Every function here is expanded from ROW_SCHEMA, one statement or case per column, so each
+ * column is copied with its own constant offset and size. Strings are read up to their
+ * terminator only. When they are written the rest of the slot is zeroed: a slot may still hold
+ * a longer value from before an update or a cell shift, and stale bytes would both stay
+ * readable in the file and compress worse than zeros.
+ *
+ */
+
+static void copy_text(char* destination, const char* source, uint32_t size) {
+    size_t length = strnlen(source, size - 1);
+    memcpy(destination, source, length);
+    destination[length] = '\0';
+}
+
+static void write_text(char* destination, const char* source, uint32_t size) {
+    size_t length = strnlen(source, size - 1);
+    memcpy(destination, source, length);
+    memset(destination + length, 0, size - length);
+}
+
+static void serialize_key(uint64_t key, char* destination) {
+    uint32_t id = (uint32_t)key;
+    memcpy(destination, &id, sizeof(id));
+}
+
+static uint64_t deserialize_key(const char* source) {
+    uint32_t id;
+    memcpy(&id, source, sizeof(id));
+    return id;
+}
+
+#define SERIALIZE_KEY(name, NAME) serialize_key(source->name, destination + NAME##_OFFSET);
+#define SERIALIZE_TEXT(name, NAME, size) write_text(destination + NAME##_OFFSET, source->name, size);
 
 void serialize_row(Row* source, char* destination) {
-    memcpy(destination + ID_OFFSET, &(source->id), ID_SIZE);
-    strncpy(destination + USERNAME_OFFSET, source->username, USERNAME_SIZE);
-    strncpy(destination + EMAIL_OFFSET, source->email, EMAIL_SIZE);
+    ROW_SCHEMA(SERIALIZE_KEY, SERIALIZE_TEXT)
+}
+
+#define SERIALIZE_KEY_CASE(name, NAME) case (COLUMN_##NAME): SERIALIZE_KEY(name, NAME) break;
+#define SERIALIZE_TEXT_CASE(name, NAME, size) case (COLUMN_##NAME): SERIALIZE_TEXT(name, NAME, size) break;
+
+// Overwrites one column of a serialized row and leaves the others as they are
+void serialize_column(Row* source, Column column, char* destination) {
+    switch (column) {
+        ROW_SCHEMA(SERIALIZE_KEY_CASE, SERIALIZE_TEXT_CASE)
+        case (NUM_COLUMNS):
+            break;
+    }
 }
 
+#define DESERIALIZE_KEY(name, NAME) destination->name = deserialize_key(source + NAME##_OFFSET);
+#define DESERIALIZE_TEXT(name, NAME, size) copy_text(destination->name, source + NAME##_OFFSET, size);
+
 void deserialize_row(char* source, Row* destination) {
-    memcpy(&(destination->id), source + ID_OFFSET, ID_SIZE);
-    memcpy(&(destination->username), source + USERNAME_OFFSET, USERNAME_SIZE);
-    memcpy(&(destination->email), source + EMAIL_OFFSET, EMAIL_SIZE);
+    ROW_SCHEMA(DESERIALIZE_KEY, DESERIALIZE_TEXT)
+}
+
+#define COMPARE_KEY_CASE(name, NAME) \
+    case (COLUMN_##NAME): \
+        return left_key < right_key ? -1 : (left_key > right_key ? 1 : 0);
+#define COMPARE_TEXT_CASE(name, NAME, size) \
+    case (COLUMN_##NAME): \
+        return strncmp(left + NAME##_OFFSET, right + NAME##_OFFSET, size);
+
+// Orders two serialized rows by one column, the key stands in for the id slot
+int compare_serialized_column(Column column, uint64_t left_key, const char* left, uint64_t right_key, const char* right) {
+    switch (column) {
+        ROW_SCHEMA(COMPARE_KEY_CASE, COMPARE_TEXT_CASE)
+        case (NUM_COLUMNS):
+            break;
+    }
+    return 0;
 }
 
+#define PRINT_KEY(name, NAME) printf("%s%" PRIu64, COLUMN_##NAME == 0 ? "(" : ", ", row->name);
+#define PRINT_TEXT(name, NAME, size) printf("%s%s", COLUMN_##NAME == 0 ? "(" : ", ", row->name);
+
 void print_row(Row* row) {
-    printf("(%d, %s, %s)\n", row->id, row->username, row->email);
+    ROW_SCHEMA(PRINT_KEY, PRINT_TEXT)
+    printf(")\n");
+}
+
+#define NAME_KEY(name, NAME) #name,
+#define NAME_TEXT(name, NAME, size) #name,
+#define OFFSET_KEY(name, NAME) NAME##_OFFSET,
+#define OFFSET_TEXT(name, NAME, size) NAME##_OFFSET,
+#define SIZE_KEY(name, NAME) NAME##_SIZE,
+#define SIZE_TEXT(name, NAME, size) size,
+#define IS_TEXT_KEY(name, NAME) false,
+#define IS_TEXT_TEXT(name, NAME, size) true,
+
+static const char* COLUMN_NAMES[NUM_COLUMNS] = { ROW_SCHEMA(NAME_KEY, NAME_TEXT) };
+static const uint32_t COLUMN_OFFSETS[NUM_COLUMNS] = { ROW_SCHEMA(OFFSET_KEY, OFFSET_TEXT) };
+static const uint32_t COLUMN_SIZES[NUM_COLUMNS] = { ROW_SCHEMA(SIZE_KEY, SIZE_TEXT) };
+static const bool COLUMN_IS_TEXT[NUM_COLUMNS] = { ROW_SCHEMA(IS_TEXT_KEY, IS_TEXT_TEXT) };
+
+bool parse_column(const char* name, Column* column) {
+    for (uint32_t i = 0; i < NUM_COLUMNS; i++) {
+        if (strcmp(name, COLUMN_NAMES[i]) == 0) {
+            *column = (Column)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char* column_name(Column column) {
+    return COLUMN_NAMES[column];
+}
+
+bool is_text_column(Column column) {
+    return COLUMN_IS_TEXT[column];
+}
+
+uint32_t column_offset(Column column) {
+    return COLUMN_OFFSETS[column];
+}
+
+uint32_t column_size(Column column) {
+    return COLUMN_SIZES[column];
+}
+
+#define TEXT_KEY_CASE(name, NAME) case (COLUMN_##NAME): return NULL;
+#define TEXT_TEXT_CASE(name, NAME, size) case (COLUMN_##NAME): return row->name;
+
+// Where a text column lives in an unserialized row, NULL for the id
+char* row_text(Row* row, Column column) {
+    switch (column) {
+        ROW_SCHEMA(TEXT_KEY_CASE, TEXT_TEXT_CASE)
+        case (NUM_COLUMNS):
+            break;
+    }
+    return NULL;
 }
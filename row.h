@@ -1,16 +1,58 @@
 #ifndef ROW_H
 #define ROW_H
 
+#include "schema.h"
+#include <stddef.h>
 #include <stdint.h>
+#include <stdbool.h>
+
+#define ROW_KEY_FIELD(name, NAME) uint64_t name;
+#define ROW_TEXT_FIELD(name, NAME, size) char name[size];
 
 typedef struct {
-    uint32_t id;
-    char username[32];
-    char email[256];
+    ROW_SCHEMA(ROW_KEY_FIELD, ROW_TEXT_FIELD)
 } Row;
 
+// A row as it is stored in a leaf cell. Only byte arrays, so the compiler adds no padding
+#define SERIALIZED_KEY_FIELD(name, NAME) uint8_t name[sizeof(uint32_t)];
+#define SERIALIZED_TEXT_FIELD(name, NAME, size) char name[size];
+
+typedef struct {
+    ROW_SCHEMA(SERIALIZED_KEY_FIELD, SERIALIZED_TEXT_FIELD)
+} SerializedRow;
+
+#define COLUMN_KEY_ENUM(name, NAME) COLUMN_##NAME,
+#define COLUMN_TEXT_ENUM(name, NAME, size) COLUMN_##NAME,
+
+typedef enum {
+    ROW_SCHEMA(COLUMN_KEY_ENUM, COLUMN_TEXT_ENUM)
+    NUM_COLUMNS
+} Column;
+
+// <NAME>_SIZE and <NAME>_OFFSET for every column, COLUMN_<NAME>_LENGTH for text columns
+#define ROW_KEY_LAYOUT(name, NAME) \
+    NAME##_SIZE = sizeof(((SerializedRow*)0)->name), \
+    NAME##_OFFSET = offsetof(SerializedRow, name),
+#define ROW_TEXT_LAYOUT(name, NAME, size) \
+    NAME##_SIZE = size, \
+    NAME##_OFFSET = offsetof(SerializedRow, name), \
+    COLUMN_##NAME##_LENGTH = size - 1,
+
+enum {
+    ROW_SCHEMA(ROW_KEY_LAYOUT, ROW_TEXT_LAYOUT)
+    ROW_SIZE = sizeof(SerializedRow)
+};
+
 void serialize_row(Row* source, char* destination);
+void serialize_column(Row* source, Column column, char* destination);
 void deserialize_row(char* source, Row* destination);
+int compare_serialized_column(Column column, uint64_t left_key, const char* left, uint64_t right_key, const char* right);
 void print_row(Row* row);
+bool parse_column(const char* name, Column* column);
+const char* column_name(Column column);
+bool is_text_column(Column column);
+uint32_t column_offset(Column column);
+uint32_t column_size(Column column);
+char* row_text(Row* row, Column column);
 
 #endif
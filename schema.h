@@ -0,0 +1,23 @@
+#ifndef SCHEMA_H
+#define SCHEMA_H
+
+/**
+ *
+ * Row Schema
+ *
+ * The columns of a row, in the order they are stored, printed and inserted. row.h and row.c
+ * expand this list into the Row struct, the Column enum, the serialized layout with its sizes
+ * and offsets, and one serialize, deserialize, compare and parse case per column. Adding a
+ * column is one line here.
+ *
+ * KEY(name, NAME): the id, kept in the cell key, whose slot in the value is 32 bits wide
+ * TEXT(name, NAME, size): a zero terminated string, size counts the terminator
+ *
+ */
+
+#define ROW_SCHEMA(KEY, TEXT) \
+    KEY(id, ID) \
+    TEXT(username, USERNAME, 32) \
+    TEXT(email, EMAIL, 256)
+
+#endif
@@ -0,0 +1,649 @@
+#include "simplesqlite.h"
+#include "options.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+
+/**
+ *
+ * Server
+ *
+ * One process owns the database and serves every client over a Unix domain socket, so all of
+ * them share one page cache and there is a single writer. A single thread runs a non-blocking
+ * epoll loop. The protocol is line based:
+ *
+ *   request: one statement per line, `.exit` closes the connection, `.stats` asks for statistics,
+ *            `.stats tree` for the shape of every table, `.defrag` lays the pages out in key order
+ *   reply:   one line per row, "(1, ben, ben@gmail.com)", then "OK" or "ERR <message>",
+ *            statistics come back as one line of JSON followed by "OK"
+ *
+ * Clients may pipeline: every complete line that has arrived is executed in order, and the
+ * replies are collected in the connection's output buffer and sent with as few writes as the
+ * socket allows. A connection that begins a transaction owns the database until it commits or
+ * rolls back, requests from other connections wait in their input buffers meanwhile.
+ *
+ * A select is stepped a slice of rows at a time, and other connections are served between two
+ * slices. The select reads a snapshot, so a long one neither holds up writers nor sees what
+ * they write, and one whose client reads slowly simply pauses at the output high water. An
+ * order by reads its rows into the sorter a batch per slice the same way, only sorting the rows
+ * held in memory and merging spilled runs down to one last pass take a single step.
+ * `.defrag` is sliced the same way, a few pages per turn, and waits while a transaction is open.
+ *
+ */
+
+#define MAX_EVENTS 64
+#define MAX_REQUEST_LENGTH (64 * 1024)
+#define OUTPUT_HIGH_WATER (1024 * 1024) // Stop executing requests until the client reads its replies
+#define ROWS_PER_SLICE 256
+#define DEFRAG_PAGES_PER_SLICE 64
+
+typedef struct {
+    char* data;
+    size_t length;
+    size_t capacity;
+    bool failed; // Could not grow, what was appended since is lost and the connection gets closed
+} Buffer;
+
+typedef struct Connection {
+    int fd;
+    uint64_t id; // Registered with epoll in place of the pointer, never reused
+    uint32_t session; // Its statements are captured under this session
+    Buffer input;
+    Buffer output;
+    size_t output_sent; // Bytes at the front of output already written to the socket
+    bool read_closed; // The client sent EOF, its remaining requests are still answered
+    uint32_t watched_events; // Events registered with epoll, 0 when not registered
+    SimpleSqliteStmt* statement; // Statement with rows still to send, NULL between requests
+    bool defragmenting; // Running `.defrag`, replied to once every page is in place
+    struct Connection* next;
+} Connection;
+
+typedef struct {
+    SimpleSqlite* db;
+    int epoll_fd;
+    int listen_fd;
+    Connection* connections;
+    Connection* transaction_owner; // Connection whose transaction is open, NULL outside one
+    uint64_t next_connection_id;
+} Server;
+
+static volatile sig_atomic_t stopping = false;
+
+static void handle_stop_signal(int signal_number) {
+    stopping = true;
+}
+
+void print_usage(void) {
+    printf("Usage: simpleSQLiteServer [options] <socket path> <filename>\n");
+    print_config_usage();
+}
+
+static bool buffer_reserve(Buffer* buffer, size_t additional) {
+    if (buffer->failed) {
+        return false;
+    }
+    if (buffer->length + additional <= buffer->capacity) {
+        return true;
+    }
+
+    size_t new_capacity = buffer->capacity == 0 ? 4096 : buffer->capacity;
+    while (new_capacity < buffer->length + additional) {
+        new_capacity *= 2;
+    }
+    char* data = realloc(buffer->data, new_capacity);
+    if (data == NULL) {
+        buffer->failed = true;
+        return false;
+    }
+    buffer->data = data;
+    buffer->capacity = new_capacity;
+    return true;
+}
+
+static void buffer_append(Buffer* buffer, const char* data, size_t length) {
+    if (!buffer_reserve(buffer, length)) {
+        return;
+    }
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
+}
+
+static void buffer_append_string(Buffer* buffer, const char* text) {
+    buffer_append(buffer, text, strlen(text));
+}
+
+// Drops the first `length` bytes
+static void buffer_consume(Buffer* buffer, size_t length) {
+    memmove(buffer->data, buffer->data + length, buffer->length - length);
+    buffer->length -= length;
+}
+
+static void set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        printf("Error making socket non-blocking: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/**
+ *
+ * Registers for reads until the client closes its end, and for writes while replies are
+ * pending. A connection that wants neither, because it is closed for reading and its requests
+ * wait for another connection's transaction, is taken out of epoll so a hang-up does not spin.
+ *
+ */
+static void update_watch(Server* server, Connection* connection) {
+    uint32_t events = 0;
+    if (!connection->read_closed) {
+        events |= EPOLLIN;
+    }
+    if (connection->output.length > connection->output_sent) {
+        events |= EPOLLOUT;
+    }
+    if (events == connection->watched_events) {
+        return;
+    }
+
+    struct epoll_event event;
+    event.events = events;
+    event.data.u64 = connection->id;
+    int operation = connection->watched_events == 0 ? EPOLL_CTL_ADD : events == 0 ? EPOLL_CTL_DEL : EPOLL_CTL_MOD;
+    if (epoll_ctl(server->epoll_fd, operation, connection->fd, &event) == -1) {
+        printf("Error updating epoll registration: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+    connection->watched_events = events;
+}
+
+static void append_row(Buffer* output, SimpleSqliteStmt* stmt) {
+    buffer_append_string(output, "(");
+    for (uint32_t i = 0; i < simplesqlite_column_count(stmt); i++) {
+        if (i > 0) {
+            buffer_append_string(output, ", ");
+        }
+        buffer_append_string(output, simplesqlite_column_text(stmt, i));
+    }
+    buffer_append_string(output, ")\n");
+}
+
+static void append_error(Buffer* output, const char* message) {
+    buffer_append_string(output, "ERR ");
+    buffer_append_string(output, message);
+    buffer_append_string(output, "\n");
+}
+
+// Runs the connection's statement for up to a slice of rows, returns true once it is finished
+static bool step_statement(Server* server, Connection* connection) {
+    SimpleSqliteStmt* stmt = connection->statement;
+    SimpleSqliteResult result;
+    uint32_t num_rows = 0;
+    simplesqlite_set_session(server->db, connection->session);
+    while ((result = simplesqlite_step_slice(stmt)) == SIMPLESQLITE_ROW || result == SIMPLESQLITE_PENDING) {
+        // A batch of rows going into a sort takes a whole slice
+        if (result == SIMPLESQLITE_PENDING) {
+            return false;
+        }
+        append_row(&connection->output, stmt);
+        if (++num_rows == ROWS_PER_SLICE) {
+            return false;
+        }
+    }
+    if (result == SIMPLESQLITE_DONE) {
+        buffer_append_string(&connection->output, "OK\n");
+    } else {
+        append_error(&connection->output, simplesqlite_errmsg(server->db));
+    }
+    simplesqlite_finalize(stmt);
+    connection->statement = NULL;
+
+    // A select finishing while another connection owns the transaction leaves it with that connection
+    if (server->transaction_owner == NULL || server->transaction_owner == connection) {
+        server->transaction_owner = simplesqlite_in_transaction(server->db) ? connection : NULL;
+    }
+    return true;
+}
+
+static void execute_request(Server* server, Connection* connection, const char* sql) {
+    if (simplesqlite_prepare(server->db, sql, &connection->statement) != SIMPLESQLITE_OK) {
+        connection->statement = NULL;
+        append_error(&connection->output, simplesqlite_errmsg(server->db));
+        return;
+    }
+    step_statement(server, connection);
+}
+
+// Moves up to a slice of pages, returns true once the layout is done or failed
+static bool step_defrag(Server* server, Connection* connection) {
+    SimpleSqliteDefragStats stats;
+    if (simplesqlite_defrag(server->db, DEFRAG_PAGES_PER_SLICE, &stats) != SIMPLESQLITE_OK) {
+        append_error(&connection->output, simplesqlite_errmsg(server->db));
+    } else if (!stats.done) {
+        return false;
+    } else {
+        buffer_append_string(&connection->output, "OK\n");
+    }
+    connection->defragmenting = false;
+    return true;
+}
+
+// With tree the shape of every table, which walks the whole file before anyone else is served
+static void append_stats(Server* server, Connection* connection, bool tree) {
+    char* text;
+    size_t length;
+    FILE* out = open_memstream(&text, &length);
+    if (out == NULL) {
+        append_error(&connection->output, "Out of memory");
+        return;
+    }
+    SimpleSqliteResult result = tree ? simplesqlite_print_tree_shape(server->db, out, true)
+                                     : simplesqlite_print_stats(server->db, out, true);
+    fclose(out);
+
+    if (result == SIMPLESQLITE_OK) {
+        buffer_append(&connection->output, text, length);
+        buffer_append_string(&connection->output, "OK\n");
+    } else {
+        append_error(&connection->output, simplesqlite_errmsg(server->db));
+    }
+    free(text);
+}
+
+static bool connection_failed(Connection* connection) {
+    return connection->input.failed || connection->output.failed;
+}
+
+static bool connection_done(Connection* connection) {
+    return connection->read_closed && connection->input.length == 0 && connection->statement == NULL &&
+           !connection->defragmenting;
+}
+
+/**
+ *
+ * Executes the complete requests waiting in the connection's input, in order. Stops early while
+ * another connection owns the transaction or the client is slow to read its replies, and after
+ * each slice of a select so that other connections get a turn.
+ *
+ */
+static void process_requests(Server* server, Connection* connection) {
+    while (connection->output.length < OUTPUT_HIGH_WATER && !connection_failed(connection)) {
+        // A select already running reads its snapshot, another connection's transaction does not hold it up
+        if (connection->statement != NULL) {
+            if (!step_statement(server, connection)) {
+                return;
+            }
+            continue;
+        }
+
+        if (server->transaction_owner != NULL && server->transaction_owner != connection) {
+            return;
+        }
+
+        // Moving pages rewrites the tree, so it waits for the transaction like any other write
+        if (connection->defragmenting) {
+            if (!step_defrag(server, connection)) {
+                return;
+            }
+            continue;
+        }
+
+        if (connection->input.length == 0) {
+            return;
+        }
+        char* newline = memchr(connection->input.data, '\n', connection->input.length);
+        if (newline == NULL) {
+            // A trailing request without a newline still counts once the client has closed
+            if (!connection->read_closed) {
+                return;
+            }
+            buffer_append(&connection->input, "\n", 1);
+            continue;
+        }
+
+        size_t line_length = newline - connection->input.data;
+        *newline = '\0';
+        if (line_length > 0 && connection->input.data[line_length - 1] == '\r') {
+            connection->input.data[line_length - 1] = '\0';
+        }
+
+        if (strcmp(connection->input.data, ".exit") == 0) {
+            connection->read_closed = true;
+            connection->input.length = 0;
+            return;
+        }
+        if (strcmp(connection->input.data, ".stats") == 0 || strcmp(connection->input.data, ".stats tree") == 0) {
+            append_stats(server, connection, strcmp(connection->input.data, ".stats tree") == 0);
+        } else if (strcmp(connection->input.data, ".defrag") == 0) {
+            connection->defragmenting = !step_defrag(server, connection);
+        } else if (connection->input.data[0] == '.') {
+            buffer_append_string(&connection->output, "ERR Unrecognized command '");
+            buffer_append_string(&connection->output, connection->input.data);
+            buffer_append_string(&connection->output, "'\n");
+        } else {
+            execute_request(server, connection, connection->input.data);
+        }
+        buffer_consume(&connection->input, line_length + 1);
+        if (connection->statement != NULL || connection->defragmenting) {
+            return;
+        }
+    }
+}
+
+static void close_connection(Server* server, Connection* connection) {
+    simplesqlite_finalize(connection->statement);
+
+    // A transaction left open by a client that went away is abandoned
+    if (server->transaction_owner == connection) {
+        SimpleSqliteStmt* stmt;
+        if (simplesqlite_prepare(server->db, "rollback", &stmt) == SIMPLESQLITE_OK) {
+            simplesqlite_set_session(server->db, connection->session);
+            simplesqlite_step(stmt);
+            simplesqlite_finalize(stmt);
+        }
+        server->transaction_owner = NULL;
+    }
+
+    Connection** link = &server->connections;
+    while (*link != connection) {
+        link = &(*link)->next;
+    }
+    *link = connection->next;
+
+    close(connection->fd);
+    free(connection->input.data);
+    free(connection->output.data);
+    free(connection);
+}
+
+/**
+ *
+ * Sends as much of the output as the socket takes. Returns false once the connection is gone,
+ * either because the client disconnected or because everything it asked for was answered. A
+ * connection whose buffers could not grow is told so and closed, the others keep being served.
+ *
+ */
+static bool flush_output(Server* server, Connection* connection) {
+    if (connection_failed(connection)) {
+        static const char out_of_memory[] = "ERR Out of memory\n";
+        send(connection->fd, out_of_memory, sizeof(out_of_memory) - 1, MSG_NOSIGNAL);
+        close_connection(server, connection);
+        return false;
+    }
+
+    while (connection->output_sent < connection->output.length) {
+        ssize_t bytes_written = send(connection->fd, connection->output.data + connection->output_sent,
+                                     connection->output.length - connection->output_sent, MSG_NOSIGNAL);
+        if (bytes_written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            close_connection(server, connection);
+            return false;
+        }
+        connection->output_sent += bytes_written;
+    }
+
+    if (connection->output_sent == connection->output.length) {
+        connection->output.length = 0;
+        connection->output_sent = 0;
+    }
+
+    if (connection->output.length == 0 && connection_done(connection)) {
+        close_connection(server, connection);
+        return false;
+    }
+    update_watch(server, connection);
+    return true;
+}
+
+static void read_requests(Server* server, Connection* connection) {
+    while (!connection->read_closed) {
+        if (!buffer_reserve(&connection->input, 4096)) {
+            break;
+        }
+        ssize_t bytes_read = recv(connection->fd, connection->input.data + connection->input.length,
+                                  connection->input.capacity - connection->input.length, 0);
+        if (bytes_read == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                connection->read_closed = true;
+            }
+            break;
+        }
+        if (bytes_read == 0) {
+            connection->read_closed = true;
+            break;
+        }
+        connection->input.length += bytes_read;
+
+        if (connection->input.length > MAX_REQUEST_LENGTH &&
+            memchr(connection->input.data, '\n', connection->input.length) == NULL) {
+            append_error(&connection->output, "Request is too long.");
+            connection->read_closed = true;
+            connection->input.length = 0;
+            break;
+        }
+    }
+}
+
+static void accept_connections(Server* server) {
+    while (true) {
+        int fd = accept(server->listen_fd, NULL, NULL);
+        if (fd == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        set_nonblocking(fd);
+
+        Connection* connection = calloc(1, sizeof(Connection));
+        if (connection == NULL) {
+            close(fd);
+            continue;
+        }
+        connection->fd = fd;
+        connection->id = ++server->next_connection_id;
+        connection->session = (uint32_t)connection->id;
+        connection->next = server->connections;
+        server->connections = connection;
+        update_watch(server, connection);
+    }
+}
+
+// NULL once the connection is closed
+static Connection* find_connection(Server* server, uint64_t id) {
+    Connection* connection = server->connections;
+    while (connection != NULL && connection->id != id) {
+        connection = connection->next;
+    }
+    return connection;
+}
+
+// Requests held back by a transaction can run once it is over
+static void resume_waiting_connections(Server* server) {
+    Connection* connection = server->connections;
+    while (connection != NULL && server->transaction_owner == NULL) {
+        Connection* next = connection->next;
+        if (connection->input.length > 0) {
+            process_requests(server, connection);
+            flush_output(server, connection);
+        }
+        connection = next;
+    }
+}
+
+// A select with rows left or a `.defrag` with pages left, the latter only outside a transaction
+static bool has_pending_work(Server* server, Connection* connection) {
+    return (connection->statement != NULL || (connection->defragmenting && server->transaction_owner == NULL)) &&
+           connection->output.length < OUTPUT_HIGH_WATER;
+}
+
+// Pending work keeps going between events, a slice per connection per pass
+static bool run_pending_statements(Server* server) {
+    bool pending = false;
+    Connection* connection = server->connections;
+    while (connection != NULL) {
+        Connection* next = connection->next;
+        if (has_pending_work(server, connection)) {
+            Connection* owner = server->transaction_owner;
+            process_requests(server, connection);
+            if (flush_output(server, connection) && has_pending_work(server, connection)) {
+                pending = true;
+            }
+            if (owner != NULL && server->transaction_owner == NULL) {
+                resume_waiting_connections(server);
+            }
+        }
+        connection = next;
+    }
+    return pending;
+}
+
+static void handle_connection_event(Server* server, Connection* connection, uint32_t events) {
+    if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+        read_requests(server, connection);
+    }
+
+    Connection* owner = server->transaction_owner;
+    process_requests(server, connection);
+
+    // The client reading its replies may make room to execute more of its requests
+    if (flush_output(server, connection) && (events & EPOLLOUT) && connection->input.length > 0) {
+        process_requests(server, connection);
+        flush_output(server, connection);
+    }
+
+    if (owner != NULL && server->transaction_owner == NULL) {
+        resume_waiting_connections(server);
+    }
+}
+
+static int listen_on(const char* socket_path) {
+    struct sockaddr_un address;
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        printf("Socket path is too long.\n");
+        exit(EXIT_FAILURE);
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) {
+        printf("Unable to create socket: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+
+    // A socket file left by a previous server that did not shut down cleanly is replaced
+    unlink(socket_path);
+    if (bind(fd, (struct sockaddr*)&address, sizeof(address)) == -1 || listen(fd, SOMAXCONN) == -1) {
+        printf("Unable to listen on %s: %d\n", socket_path, errno);
+        exit(EXIT_FAILURE);
+    }
+    set_nonblocking(fd);
+
+    return fd;
+}
+
+int main(int argc, char* argv[]) {
+    SimpleSqliteConfig config;
+    if (!parse_config_arguments(argc, argv, &config) || argc - optind != 2) {
+        print_usage();
+        exit(EXIT_FAILURE);
+    }
+    const char* socket_path = argv[optind];
+    const char* filename = argv[optind + 1];
+
+    Server server;
+    server.connections = NULL;
+    server.transaction_owner = NULL;
+    server.next_connection_id = 0;
+    if (simplesqlite_open(filename, &config, &server.db) != SIMPLESQLITE_OK) {
+        printf("%s\n", simplesqlite_errmsg(server.db));
+        simplesqlite_close(server.db);
+        exit(EXIT_FAILURE);
+    }
+
+    // Without SA_RESTART the signal interrupts epoll_wait, which is when the flag is checked
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handle_stop_signal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    server.listen_fd = listen_on(socket_path);
+    server.epoll_fd = epoll_create1(0);
+    if (server.epoll_fd == -1) {
+        printf("Unable to create epoll instance: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+
+    // The listening socket is registered as id 0, connections are numbered from 1
+    struct epoll_event listen_event;
+    listen_event.events = EPOLLIN;
+    listen_event.data.u64 = 0;
+    if (epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.listen_fd, &listen_event) == -1) {
+        printf("Error updating epoll registration: %d\n", errno);
+        exit(EXIT_FAILURE);
+    }
+
+    printf("Listening on %s\n", socket_path);
+    fflush(stdout);
+
+    struct epoll_event events[MAX_EVENTS];
+    bool statements_pending = false;
+    while (!stopping) {
+        // Only poll while a select or a `.defrag` has work left, otherwise sleep until a client needs something
+        int num_events = epoll_wait(server.epoll_fd, events, MAX_EVENTS, statements_pending ? 0 : -1);
+        if (num_events == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            printf("Error waiting for events: %d\n", errno);
+            break;
+        }
+
+        for (int i = 0; i < num_events; i++) {
+            if (events[i].data.u64 == 0) {
+                accept_connections(&server);
+                continue;
+            }
+
+            // An earlier event in this batch may have closed the connection. Its id is not reused,
+            // even by a connection accepted since into the same memory
+            Connection* connection = find_connection(&server, events[i].data.u64);
+            if (connection != NULL) {
+                handle_connection_event(&server, connection, events[i].events);
+            }
+        }
+
+        statements_pending = run_pending_statements(&server);
+    }
+
+    while (server.connections != NULL) {
+        close_connection(&server, server.connections);
+    }
+    close(server.listen_fd);
+    close(server.epoll_fd);
+    unlink(socket_path);
+
+    if (simplesqlite_close(server.db) != SIMPLESQLITE_OK) {
+        printf("Error closing db file.\n");
+        exit(EXIT_FAILURE);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,666 @@
+#include "simplesqlite.h"
+#include "db_error.h"
+#include "table.h"
+#include "statement.h"
+#include "catalog.h"
+#include "stats.h"
+#include "checksum.h"
+#include "backup.h"
+#include "import.h"
+#include "defrag.h"
+#include "capture.h"
+#include "page_trace.h"
+#include "constants.h"
+#include "utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+struct SimpleSqlite {
+    Table* table; // NULL when opening failed
+    DbError error; // Outcome of the last call that failed
+    char* stats_json_path;
+    LatencyHistogram latencies[NUM_STATEMENT_TYPES];
+    Capture* capture; // NULL unless statements are captured
+    uint32_t session; // Captured with the statements started from now on
+    Defrag* defrag; // NULL unless a defragmentation is under way
+    uint64_t statement_runs; // Numbers the runs of statements in a page trace
+};
+
+struct SimpleSqliteStmt {
+    SimpleSqlite* db;
+    Statement statement;
+    SelectScan scan;
+    bool running; // Stepped since the last reset and not finished yet
+    uint64_t elapsed_ns; // Time spent executing so far, every step of a select adds to it
+    char id_text[21]; // Decimal text of the id column of the current row
+    uint64_t start_ns; // First step of the current run
+    uint64_t rows; // Rows returned by the current run
+    uint32_t session;
+    uint64_t run; // Pages fetched for the current run are traced under this number
+    char* sql; // Only kept while capturing, like the text of the bound values
+    char* parameter_text[MAX_PARAMETERS];
+};
+
+void simplesqlite_config_init(SimpleSqliteConfig* config) {
+    initialize_db_config(config);
+}
+
+SimpleSqliteResult simplesqlite_open(const char* filename, const SimpleSqliteConfig* config, SimpleSqlite** db) {
+    SimpleSqlite* handle = malloc(sizeof(SimpleSqlite));
+    *db = handle;
+    if (handle == NULL) {
+        return SIMPLESQLITE_NO_MEMORY;
+    }
+    handle->table = NULL;
+    clear_db_error(&handle->error);
+    handle->stats_json_path = NULL;
+    memset(handle->latencies, 0, sizeof(handle->latencies));
+    handle->capture = NULL;
+    handle->session = 0;
+    handle->defrag = NULL;
+    handle->statement_runs = 0;
+
+    SimpleSqliteConfig defaults;
+    if (config == NULL) {
+        simplesqlite_config_init(&defaults);
+        config = &defaults;
+    }
+    if (config->stats_json_path != NULL) {
+        handle->stats_json_path = malloc(strlen(config->stats_json_path) + 1);
+        if (handle->stats_json_path == NULL) {
+            set_db_error(&handle->error, SIMPLESQLITE_NO_MEMORY, "Out of memory");
+            return handle->error.code;
+        }
+        strcpy(handle->stats_json_path, config->stats_json_path);
+    }
+    if (config->key_size != NARROW_KEY_SIZE && config->key_size != WIDE_KEY_SIZE) {
+        set_db_error(&handle->error, SIMPLESQLITE_MISUSE, "Key size must be %" PRIu32 " or %" PRIu32 " bytes.",
+                     NARROW_KEY_SIZE, WIDE_KEY_SIZE);
+        return handle->error.code;
+    }
+
+    if (config->capture_path != NULL) {
+        handle->capture = capture_open(config->capture_path, &handle->error);
+        if (handle->capture == NULL) {
+            return handle->error.code;
+        }
+    }
+
+    handle->table = db_open(filename, config, &handle->error);
+    return handle->error.code;
+}
+
+SimpleSqliteResult simplesqlite_close(SimpleSqlite* db) {
+    if (db == NULL) {
+        return SIMPLESQLITE_OK;
+    }
+
+    SimpleSqliteResult result = SIMPLESQLITE_OK;
+    if (db->table != NULL && db->stats_json_path != NULL) {
+        FILE* out = fopen(db->stats_json_path, "w");
+        if (out == NULL) {
+            result = SIMPLESQLITE_IO_ERROR;
+        } else {
+            simplesqlite_print_stats(db, out, true);
+            if (fclose(out) != 0) {
+                result = SIMPLESQLITE_IO_ERROR;
+            }
+        }
+    }
+    if (db->table != NULL) {
+        DbError error;
+        if (!db_close(db->table, &error)) {
+            result = error.code;
+        }
+    }
+    if (db->capture != NULL && !capture_close(db->capture, &db->error)) {
+        result = db->error.code;
+    }
+    defrag_free(db->defrag);
+    free(db->stats_json_path);
+    free(db);
+
+    return result;
+}
+
+const char* simplesqlite_errmsg(SimpleSqlite* db) {
+    if (db == NULL) {
+        return "Out of memory";
+    }
+    return db->error.message;
+}
+
+bool simplesqlite_in_transaction(SimpleSqlite* db) {
+    return db->table != NULL && db->table->pager->in_transaction;
+}
+
+void simplesqlite_set_session(SimpleSqlite* db, uint32_t session) {
+    db->session = session;
+}
+
+// Tags the pages the calling thread fetches from now on, when they are traced
+static void trace_operation(SimpleSqlite* db, PageOperation operation, uint64_t run) {
+    if (db->table->pager->page_trace != NULL) {
+        page_trace_begin(db->table->pager->page_trace, operation, run);
+    }
+}
+
+static char* copy_string(const char* text) {
+    char* copy = malloc(strlen(text) + 1);
+    if (copy != NULL) {
+        strcpy(copy, text);
+    }
+    return copy;
+}
+
+// Called once a statement has run to the end, successfully or not
+static void capture_statement(SimpleSqliteStmt* stmt, SimpleSqliteResult result) {
+    CaptureRecord record;
+    record.start_ns = stmt->start_ns - stmt->db->capture->start_ns;
+    record.elapsed_ns = stmt->elapsed_ns;
+    record.session = stmt->session;
+    record.result = result;
+    record.rows = stmt->rows;
+    record.sql = stmt->sql;
+    record.num_parameters = stmt->statement.num_parameters;
+    memcpy(record.parameters, stmt->parameter_text, sizeof(record.parameters));
+    capture_write(stmt->db->capture, &record);
+}
+
+static SimpleSqliteResult prepare_error(SimpleSqlite* db, PrepareResult result, const char* sql) {
+    switch (result) {
+        case (PREPARE_SUCCESS):
+            break;
+        case (PREPARE_STRING_TOO_LONG):
+            set_db_error(&db->error, SIMPLESQLITE_TOO_BIG, "String is too long.");
+            break;
+        case (PREPARE_NEGATIVE_ID):
+            set_db_error(&db->error, SIMPLESQLITE_RANGE, "ID must be positive.");
+            break;
+        case (PREPARE_SYNTAX_ERROR):
+            set_db_error(&db->error, SIMPLESQLITE_ERROR, "Syntax error. Could not parse statement.");
+            break;
+        case (PREPARE_UNRECOGNIZED_STATEMENT):
+            set_db_error(&db->error, SIMPLESQLITE_ERROR, "Unrecognized keyword at start of '%s'.", sql);
+            break;
+    }
+    return result == PREPARE_SUCCESS ? SIMPLESQLITE_OK : db->error.code;
+}
+
+static SimpleSqliteResult execute_error(SimpleSqlite* db, ExecuteResult result) {
+    switch (result) {
+        case (EXECUTE_SUCCESS):
+            return SIMPLESQLITE_DONE;
+        case (EXECUTE_ROW):
+            return SIMPLESQLITE_ROW;
+        case (EXECUTE_DUPLICATE_KEY):
+            set_db_error(&db->error, SIMPLESQLITE_CONSTRAINT, "Error: Duplicate key.");
+            break;
+        case (EXECUTE_TABLE_FULL):
+            set_db_error(&db->error, SIMPLESQLITE_FULL, "Error: Table full.");
+            break;
+        case (EXECUTE_KEY_OUT_OF_RANGE):
+            set_db_error(&db->error, SIMPLESQLITE_RANGE, "Error: Key out of range.");
+            break;
+        case (EXECUTE_TRANSACTION_ALREADY_ACTIVE):
+            set_db_error(&db->error, SIMPLESQLITE_MISUSE, "Error: Transaction already active.");
+            break;
+        case (EXECUTE_NO_ACTIVE_TRANSACTION):
+            set_db_error(&db->error, SIMPLESQLITE_MISUSE, "Error: No active transaction.");
+            break;
+        case (EXECUTE_SORT_FAILED):
+            set_db_error(&db->error, SIMPLESQLITE_IO_ERROR, "Error: Unable to sort, out of memory or temporary space.");
+            break;
+        case (EXECUTE_KEY_NOT_FOUND):
+            set_db_error(&db->error, SIMPLESQLITE_NOT_FOUND, "Error: Key not found.");
+            break;
+        case (EXECUTE_TABLE_EXISTS):
+            set_db_error(&db->error, SIMPLESQLITE_CONSTRAINT, "Error: Table already exists.");
+            break;
+        case (EXECUTE_NO_SUCH_TABLE):
+            set_db_error(&db->error, SIMPLESQLITE_NOT_FOUND, "Error: No such table.");
+            break;
+        case (EXECUTE_CATALOG_FULL):
+            set_db_error(&db->error, SIMPLESQLITE_FULL, "Error: Too many tables.");
+            break;
+        case (EXECUTE_OUT_OF_MEMORY):
+            set_db_error(&db->error, SIMPLESQLITE_NO_MEMORY, "Out of memory");
+            break;
+        case (EXECUTE_PENDING):
+            return SIMPLESQLITE_PENDING;
+    }
+    return db->error.code;
+}
+
+SimpleSqliteResult simplesqlite_prepare(SimpleSqlite* db, const char* sql, SimpleSqliteStmt** stmt) {
+    *stmt = NULL;
+    if (db->table == NULL) {
+        set_db_error(&db->error, SIMPLESQLITE_MISUSE, "Database is not open.");
+        return db->error.code;
+    }
+
+    SimpleSqliteStmt* prepared = malloc(sizeof(SimpleSqliteStmt));
+    char* text = malloc(strlen(sql) + 1);
+    if (prepared == NULL || text == NULL) {
+        free(prepared);
+        free(text);
+        set_db_error(&db->error, SIMPLESQLITE_NO_MEMORY, "Out of memory");
+        return db->error.code;
+    }
+
+    // The parser tokenizes in place, the caller's text is left alone
+    strcpy(text, sql);
+    PrepareResult result = prepare_statement(text, &prepared->statement);
+    free(text);
+    if (result != PREPARE_SUCCESS) {
+        free(prepared);
+        return prepare_error(db, result, sql);
+    }
+
+    prepared->db = db;
+    prepared->running = false;
+    initialize_select_scan(&prepared->scan);
+    prepared->sql = NULL;
+    memset(prepared->parameter_text, 0, sizeof(prepared->parameter_text));
+    if (db->capture != NULL) {
+        prepared->sql = copy_string(sql);
+    }
+    *stmt = prepared;
+
+    return SIMPLESQLITE_OK;
+}
+
+uint32_t simplesqlite_bind_parameter_count(SimpleSqliteStmt* stmt) {
+    return stmt->statement.num_parameters;
+}
+
+static SimpleSqliteResult check_bind(SimpleSqliteStmt* stmt, uint32_t index) {
+    SimpleSqlite* db = stmt->db;
+    if (stmt->running) {
+        set_db_error(&db->error, SIMPLESQLITE_MISUSE, "Statement must be reset before binding.");
+        return db->error.code;
+    }
+    if (index == 0 || index > stmt->statement.num_parameters) {
+        set_db_error(&db->error, SIMPLESQLITE_RANGE, "Parameter %" PRIu32 " does not exist.", index);
+        return db->error.code;
+    }
+    return SIMPLESQLITE_OK;
+}
+
+// Parameters are numbered from 1, in the order the `?`s appear
+SimpleSqliteResult simplesqlite_bind_text(SimpleSqliteStmt* stmt, uint32_t index, const char* value) {
+    SimpleSqlite* db = stmt->db;
+    if (check_bind(stmt, index) != SIMPLESQLITE_OK) {
+        return db->error.code;
+    }
+    if (value == NULL) {
+        set_db_error(&db->error, SIMPLESQLITE_MISUSE, "Parameter %" PRIu32 " cannot be bound to NULL.", index);
+        return db->error.code;
+    }
+
+    SimpleSqliteResult result = prepare_error(db, bind_parameter(&stmt->statement, index - 1, value), value);
+    if (result == SIMPLESQLITE_OK && stmt->sql != NULL) {
+        free(stmt->parameter_text[index - 1]);
+        stmt->parameter_text[index - 1] = copy_string(value);
+    }
+    return result;
+}
+
+SimpleSqliteResult simplesqlite_bind_int64(SimpleSqliteStmt* stmt, uint32_t index, uint64_t value) {
+    char text[21];
+    snprintf(text, sizeof(text), "%" PRIu64, value);
+    return simplesqlite_bind_text(stmt, index, text);
+}
+
+// The capture keeps parameters as text, the ids are written out only while capturing
+static char* key_list_text(const uint64_t* values, uint32_t count) {
+    char* text = malloc((size_t)count * 21 + 1);
+    if (text == NULL) {
+        return NULL;
+    }
+    size_t length = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        length += sprintf(text + length, i == 0 ? "%" PRIu64 : ",%" PRIu64, values[i]);
+    }
+    text[length] = '\0';
+    return text;
+}
+
+SimpleSqliteResult simplesqlite_bind_int64_array(SimpleSqliteStmt* stmt, uint32_t index, const uint64_t* values,
+                                                 uint32_t count) {
+    SimpleSqlite* db = stmt->db;
+    if (check_bind(stmt, index) != SIMPLESQLITE_OK) {
+        return db->error.code;
+    }
+    if (stmt->statement.parameters[index - 1].target != PARAMETER_KEY_LIST) {
+        set_db_error(&db->error, SIMPLESQLITE_MISUSE, "Parameter %" PRIu32 " is not an id list.", index);
+        return db->error.code;
+    }
+    if (values == NULL || count == 0 || count > MAX_KEY_LIST) {
+        set_db_error(&db->error, SIMPLESQLITE_RANGE, "An id list holds 1 to %d ids.", MAX_KEY_LIST);
+        return db->error.code;
+    }
+
+    bind_key_list(&stmt->statement, index - 1, values, count);
+    if (stmt->sql != NULL) {
+        free(stmt->parameter_text[index - 1]);
+        stmt->parameter_text[index - 1] = key_list_text(values, count);
+    }
+    return SIMPLESQLITE_OK;
+}
+
+// With yield a batch that leaves a sorted select still collecting returns SIMPLESQLITE_PENDING
+static SimpleSqliteResult step_statement(SimpleSqliteStmt* stmt, bool yield) {
+    SimpleSqlite* db = stmt->db;
+    Pager* pager = db->table->pager;
+
+    // Stepping a finished statement runs it again, like a reset would
+    if (!stmt->running) {
+        for (uint32_t i = 0; i < stmt->statement.num_parameters; i++) {
+            if (!stmt->statement.parameters[i].bound) {
+                set_db_error(&db->error, SIMPLESQLITE_MISUSE, "Parameter %" PRIu32 " is not bound.", i + 1);
+                return db->error.code;
+            }
+        }
+        reset_select_scan(&stmt->scan);
+        stmt->running = true;
+        stmt->elapsed_ns = 0;
+        stmt->start_ns = monotonic_time_ns();
+        stmt->rows = 0;
+        stmt->session = db->session;
+        stmt->run = ++db->statement_runs;
+    }
+
+    // Other threads get the pager lock between two batches of a sorted select
+    ExecuteResult result;
+    do {
+        trace_operation(db, page_operation_for_statement(stmt->statement.type), stmt->run);
+        pager_lock(pager);
+        if (pager->error.code != SIMPLESQLITE_OK) {
+            db->error = pager->error;
+            pager_unlock(pager);
+            stmt->running = false;
+            return db->error.code;
+        }
+
+        // A failed read deep inside the tree unwinds back to here instead of ending the process
+        jmp_buf error_handler;
+        if (setjmp(error_handler) != 0) {
+            pager->error_handler = NULL;
+            db->error = pager->error;
+            pager_unlock(pager);
+            stmt->running = false;
+            return db->error.code;
+        }
+        pager->error_handler = &error_handler;
+        uint64_t start_ns = monotonic_time_ns();
+        result = execute_statement(&stmt->statement, db->table, &stmt->scan);
+        stmt->elapsed_ns += monotonic_time_ns() - start_ns;
+        pager->error_handler = NULL;
+        pager_unlock(pager);
+    } while (result == EXECUTE_PENDING && !yield);
+
+    if (result == EXECUTE_PENDING) {
+        return SIMPLESQLITE_PENDING;
+    }
+    SimpleSqliteResult code = execute_error(db, result);
+    if (result != EXECUTE_ROW) {
+        stmt->running = false;
+        record_latency(&db->latencies[stmt->statement.type], stmt->elapsed_ns);
+        if (db->capture != NULL && stmt->sql != NULL) {
+            capture_statement(stmt, code);
+        }
+    } else {
+        stmt->rows++;
+    }
+    return code;
+}
+
+SimpleSqliteResult simplesqlite_step(SimpleSqliteStmt* stmt) {
+    return step_statement(stmt, false);
+}
+
+SimpleSqliteResult simplesqlite_step_slice(SimpleSqliteStmt* stmt) {
+    return step_statement(stmt, true);
+}
+
+SimpleSqliteResult simplesqlite_reset(SimpleSqliteStmt* stmt) {
+    reset_select_scan(&stmt->scan);
+    stmt->running = false;
+    return SIMPLESQLITE_OK;
+}
+
+SimpleSqliteResult simplesqlite_finalize(SimpleSqliteStmt* stmt) {
+    if (stmt == NULL) {
+        return SIMPLESQLITE_OK;
+    }
+    free_select_scan(&stmt->scan);
+    free(stmt->sql);
+    for (uint32_t i = 0; i < MAX_PARAMETERS; i++) {
+        free(stmt->parameter_text[i]);
+    }
+    free(stmt);
+    return SIMPLESQLITE_OK;
+}
+
+uint32_t simplesqlite_column_count(SimpleSqliteStmt* stmt) {
+    if (stmt->statement.type != STATEMENT_SELECT) {
+        return 0;
+    }
+    return stmt->statement.num_select_columns;
+}
+
+static bool column_in_row(SimpleSqliteStmt* stmt, uint32_t column) {
+    return stmt->running && column < simplesqlite_column_count(stmt);
+}
+
+const char* simplesqlite_column_name(SimpleSqliteStmt* stmt, uint32_t column) {
+    if (column >= simplesqlite_column_count(stmt)) {
+        return NULL;
+    }
+    return column_name(stmt->statement.select_columns[column]);
+}
+
+uint64_t simplesqlite_column_int64(SimpleSqliteStmt* stmt, uint32_t column) {
+    if (!column_in_row(stmt, column)) {
+        return 0;
+    }
+    if (stmt->statement.select_columns[column] == COLUMN_ID) {
+        return stmt->scan.key;
+    }
+    return strtoull(simplesqlite_column_text(stmt, column), NULL, 10);
+}
+
+// Text columns point into the row copy, which is zero terminated inside each slot
+const char* simplesqlite_column_text(SimpleSqliteStmt* stmt, uint32_t column) {
+    if (!column_in_row(stmt, column)) {
+        return NULL;
+    }
+    Column selected = stmt->statement.select_columns[column];
+    if (selected == COLUMN_ID) {
+        snprintf(stmt->id_text, sizeof(stmt->id_text), "%" PRIu64, stmt->scan.key);
+        return stmt->id_text;
+    }
+    return (const char*)stmt->scan.value + column_offset(selected);
+}
+
+SimpleSqliteResult simplesqlite_print_tree(SimpleSqlite* db) {
+    Pager* pager = db->table->pager;
+
+    trace_operation(db, PAGE_OPERATION_INSPECT, 0);
+    pager_lock(pager);
+    jmp_buf error_handler;
+    if (setjmp(error_handler) != 0) {
+        pager->error_handler = NULL;
+        db->error = pager->error;
+        pager_unlock(pager);
+        return db->error.code;
+    }
+    pager->error_handler = &error_handler;
+    print_tree(pager, db->table->root_page_num);
+    pager->error_handler = NULL;
+    pager_unlock(pager);
+
+    return SIMPLESQLITE_OK;
+}
+
+SimpleSqliteResult simplesqlite_print_tables(SimpleSqlite* db) {
+    Pager* pager = db->table->pager;
+
+    trace_operation(db, PAGE_OPERATION_INSPECT, 0);
+    pager_lock(pager);
+    jmp_buf error_handler;
+    if (setjmp(error_handler) != 0) {
+        pager->error_handler = NULL;
+        db->error = pager->error;
+        pager_unlock(pager);
+        return db->error.code;
+    }
+    pager->error_handler = &error_handler;
+    print_catalog(db->table);
+    pager->error_handler = NULL;
+    pager_unlock(pager);
+
+    return SIMPLESQLITE_OK;
+}
+
+// The counters are copied under the locks that guard them and printed afterwards
+SimpleSqliteResult simplesqlite_print_stats(SimpleSqlite* db, FILE* out, bool json) {
+    Pager* pager = db->table->pager;
+    StatsSnapshot snapshot;
+    snapshot.latencies = db->latencies;
+
+    pager_lock(pager);
+    snapshot.pager = pager->stats;
+    snapshot.tree = pager->tree_stats;
+    pthread_mutex_lock(&pager->io_lock);
+    snapshot.io = pager->io_stats;
+    pthread_mutex_unlock(&pager->io_lock);
+    pager_unlock(pager);
+
+    if (json) {
+        print_stats_json(out, &snapshot);
+    } else {
+        print_stats(out, &snapshot);
+    }
+    return SIMPLESQLITE_OK;
+}
+
+// Every table is measured before anything is printed, so a failed read prints nothing
+SimpleSqliteResult simplesqlite_print_tree_shape(SimpleSqlite* db, FILE* out, bool json) {
+    Pager* pager = db->table->pager;
+    TableShape* shapes = malloc(sizeof(TableShape) * (1 + CATALOG_MAX_TABLES));
+    if (shapes == NULL) {
+        set_db_error(&db->error, SIMPLESQLITE_NO_MEMORY, "Out of memory");
+        return db->error.code;
+    }
+
+    trace_operation(db, PAGE_OPERATION_INSPECT, 0);
+    pager_lock(pager);
+    if (pager->error.code != SIMPLESQLITE_OK) {
+        db->error = pager->error;
+        pager_unlock(pager);
+        free(shapes);
+        return db->error.code;
+    }
+    jmp_buf error_handler;
+    if (setjmp(error_handler) != 0) {
+        pager->error_handler = NULL;
+        db->error = pager->error;
+        pager_unlock(pager);
+        free(shapes);
+        return db->error.code;
+    }
+    pager->error_handler = &error_handler;
+    uint32_t num_tables = measure_tables(db->table, shapes);
+    pager->error_handler = NULL;
+    pager_unlock(pager);
+
+    if (json) {
+        print_table_shapes_json(out, shapes, num_tables);
+    } else {
+        print_table_shapes(out, shapes, num_tables);
+    }
+    free(shapes);
+    return SIMPLESQLITE_OK;
+}
+
+SimpleSqliteResult simplesqlite_reset_stats(SimpleSqlite* db) {
+    Pager* pager = db->table->pager;
+
+    pager_lock(pager);
+    memset(&pager->stats, 0, sizeof(pager->stats));
+    memset(&pager->tree_stats, 0, sizeof(pager->tree_stats));
+    pthread_mutex_lock(&pager->io_lock);
+    memset(&pager->io_stats, 0, sizeof(pager->io_stats));
+    pthread_mutex_unlock(&pager->io_lock);
+    pager_unlock(pager);
+    memset(db->latencies, 0, sizeof(db->latencies));
+
+    return SIMPLESQLITE_OK;
+}
+
+/**
+ *
+ * Reads the file rather than the cache, so a page that is corrupt on disk is found even
+ * when a good copy of it is cached. Writers wait on the io lock until it is done.
+ *
+ */
+SimpleSqliteResult simplesqlite_verify(SimpleSqlite* db, uint64_t* pages_checked) {
+    Pager* pager = db->table->pager;
+    VerifyResult result;
+
+    pthread_mutex_lock(&pager->io_lock);
+    bool verified = verify_database_file(pager->file_descriptor, pager->page_map, &result, &db->error);
+    pthread_mutex_unlock(&pager->io_lock);
+    if (!verified) {
+        return db->error.code;
+    }
+
+    *pages_checked = result.pages_checked;
+    if (result.num_corrupt_pages == 0) {
+        return SIMPLESQLITE_OK;
+    }
+
+    int length = snprintf(db->error.message, sizeof(db->error.message), "%" PRIu64 " of %" PRIu64 " pages failed their checksum:",
+                          result.num_corrupt_pages, result.pages_checked);
+    for (uint64_t i = 0; i < result.num_corrupt_pages && i < MAX_REPORTED_CORRUPT_PAGES; i++) {
+        length += snprintf(db->error.message + length, sizeof(db->error.message) - length, " %" PRIu32, result.corrupt_pages[i]);
+    }
+    if (result.num_corrupt_pages > MAX_REPORTED_CORRUPT_PAGES) {
+        snprintf(db->error.message + length, sizeof(db->error.message) - length, " ...");
+    }
+    db->error.code = SIMPLESQLITE_CORRUPT;
+    return db->error.code;
+}
+
+SimpleSqliteResult simplesqlite_backup(SimpleSqlite* db, const char* path, SimpleSqliteBackupStats* stats) {
+    trace_operation(db, PAGE_OPERATION_BACKUP, 0);
+    if (!backup_database(db->table->pager, path, stats, &db->error)) {
+        return db->error.code;
+    }
+    return SIMPLESQLITE_OK;
+}
+
+SimpleSqliteResult simplesqlite_import(SimpleSqlite* db, const char* path, const char* table_name,
+                                       SimpleSqliteImportStats* stats) {
+    trace_operation(db, PAGE_OPERATION_IMPORT, 0);
+    if (!import_rows(db->table, path, table_name, stats, &db->error)) {
+        return db->error.code;
+    }
+    return SIMPLESQLITE_OK;
+}
+
+SimpleSqliteResult simplesqlite_defrag(SimpleSqlite* db, uint32_t max_pages, SimpleSqliteDefragStats* stats) {
+    trace_operation(db, PAGE_OPERATION_DEFRAG, 0);
+    if (!defrag_run(db->table, &db->defrag, max_pages, stats, &db->error)) {
+        return db->error.code;
+    }
+    return SIMPLESQLITE_OK;
+}
+
+void simplesqlite_print_constants(void) {
+    print_constants();
+}
@@ -0,0 +1,154 @@
+#ifndef SIMPLESQLITE_H
+#define SIMPLESQLITE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ *
+ * Embedding API
+ *
+ * A database is opened into a handle, statements are prepared against it, parameters written
+ * as `?` are bound, and step runs the statement: it returns SIMPLESQLITE_ROW for every row a
+ * select produces and SIMPLESQLITE_DONE once the statement is finished. Every call reports
+ * failure through its result code and simplesqlite_errmsg, nothing ever exits the process.
+ * A handle and its statements must be used from one thread at a time.
+ *
+ */
+
+typedef enum {
+    SIMPLESQLITE_OK,
+    SIMPLESQLITE_ROW,
+    SIMPLESQLITE_DONE,
+    SIMPLESQLITE_ERROR, // The statement could not be parsed
+    SIMPLESQLITE_TOO_BIG, // A string is longer than its column
+    SIMPLESQLITE_RANGE, // An id or an index is outside what is allowed
+    SIMPLESQLITE_CONSTRAINT, // The key or the table already exists
+    SIMPLESQLITE_NOT_FOUND, // The key or the table does not exist
+    SIMPLESQLITE_FULL,
+    SIMPLESQLITE_MISUSE, // The call does not fit the current state, e.g. commit without begin
+    SIMPLESQLITE_CANT_OPEN,
+    SIMPLESQLITE_CORRUPT,
+    SIMPLESQLITE_IO_ERROR,
+    SIMPLESQLITE_NO_MEMORY,
+    SIMPLESQLITE_PENDING // Only from simplesqlite_step_slice: the statement has no row yet, step it again
+} SimpleSqliteResult;
+
+typedef struct SimpleSqlite SimpleSqlite;
+typedef struct SimpleSqliteStmt SimpleSqliteStmt;
+
+typedef struct {
+    uint32_t key_size; // Only used when creating a new database, existing ones keep their header
+    uint32_t flush_dirty_pages; // Background flush once this many pages are dirty, 0 disables the flusher
+    uint32_t flush_max_age_ms; // Background flush once the oldest dirty page is this old
+    uint32_t flush_pages_per_second; // Upper bound on background write rate, 0 means unlimited
+    uint32_t sort_memory_kb; // Memory an order by may use before it spills sorted runs to disk
+    const char* stats_json_path; // Statistics are written here as JSON when the database is closed, NULL skips it
+    bool compress; // Only used when creating a new database, existing ones keep their header
+    uint32_t hash_index_kb; // Memory for the adaptive hash index over hot keys, 0 disables it
+    const char* capture_path; // Every statement executed is appended here as a binary trace, NULL skips it
+    const char* page_trace_path; // Every page fetched is recorded here, NULL skips it
+} SimpleSqliteConfig;
+
+void simplesqlite_config_init(SimpleSqliteConfig* config);
+
+// A handle is returned even when opening fails, so that the error can be read before closing it
+SimpleSqliteResult simplesqlite_open(const char* filename, const SimpleSqliteConfig* config, SimpleSqlite** db);
+SimpleSqliteResult simplesqlite_close(SimpleSqlite* db);
+const char* simplesqlite_errmsg(SimpleSqlite* db);
+bool simplesqlite_in_transaction(SimpleSqlite* db);
+// Statements started from now on are captured as coming from session, the server passes its connection
+void simplesqlite_set_session(SimpleSqlite* db, uint32_t session);
+
+SimpleSqliteResult simplesqlite_prepare(SimpleSqlite* db, const char* sql, SimpleSqliteStmt** stmt);
+uint32_t simplesqlite_bind_parameter_count(SimpleSqliteStmt* stmt);
+SimpleSqliteResult simplesqlite_bind_int64(SimpleSqliteStmt* stmt, uint32_t index, uint64_t value);
+SimpleSqliteResult simplesqlite_bind_text(SimpleSqliteStmt* stmt, uint32_t index, const char* value);
+// Binds the ids of an `id in ?`, up to 1024 in any order, repeats are returned once
+SimpleSqliteResult simplesqlite_bind_int64_array(SimpleSqliteStmt* stmt, uint32_t index, const uint64_t* values,
+                                                 uint32_t count);
+SimpleSqliteResult simplesqlite_step(SimpleSqliteStmt* stmt);
+// Like step, but a sorted select still collecting its rows returns SIMPLESQLITE_PENDING after each
+// batch of them, so the caller can serve others before the sort is done. Step releases the
+// pager lock between batches too, but only returns with a row
+SimpleSqliteResult simplesqlite_step_slice(SimpleSqliteStmt* stmt);
+SimpleSqliteResult simplesqlite_reset(SimpleSqliteStmt* stmt);
+SimpleSqliteResult simplesqlite_finalize(SimpleSqliteStmt* stmt);
+
+// Columns of the current row, valid until the next step
+uint32_t simplesqlite_column_count(SimpleSqliteStmt* stmt);
+const char* simplesqlite_column_name(SimpleSqliteStmt* stmt, uint32_t column);
+uint64_t simplesqlite_column_int64(SimpleSqliteStmt* stmt, uint32_t column);
+const char* simplesqlite_column_text(SimpleSqliteStmt* stmt, uint32_t column);
+
+// Pager, tree and statement statistics since open or the last reset, as text or as one JSON object
+SimpleSqliteResult simplesqlite_print_stats(SimpleSqlite* db, FILE* out, bool json);
+SimpleSqliteResult simplesqlite_reset_stats(SimpleSqlite* db);
+// Height, fill factor and leaf order of the default table and every named one. Walks every page
+// under the pager lock, loading the whole file into the cache and holding up every other
+// statement meanwhile, so it is for inspecting a database rather than monitoring one
+SimpleSqliteResult simplesqlite_print_tree_shape(SimpleSqlite* db, FILE* out, bool json);
+
+// Checks the checksum of every page in the file, SIMPLESQLITE_CORRUPT names the first pages that fail
+SimpleSqliteResult simplesqlite_verify(SimpleSqlite* db, uint64_t* pages_checked);
+
+typedef struct {
+    uint32_t num_pages; // Pages in the backup
+    uint32_t pages_copied; // Pages written this time, the header included
+    uint64_t change_seq; // High-water mark recorded in the backup, pages written from then on go in the next one
+    bool incremental; // The file already held a backup of this database and only changed pages were copied
+} SimpleSqliteBackupStats;
+
+/**
+ *
+ * Copies the database as it is between two statements to path while it stays open, and fails
+ * inside a transaction. When path holds an earlier backup of the same database, only the pages
+ * written since that backup are copied.
+ *
+ */
+SimpleSqliteResult simplesqlite_backup(SimpleSqlite* db, const char* path, SimpleSqliteBackupStats* stats);
+
+typedef struct {
+    uint64_t rows_read; // Rows in the file
+    uint64_t rows_imported;
+    uint64_t duplicate_keys; // Rows skipped because an earlier row or the table already had their key
+    uint32_t sorted_runs; // Chunks spilled to temporary files, 0 when the rows fit in the sort memory
+    bool built; // The table was empty and was built bottom-up instead of inserted into
+} SimpleSqliteImportStats;
+
+/**
+ *
+ * Loads the rows in the file at path, one `<id> <username> <email>` per line, into the named
+ * table or the default one when table_name is NULL. The rows are sorted by key first, so their
+ * order in the file does not matter. A row that cannot be parsed fails the whole import before
+ * the table is touched; a row whose key is already taken is skipped, like a failed insert.
+ *
+ */
+SimpleSqliteResult simplesqlite_import(SimpleSqlite* db, const char* path, const char* table_name,
+                                       SimpleSqliteImportStats* stats);
+
+typedef struct {
+    uint32_t num_pages; // Pages the layout places, all but the header, the catalog and the roots
+    uint32_t pages_placed; // Of those, the ones at their place in the layout so far
+    uint32_t pages_moved; // Pages swapped into place since the defragmentation started
+    bool done;
+} SimpleSqliteDefragStats;
+
+/**
+ *
+ * Moves pages so that every table lies in key order: its leaves on consecutive pages, followed
+ * by its internal nodes level by level, so a full scan reads the file front to back. At most
+ * max_pages pages are moved per call, 0 for no limit, and statements can run between calls; the
+ * next call carries on where the last one stopped, planning again when the tree changed in
+ * between. It cannot run inside a transaction.
+ *
+ */
+SimpleSqliteResult simplesqlite_defrag(SimpleSqlite* db, uint32_t max_pages, SimpleSqliteDefragStats* stats);
+
+// Debugging aids used by the shell
+SimpleSqliteResult simplesqlite_print_tree(SimpleSqlite* db);
+SimpleSqliteResult simplesqlite_print_tables(SimpleSqlite* db);
+void simplesqlite_print_constants(void);
+
+#endif
@@ -0,0 +1,499 @@
+#include "sort.h"
+#include "constants.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#define RADIX_BITS 8
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+
+// Record layout: KEY (uint64_t) | VALUE (ROW_SIZE bytes)
+static const uint32_t SORT_RECORD_KEY_SIZE = sizeof(uint64_t);
+
+static uint64_t record_key(uint8_t* record) {
+    uint64_t key;
+    memcpy(&key, record, SORT_RECORD_KEY_SIZE);
+    return key;
+}
+
+static uint8_t* record_value(uint8_t* record) {
+    return record + SORT_RECORD_KEY_SIZE;
+}
+
+// Negative when left comes before right in the output, ties are broken by key
+static int compare_records(Sorter* sorter, uint8_t* left, uint8_t* right) {
+    uint64_t left_key = record_key(left);
+    uint64_t right_key = record_key(right);
+    int order = compare_serialized_column(sorter->column, left_key, (char*)record_value(left),
+                                          right_key, (char*)record_value(right));
+
+    if (sorter->descending) {
+        order = -order;
+    }
+    if (order == 0) {
+        order = left_key < right_key ? -1 : (left_key > right_key ? 1 : 0);
+    }
+    return order;
+}
+
+/**
+ *
+ * Binary heap over record pointers. With direction 1 the root is the record that comes last
+ * in the output (used for the top-N heap and heapsort), with -1 it is the one that comes first
+ * (used for merging runs).
+ *
+ */
+static void heap_sift_down(Sorter* sorter, uint8_t** heap, uint32_t size, uint32_t index, int direction) {
+    while (true) {
+        uint32_t left_child = 2 * index + 1;
+        uint32_t right_child = left_child + 1;
+        uint32_t top = index;
+
+        if (left_child < size && direction * compare_records(sorter, heap[left_child], heap[top]) > 0) {
+            top = left_child;
+        }
+        if (right_child < size && direction * compare_records(sorter, heap[right_child], heap[top]) > 0) {
+            top = right_child;
+        }
+        if (top == index) {
+            return;
+        }
+
+        uint8_t* swap = heap[index];
+        heap[index] = heap[top];
+        heap[top] = swap;
+        index = top;
+    }
+}
+
+static void heap_build(Sorter* sorter, uint8_t** heap, uint32_t size, int direction) {
+    for (uint32_t i = size / 2; i > 0; i--) {
+        heap_sift_down(sorter, heap, size, i - 1, direction);
+    }
+}
+
+// Leaves heap[0..size) in output order
+static void heap_sort(Sorter* sorter, uint8_t** heap, uint32_t size) {
+    heap_build(sorter, heap, size, 1);
+    for (uint32_t end = size; end > 1; end--) {
+        uint8_t* swap = heap[0];
+        heap[0] = heap[end - 1];
+        heap[end - 1] = swap;
+        heap_sift_down(sorter, heap, end - 1, 0, 1);
+    }
+}
+
+void initialize_sorter(Sorter* sorter, Column column, bool descending, bool has_limit, uint64_t limit, uint64_t memory_budget) {
+    sorter->column = column;
+    sorter->descending = descending;
+    sorter->has_limit = has_limit;
+    sorter->limit = limit;
+    sorter->record_size = SORT_RECORD_KEY_SIZE + ROW_SIZE;
+
+    // A limit within the budget bounds memory by itself, otherwise the budget decides when to spill a run
+    uint64_t capacity = memory_budget / sorter->record_size;
+    if (capacity == 0) {
+        capacity = 1;
+    }
+    sorter->top_n = has_limit && limit <= capacity;
+    if (sorter->top_n && limit > 0) {
+        capacity = limit;
+    }
+    if (capacity > UINT32_MAX) {
+        capacity = UINT32_MAX;
+    }
+    sorter->capacity = (uint32_t)capacity;
+
+    // Each run being merged costs its current record and a stdio buffer
+    uint64_t max_merge_runs = memory_budget / (BUFSIZ + sorter->record_size);
+    if (max_merge_runs < SORT_MIN_MERGE_RUNS) {
+        max_merge_runs = SORT_MIN_MERGE_RUNS;
+    }
+    if (max_merge_runs > SORT_MAX_MERGE_RUNS) {
+        max_merge_runs = SORT_MAX_MERGE_RUNS;
+    }
+    sorter->max_merge_runs = (uint32_t)max_merge_runs;
+
+    // Memory grows with the records actually added, up to capacity
+    sorter->allocated = 0;
+    sorter->num_records = 0;
+    sorter->records = NULL;
+    sorter->heap = NULL;
+    sorter->runs = NULL;
+    sorter->num_runs = 0;
+    memset(&sorter->merge, 0, sizeof(RunMerge));
+    sorter->next_record = 0;
+    sorter->num_returned = 0;
+}
+
+static bool sorter_reserve(Sorter* sorter) {
+    if (sorter->num_records < sorter->allocated) {
+        return true;
+    }
+
+    uint32_t new_allocated = sorter->allocated == 0 ? 64 : sorter->allocated * 2;
+    if (new_allocated > sorter->capacity || new_allocated < sorter->allocated) {
+        new_allocated = sorter->capacity;
+    }
+
+    uint8_t* records = realloc(sorter->records, (size_t)new_allocated * sorter->record_size);
+    if (records == NULL) {
+        return false;
+    }
+    sorter->records = records;
+
+    uint8_t** heap = realloc(sorter->heap, sizeof(uint8_t*) * new_allocated);
+    if (heap == NULL) {
+        return false;
+    }
+    sorter->heap = heap;
+    sorter->allocated = new_allocated;
+
+    // The buffer only grows before it is full, while the heap is still in insertion order
+    for (uint32_t i = 0; i < sorter->num_records; i++) {
+        sorter->heap[i] = sorter->records + (size_t)i * sorter->record_size;
+    }
+    return true;
+}
+
+static bool read_run_record(Sorter* sorter, RunMerge* merge, uint32_t run_index) {
+    uint8_t* record = merge->records + (size_t)run_index * sorter->record_size;
+    return fread(record, sorter->record_size, 1, merge->runs[run_index].file) == 1;
+}
+
+static bool merge_begin(Sorter* sorter, RunMerge* merge, SortRun* runs, uint32_t num_runs) {
+    merge->runs = runs;
+    merge->records = malloc((size_t)num_runs * sorter->record_size);
+    merge->heap = malloc(sizeof(uint8_t*) * num_runs);
+    merge->size = 0;
+    merge->started = false;
+    if (merge->records == NULL || merge->heap == NULL) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < num_runs; i++) {
+        rewind(runs[i].file);
+        if (read_run_record(sorter, merge, i)) {
+            merge->heap[merge->size++] = merge->records + (size_t)i * sorter->record_size;
+        }
+    }
+    heap_build(sorter, merge->heap, merge->size, -1);
+    return true;
+}
+
+// The record stays valid until the next call, NULL once every run is used up
+static uint8_t* merge_next(Sorter* sorter, RunMerge* merge) {
+    // The previously returned record is refilled from its run before the heap is consulted again
+    if (merge->started && merge->size > 0) {
+        uint32_t run_index = (merge->heap[0] - merge->records) / sorter->record_size;
+        if (!read_run_record(sorter, merge, run_index)) {
+            merge->heap[0] = merge->heap[--merge->size];
+        }
+        heap_sift_down(sorter, merge->heap, merge->size, 0, -1);
+    }
+    merge->started = true;
+    return merge->size > 0 ? merge->heap[0] : NULL;
+}
+
+static void merge_end(RunMerge* merge) {
+    free(merge->records);
+    free(merge->heap);
+    merge->records = NULL;
+    merge->heap = NULL;
+    merge->size = 0;
+}
+
+// Replaces the last count runs, the smallest ones, with one run one level above the largest of them
+static bool sorter_merge_last_runs(Sorter* sorter, uint32_t count) {
+    uint32_t first = sorter->num_runs - count;
+    FILE* file = tmpfile();
+    if (file == NULL) {
+        return false;
+    }
+
+    RunMerge merge;
+    bool merged = merge_begin(sorter, &merge, sorter->runs + first, count);
+    uint8_t* record;
+    while (merged && (record = merge_next(sorter, &merge)) != NULL) {
+        merged = fwrite(record, sorter->record_size, 1, file) == 1;
+    }
+    merge_end(&merge);
+    if (!merged || fflush(file) != 0) {
+        fclose(file);
+        return false;
+    }
+
+    uint32_t level = sorter->runs[first].level + 1;
+    for (uint32_t i = first; i < sorter->num_runs; i++) {
+        fclose(sorter->runs[i].file);
+    }
+    sorter->runs[first].file = file;
+    sorter->runs[first].level = level;
+    sorter->num_runs = first + 1;
+    return true;
+}
+
+static bool sorter_spill_run(Sorter* sorter) {
+    heap_sort(sorter, sorter->heap, sorter->num_records);
+
+    FILE* file = tmpfile();
+    if (file == NULL) {
+        return false;
+    }
+    for (uint32_t i = 0; i < sorter->num_records; i++) {
+        if (fwrite(sorter->heap[i], sorter->record_size, 1, file) != 1) {
+            fclose(file);
+            return false;
+        }
+    }
+
+    SortRun* runs = realloc(sorter->runs, sizeof(SortRun) * (sorter->num_runs + 1));
+    if (runs == NULL) {
+        fclose(file);
+        return false;
+    }
+    sorter->runs = runs;
+    sorter->runs[sorter->num_runs].file = file;
+    sorter->runs[sorter->num_runs].level = 0;
+    sorter->num_runs++;
+    sorter->num_records = 0;
+
+    // Merging as soon as a level fills keeps fewer than max_merge_runs runs per level open
+    uint32_t max = sorter->max_merge_runs;
+    while (sorter->num_runs >= max &&
+           sorter->runs[sorter->num_runs - max].level == sorter->runs[sorter->num_runs - 1].level) {
+        if (!sorter_merge_last_runs(sorter, max)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ *
+ * Returns false when the record could not be kept, because memory ran out or a run could
+ * not be written. The sorter can only be freed after that.
+ *
+ */
+bool sorter_add(Sorter* sorter, uint64_t key, uint8_t* value) {
+    if (sorter->has_limit && sorter->limit == 0) {
+        return true;
+    }
+
+    if (sorter->num_records == sorter->capacity) {
+        if (sorter->top_n) {
+            // The root of the top-N heap is the worst record kept so far
+            uint8_t* worst = sorter->heap[0];
+            uint8_t candidate[SORT_RECORD_KEY_SIZE + ROW_SIZE];
+            memcpy(candidate, &key, SORT_RECORD_KEY_SIZE);
+            memcpy(record_value(candidate), value, ROW_SIZE);
+            if (compare_records(sorter, candidate, worst) >= 0) {
+                return true;
+            }
+            memcpy(worst, candidate, sorter->record_size);
+            heap_sift_down(sorter, sorter->heap, sorter->num_records, 0, 1);
+            return true;
+        }
+        if (!sorter_spill_run(sorter)) {
+            return false;
+        }
+    }
+
+    if (!sorter_reserve(sorter)) {
+        return false;
+    }
+    uint8_t* record = sorter->records + (size_t)sorter->num_records * sorter->record_size;
+    memcpy(record, &key, SORT_RECORD_KEY_SIZE);
+    memcpy(record_value(record), value, ROW_SIZE);
+    sorter->heap[sorter->num_records] = record;
+    sorter->num_records++;
+
+    if (sorter->top_n && sorter->num_records == sorter->capacity) {
+        heap_build(sorter, sorter->heap, sorter->num_records, 1);
+    }
+    return true;
+}
+
+bool sorter_finish(Sorter* sorter) {
+    sorter->next_record = 0;
+    if (sorter->num_runs == 0) {
+        heap_sort(sorter, sorter->heap, sorter->num_records);
+        return true;
+    }
+
+    if (sorter->num_records > 0 && !sorter_spill_run(sorter)) {
+        return false;
+    }
+
+    // The record buffer is not needed any more, the merges read from the runs
+    free(sorter->records);
+    free(sorter->heap);
+    sorter->records = NULL;
+    sorter->heap = NULL;
+    sorter->num_records = 0;
+    sorter->allocated = 0;
+
+    // Merge the smallest runs, just enough of them that the rest fit into the last pass
+    while (sorter->num_runs > sorter->max_merge_runs) {
+        uint32_t count = sorter->num_runs - sorter->max_merge_runs + 1;
+        if (count > sorter->max_merge_runs) {
+            count = sorter->max_merge_runs;
+        }
+        if (!sorter_merge_last_runs(sorter, count)) {
+            return false;
+        }
+    }
+    return merge_begin(sorter, &sorter->merge, sorter->runs, sorter->num_runs);
+}
+
+static bool next_record(Sorter* sorter, uint64_t* key, uint8_t** value) {
+    uint8_t* record;
+    if (sorter->num_runs == 0) {
+        if (sorter->next_record >= sorter->num_records) {
+            return false;
+        }
+        record = sorter->heap[sorter->next_record++];
+    } else {
+        record = merge_next(sorter, &sorter->merge);
+        if (record == NULL) {
+            return false;
+        }
+    }
+    *key = record_key(record);
+    *value = record_value(record);
+    return true;
+}
+
+/**
+ *
+ * Returns the next record in output order. The value stays valid until the next call.
+ *
+ */
+bool sorter_next(Sorter* sorter, uint64_t* key, uint8_t** value) {
+    if (sorter->has_limit && sorter->num_returned == sorter->limit) {
+        return false;
+    }
+    if (!next_record(sorter, key, value)) {
+        return false;
+    }
+    sorter->num_returned++;
+    return true;
+}
+
+void free_sorter(Sorter* sorter) {
+    merge_end(&sorter->merge);
+    for (uint32_t i = 0; i < sorter->num_runs; i++) {
+        fclose(sorter->runs[i].file);
+    }
+    free(sorter->runs);
+    free(sorter->records);
+    free(sorter->heap);
+}
+
+// The keys in [begin, end) of one pass, counted and then scattered by one thread
+typedef struct {
+    SortKey* source;
+    SortKey* destination;
+    uint32_t begin;
+    uint32_t end;
+    uint32_t shift;
+    uint32_t counts[RADIX_BUCKETS]; // Keys per bucket, then where the next key of each bucket goes
+} RadixSlice;
+
+static uint32_t radix_bucket(RadixSlice* slice, uint64_t key) {
+    return (uint32_t)(key >> slice->shift) & (RADIX_BUCKETS - 1);
+}
+
+static void* radix_count(void* argument) {
+    RadixSlice* slice = argument;
+    memset(slice->counts, 0, sizeof(slice->counts));
+    for (uint32_t i = slice->begin; i < slice->end; i++) {
+        slice->counts[radix_bucket(slice, slice->source[i].key)]++;
+    }
+    return NULL;
+}
+
+static void* radix_scatter(void* argument) {
+    RadixSlice* slice = argument;
+    for (uint32_t i = slice->begin; i < slice->end; i++) {
+        SortKey key = slice->source[i];
+        slice->destination[slice->counts[radix_bucket(slice, key.key)]++] = key;
+    }
+    return NULL;
+}
+
+// The first slice runs on the caller's thread, and so does any slice a thread could not be started for
+static void radix_run(RadixSlice* slices, uint32_t num_slices, void* (*work)(void*)) {
+    pthread_t threads[RADIX_MAX_THREADS];
+    bool started[RADIX_MAX_THREADS];
+    for (uint32_t i = 1; i < num_slices; i++) {
+        started[i] = pthread_create(&threads[i], NULL, work, &slices[i]) == 0;
+    }
+    work(&slices[0]);
+    for (uint32_t i = 1; i < num_slices; i++) {
+        if (started[i]) {
+            pthread_join(threads[i], NULL);
+        } else {
+            work(&slices[i]);
+        }
+    }
+}
+
+/**
+ *
+ * Every pass counts the keys of each slice per bucket, then lays the buckets out in order and,
+ * within a bucket, the slices in order, so every thread scatters its slice into places of its
+ * own and equal keys keep their order. Passes over a byte every key shares are skipped, so
+ * 32-bit keys take at most four.
+ *
+ */
+SortKey* radix_sort_keys(SortKey* keys, SortKey* scratch, uint32_t num_keys, uint32_t num_threads) {
+    uint32_t num_slices = num_keys / RADIX_MIN_KEYS_PER_THREAD;
+    if (num_slices > num_threads) {
+        num_slices = num_threads;
+    }
+    if (num_slices > RADIX_MAX_THREADS) {
+        num_slices = RADIX_MAX_THREADS;
+    }
+    if (num_slices == 0) {
+        num_slices = 1;
+    }
+
+    uint64_t differing_bits = 0;
+    for (uint32_t i = 1; i < num_keys; i++) {
+        differing_bits |= keys[i].key ^ keys[0].key;
+    }
+
+    RadixSlice slices[RADIX_MAX_THREADS];
+    SortKey* source = keys;
+    SortKey* destination = scratch;
+    for (uint32_t shift = 0; shift < 64; shift += RADIX_BITS) {
+        if (((differing_bits >> shift) & (RADIX_BUCKETS - 1)) == 0) {
+            continue;
+        }
+
+        for (uint32_t i = 0; i < num_slices; i++) {
+            slices[i].source = source;
+            slices[i].destination = destination;
+            slices[i].begin = (uint32_t)((uint64_t)num_keys * i / num_slices);
+            slices[i].end = (uint32_t)((uint64_t)num_keys * (i + 1) / num_slices);
+            slices[i].shift = shift;
+        }
+        radix_run(slices, num_slices, radix_count);
+
+        uint32_t offset = 0;
+        for (uint32_t bucket = 0; bucket < RADIX_BUCKETS; bucket++) {
+            for (uint32_t i = 0; i < num_slices; i++) {
+                uint32_t count = slices[i].counts[bucket];
+                slices[i].counts[bucket] = offset;
+                offset += count;
+            }
+        }
+        radix_run(slices, num_slices, radix_scatter);
+
+        SortKey* swap = source;
+        source = destination;
+        destination = swap;
+    }
+    return source;
+}
@@ -0,0 +1,82 @@
+#ifndef SORT_H
+#define SORT_H
+
+#include "row.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SORT_MIN_MERGE_RUNS 8 // Runs merged at once however small the budget
+#define SORT_MAX_MERGE_RUNS 64 // Runs merged at once however large the budget, bounds the open files
+
+// A sorted run in a temporary file
+typedef struct {
+    FILE* file;
+    uint32_t level; // Merges its records went through, runs of one level are about the same size
+} SortRun;
+
+// Streams the records of several runs in output order
+typedef struct {
+    SortRun* runs;
+    uint8_t* records; // The current record of each run
+    uint8_t** heap;
+    uint32_t size; // Runs with records left
+    bool started;
+} RunMerge;
+
+/**
+ *
+ * Orders (key, value) records by one column. With a limit that fits in `memory_budget` the
+ * sorter keeps only the best `limit` records in a bounded heap. Otherwise it sorts up to
+ * `memory_budget` bytes of records at a time, spills each sorted run to a temporary file, and
+ * merges the runs, stopping after `limit` records when there is a limit. At most
+ * `max_merge_runs` runs are merged at once, each with its own stdio buffer: whenever that many
+ * runs of one level pile up they are merged into one run of the next level, and the last
+ * pass only starts once the runs left fit into one merge.
+ *
+ */
+typedef struct {
+    Column column;
+    bool descending;
+    bool has_limit;
+    uint64_t limit;
+    bool top_n; // The limit fits in the budget, so only the best limit records are kept
+    uint64_t num_returned;
+    uint32_t record_size;
+    uint32_t capacity; // Records held in memory at once
+    uint32_t allocated; // Records the buffer has room for, grows up to capacity
+    uint32_t num_records;
+    uint8_t* records;
+    uint8_t** heap;
+    SortRun* runs; // Levels never increase along the array
+    uint32_t num_runs;
+    uint32_t max_merge_runs;
+    RunMerge merge; // The last pass, once the sort is finished
+    uint32_t next_record; // Read position once an in-memory sort is finished
+} Sorter;
+
+#define RADIX_MAX_THREADS 16
+#define RADIX_MIN_KEYS_PER_THREAD 65536 // Below this a slice is not worth a thread
+
+// A key and the record it belongs to
+typedef struct {
+    uint64_t key;
+    uint32_t index;
+} SortKey;
+
+/**
+ *
+ * Sorts keys by key with an LSD radix sort, one byte per pass, on up to num_threads threads.
+ * Equal keys keep their order. Returns whichever of keys and scratch, both num_keys long,
+ * holds the result.
+ *
+ */
+SortKey* radix_sort_keys(SortKey* keys, SortKey* scratch, uint32_t num_keys, uint32_t num_threads);
+
+void initialize_sorter(Sorter* sorter, Column column, bool descending, bool has_limit, uint64_t limit, uint64_t memory_budget);
+bool sorter_add(Sorter* sorter, uint64_t key, uint8_t* value);
+bool sorter_finish(Sorter* sorter);
+bool sorter_next(Sorter* sorter, uint64_t* key, uint8_t** value);
+void free_sorter(Sorter* sorter);
+
+#endif
@@ -1,17 +1,19 @@
 require 'spec_helper'
+require 'socket'
+require 'json'
 
 describe 'database' do
     before do
-        `rm -rf test.db`
+        `rm -rf test.db test.db-journal test.sock test.json test.backup test.trace test.replay.db test.import test.pages`
     end
 
     after do
-        `rm -rf test.db`
+        `rm -rf test.db test.db-journal test.sock test.json test.backup test.trace test.replay.db test.import test.pages`
     end
 
-    def run_script(commands)
+    def run_script(commands, options = "")
         raw_output = nil
-        IO.popen("./build/simpleSQLite test.db", "r+") do |pipe|
+        IO.popen("./build/simpleSQLite --interactive #{options} test.db", "r+") do |pipe|
             commands.each do |command|
                 begin
                     pipe.puts command
@@ -26,6 +28,22 @@ describe 'database' do
         end
         raw_output.split("\n")
     end
+
+    def crc32c(data)
+        crc = 0xFFFFFFFF
+        data.each_byte do |byte|
+            crc ^= byte
+            8.times { crc = (crc >> 1) ^ (0x82F63B78 & -(crc & 1)) }
+        end
+        crc ^ 0xFFFFFFFF
+    end
+
+    # Writes the checksum trailer that a page edited in place needs to be read again
+    def rewrite_page_checksum(page_num)
+        page = File.binread("test.db", 4092, page_num * 4096)
+        checksum = crc32c([page_num].pack("L<") + page)
+        File.binwrite("test.db", [checksum].pack("L<"), page_num * 4096 + 4092)
+    end
   
     it 'inserts and retrieves a row' do
         result = run_script([
@@ -120,6 +138,624 @@ describe 'database' do
         ])
     end
 
+    it 'stores keys beyond 32 bits in a 64-bit key database' do
+        big_id = 2**40 + 7
+        result1 = run_script([
+            "insert #{big_id} big big@example.com",
+            "insert 3 small small@example.com",
+            ".exit",
+        ], "-k 64")
+        expect(result1).to match_array([
+            "db > Executed.",
+            "db > Executed.",
+            "db > ",
+        ])
+
+        result2 = run_script([
+            "select",
+            ".exit",
+        ])
+        expect(result2).to match_array([
+            "db > (3, small, small@example.com)",
+            "(#{big_id}, big, big@example.com)",
+            "Executed.",
+            "db > ",
+        ])
+    end
+
+    it 'rejects keys beyond 32 bits in a 32-bit key database' do
+        result = run_script([
+            "insert #{2**32} big big@example.com",
+            "select",
+            ".exit",
+        ])
+        expect(result).to match_array([
+            "db > Error: Key out of range.",
+            "db > Executed.",
+            "db > ",
+        ])
+    end
+
+    it 'reads and writes pages beyond 4 GB in a sparse file' do
+        run_script([".exit"])
+        # Grow the file sparsely so that every page allocated from now on lives past 4 GB
+        File.open("test.db", "r+") { |file| file.truncate(4 * 1024**3 + 2 * 4096) }
+
+        script = (1..30).map do |i|
+            "insert #{i} user#{i} person#{i}@example.com"
+        end
+        script << ".exit"
+        run_script(script)
+        expect(File.size("test.db")).to be > 4 * 1024**3
+
+        result = run_script([
+            "select",
+            ".exit",
+        ])
+        expect(result).to eq(
+            ["db > (1, user1, person1@example.com)"] +
+            (2..30).map { |i| "(#{i}, user#{i}, person#{i}@example.com)" } +
+            ["Executed.", "db > "]
+        )
+    end
+
+    it 'rolls back a transaction including leaf and internal splits' do
+        script = (1..5).map { |i| "insert #{i} user#{i} person#{i}@example.com" }
+        script << "begin"
+        script += (6..60).map { |i| "insert #{i} user#{i} person#{i}@example.com" }
+        script << "rollback"
+        script << ".btree"
+        script << "insert 6 user6 person6@example.com"
+        script << "select"
+        script << ".exit"
+        result = run_script(script)
+
+        expect(result[61...result.length]).to eq([
+            "db > Executed.",
+            "db > Tree:",
+            "- leaf (size 5)",
+            "  - 1",
+            "  - 2",
+            "  - 3",
+            "  - 4",
+            "  - 5",
+            "db > Executed.",
+            "db > (1, user1, person1@example.com)",
+            "(2, user2, person2@example.com)",
+            "(3, user3, person3@example.com)",
+            "(4, user4, person4@example.com)",
+            "(5, user5, person5@example.com)",
+            "(6, user6, person6@example.com)",
+            "Executed.",
+            "db > ",
+        ])
+    end
+
+    it 'keeps committed transactions and discards open ones on exit' do
+        script = ["begin"]
+        script += (1..20).map { |i| "insert #{i} user#{i} person#{i}@example.com" }
+        script << "commit"
+        script << "begin"
+        script << "insert 21 user21 person21@example.com"
+        script << ".exit"
+        run_script(script)
+        expect(File.exist?("test.db-journal")).to eq(false)
+
+        result = run_script([
+            "select",
+            ".exit",
+        ])
+        expect(result).to eq(
+            ["db > (1, user1, person1@example.com)"] +
+            (2..20).map { |i| "(#{i}, user#{i}, person#{i}@example.com)" } +
+            ["Executed.", "db > "]
+        )
+    end
+
+    it 'prints error messages for misplaced transaction statements' do
+        result = run_script([
+            "commit",
+            "rollback",
+            "begin",
+            "begin",
+            "commit",
+            ".exit",
+        ])
+        expect(result).to eq([
+            "db > Error: No active transaction.",
+            "db > Error: No active transaction.",
+            "db > Executed.",
+            "db > Error: Transaction already active.",
+            "db > Executed.",
+            "db > ",
+        ])
+    end
+
+    it 'writes dirty pages in the background before the database is closed' do
+        IO.popen("./build/simpleSQLite --interactive --flush-age-ms 10 test.db", "r+") do |pipe|
+            pipe.puts "insert 1 user1 person1@example.com"
+            pipe.flush
+            deadline = Time.now + 5
+            sleep 0.01 until File.size?("test.db") || Time.now > deadline
+            expect(File.size?("test.db")).to eq(2 * 4096)
+            pipe.puts ".exit"
+            pipe.close_write
+            pipe.gets(nil)
+        end
+    end
+
+    it 'keeps every row when the background flusher runs during inserts' do
+        script = (1..500).map { |i| "insert #{i} user#{i} person#{i}@example.com" }
+        script << ".exit"
+        run_script(script, "--flush-pages 1 --flush-age-ms 1")
+
+        result = run_script([
+            "select",
+            ".exit",
+        ])
+        expect(result.length).to eq(502)
+        expect(result[499]).to eq("(500, user500, person500@example.com)")
+    end
+
+    it 'selects only the projected columns' do
+        result = run_script([
+            "insert 2 tom tom@yahoo.com",
+            "insert 1 ben ben@gmail.com",
+            "select id",
+            "select email, id",
+            "select *",
+            "select id, phone",
+            ".exit",
+        ])
+        expect(result).to eq([
+            "db > Executed.",
+            "db > Executed.",
+            "db > (1)",
+            "(2)",
+            "Executed.",
+            "db > (ben@gmail.com, 1)",
+            "(tom@yahoo.com, 2)",
+            "Executed.",
+            "db > (1, ben, ben@gmail.com)",
+            "(2, tom, tom@yahoo.com)",
+            "Executed.",
+            "db > Syntax error. Could not parse statement.",
+            "db > ",
+        ])
+    end
+
+    it 'filters rows with where on string columns' do
+        long_email = "a" * 240 + "@example.com"
+        result = run_script([
+            "insert 1 ben ben@gmail.com",
+            "insert 2 tom tom@example.com",
+            "insert 3 bent #{long_email}",
+            "select where username = 'ben'",
+            "select id where email like '%@example.com'",
+            "select id, username where username like 'ben%'",
+            "select id where email like '%mail%' and username = ben",
+            "select id where email = '#{long_email}'",
+            "select where username like 'b_n'",
+            ".exit",
+        ])
+        expect(result).to eq([
+            "db > Executed.",
+            "db > Executed.",
+            "db > Executed.",
+            "db > (1, ben, ben@gmail.com)",
+            "Executed.",
+            "db > (2)",
+            "(3)",
+            "Executed.",
+            "db > (1, ben)",
+            "(3, bent)",
+            "Executed.",
+            "db > (1)",
+            "Executed.",
+            "db > (3)",
+            "Executed.",
+            "db > Syntax error. Could not parse statement.",
+            "db > ",
+        ])
+    end
+
+    it 'keeps running after a read fails inside the tree' do
+        run_script([
+            "insert 1 ben ben@gmail.com",
+            ".exit",
+        ])
+
+        # Point the header's root page at a page number that can never exist
+        File.binwrite("test.db", [0xFFFFFFFF].pack("L<"), 22)
+        rewrite_page_checksum(0)
+
+        result = run_script([
+            "select",
+            "insert 2 tom tom@gmail.com",
+            ".exit",
+        ])
+        expect(result).to eq([
+            "db > Tried to fetch page number out of bounds. 4294967295 > 4294967295",
+            "db > Tried to fetch page number out of bounds. 4294967295 > 4294967295",
+            "db > Error closing db file.",
+        ])
+    end
+
+    it 'catches a corrupted page by its checksum' do
+        script = (1..20).map { |i| "insert #{i} user#{i} person#{i}@example.com" }
+        script << ".exit"
+        run_script(script)
+        expect(run_script([".verify", ".exit"])).to eq(["db > Verified 4 pages.", "db > "])
+
+        # Flip one byte of a username in the first leaf
+        offset = 1 * 4096 + 100
+        byte = File.binread("test.db", 1, offset)
+        File.binwrite("test.db", (byte.ord ^ 0x01).chr, offset)
+
+        result = run_script([
+            ".verify",
+            "select",
+            ".exit",
+        ])
+        expect(result).to eq([
+            "db > 1 of 4 pages failed their checksum: 1",
+            "db > Checksum mismatch on page 1.",
+            "db > Error closing db file.",
+        ])
+    end
+
+    it 'keeps a compressed database smaller on disk and reads it back' do
+        script = (1..200).map { |i| "insert #{i} user#{i} person#{i}@example.com" }
+        script << ".exit"
+        run_script(script)
+        uncompressed_size = File.size("test.db")
+        File.delete("test.db")
+
+        run_script(script, "--compress")
+        expect(File.size("test.db")).to be < uncompressed_size / 4
+
+        result = run_script(["select where username = user200", ".verify", ".exit"])
+        expect(result).to eq([
+            "db > (200, user200, person200@example.com)",
+            "Executed.",
+            "db > Verified 51 pages.",
+            "db > ",
+        ])
+
+        result = run_script([".defrag", "select where username = user1", ".exit"])
+        expect(result).to eq([
+            "db > Error: Cannot defragment a compressed database.",
+            "db > (1, user1, person1@example.com)",
+            "Executed.",
+            "db > ",
+        ])
+    end
+
+    it 'serves pipelined requests from several clients over a socket' do
+        server = IO.popen("./build/simpleSQLiteServer test.sock test.db", "r")
+        expect(server.gets).to eq("Listening on test.sock\n")
+
+        first = UNIXSocket.new("test.sock")
+        second = UNIXSocket.new("test.sock")
+
+        first.write("insert 1 ben ben@gmail.com\ninsert 1 ben ben@gmail.com\nbegin\ninsert 2 tom tom@gmail.com\n")
+        expect((1..4).map { first.gets }).to eq([
+            "OK\n",
+            "ERR Error: Duplicate key.\n",
+            "OK\n",
+            "OK\n",
+        ])
+
+        # The second client waits until the transaction it would otherwise see half of is over
+        second.write("select id\n")
+        expect(IO.select([second], nil, nil, 0.2)).to eq(nil)
+        first.write("commit\n")
+        expect(first.gets).to eq("OK\n")
+        expect((1..3).map { second.gets }).to eq(["(1)\n", "(2)\n", "OK\n"])
+
+        first.close
+        second.close
+        Process.kill("TERM", server.pid)
+        server.close
+
+        result = run_script([
+            "select",
+            ".exit",
+        ])
+        expect(result).to eq([
+            "db > (1, ben, ben@gmail.com)",
+            "(2, tom, tom@gmail.com)",
+            "Executed.",
+            "db > ",
+        ])
+    end
+
+    it 'lets writers run while a long select reads its snapshot' do
+        server = IO.popen("./build/simpleSQLiteServer test.sock test.db", "r")
+        expect(server.gets).to eq("Listening on test.sock\n")
+
+        long_email = "a" * 240 + "@example.com"
+        loader = UNIXSocket.new("test.sock")
+        loader.write((1..10000).map { |i| "insert #{2 * i} user#{2 * i} #{long_email}\n" }.join)
+        expect((1..10000).map { loader.gets }.uniq).to eq(["OK\n"])
+        loader.close
+
+        # The reader does not read on, so its select stalls at the output high water
+        reader = UNIXSocket.new("test.sock")
+        reader.write("select\n")
+        expect(reader.gets).to eq("(2, user2, #{long_email})\n")
+
+        # Odd ids land in leaves all over the tree, splitting some the select has yet to reach
+        writer = UNIXSocket.new("test.sock")
+        (0...100).each do |i|
+            writer.write("insert #{200 * i + 1} new#{i} new#{i}@example.com\n")
+            expect(writer.gets).to eq("OK\n")
+        end
+
+        rows = []
+        while (line = reader.gets) != "OK\n"
+            rows << line
+        end
+        expect(rows.length).to eq(9999)
+        expect(rows.all? { |row| row.split(",").first.delete("(").to_i.even? }).to eq(true)
+
+        writer.write("select id where username = new99\n")
+        expect((1..2).map { writer.gets }).to eq(["(19801)\n", "OK\n"])
+
+        reader.close
+        writer.close
+        Process.kill("TERM", server.pid)
+        server.close
+    end
+
+    it 'orders rows by a column with a limit' do
+        result = run_script([
+            "insert 1 zed zed@gmail.com",
+            "insert 2 amy amy@gmail.com",
+            "insert 3 bob bob@gmail.com",
+            "select order by username desc limit 2",
+            "select id order by id desc",
+            "select id where email like '%gmail.com' limit 1",
+            "select order by phone",
+            ".exit",
+        ])
+        expect(result).to eq([
+            "db > Executed.",
+            "db > Executed.",
+            "db > Executed.",
+            "db > (1, zed, zed@gmail.com)",
+            "(3, bob, bob@gmail.com)",
+            "Executed.",
+            "db > (3)",
+            "(2)",
+            "(1)",
+            "Executed.",
+            "db > (1)",
+            "Executed.",
+            "db > Syntax error. Could not parse statement.",
+            "db > ",
+        ])
+    end
+
+    it 'merges sorted runs when an order by spills to disk' do
+        script = (1..200).map do |i|
+            "insert #{i} user#{i} #{(i * 37) % 200}@x.com"
+        end
+        script << "select id order by email"
+        script << ".exit"
+        result = run_script(script, "--sort-memory-kb 1")
+
+        expected = (1..200).sort_by { |i| "#{(i * 37) % 200}@x.com" }.map { |i| "(#{i})" }
+        expected[0] = "db > " + expected[0]
+        expect(result[200...400]).to eq(expected)
+
+        # A limit beyond the budget spills runs too and stops the merge after limit rows
+        script[-2] = "select id order by email limit 50"
+        `rm -rf test.db`
+        result = run_script(script, "--sort-memory-kb 1")
+        expect(result[200...250]).to eq(expected[0...50])
+        expect(result[250]).to eq("Executed.")
+
+        # Thousands of runs are merged a few at a time, so they never all need a file at once
+        script = (1..3000).map { |i| "insert #{i} user#{i} #{(i * 37) % 3000}@x.com" }
+        script << "select id order by email desc"
+        script << ".exit"
+        `rm -rf test.db`
+        output = IO.popen(["sh", "-c", "ulimit -n 32 && ./build/simpleSQLite --interactive --sort-memory-kb 1 test.db"], "r+") do |pipe|
+            pipe.puts script
+            pipe.close_write
+            pipe.gets(nil)
+        end
+        result = output.split("\n")
+        expected = (1..3000).sort_by { |i| "#{(i * 37) % 3000}@x.com" }.reverse.map { |i| "(#{i})" }
+        expected[0] = "db > " + expected[0]
+        expect(result[3000...6000]).to eq(expected)
+        expect(result[6000]).to eq("Executed.")
+    end
+
+    it 'counts pager, tree and statement statistics' do
+        script = (1..14).map { |i| "insert #{i} user#{i} person#{i}@example.com" }
+        script += [
+            "create table other",
+            "insert into other 1 one one@example.com",
+            "select",
+            ".stats",
+            ".stats tree",
+            ".stats tree json",
+            ".stats reset",
+            ".stats",
+            ".exit",
+        ]
+        result = run_script(script, "--stats-json test.json")
+
+        before_reset = result[0...result.index("db > Statistics reset.")]
+        # Only .stats tree walks the tables
+        expect(before_reset[0...before_reset.index("db > Default table:")].grep(/height/)).to eq([])
+        tree = before_reset[before_reset.index("db > Default table:")..-1]
+        expect(tree[0...3]).to eq(["db > Default table:", "  height: 2", "  leaf pages: 2"])
+        expect(tree).to include("Table other:")
+        shapes = JSON.parse(before_reset.find { |line| line.start_with?("db > [") }.sub("db > ", ""))
+        expect(shapes.map { |shape| shape["name"] }).to eq([nil, "other"])
+        expect(shapes.map { |shape| shape["height"] }).to eq([2, 1])
+        expect(shapes[0]["leaf_fill"].sum).to eq(2)
+        expect(before_reset).to include("  leaf splits: 1")
+        expect(before_reset).to include("  root splits: 1")
+        expect(before_reset).to include("  cursor advances: 14")
+        expect(before_reset.any? { |line| line.start_with?("  insert: 15 run, p50 ") }).to eq(true)
+        expect(before_reset.any? { |line| line.start_with?("  select: 1 run, p50 ") }).to eq(true)
+
+        after_reset = result[result.index("db > Statistics reset.")..-1]
+        expect(after_reset).to include("  leaf splits: 0")
+        expect(after_reset).to include("  insert: 0 run")
+
+        # Closing the database does not walk the tree
+        stats = JSON.parse(File.read("test.json"))
+        expect(stats["tree"].key?("height")).to eq(false)
+        expect(stats["statements"]["insert"]["count"]).to eq(0)
+        expect(stats["pager"]["cache_misses"]).to eq(0)
+    end
+
+    it 'starts lookups from the last leaf and still finds every key' do
+        keys = (1..60).map { |i| (i * 37) % 60 + 1 }
+        script = keys.map { |i| "insert #{i} user#{i} person#{i}@example.com" }
+        script += [5, 6, 7, 40, 41, 42, 43].map { |i| "update #{i} set username=new#{i}" }
+        script += [
+            "select id, username",
+            ".stats",
+            ".exit",
+        ]
+        result = run_script(script)
+
+        rows = result.select { |line| line.match?(/\(\d+, /) }.map { |line| line.sub("db > ", "") }
+        expect(rows).to eq((1..60).map do |i|
+            name = [5, 6, 7, 40, 41, 42, 43].include?(i) ? "new#{i}" : "user#{i}"
+            "(#{i}, #{name})"
+        end)
+        finger_hits = result.find { |line| line.start_with?("  finger hits: ") }
+        expect(finger_hits.split(": ").last.to_i).to be > 0
+    end
+
+    it 'imports unsorted rows by building the tree bottom-up' do
+        keys = (1..40).map { |i| (i * 17) % 40 + 1 }
+        rows = keys.map { |i| "#{i} user#{i} person#{i}@example.com" }
+        rows.insert(5, "23 first23 first@example.com")
+        File.write("test.import", rows.join("\n") + "\n\n")
+        script = [
+            ".import test.import",
+            ".import test.import",
+            "select id, username",
+            ".stats",
+            ".stats tree",
+            ".exit",
+        ]
+        result = run_script(script)
+
+        expect(result).to include("db > Imported 40 rows, skipped 1 duplicate keys.")
+        expect(result).to include("db > Imported 0 rows, skipped 41 duplicate keys.")
+        selected = result.select { |line| line.match?(/\(\d+, /) }.map { |line| line.sub("db > ", "") }
+        expect(selected).to eq((1..40).map { |i| "(#{i}, #{i == 23 ? "first23" : "user#{i}"})" })
+        expect(result).to include("  leaf splits: 0")
+        expect(result).to include("  height: 2")
+
+        File.write("test.import", "41 user41 person41@example.com\n42 user42\n")
+        result = run_script([".import test.import", "select id", ".exit"])
+        expect(result).to include("db > Error: line 2: Syntax error. Could not parse row.")
+        expect(result.count { |line| line.match?(/\(\d+\)/) }).to eq(40)
+        expect(result.select { |line| line.include?("(41)") }).to eq([])
+    end
+
+    it 'lays the leaves out in key order and keeps every row' do
+        keys = (0...850).map { |i| (i * 7919) % 850 + 1 }
+        script = keys.map { |i| "insert #{i} user#{i} person#{i}@example.com" }
+        script += [
+            "create table extra",
+            "insert into extra 7 seven seven@example.com",
+            ".stats tree",
+            ".defrag",
+            ".defrag",
+            ".stats tree",
+            ".verify",
+            ".exit",
+        ]
+        result = run_script(script)
+
+        before = result[0...result.index { |line| line.start_with?("db > Moved ") }]
+        after = result[result.index { |line| line.start_with?("db > Moved ") }..-1]
+        leaf_pages = after.find { |line| line.start_with?("  leaf pages: ") }.split(": ").last.to_i
+        expect(before.find { |line| line.start_with?("  sequential leaf links: ") }).not_to eq("  sequential leaf links: #{leaf_pages - 1}")
+        expect(after).to include("  sequential leaf links: #{leaf_pages - 1}")
+        expect(after[1]).to match(/^db > Moved 0 of \d+ pages\.$/)
+        expect(after.any? { |line| line.match?(/^db > Verified \d+ pages\.$/) }).to eq(true)
+
+        result = run_script(["select id", "select from extra", ".exit"])
+        selected = result.select { |line| line.match?(/\(\d+\)/) }.map { |line| line.sub("db > ", "") }
+        expect(selected).to eq((1..850).map { |i| "(#{i})" })
+        expect(result).to include("db > (7, seven, seven@example.com)")
+    end
+
+    it 'looks up a list of ids in one batch' do
+        keys = (0...300).map { |i| (i * 37) % 300 + 1 }
+        script = keys.map { |i| "insert #{i} user#{i} person#{i}@example.com" }
+        script += [
+            "create table extra",
+            "insert into extra 7 seven seven@example.com",
+            ".stats reset",
+            "select id, username where id in (250, 3, 999, 3, 120,121)",
+            "select id where id in ( 5 , 200 ) and username = user200",
+            "select id where id in (1, 2, 3, 4) order by id desc limit 2",
+            "select from extra where id in (7, 8)",
+            "select id where id in (3, -1)",
+            "select id where id in (3, 4",
+            "select id where username in (3)",
+            ".stats",
+            ".stats tree",
+            ".exit",
+        ]
+        result = run_script(script)
+
+        output = result[result.index("db > Statistics reset.") + 1..-1]
+        expect(output[0...14]).to eq([
+            "db > (3, user3)",
+            "(120, user120)",
+            "(121, user121)",
+            "(250, user250)",
+            "Executed.",
+            "db > (200)",
+            "Executed.",
+            "db > (4)",
+            "(3)",
+            "Executed.",
+            "db > (7, seven, seven@example.com)",
+            "Executed.",
+            "db > ID must be positive.",
+            "db > Syntax error. Could not parse statement.",
+        ])
+        expect(output[14]).to eq("db > Syntax error. Could not parse statement.")
+        expect(output).to include("  batched keys: 13")
+        height = output.find { |line| line.start_with?("  height: ") }.split(": ").last.to_i
+        visits = output.find { |line| line.start_with?("  batched node visits: ") }.split(": ").last.to_i
+        expect(visits).to be < 13 * height / 2
+    end
+
+    it 'answers hot lookups from the hash index across splits' do
+        hot = [5, 20]
+        script = (1..30).map { |i| "insert #{i} user#{i} person#{i}@example.com" }
+        script += hot.map { |i| "update #{i} set username=warm#{i}" }
+        script += (31..60).map { |i| "insert #{i} user#{i} person#{i}@example.com" }
+        script += (1..10).flat_map { |n| hot.map { |i| "update #{i} set username=hot#{i}x#{n}" } }
+        script += [
+            "select id, username",
+            ".stats",
+            ".exit",
+        ]
+        result = run_script(script, "--hash-index-kb 64")
+
+        rows = result.select { |line| line.match?(/\(\d+, /) }.map { |line| line.sub("db > ", "") }
+        expect(rows).to eq((1..60).map { |i| "(#{i}, #{hot.include?(i) ? "hot#{i}x10" : "user#{i}"})" })
+        hash_index_hits = result.find { |line| line.start_with?("  hash index hits: ") }
+        expect(hash_index_hits.split(": ").last.to_i).to be > 0
+    end
+
     it 'allows printing out the structure of a one-node btree' do
         script = [3, 1, 2].map do |i|
             "insert #{i} user#{i} person#{i}@example.com"
@@ -155,12 +791,206 @@ describe 'database' do
             "COMMON_NODE_HEADER_SIZE: 6",
             "LEAF_NODE_HEADER_SIZE: 14",
             "LEAF_NODE_CELL_SIZE: 296",
-            "LEAF_NODE_SPACE_FOR_CELLS: 4082",
+            "LEAF_NODE_SPACE_FOR_CELLS: 4070",
             "LEAF_NODE_MAX_CELLS: 13",
             "db > ",
         ])
     end
 
+    it 'updates rows in place and upserts missing ones' do
+        script = (1..20).map do |i|
+            "insert #{i} user#{i} person#{i}@example.com"
+        end
+        script += [
+            "update 7 set email=seven@example.com",
+            "update 8 set username=eight, email=eight@example.com",
+            "update 21 set username=nobody",
+            "upsert 9 nine nine@example.com",
+            "insert or replace 21 user21 person21@example.com",
+            "update 7 set id=8",
+            "select where email = seven@example.com",
+            "select where username = eight",
+            "select where username = nine",
+            "select where username = user21",
+            ".exit",
+        ]
+        result = run_script(script)
+
+        expect(result[20...(result.length)]).to eq([
+            "db > Executed.",
+            "db > Executed.",
+            "db > Error: Key not found.",
+            "db > Executed.",
+            "db > Executed.",
+            "db > Syntax error. Could not parse statement.",
+            "db > (7, user7, seven@example.com)",
+            "Executed.",
+            "db > (8, eight, eight@example.com)",
+            "Executed.",
+            "db > (9, nine, nine@example.com)",
+            "Executed.",
+            "db > (21, user21, person21@example.com)",
+            "Executed.",
+            "db > ",
+        ])
+    end
+
+    it 'leaves no trace of a longer string in the slot a row is written over' do
+        # Row 1 is written into the cell row 2 is shifted out of, then row 2 gets a shorter email
+        run_script([
+            "insert 2 two aaaaaaaaaaaaaaaaaaaaaaaaa.stale.tail@example.com",
+            "insert 1 one one@example.com",
+            "update 2 set email=two@example.com",
+            ".exit",
+        ])
+        expect(File.binread("test.db")).not_to include("stale")
+    end
+
+    it 'keeps named tables apart in one file' do
+        script = [
+            "create table users",
+            "create table users",
+            "insert 1 main1 main1@example.com",
+            "insert into users 1 user1 person1@example.com",
+            "insert into orders 1 user1 person1@example.com",
+        ]
+        script += (2..30).map do |i|
+            "insert into users #{i} user#{i} person#{i}@example.com"
+        end
+        script += [
+            "update users 2 set username=two",
+            ".exit",
+        ]
+        run_script(script)
+
+        result = run_script([
+            "select",
+            "select id from users where username = two",
+            "select id from users order by id desc limit 1",
+            ".tables",
+            "drop table users",
+            "select from users",
+            ".tables",
+            ".exit",
+        ])
+        expect(result).to eq([
+            "db > (1, main1, main1@example.com)",
+            "Executed.",
+            "db > (2)",
+            "Executed.",
+            "db > (30)",
+            "Executed.",
+            "db > users",
+            "db > Executed.",
+            "db > Error: No such table.",
+            "db > db > ",
+        ])
+    end
+
+    it 'runs a script in batch mode and keeps its rows without an .exit' do
+        File.write("test.sql", (1..50).map { |i| "insert #{i} user#{i} person#{i}@example.com" }.join("\n") +
+            "\ninsert 7 user7 person7@example.com\nselect where username = user50")
+        output = `./build/simpleSQLite -f test.sql test.db 2>&1`
+        expect($?.exitstatus).to eq(1)
+        expect(output.split("\n")).to eq([
+            "line 51: Error: Duplicate key.",
+            "(50, user50, person50@example.com)",
+        ])
+
+        output = `echo "select id where username = user49" | ./build/simpleSQLite test.db`
+        expect($?.exitstatus).to eq(0)
+        expect(output).to eq("(49)\n")
+        File.delete("test.sql")
+
+        output = `./build/simpleSQLite -f test.sql test.db 2>/dev/null`
+        expect($?.exitstatus).to eq(1)
+        expect(output).to eq("")
+    end
+
+    it 'fails a batch that ends in .exit when a statement or a meta command failed' do
+        output = `printf 'insert 1 a a\nbogus\n.exit\n' | ./build/simpleSQLite test.db 2>&1`
+        expect($?.exitstatus).to eq(1)
+        expect(output).to eq("line 2: Unrecognized keyword at start of 'bogus'.\n")
+
+        output = `printf 'select\n.backup /nonexistent/test.backup\n.exit\n' | ./build/simpleSQLite test.db 2>/dev/null`
+        expect($?.exitstatus).to eq(1)
+        expect(output).to eq("(1, a, a)\n")
+
+        `printf 'select\n.exit\n' | ./build/simpleSQLite test.db`
+        expect($?.exitstatus).to eq(0)
+    end
+
+    it 'backs up an open database and copies only the changed pages the next time' do
+        script = (1..100).map { |i| "insert #{i} user#{i} person#{i}@example.com" }
+        script += [
+            ".backup test.backup",
+            "insert 101 user101 person101@example.com",
+            ".backup test.backup",
+            "begin",
+            ".backup test.backup",
+            "rollback",
+            ".exit",
+        ]
+        result = run_script(script)
+        expect(result[-7..-1]).to eq([
+            "db > Backed up 24 of 24 pages.",
+            "db > Executed.",
+            "db > Backed up 2 of 24 pages, changed since the last backup.",
+            "db > Executed.",
+            "db > Error: Cannot back up inside a transaction.",
+            "db > Executed.",
+            "db > ",
+        ])
+
+        output = `printf 'select where username = user101\\n.verify\\n' | ./build/simpleSQLite --interactive test.backup`
+        expect(output.split("\n")).to eq([
+            "db > (101, user101, person101@example.com)",
+            "Executed.",
+            "db > Verified 24 pages.",
+            "db > ",
+        ])
+
+        # Opening the copy made it a database of its own, so the next backup starts over
+        expect(run_script([".backup test.backup", ".exit"])).to eq(["db > Backed up 24 of 24 pages.", "db > "])
+    end
+
+    it 'captures statements and replays them against a fresh database' do
+        script = (1..300).map { |i| "insert #{i} user#{i} person#{i}@example.com" }
+        script += ["insert 7 user7 person7@example.com", "select where username = user42", "select", ".exit"]
+        run_script(script, "--capture test.trace")
+        expect(File.size("test.trace")).to be < 300 * 64
+
+        output = `./build/simpleSQLiteReplay --threads 2 test.trace test.replay.db`
+        expect($?.exitstatus).to eq(0)
+        report = JSON.parse(output)
+        expect(report["statements"]).to eq(303)
+        expect(report["errors"]).to eq(1)
+        expect(report["mismatches"]).to eq(0)
+
+        # Replayed a second time, the inserts that worked in the capture now fail
+        report = JSON.parse(`./build/simpleSQLiteReplay test.trace test.replay.db`)
+        expect(report["mismatches"]).to eq(300)
+    end
+
+    it 'traces the pages each statement fetches' do
+        script = (1..300).map { |i| "insert #{i} user#{i} person#{i}@example.com" }
+        run_script(script + [".exit"], "--page-trace test.pages")
+        report = JSON.parse(`./build/simpleSQLitePageReport test.pages`)
+        expect(report["statements"]).to eq(300)
+        expect(report["accesses"]).to eq(report["hits"] + report["misses"] + report["new_pages"])
+        expect(report["new_pages"]).to eq(report["pages"])
+        expect(report["operations"]["insert"]["pages"]).to eq(report["pages"] - 1)
+
+        # Opened again every page comes from the file, the scan reads the leaves once each
+        run_script(["select", ".exit"], "--page-trace test.pages")
+        report = JSON.parse(`./build/simpleSQLitePageReport --window 10 test.pages`)
+        expect(report["statements"]).to eq(1)
+        expect(report["misses"]).to eq(report["pages"])
+        expect(report["miss_sequential"] + report["miss_random"]).to eq(report["misses"])
+        expect(report["page_types"]["leaf"]).to be > 300
+        expect(report["lru_hit_percent"]["16"]).to eq((100.0 * report["hits"] / report["accesses"]).round(1))
+    end
+
     it 'prints an error message if there is a duplicate id' do
         scripts = [
             "insert 1 user1 person1@example.com",
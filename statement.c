@@ -3,73 +3,618 @@
 #include "cursor.h"
 #include "node.h"
 #include "constants.h"
+#include "sort.h"
+#include "catalog.h"
 #include <string.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <ctype.h>
 
-PrepareResult prepare_statement(InputBuffer* input_buffer, Statement* statement) {
-    if (strncmp(input_buffer->buffer, "insert", 6) == 0) {
-        return prepare_insert_statement(input_buffer, statement);
+PrepareResult prepare_statement(char* sql, Statement* statement) {
+    statement->num_parameters = 0;
+    statement->table_name[0] = '\0';
+
+    if (strncmp(sql, "insert", 6) == 0 || strncmp(sql, "upsert", 6) == 0) {
+        return prepare_insert_statement(sql, statement);
+    }
+
+    if (strncmp(sql, "update", 6) == 0) {
+        return prepare_update_statement(sql, statement);
+    }
+
+    if (strncmp(sql, "select", 6) == 0) {
+        return prepare_select_statement(sql, statement);
+    }
+
+    if (strncmp(sql, "create", 6) == 0 || strncmp(sql, "drop", 4) == 0) {
+        return prepare_table_statement(sql, statement);
+    }
+
+    if (strcmp(sql, "begin") == 0) {
+        statement->type = STATEMENT_BEGIN;
+        return PREPARE_SUCCESS;
+    }
+
+    if (strcmp(sql, "commit") == 0) {
+        statement->type = STATEMENT_COMMIT;
+        return PREPARE_SUCCESS;
     }
 
-    if (strcmp(input_buffer->buffer, "select") == 0) {
-        statement->type = STATEMENT_SELECT;
+    if (strcmp(sql, "rollback") == 0) {
+        statement->type = STATEMENT_ROLLBACK;
         return PREPARE_SUCCESS;
     }
 
     return PREPARE_UNRECOGNIZED_STATEMENT;
 }
 
-PrepareResult prepare_insert_statement(InputBuffer* input_buffer, Statement* statement) {
+static PrepareResult parse_unsigned(const char* text, uint64_t* value) {
+    if (text[0] == '-') {
+        return PREPARE_NEGATIVE_ID;
+    }
+
+    char* end;
+    errno = 0;
+    unsigned long long parsed = strtoull(text, &end, 10);
+    if (errno == ERANGE || text[0] == '\0' || *end != '\0') {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    *value = parsed;
+    return PREPARE_SUCCESS;
+}
+
+static PrepareResult copy_column_string(char* destination, const char* text, uint32_t max_length) {
+    if (strlen(text) > max_length) {
+        return PREPARE_STRING_TOO_LONG;
+    }
+    strcpy(destination, text);
+    return PREPARE_SUCCESS;
+}
+
+// Table names start with a letter, so they never read as an id
+static PrepareResult copy_table_name(char* destination, const char* name) {
+    if (name == NULL || !isalpha((unsigned char)name[0])) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    for (const char* c = name; *c != '\0'; c++) {
+        if (!isalnum((unsigned char)*c) && *c != '_') {
+            return PREPARE_SYNTAX_ERROR;
+        }
+    }
+    return copy_column_string(destination, name, MAX_TABLE_NAME_LENGTH);
+}
+
+static bool is_parameter(const char* token) {
+    return strcmp(token, "?") == 0;
+}
+
+// Records a `?`, which is only checked once a value is bound to it
+static PrepareResult add_parameter(Statement* statement, ParameterTarget target) {
+    if (statement->num_parameters >= MAX_PARAMETERS) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    Parameter* parameter = &statement->parameters[statement->num_parameters++];
+    parameter->target = target;
+    parameter->bound = false;
+    return PREPARE_SUCCESS;
+}
+
+static PrepareResult set_row_column(Row* row, Column column, const char* value) {
+    // The id is the only column that is not text
+    if (!is_text_column(column)) {
+        return parse_unsigned(value, &row->id);
+    }
+    return copy_column_string(row_text(row, column), value, column_size(column) - 1);
+}
+
+static int compare_keys(const void* left, const void* right) {
+    uint64_t left_key = *(const uint64_t*)left;
+    uint64_t right_key = *(const uint64_t*)right;
+    return left_key < right_key ? -1 : left_key > right_key;
+}
+
+// Sorted once here, so a select with a key list can share the descents of neighbouring ids
+static void normalize_key_list(Statement* statement) {
+    qsort(statement->key_list, statement->key_list_length, sizeof(uint64_t), compare_keys);
+    uint32_t length = 0;
+    for (uint32_t i = 0; i < statement->key_list_length; i++) {
+        if (length == 0 || statement->key_list[length - 1] != statement->key_list[i]) {
+            statement->key_list[length++] = statement->key_list[i];
+        }
+    }
+    statement->key_list_length = length;
+}
+
+static const char* skip_spaces(const char* text, const char* end) {
+    while (text < end && isspace((unsigned char)*text)) {
+        text++;
+    }
+    return text;
+}
+
+// <id>[, <id> ...] between text and end, in parentheses or not
+static PrepareResult parse_key_list(const char* text, const char* end, Statement* statement) {
+    text = skip_spaces(text, end);
+    bool parenthesized = text < end && *text == '(';
+    if (parenthesized) {
+        text++;
+    }
+
+    uint32_t length = 0;
+    while (true) {
+        text = skip_spaces(text, end);
+        if (text < end && *text == '-') {
+            return PREPARE_NEGATIVE_ID;
+        }
+        if (text >= end || !isdigit((unsigned char)*text) || length >= MAX_KEY_LIST) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+
+        char* key_end;
+        errno = 0;
+        unsigned long long key = strtoull(text, &key_end, 10);
+        if (errno == ERANGE || key_end > end) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        statement->key_list[length++] = key;
+
+        text = skip_spaces(key_end, end);
+        if (text >= end || *text != ',') {
+            break;
+        }
+        text++;
+    }
+
+    if (parenthesized) {
+        if (text >= end || *text != ')') {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        text = skip_spaces(text + 1, end);
+    }
+    if (text != end) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    statement->key_list_length = length;
+    normalize_key_list(statement);
+    return PREPARE_SUCCESS;
+}
+
+// Fills in the part of the statement a `?` stands for, with the same checks as a literal
+static PrepareResult set_parameter_target(Statement* statement, Parameter* parameter, const char* value) {
+    switch (parameter->target) {
+        case (PARAMETER_ROW_COLUMN):
+            return set_row_column(&statement->row_to_insert, parameter->column, value);
+        case (PARAMETER_PREDICATE): {
+            Predicate* predicate = &statement->select_predicates[parameter->predicate_num];
+            if (!initialize_predicate(predicate, predicate->column, parameter->operator, value)) {
+                return PREPARE_SYNTAX_ERROR;
+            }
+            return PREPARE_SUCCESS;
+        }
+        case (PARAMETER_LIMIT): {
+            PrepareResult result = parse_unsigned(value, &statement->limit);
+            return result == PREPARE_NEGATIVE_ID ? PREPARE_SYNTAX_ERROR : result;
+        }
+        case (PARAMETER_KEY_LIST):
+            return parse_key_list(value, value + strlen(value), statement);
+    }
+    return PREPARE_SYNTAX_ERROR;
+}
+
+// A literal is checked right away, a `?` once a value is bound to it
+static PrepareResult prepare_row_value(Statement* statement, Column column, const char* token) {
+    if (is_parameter(token)) {
+        PrepareResult result = add_parameter(statement, PARAMETER_ROW_COLUMN);
+        if (result == PREPARE_SUCCESS) {
+            statement->parameters[statement->num_parameters - 1].column = column;
+        }
+        return result;
+    }
+
+    Parameter literal = { .target = PARAMETER_ROW_COLUMN, .column = column };
+    return set_parameter_target(statement, &literal, token);
+}
+
+PrepareResult bind_parameter(Statement* statement, uint32_t parameter_num, const char* value) {
+    Parameter* parameter = &statement->parameters[parameter_num];
+    PrepareResult result = set_parameter_target(statement, parameter, value);
+    parameter->bound = result == PREPARE_SUCCESS;
+    return result;
+}
+
+// The ids of an `id in ?`, taken as they are instead of being parsed from text
+PrepareResult bind_key_list(Statement* statement, uint32_t parameter_num, const uint64_t* keys, uint32_t num_keys) {
+    Parameter* parameter = &statement->parameters[parameter_num];
+    parameter->bound = false;
+    if (parameter->target != PARAMETER_KEY_LIST || num_keys == 0 || num_keys > MAX_KEY_LIST) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    memcpy(statement->key_list, keys, sizeof(uint64_t) * num_keys);
+    statement->key_list_length = num_keys;
+    normalize_key_list(statement);
+    parameter->bound = true;
+    return PREPARE_SUCCESS;
+}
+
+// insert [into <table>] <id> <username> <email>, or upsert / insert or replace with the same values.
+// The values follow the order of ROW_SCHEMA
+PrepareResult prepare_insert_statement(char* sql, Statement* statement) {
     statement->type = STATEMENT_INSERT;
 
-    char* keyword = strtok(input_buffer->buffer, " ");
-    if (strcmp(keyword, "insert") != 0) {
+    char* keyword = strtok(sql, " ");
+    if (strcmp(keyword, "upsert") == 0) {
+        statement->type = STATEMENT_UPSERT;
+    } else if (strcmp(keyword, "insert") != 0) {
         return PREPARE_SYNTAX_ERROR;
     }
 
     char* id_string = strtok(NULL, " ");
-    char* username = strtok(NULL, " ");
-    char* email = strtok(NULL, " ");
-    if (id_string == NULL || username == NULL || email == NULL) {
+    if (statement->type == STATEMENT_INSERT && id_string != NULL && strcmp(id_string, "or") == 0) {
+        char* replace = strtok(NULL, " ");
+        if (replace == NULL || strcmp(replace, "replace") != 0) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        statement->type = STATEMENT_UPSERT;
+        id_string = strtok(NULL, " ");
+    }
+    if (id_string != NULL && strcmp(id_string, "into") == 0) {
+        PrepareResult result = copy_table_name(statement->table_name, strtok(NULL, " "));
+        if (result != PREPARE_SUCCESS) {
+            return result;
+        }
+        id_string = strtok(NULL, " ");
+    }
+    char* values[NUM_COLUMNS];
+    values[COLUMN_ID] = id_string;
+    for (uint32_t i = 0; i < NUM_COLUMNS; i++) {
+        if (i != COLUMN_ID) {
+            values[i] = strtok(NULL, " ");
+        }
+        if (values[i] == NULL) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+    }
+
+    for (uint32_t i = 0; i < NUM_COLUMNS; i++) {
+        PrepareResult result = prepare_row_value(statement, (Column)i, values[i]);
+        if (result != PREPARE_SUCCESS) {
+            return result;
+        }
+    }
+
+    return PREPARE_SUCCESS;
+}
+
+// <id> <username> <email>, the values of an insert on a line of their own, as an import reads them
+PrepareResult prepare_row(char* text, Row* row) {
+    char* value = strtok(text, " ");
+    for (uint32_t i = 0; i < NUM_COLUMNS; i++) {
+        if (value == NULL) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        PrepareResult result = set_row_column(row, (Column)i, value);
+        if (result != PREPARE_SUCCESS) {
+            return result;
+        }
+        value = strtok(NULL, " ");
+    }
+    return value == NULL ? PREPARE_SUCCESS : PREPARE_SYNTAX_ERROR;
+}
+
+// update [<table>] <id> set <column>=<value>[, ...] for any of the text columns
+PrepareResult prepare_update_statement(char* sql, Statement* statement) {
+    statement->type = STATEMENT_UPDATE;
+    memset(statement->update_columns, 0, sizeof(statement->update_columns));
+
+    char* keyword = strtok(sql, " ");
+    if (strcmp(keyword, "update") != 0) {
+        return PREPARE_UNRECOGNIZED_STATEMENT;
+    }
+
+    char* id_string = strtok(NULL, " ");
+    if (id_string != NULL && isalpha((unsigned char)id_string[0])) {
+        PrepareResult result = copy_table_name(statement->table_name, id_string);
+        if (result != PREPARE_SUCCESS) {
+            return result;
+        }
+        id_string = strtok(NULL, " ");
+    }
+    char* set = strtok(NULL, " ");
+    if (id_string == NULL || set == NULL || strcmp(set, "set") != 0) {
         return PREPARE_SYNTAX_ERROR;
     }
 
-    int id = atoi(id_string);
-    if (id < 0) {
-        return PREPARE_NEGATIVE_ID;
+    PrepareResult result = prepare_row_value(statement, COLUMN_ID, id_string);
+    if (result != PREPARE_SUCCESS) {
+        return result;
     }
-    if (strlen(username) > COLUMN_USERNAME_LENGTH) {
-        return PREPARE_STRING_TOO_LONG;
+
+    char* assignment;
+    while ((assignment = strtok(NULL, " ,")) != NULL) {
+        char* value = strchr(assignment, '=');
+        if (value == NULL) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        *value++ = '\0';
+
+        Column column;
+        if (!parse_column(assignment, &column) || !is_text_column(column) || statement->update_columns[column]) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        statement->update_columns[column] = true;
+
+        result = prepare_row_value(statement, column, value);
+        if (result != PREPARE_SUCCESS) {
+            return result;
+        }
     }
-    if (strlen(email) > COLUMN_EMAIL_LENGTH) {
-        return PREPARE_STRING_TOO_LONG;
+
+    for (uint32_t i = 0; i < NUM_COLUMNS; i++) {
+        if (statement->update_columns[i]) {
+            return PREPARE_SUCCESS;
+        }
     }
+    return PREPARE_SYNTAX_ERROR;
+}
 
-    statement->row_to_insert.id = id;
-    strcpy(statement->row_to_insert.username, username);
-    strcpy(statement->row_to_insert.email, email);
+// create table <name> and drop table <name>
+PrepareResult prepare_table_statement(char* sql, Statement* statement) {
+    char* keyword = strtok(sql, " ");
+    if (strcmp(keyword, "create") == 0) {
+        statement->type = STATEMENT_CREATE_TABLE;
+    } else if (strcmp(keyword, "drop") == 0) {
+        statement->type = STATEMENT_DROP_TABLE;
+    } else {
+        return PREPARE_UNRECOGNIZED_STATEMENT;
+    }
+
+    char* table = strtok(NULL, " ");
+    char* name = strtok(NULL, " ");
+    if (table == NULL || strcmp(table, "table") != 0 || name == NULL || strtok(NULL, " ") != NULL) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    return copy_table_name(statement->table_name, name);
+}
+
+/**
+ *
+ * `in (<id>, ...)` may contain spaces, so it is taken as one piece. strtok ended the operand at
+ * the first space, and the rest of the list is still intact behind it up to the `)`;
+ * tokenizing then starts over after the `)`.
+ *
+ */
+static PrepareResult prepare_key_list(Statement* statement, char* operand, char* sql_end, char** next_keyword) {
+    if (is_parameter(operand)) {
+        *next_keyword = strtok(NULL, " ");
+        return add_parameter(statement, PARAMETER_KEY_LIST);
+    }
+    if (operand[0] != '(') {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    char* operand_end = operand + strlen(operand);
+    if (operand_end < sql_end) {
+        *operand_end = ' ';
+    }
+    char* close = strchr(operand, ')');
+    if (close == NULL) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+    PrepareResult result = parse_key_list(operand, close + 1, statement);
+    *next_keyword = strtok(close + 1, " ");
+    return result;
+}
+
+PrepareResult prepare_select_statement(char* sql, Statement* statement) {
+    char* sql_end = sql + strlen(sql);
+    statement->type = STATEMENT_SELECT;
+    statement->num_select_columns = 0;
+    statement->num_select_predicates = 0;
+    statement->has_key_list = false;
+    statement->key_list_length = 0;
+    statement->has_order_by = false;
+    statement->order_descending = false;
+    statement->has_limit = false;
+
+    char* keyword = strtok(sql, " ,");
+    if (strcmp(keyword, "select") != 0) {
+        return PREPARE_UNRECOGNIZED_STATEMENT;
+    }
+
+    while ((keyword = strtok(NULL, " ,")) != NULL) {
+        if (strcmp(keyword, "from") == 0 || strcmp(keyword, "where") == 0 || strcmp(keyword, "order") == 0 ||
+            strcmp(keyword, "limit") == 0) {
+            break;
+        }
+        if (strcmp(keyword, "*") == 0 && statement->num_select_columns == 0) {
+            continue;
+        }
+        if (statement->num_select_columns >= MAX_SELECT_COLUMNS) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+
+        Column* column = &statement->select_columns[statement->num_select_columns];
+        if (!parse_column(keyword, column)) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        statement->num_select_columns++;
+    }
+
+    // from <table>
+    if (keyword != NULL && strcmp(keyword, "from") == 0) {
+        PrepareResult result = copy_table_name(statement->table_name, strtok(NULL, " "));
+        if (result != PREPARE_SUCCESS) {
+            return result;
+        }
+        keyword = strtok(NULL, " ");
+    }
+
+    // where <column> =|like <value> [and ...], and id in (<id>, ...) at most once
+    if (keyword != NULL && strcmp(keyword, "where") == 0) {
+        do {
+            char* predicate_column_name = strtok(NULL, " ");
+            char* operator = strtok(NULL, " ");
+            char* operand = strtok(NULL, " ");
+            if (operand == NULL) {
+                return PREPARE_SYNTAX_ERROR;
+            }
+
+            if (strcmp(operator, "in") == 0) {
+                Column column;
+                if (!parse_column(predicate_column_name, &column) || column != COLUMN_ID || statement->has_key_list) {
+                    return PREPARE_SYNTAX_ERROR;
+                }
+                statement->has_key_list = true;
+                PrepareResult result = prepare_key_list(statement, operand, sql_end, &keyword);
+                if (result != PREPARE_SUCCESS) {
+                    return result;
+                }
+                continue;
+            }
+
+            if (statement->num_select_predicates >= MAX_SELECT_PREDICATES) {
+                return PREPARE_SYNTAX_ERROR;
+            }
+
+            // A `?` operand is checked once it is bound, only the column and operator are checked here
+            Column column;
+            Predicate* predicate = &statement->select_predicates[statement->num_select_predicates];
+            bool parameterized = is_parameter(operand);
+            if (!parse_column(predicate_column_name, &column) ||
+                !initialize_predicate(predicate, column, operator, parameterized ? "" : operand)) {
+                return PREPARE_SYNTAX_ERROR;
+            }
+            if (parameterized) {
+                if (add_parameter(statement, PARAMETER_PREDICATE) != PREPARE_SUCCESS) {
+                    return PREPARE_SYNTAX_ERROR;
+                }
+                Parameter* parameter = &statement->parameters[statement->num_parameters - 1];
+                parameter->predicate_num = statement->num_select_predicates;
+                parameter->operator = strcmp(operator, "like") == 0 ? "like" : "=";
+            }
+            statement->num_select_predicates++;
+
+            keyword = strtok(NULL, " ");
+        } while (keyword != NULL && strcmp(keyword, "and") == 0);
+    }
+
+    // order by <column> [asc|desc]
+    if (keyword != NULL && strcmp(keyword, "order") == 0) {
+        char* by = strtok(NULL, " ");
+        char* column_name = strtok(NULL, " ");
+        if (by == NULL || strcmp(by, "by") != 0 || column_name == NULL ||
+            !parse_column(column_name, &statement->order_by_column)) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+        statement->has_order_by = true;
+
+        keyword = strtok(NULL, " ");
+        if (keyword != NULL && (strcmp(keyword, "asc") == 0 || strcmp(keyword, "desc") == 0)) {
+            statement->order_descending = strcmp(keyword, "desc") == 0;
+            keyword = strtok(NULL, " ");
+        }
+    }
+
+    // limit <n>
+    if (keyword != NULL && strcmp(keyword, "limit") == 0) {
+        char* limit_string = strtok(NULL, " ");
+        if (limit_string == NULL) {
+            return PREPARE_SYNTAX_ERROR;
+        }
+
+        Parameter literal = { .target = PARAMETER_LIMIT };
+        PrepareResult result = is_parameter(limit_string)
+            ? add_parameter(statement, PARAMETER_LIMIT)
+            : set_parameter_target(statement, &literal, limit_string);
+        if (result != PREPARE_SUCCESS) {
+            return result;
+        }
+        statement->has_limit = true;
+
+        keyword = strtok(NULL, " ");
+    }
+
+    if (keyword != NULL) {
+        return PREPARE_SYNTAX_ERROR;
+    }
+
+    // A bare select, or select *, projects every column
+    if (statement->num_select_columns == 0) {
+        for (uint32_t i = 0; i < NUM_COLUMNS; i++) {
+            statement->select_columns[i] = (Column)i;
+        }
+        statement->num_select_columns = NUM_COLUMNS;
+    }
 
     return PREPARE_SUCCESS;
 }
 
-ExecuteResult execute_statement(Statement* statement, Table* table) {
+/**
+ *
+ * Runs one step of the statement. Called with the pager lock held, the background flusher
+ * only sees the pages between statements. A select returns EXECUTE_ROW for every row and
+ * EXECUTE_SUCCESS once it has no more.
+ *
+ */
+ExecuteResult execute_statement(Statement* statement, Table* table, SelectScan* scan) {
+    ExecuteResult result = EXECUTE_SUCCESS;
+
+    // The default table needs no lookup, so scan may be NULL for anything but a select on it
+    Table* target = table;
+    bool names_table = statement->type != STATEMENT_CREATE_TABLE && statement->type != STATEMENT_DROP_TABLE;
+    if (names_table && statement->table_name[0] != '\0') {
+        if (!scan->started && !catalog_find_table(table, statement->table_name, &scan->table)) {
+            return EXECUTE_NO_SUCH_TABLE;
+        }
+        target = &scan->table;
+    }
+
     switch (statement->type) {
         case (STATEMENT_INSERT):
-            return execute_insert(statement, table);
+            result = execute_insert(statement, target);
+            break;
         case (STATEMENT_SELECT):
-            return execute_select(statement, table);
+            result = execute_select(statement, target, scan);
+            break;
+        case (STATEMENT_BEGIN):
+            result = execute_begin(statement, table);
+            break;
+        case (STATEMENT_COMMIT):
+            result = execute_commit(statement, table);
+            break;
+        case (STATEMENT_ROLLBACK):
+            result = execute_rollback(statement, table);
+            break;
+        case (STATEMENT_UPDATE):
+        case (STATEMENT_UPSERT):
+            result = execute_update(statement, target);
+            break;
+        case (STATEMENT_CREATE_TABLE):
+            result = catalog_create_table(table, statement->table_name);
+            break;
+        case (STATEMENT_DROP_TABLE):
+            result = catalog_drop_table(table, statement->table_name);
+            break;
     }
+
+    return result;
 }
 
 ExecuteResult execute_insert(Statement* statement, Table* table) {
     Row* row_to_insert = &(statement->row_to_insert);
-    uint32_t key_to_insert = row_to_insert->id;
+    uint64_t key_to_insert = row_to_insert->id;
+    if (table->key_size == NARROW_KEY_SIZE && key_to_insert > UINT32_MAX) {
+        return EXECUTE_KEY_OUT_OF_RANGE;
+    }
+
     Cursor* cursor = table_find(table, key_to_insert);
     uint8_t* node = get_page(table->pager, cursor->page_num);
     uint32_t num_cells = *leaf_node_num_cells(node);
     if (cursor->cell_num < num_cells) {
-        uint32_t key_at_index = *leaf_node_key(node, cursor->cell_num);
+        uint64_t key_at_index = leaf_node_key(node, cursor->cell_num);
         if (key_at_index == key_to_insert) {
+            free(cursor);
             return EXECUTE_DUPLICATE_KEY;
         }
     }
@@ -81,13 +626,300 @@ ExecuteResult execute_insert(Statement* statement, Table* table) {
     return insert_result;
 }
 
-ExecuteResult execute_select(Statement* statement, Table* table) {
-    Cursor* cursor = table_start(table);
-    Row row;
-    while (!(cursor->end_of_table)) {
-        deserialize_row((char*) cursor_value(cursor), &row);
-        print_row(&row);
-        cursor_advance(cursor);
+/**
+ *
+ * Rows have a fixed size, so an update overwrites the value bytes in the leaf the key already
+ * lives in: no cell moves and no node splits. An upsert of a missing key is an ordinary insert
+ * at the position the same lookup found.
+ *
+ */
+ExecuteResult execute_update(Statement* statement, Table* table) {
+    Row* row = &(statement->row_to_insert);
+    if (table->key_size == NARROW_KEY_SIZE && row->id > UINT32_MAX) {
+        return EXECUTE_KEY_OUT_OF_RANGE;
+    }
+
+    Cursor* cursor = table_find(table, row->id);
+    uint8_t* node = get_page(table->pager, cursor->page_num);
+    bool found = cursor->cell_num < *leaf_node_num_cells(node) &&
+        leaf_node_key(node, cursor->cell_num) == row->id;
+
+    ExecuteResult result = EXECUTE_SUCCESS;
+    if (!found) {
+        result = statement->type == STATEMENT_UPSERT
+            ? leaf_node_insert(cursor, row->id, row)
+            : EXECUTE_KEY_NOT_FOUND;
+    } else {
+        node = get_page_for_write(table->pager, cursor->page_num);
+        char* value = (char*)leaf_node_value(node, cursor->cell_num);
+        if (statement->type == STATEMENT_UPSERT) {
+            serialize_row(row, value);
+        } else {
+            for (uint32_t i = 0; i < NUM_COLUMNS; i++) {
+                if (statement->update_columns[i]) {
+                    serialize_column(row, (Column)i, value);
+                }
+            }
+        }
+    }
+
+    free(cursor);
+    return result;
+}
+
+static bool select_predicates_match(Statement* statement, uint8_t* value) {
+    for (uint32_t i = 0; i < statement->num_select_predicates; i++) {
+        if (!predicate_matches(&statement->select_predicates[i], value)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void initialize_select_scan(SelectScan* scan) {
+    scan->started = false;
+    scan->finished = false;
+    scan->cursor = NULL;
+    scan->snapshot = NULL;
+    scan->pager = NULL;
+    scan->sorter = NULL;
+    scan->sorted = false;
+    scan->key_list_rows = NULL;
+    scan->num_key_list_rows = 0;
+    scan->next_key_list_row = 0;
+    scan->rows_returned = 0;
+    scan->key = 0;
+    scan->value = malloc(ROW_SIZE);
+}
+
+// Called without the pager lock
+void reset_select_scan(SelectScan* scan) {
+    free(scan->cursor);
+    scan->cursor = NULL;
+    if (scan->snapshot != NULL) {
+        pager_lock(scan->pager);
+        pager_release_snapshot(scan->pager, scan->snapshot);
+        pager_unlock(scan->pager);
+        scan->snapshot = NULL;
+    }
+    if (scan->sorter != NULL) {
+        free_sorter(scan->sorter);
+        free(scan->sorter);
+        scan->sorter = NULL;
+    }
+    scan->sorted = false;
+    free(scan->key_list_rows);
+    scan->key_list_rows = NULL;
+    scan->num_key_list_rows = 0;
+    scan->next_key_list_row = 0;
+    scan->started = false;
+    scan->finished = false;
+    scan->rows_returned = 0;
+}
+
+void free_select_scan(SelectScan* scan) {
+    reset_select_scan(scan);
+    free(scan->value);
+}
+
+// Lets writers reclaim the pages the snapshot kept as soon as the walk is over
+static ExecuteResult finish_select(Table* table, SelectScan* scan) {
+    scan->finished = true;
+    if (scan->snapshot != NULL) {
+        pager_release_snapshot(table->pager, scan->snapshot);
+        scan->snapshot = NULL;
+    }
+    return EXECUTE_SUCCESS;
+}
+
+// Copies the row under the cursor into the scan when it passes the filters
+static bool select_row(Statement* statement, SelectScan* scan, Cursor* cursor, bool needs_value) {
+    uint8_t* value = needs_value ? cursor_value(cursor) : NULL;
+    if (!select_predicates_match(statement, value)) {
+        return false;
+    }
+    scan->key = cursor_key(cursor);
+    if (needs_value) {
+        memcpy(scan->value, value, ROW_SIZE);
+    }
+    scan->rows_returned++;
+    return true;
+}
+
+// The ids of the key list are all looked up in the first step, in one batch
+static bool find_key_list_rows(Statement* statement, Table* table, SelectScan* scan) {
+    scan->key_list_rows = malloc(sizeof(Cursor) * statement->key_list_length);
+    scan->next_key_list_row = 0;
+    return scan->key_list_rows != NULL &&
+           table_find_many(table, statement->key_list, statement->key_list_length, scan->key_list_rows,
+                           &scan->num_key_list_rows);
+}
+
+/**
+ *
+ * Walks the leaves one row per step, or with a key list hands out the rows of its ids. The
+ * first step takes a snapshot and every step reads the tree through it, so inserts run between
+ * two steps neither show up in the result nor move the cursor, and the walk never sees a split
+ * half done.
+ *
+ */
+ExecuteResult execute_select(Statement* statement, Table* table, SelectScan* scan) {
+    // The leaf chain is already in ascending id order
+    if (statement->has_order_by && (statement->order_by_column != COLUMN_ID || statement->order_descending)) {
+        return execute_sorted_select(statement, table, scan);
+    }
+
+    if (scan->finished || (statement->has_limit && scan->rows_returned >= statement->limit)) {
+        return finish_select(table, scan);
+    }
+
+    // Ids live in the key array, the value bytes are only touched for string columns and filters
+    bool needs_value = statement->num_select_predicates > 0;
+    for (uint32_t i = 0; i < statement->num_select_columns; i++) {
+        if (statement->select_columns[i] != COLUMN_ID) {
+            needs_value = true;
+        }
+    }
+
+    Pager* pager = table->pager;
+    if (!scan->started) {
+        scan->snapshot = pager_take_snapshot(pager);
+        scan->pager = pager;
+        pager->read_snapshot = scan->snapshot;
+        scan->started = true;
+        if (!statement->has_key_list) {
+            scan->cursor = table_start(table);
+        } else if (!find_key_list_rows(statement, table, scan)) {
+            pager->read_snapshot = NULL;
+            return EXECUTE_OUT_OF_MEMORY;
+        }
+    } else {
+        pager->read_snapshot = scan->snapshot;
+        if (!statement->has_key_list) {
+            cursor_advance(scan->cursor);
+        }
+    }
+
+    if (statement->has_key_list) {
+        while (scan->next_key_list_row < scan->num_key_list_rows) {
+            if (select_row(statement, scan, &scan->key_list_rows[scan->next_key_list_row++], needs_value)) {
+                pager->read_snapshot = NULL;
+                return EXECUTE_ROW;
+            }
+        }
+    } else {
+        Cursor* cursor = scan->cursor;
+        while (!(cursor->end_of_table)) {
+            if (select_row(statement, scan, cursor, needs_value)) {
+                pager->read_snapshot = NULL;
+                return EXECUTE_ROW;
+            }
+            cursor_advance(cursor);
+        }
+    }
+
+    pager->read_snapshot = NULL;
+    return finish_select(table, scan);
+}
+
+/**
+ *
+ * Reads the matching rows through a snapshot, like a walk of the leaves, and hands them to the
+ * sorter SORT_ROWS_PER_STEP at a time, returning EXECUTE_PENDING after each batch. Once they
+ * are all in the snapshot is released and the sorted rows are handed out one per step.
+ *
+ */
+ExecuteResult execute_sorted_select(Statement* statement, Table* table, SelectScan* scan) {
+    Pager* pager = table->pager;
+    if (!scan->started) {
+        scan->sorter = malloc(sizeof(Sorter));
+        if (scan->sorter == NULL) {
+            return EXECUTE_OUT_OF_MEMORY;
+        }
+        initialize_sorter(scan->sorter, statement->order_by_column, statement->order_descending,
+                          statement->has_limit, statement->limit, table->sort_memory_bytes);
+        scan->snapshot = pager_take_snapshot(pager);
+        scan->pager = pager;
+        scan->started = true;
+
+        pager->read_snapshot = scan->snapshot;
+        if (statement->has_key_list) {
+            // A key list holds few enough rows for one batch
+            if (!find_key_list_rows(statement, table, scan)) {
+                pager->read_snapshot = NULL;
+                return EXECUTE_OUT_OF_MEMORY;
+            }
+            for (uint32_t i = 0; i < scan->num_key_list_rows; i++) {
+                Cursor* cursor = &scan->key_list_rows[i];
+                uint8_t* value = cursor_value(cursor);
+                if (select_predicates_match(statement, value) && !sorter_add(scan->sorter, cursor_key(cursor), value)) {
+                    pager->read_snapshot = NULL;
+                    return EXECUTE_SORT_FAILED;
+                }
+            }
+        } else {
+            scan->cursor = table_start(table);
+        }
+    } else if (!scan->sorted) {
+        pager->read_snapshot = scan->snapshot;
+    }
+
+    if (!scan->sorted) {
+        // The cursor is left on the next row to read
+        Cursor* cursor = scan->cursor;
+        for (uint32_t i = 0; cursor != NULL && !(cursor->end_of_table); i++) {
+            if (i == SORT_ROWS_PER_STEP) {
+                pager->read_snapshot = NULL;
+                return EXECUTE_PENDING;
+            }
+            uint8_t* value = cursor_value(cursor);
+            if (select_predicates_match(statement, value) && !sorter_add(scan->sorter, cursor_key(cursor), value)) {
+                pager->read_snapshot = NULL;
+                return EXECUTE_SORT_FAILED;
+            }
+            cursor_advance(cursor);
+        }
+
+        pager->read_snapshot = NULL;
+        pager_release_snapshot(pager, scan->snapshot);
+        scan->snapshot = NULL;
+        scan->sorted = true;
+        if (!sorter_finish(scan->sorter)) {
+            return EXECUTE_SORT_FAILED;
+        }
+    }
+
+    uint8_t* value;
+    if (scan->finished || !sorter_next(scan->sorter, &scan->key, &value)) {
+        scan->finished = true;
+        return EXECUTE_SUCCESS;
+    }
+    memcpy(scan->value, value, ROW_SIZE);
+    scan->rows_returned++;
+
+    return EXECUTE_ROW;
+}
+
+ExecuteResult execute_begin(Statement* statement, Table* table) {
+    if (table->pager->in_transaction) {
+        return EXECUTE_TRANSACTION_ALREADY_ACTIVE;
+    }
+    pager_begin_transaction(table->pager);
+    return EXECUTE_SUCCESS;
+}
+
+ExecuteResult execute_commit(Statement* statement, Table* table) {
+    if (!table->pager->in_transaction) {
+        return EXECUTE_NO_ACTIVE_TRANSACTION;
+    }
+    pager_commit(table->pager);
+    return EXECUTE_SUCCESS;
+}
+
+ExecuteResult execute_rollback(Statement* statement, Table* table) {
+    if (!table->pager->in_transaction) {
+        return EXECUTE_NO_ACTIVE_TRANSACTION;
     }
+    pager_rollback(table->pager);
     return EXECUTE_SUCCESS;
 }
@@ -2,19 +2,86 @@
 #define STATEMENT_H
 
 #include "row.h"
-#include "input.h"
 #include "table.h"
+#include "cursor.h"
+#include "predicate.h"
+#include "sort.h"
 
 typedef enum {
     STATEMENT_INSERT,
-    STATEMENT_SELECT
+    STATEMENT_SELECT,
+    STATEMENT_BEGIN,
+    STATEMENT_COMMIT,
+    STATEMENT_ROLLBACK,
+    STATEMENT_UPDATE,
+    STATEMENT_UPSERT,
+    STATEMENT_CREATE_TABLE,
+    STATEMENT_DROP_TABLE
 } StatementType;
 
+#define NUM_STATEMENT_TYPES (STATEMENT_DROP_TABLE + 1)
+
+#define MAX_SELECT_COLUMNS 8 // At least NUM_COLUMNS, a bare select projects every column
+#define MAX_SELECT_PREDICATES 4
+#define MAX_PARAMETERS 8
+#define MAX_KEY_LIST 1024 // Ids in one `where id in (...)`
+#define SORT_ROWS_PER_STEP 4096 // Rows a sorted select reads in one step before it lets others in
+
+// What a `?` in the statement stands for, filled in when a value is bound to it
+typedef enum {
+    PARAMETER_ROW_COLUMN,
+    PARAMETER_PREDICATE,
+    PARAMETER_LIMIT,
+    PARAMETER_KEY_LIST
+} ParameterTarget;
+
+typedef struct {
+    ParameterTarget target;
+    Column column; // PARAMETER_ROW_COLUMN only
+    uint32_t predicate_num; // PARAMETER_PREDICATE only
+    const char* operator; // PARAMETER_PREDICATE only
+    bool bound;
+} Parameter;
+
 typedef struct {
     StatementType type;
-    Row row_to_insert;
+    char table_name[MAX_TABLE_NAME_LENGTH + 1]; // Empty for the default table
+    Row row_to_insert; // Also the new values of an update or upsert
+    bool update_columns[NUM_COLUMNS]; // Update only
+    Column select_columns[MAX_SELECT_COLUMNS];
+    uint32_t num_select_columns;
+    Predicate select_predicates[MAX_SELECT_PREDICATES]; // Combined with and
+    uint32_t num_select_predicates;
+    bool has_key_list;
+    uint64_t key_list[MAX_KEY_LIST]; // Ascending and distinct, whatever order they were written in
+    uint32_t key_list_length;
+    bool has_order_by;
+    Column order_by_column;
+    bool order_descending;
+    bool has_limit;
+    uint64_t limit;
+    Parameter parameters[MAX_PARAMETERS]; // In the order the `?`s appear
+    uint32_t num_parameters;
 } Statement;
 
+// Where a select is between two steps
+typedef struct {
+    Table table; // The named table the statement runs against, looked up again until a select starts
+    bool started;
+    bool finished;
+    Cursor* cursor; // Row returned last, for a select that walks the leaves
+    PagerSnapshot* snapshot; // The tree as it was at the first step, held until the walk ends
+    Pager* pager; // Owner of the snapshot
+    Sorter* sorter; // Every matching row, for a select with an order by
+    bool sorted; // The sorter has every matching row and hands them out
+    Cursor* key_list_rows; // Rows of the ids in the key list that exist, for a select with one
+    uint32_t num_key_list_rows;
+    uint32_t next_key_list_row;
+    uint64_t rows_returned;
+    uint64_t key; // Current row
+    uint8_t* value; // Current row, not filled in when only the id is projected
+} SelectScan;
+
 typedef enum {
     PREPARE_SUCCESS,
     PREPARE_UNRECOGNIZED_STATEMENT,
@@ -23,17 +90,42 @@ typedef enum {
     PREPARE_NEGATIVE_ID
 } PrepareResult;
 
-PrepareResult prepare_statement(InputBuffer* input_buffer, Statement* statement);
-PrepareResult prepare_insert_statement(InputBuffer* input_buffer, Statement* statement);
+PrepareResult prepare_statement(char* sql, Statement* statement);
+PrepareResult prepare_insert_statement(char* sql, Statement* statement);
+PrepareResult prepare_select_statement(char* sql, Statement* statement);
+PrepareResult prepare_update_statement(char* sql, Statement* statement);
+PrepareResult prepare_table_statement(char* sql, Statement* statement);
+PrepareResult prepare_row(char* text, Row* row);
+PrepareResult bind_parameter(Statement* statement, uint32_t parameter_num, const char* value);
+PrepareResult bind_key_list(Statement* statement, uint32_t parameter_num, const uint64_t* keys, uint32_t num_keys);
 
 typedef enum { 
     EXECUTE_SUCCESS, 
+    EXECUTE_ROW,
     EXECUTE_DUPLICATE_KEY,
-    EXECUTE_TABLE_FULL 
+    EXECUTE_TABLE_FULL,
+    EXECUTE_KEY_OUT_OF_RANGE,
+    EXECUTE_TRANSACTION_ALREADY_ACTIVE,
+    EXECUTE_NO_ACTIVE_TRANSACTION,
+    EXECUTE_SORT_FAILED,
+    EXECUTE_KEY_NOT_FOUND,
+    EXECUTE_TABLE_EXISTS,
+    EXECUTE_NO_SUCH_TABLE,
+    EXECUTE_CATALOG_FULL,
+    EXECUTE_OUT_OF_MEMORY,
+    EXECUTE_PENDING // A sorted select collected a batch of rows and has none to return yet
 } ExecuteResult;
 
-ExecuteResult execute_statement(Statement* statement, Table* table);
+ExecuteResult execute_statement(Statement* statement, Table* table, SelectScan* scan);
 ExecuteResult execute_insert(Statement* statement, Table* table);
-ExecuteResult execute_select(Statement* statement, Table* table);
+ExecuteResult execute_update(Statement* statement, Table* table);
+ExecuteResult execute_select(Statement* statement, Table* table, SelectScan* scan);
+ExecuteResult execute_sorted_select(Statement* statement, Table* table, SelectScan* scan);
+void initialize_select_scan(SelectScan* scan);
+void reset_select_scan(SelectScan* scan);
+void free_select_scan(SelectScan* scan);
+ExecuteResult execute_begin(Statement* statement, Table* table);
+ExecuteResult execute_commit(Statement* statement, Table* table);
+ExecuteResult execute_rollback(Statement* statement, Table* table);
 
 #endif
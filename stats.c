@@ -0,0 +1,238 @@
+#include "stats.h"
+#include "node.h"
+#include "header.h"
+#include "catalog.h"
+#include "constants.h"
+#include <inttypes.h>
+#include <string.h>
+
+static const char* STATEMENT_NAMES[NUM_STATEMENT_TYPES] = {"insert", "select", "begin", "commit", "rollback", "update", "upsert", "create", "drop"};
+
+static uint32_t latency_bucket(uint64_t latency_ns) {
+    if (latency_ns < LATENCY_SUB_BUCKETS) {
+        return (uint32_t)latency_ns;
+    }
+    uint32_t exponent = 63 - __builtin_clzll(latency_ns);
+    uint32_t shift = exponent - LATENCY_SUB_BUCKET_BITS;
+    uint32_t sub_bucket = (latency_ns >> shift) & (LATENCY_SUB_BUCKETS - 1);
+    return (shift + 1) * LATENCY_SUB_BUCKETS + sub_bucket;
+}
+
+// Smallest latency that lands in the bucket
+static uint64_t latency_bucket_start(uint32_t bucket) {
+    uint32_t group = bucket / LATENCY_SUB_BUCKETS;
+    uint64_t sub_bucket = bucket % LATENCY_SUB_BUCKETS;
+    if (group == 0) {
+        return sub_bucket;
+    }
+    return (LATENCY_SUB_BUCKETS + sub_bucket) << (group - 1);
+}
+
+void record_latency(LatencyHistogram* histogram, uint64_t latency_ns) {
+    histogram->buckets[latency_bucket(latency_ns)]++;
+    histogram->count++;
+    histogram->total_ns += latency_ns;
+    if (latency_ns > histogram->max_ns) {
+        histogram->max_ns = latency_ns;
+    }
+}
+
+// The upper end of the bucket holding the given rank, never more than the largest latency seen
+uint64_t latency_percentile(const LatencyHistogram* histogram, uint32_t per_mille) {
+    if (histogram->count == 0) {
+        return 0;
+    }
+
+    uint64_t rank = (histogram->count * per_mille + 999) / 1000;
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < LATENCY_NUM_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+        if (seen >= rank) {
+            if (i + 1 < LATENCY_NUM_BUCKETS && latency_bucket_start(i + 1) - 1 < histogram->max_ns) {
+                return latency_bucket_start(i + 1) - 1;
+            }
+            return histogram->max_ns;
+        }
+    }
+    return histogram->max_ns;
+}
+
+static uint32_t fill_bucket(uint32_t used, uint32_t capacity) {
+    uint32_t bucket = used * FILL_FACTOR_BUCKETS / capacity;
+    return bucket < FILL_FACTOR_BUCKETS ? bucket : FILL_FACTOR_BUCKETS - 1;
+}
+
+static void measure_node(Pager* pager, uint32_t page_num, uint32_t depth, TreeShape* shape) {
+    uint8_t* node = get_page(pager, page_num);
+
+    if (get_node_type(node) == NODE_LEAF) {
+        shape->leaf_pages++;
+        if (*leaf_node_next_leaf_page_num(node) == page_num + 1) {
+            shape->sequential_leaf_links++;
+        }
+        shape->leaf_fill[fill_bucket(*leaf_node_num_cells(node), leaf_node_max_cells(node))]++;
+        if (depth > shape->height) {
+            shape->height = depth;
+        }
+        return;
+    }
+
+    uint32_t num_keys = *internal_node_num_keys(node);
+    shape->internal_pages++;
+    shape->internal_fill[fill_bucket(num_keys, INTERNAL_NODE_MAX_KEYS)]++;
+    for (uint32_t i = 0; i < num_keys; i++) {
+        measure_node(pager, *internal_node_child_page_num(node, i), depth + 1, shape);
+    }
+    measure_node(pager, *internal_node_right_child_page_num(node), depth + 1, shape);
+}
+
+// Height counts levels, a tree that is a single leaf has height 1
+static void measure_tree(Pager* pager, uint32_t root_page_num, TreeShape* shape) {
+    memset(shape, 0, sizeof(TreeShape));
+    measure_node(pager, root_page_num, 1, shape);
+}
+
+uint32_t measure_tables(Table* database, TableShape* shapes) {
+    Pager* pager = database->pager;
+    shapes[0].name[0] = '\0';
+    measure_tree(pager, database->root_page_num, &shapes[0].shape);
+
+    uint32_t num_tables = 1;
+    uint32_t catalog_page_num = *db_header_catalog_page_num(get_page(pager, DB_HEADER_PAGE_NUM));
+    if (catalog_page_num == 0) {
+        return num_tables;
+    }
+    uint8_t* catalog = get_page(pager, catalog_page_num);
+    for (uint32_t i = 0; i < *catalog_num_tables(catalog); i++) {
+        uint8_t* entry = catalog_entry(catalog, i);
+        TableShape* table = &shapes[num_tables++];
+        strncpy(table->name, catalog_entry_name(entry), MAX_TABLE_NAME_LENGTH);
+        table->name[MAX_TABLE_NAME_LENGTH] = '\0';
+        measure_tree(pager, *catalog_entry_root_page_num(entry), &table->shape);
+    }
+    return num_tables;
+}
+
+static void print_fill(FILE* out, const uint64_t* fill) {
+    for (uint32_t i = 0; i < FILL_FACTOR_BUCKETS; i++) {
+        fprintf(out, " %" PRIu64, fill[i]);
+    }
+    fputc('\n', out);
+}
+
+void print_stats(FILE* out, const StatsSnapshot* snapshot) {
+    fprintf(out, "Pager:\n");
+    fprintf(out, "  cache hits: %" PRIu64 "\n", snapshot->pager.cache_hits);
+    fprintf(out, "  cache misses: %" PRIu64 "\n", snapshot->pager.cache_misses);
+    fprintf(out, "  pages read: %" PRIu64 "\n", snapshot->pager.pages_read);
+    fprintf(out, "  pages written: %" PRIu64 "\n", snapshot->io.pages_written);
+    fprintf(out, "  journal pages written: %" PRIu64 "\n", snapshot->io.journal_pages_written);
+    fprintf(out, "  bytes read: %" PRIu64 "\n", snapshot->pager.bytes_read + snapshot->io.bytes_read);
+    fprintf(out, "  bytes written: %" PRIu64 "\n", snapshot->io.bytes_written);
+    fprintf(out, "  syncs: %" PRIu64 "\n", snapshot->io.syncs);
+    fprintf(out, "  snapshot page copies: %" PRIu64 "\n", snapshot->pager.snapshot_page_copies);
+
+    fprintf(out, "Tree:\n");
+    fprintf(out, "  leaf splits: %" PRIu64 "\n", snapshot->tree.leaf_splits);
+    fprintf(out, "  internal splits: %" PRIu64 "\n", snapshot->tree.internal_splits);
+    fprintf(out, "  root splits: %" PRIu64 "\n", snapshot->tree.root_splits);
+    fprintf(out, "  cursor advances: %" PRIu64 "\n", snapshot->tree.cursor_advances);
+    fprintf(out, "  finger hits: %" PRIu64 "\n", snapshot->tree.finger_hits);
+    fprintf(out, "  hash index hits: %" PRIu64 "\n", snapshot->tree.hash_index_hits);
+    fprintf(out, "  batched keys: %" PRIu64 "\n", snapshot->tree.batched_keys);
+    fprintf(out, "  batched node visits: %" PRIu64 "\n", snapshot->tree.batched_node_visits);
+
+    fprintf(out, "Statements:\n");
+    for (uint32_t i = 0; i < NUM_STATEMENT_TYPES; i++) {
+        const LatencyHistogram* histogram = &snapshot->latencies[i];
+        fprintf(out, "  %s: %" PRIu64 " run", STATEMENT_NAMES[i], histogram->count);
+        if (histogram->count > 0) {
+            fprintf(out, ", p50 %" PRIu64 " ns, p99 %" PRIu64 " ns, p999 %" PRIu64 " ns, max %" PRIu64 " ns",
+                    latency_percentile(histogram, 500), latency_percentile(histogram, 990),
+                    latency_percentile(histogram, 999), histogram->max_ns);
+        }
+        fputc('\n', out);
+    }
+}
+
+static void print_fill_json(FILE* out, const uint64_t* fill) {
+    fputc('[', out);
+    for (uint32_t i = 0; i < FILL_FACTOR_BUCKETS; i++) {
+        fprintf(out, "%s%" PRIu64, i > 0 ? ", " : "", fill[i]);
+    }
+    fputc(']', out);
+}
+
+// A single JSON object
+void print_stats_json(FILE* out, const StatsSnapshot* snapshot) {
+    fprintf(out, "{\"pager\": {\"cache_hits\": %" PRIu64 ", \"cache_misses\": %" PRIu64
+            ", \"pages_read\": %" PRIu64 ", \"pages_written\": %" PRIu64 ", \"journal_pages_written\": %" PRIu64
+            ", \"bytes_read\": %" PRIu64 ", \"bytes_written\": %" PRIu64 ", \"syncs\": %" PRIu64 ", \"snapshot_page_copies\": %" PRIu64 "}",
+            snapshot->pager.cache_hits, snapshot->pager.cache_misses, snapshot->pager.pages_read,
+            snapshot->io.pages_written, snapshot->io.journal_pages_written,
+            snapshot->pager.bytes_read + snapshot->io.bytes_read, snapshot->io.bytes_written, snapshot->io.syncs,
+            snapshot->pager.snapshot_page_copies);
+
+    fprintf(out, ", \"tree\": {\"leaf_splits\": %" PRIu64 ", \"internal_splits\": %" PRIu64 ", \"root_splits\": %" PRIu64
+            ", \"cursor_advances\": %" PRIu64 ", \"finger_hits\": %" PRIu64 ", \"hash_index_hits\": %" PRIu64
+            ", \"batched_keys\": %" PRIu64 ", \"batched_node_visits\": %" PRIu64 "}",
+            snapshot->tree.leaf_splits, snapshot->tree.internal_splits, snapshot->tree.root_splits,
+            snapshot->tree.cursor_advances, snapshot->tree.finger_hits, snapshot->tree.hash_index_hits,
+            snapshot->tree.batched_keys, snapshot->tree.batched_node_visits);
+
+    fprintf(out, ", \"statements\": {");
+    for (uint32_t i = 0; i < NUM_STATEMENT_TYPES; i++) {
+        const LatencyHistogram* histogram = &snapshot->latencies[i];
+        fprintf(out, "%s\"%s\": {\"count\": %" PRIu64 ", \"total_ns\": %" PRIu64 ", \"p50_ns\": %" PRIu64
+                ", \"p99_ns\": %" PRIu64 ", \"p999_ns\": %" PRIu64 ", \"max_ns\": %" PRIu64 "}",
+                i > 0 ? ", " : "", STATEMENT_NAMES[i], histogram->count, histogram->total_ns,
+                latency_percentile(histogram, 500), latency_percentile(histogram, 990),
+                latency_percentile(histogram, 999), histogram->max_ns);
+    }
+    fprintf(out, "}}\n");
+}
+
+void print_table_shapes(FILE* out, const TableShape* shapes, uint32_t num_tables) {
+    for (uint32_t i = 0; i < num_tables; i++) {
+        const TreeShape* shape = &shapes[i].shape;
+        if (shapes[i].name[0] == '\0') {
+            fprintf(out, "Default table:\n");
+        } else {
+            fprintf(out, "Table %s:\n", shapes[i].name);
+        }
+        fprintf(out, "  height: %" PRIu32 "\n", shape->height);
+        fprintf(out, "  leaf pages: %" PRIu32 "\n", shape->leaf_pages);
+        fprintf(out, "  internal pages: %" PRIu32 "\n", shape->internal_pages);
+        fprintf(out, "  sequential leaf links: %" PRIu32 "\n", shape->sequential_leaf_links);
+        fprintf(out, "  leaf fill by 10%%:");
+        print_fill(out, shape->leaf_fill);
+        fprintf(out, "  internal fill by 10%%:");
+        print_fill(out, shape->internal_fill);
+    }
+}
+
+// One JSON array with an object per table, the default table has a null name
+void print_table_shapes_json(FILE* out, const TableShape* shapes, uint32_t num_tables) {
+    fputc('[', out);
+    for (uint32_t i = 0; i < num_tables; i++) {
+        const TreeShape* shape = &shapes[i].shape;
+        fprintf(out, "%s{\"name\": ", i > 0 ? ", " : "");
+        if (shapes[i].name[0] == '\0') {
+            fprintf(out, "null");
+        } else {
+            fprintf(out, "\"%s\"", shapes[i].name);
+        }
+        fprintf(out, ", \"height\": %" PRIu32 ", \"leaf_pages\": %" PRIu32 ", \"internal_pages\": %" PRIu32
+                ", \"sequential_leaf_links\": %" PRIu32 ", \"leaf_fill\": ", shape->height, shape->leaf_pages,
+                shape->internal_pages, shape->sequential_leaf_links);
+        print_fill_json(out, shape->leaf_fill);
+        fprintf(out, ", \"internal_fill\": ");
+        print_fill_json(out, shape->internal_fill);
+        fputc('}', out);
+    }
+    fprintf(out, "]\n");
+}
@@ -0,0 +1,60 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "table.h"
+#include "statement.h"
+
+/**
+ *
+ * Latencies are counted in log-linear buckets, 8 linear steps for every power of two, so
+ * recording one is a few instructions and any percentile read back is within 12.5%.
+ *
+ */
+#define LATENCY_SUB_BUCKET_BITS 3
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BUCKET_BITS)
+#define LATENCY_NUM_BUCKETS ((64 - LATENCY_SUB_BUCKET_BITS + 1) * LATENCY_SUB_BUCKETS)
+
+#define FILL_FACTOR_BUCKETS 10
+
+typedef struct {
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t buckets[LATENCY_NUM_BUCKETS];
+} LatencyHistogram;
+
+// Measured by walking a table on request, nothing is kept up to date for it
+typedef struct {
+    uint32_t height;
+    uint32_t leaf_pages;
+    uint32_t internal_pages;
+    uint32_t sequential_leaf_links; // Leaves whose next leaf is the page right after them
+    uint64_t leaf_fill[FILL_FACTOR_BUCKETS]; // Nodes by how full they are, in steps of 10%
+    uint64_t internal_fill[FILL_FACTOR_BUCKETS];
+} TreeShape;
+
+typedef struct {
+    char name[MAX_TABLE_NAME_LENGTH + 1]; // Empty for the default table
+    TreeShape shape;
+} TableShape;
+
+typedef struct {
+    PagerStats pager;
+    IoStats io;
+    TreeStats tree;
+    const LatencyHistogram* latencies; // One per statement type
+} StatsSnapshot;
+
+void record_latency(LatencyHistogram* histogram, uint64_t latency_ns);
+uint64_t latency_percentile(const LatencyHistogram* histogram, uint32_t per_mille);
+// Fills in the default table, then every table in the catalog. shapes has room for 1 + CATALOG_MAX_TABLES
+uint32_t measure_tables(Table* database, TableShape* shapes);
+void print_stats(FILE* out, const StatsSnapshot* snapshot);
+void print_stats_json(FILE* out, const StatsSnapshot* snapshot);
+void print_table_shapes(FILE* out, const TableShape* shapes, uint32_t num_tables);
+void print_table_shapes_json(FILE* out, const TableShape* shapes, uint32_t num_tables);
+
+#endif
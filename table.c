@@ -1,136 +1,802 @@
 #include "table.h"
 #include "node.h"
+#include "header.h"
+#include "journal.h"
+#include "checksum.h"
+#include "page_map.h"
+#include "hash_index.h"
+#include "page_trace.h"
+#include "flusher.h"
+#include "utils.h"
 #include "constants.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
+#include <stdarg.h>
 
-Pager* pager_open(const char* filename) {
-    int fd = open(filename, O_RDWR | O_CREAT | S_IWUSR | S_IRUSR, 0777);
+// Page offsets are computed in 64 bits so that files larger than 4 GB do not wrap
+static off_t page_offset(uint32_t page_num) {
+    return (off_t)page_num * PAGE_SIZE;
+}
+
+Pager* pager_open(const char* filename, DbError* error) {
+    int fd = open(filename, O_RDWR | O_CREAT, S_IWUSR | S_IRUSR);
 
     if (fd == -1) {
-        printf("Unable to open file\n");
-        exit(EXIT_FAILURE);
+        set_db_error(error, SIMPLESQLITE_CANT_OPEN, "Unable to open file");
+        return NULL;
+    }
+
+    // A journal left behind by an interrupted commit is rolled back before anything is read
+    char* journal_filename = journal_filename_for(filename);
+    off_t file_length = -1;
+    if (journal_recover(fd, journal_filename, error)) {
+        file_length = lseek(fd, 0, SEEK_END);
+        if (file_length == -1) {
+            set_db_error(error, SIMPLESQLITE_IO_ERROR, "Error seeking: %d", errno);
+        } else if (file_length % SECTOR_SIZE != 0) {
+            // Checked against whole pages once the header says whether the file is compressed
+            set_db_error(error, SIMPLESQLITE_CORRUPT, "DB file is not a whole number of pages. Corrupt file.");
+            file_length = -1;
+        } else if ((uint64_t)file_length / PAGE_SIZE >= TABLE_MAX_PAGES) {
+            set_db_error(error, SIMPLESQLITE_CORRUPT, "DB file has more pages than can be addressed. Corrupt file.");
+            file_length = -1;
+        }
     }
 
-    off_t file_length = lseek(fd, 0, SEEK_END);
+    if (file_length == -1) {
+        free(journal_filename);
+        close(fd);
+        return NULL;
+    }
 
     Pager* pager = malloc(sizeof(Pager));
     pager->file_descriptor = fd;
+    pager->journal_filename = journal_filename;
+    pthread_mutex_init(&pager->lock, NULL);
+    pthread_mutex_init(&pager->io_lock, NULL);
     pager->file_length = file_length;
     pager->num_pages = file_length / PAGE_SIZE;
+    pager->num_dirty_pages = 0;
+    pager->dirty_since_ns = 0;
+    pager->in_transaction = false;
+    pager->transaction_num_pages = 0;
+    clear_db_error(&pager->error);
+    pager->error_handler = NULL;
+    memset(&pager->stats, 0, sizeof(pager->stats));
+    memset(&pager->tree_stats, 0, sizeof(pager->tree_stats));
+    memset(&pager->io_stats, 0, sizeof(pager->io_stats));
+    pager->epoch = 1;
+    pager->change_seq = 1; // Read from the header once it is known to be valid
+    pager->tree_generation = 0;
+    memset(pager->fingers, 0, sizeof(pager->fingers));
+    pager->hash_index = NULL;
+    pager->newest_snapshot = NULL;
+    pager->read_snapshot = NULL;
+    pager->num_page_versions = 0;
+    pager->page_map = NULL;
+    pager->page_trace = NULL;
+
+    // The frame table grows on demand in get_page
+    pager->frames_capacity = 0;
+    pager->frames = NULL;
+
+    return pager;
+}
+
+void pager_lock(Pager* pager) {
+    pthread_mutex_lock(&pager->lock);
+}
 
-    // Check
-    if (file_length % PAGE_SIZE != 0) {
-        printf("DB file is not a whole number of pages. Corrupt file.\n");
-        exit(EXIT_FAILURE);
+void pager_unlock(Pager* pager) {
+    pthread_mutex_unlock(&pager->lock);
+}
+
+static void pager_raise(Pager* pager) {
+    pager->read_snapshot = NULL;
+    if (pager->error_handler != NULL) {
+        longjmp(*pager->error_handler, 1);
     }
+    printf("%s\n", pager->error.message);
+    exit(EXIT_FAILURE);
+}
+
+/**
+ *
+ * Records a failure that leaves the cached pages in an unknown state, e.g. a read that failed
+ * halfway through a split, and unwinds to the error handler installed by the caller of the
+ * tree code. The error sticks, so every later statement fails with it as well.
+ *
+ */
+void pager_fail(Pager* pager, SimpleSqliteResult code, const char* format, ...) {
+    va_list arguments;
+    va_start(arguments, format);
+    set_db_error_v(&pager->error, code, format, arguments);
+    va_end(arguments);
+
+    pager_raise(pager);
+}
 
-    // Initialize pages with NULL
-    for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
-        pager->pages[i] = NULL;
+static void pager_mark_dirty(Pager* pager, PageFrame* frame) {
+    if (frame->dirty) {
+        return;
     }
+    frame->dirty = true;
+    if (pager->num_dirty_pages == 0) {
+        pager->dirty_since_ns = monotonic_time_ns();
+    }
+    pager->num_dirty_pages++;
+}
 
-    return pager;
+static void pager_mark_clean(Pager* pager, PageFrame* frame) {
+    if (!frame->dirty) {
+        return;
+    }
+    frame->dirty = false;
+    pager->num_dirty_pages--;
+}
+
+static void pager_reserve(Pager* pager, uint32_t num_pages) {
+    if (num_pages <= pager->frames_capacity) {
+        return;
+    }
+
+    uint32_t new_capacity = pager->frames_capacity == 0 ? 64 : pager->frames_capacity;
+    while (new_capacity < num_pages) {
+        new_capacity = new_capacity > TABLE_MAX_PAGES / 2 ? TABLE_MAX_PAGES : new_capacity * 2;
+    }
+
+    PageFrame* frames = realloc(pager->frames, sizeof(PageFrame) * new_capacity);
+    if (frames == NULL) {
+        pager_fail(pager, SIMPLESQLITE_NO_MEMORY, "Unable to grow page table to %" PRIu32 " pages", new_capacity);
+    }
+
+    // Initialize frames with NULL
+    for (uint32_t i = pager->frames_capacity; i < new_capacity; i++) {
+        frames[i].data = NULL;
+        frames[i].before_image = NULL;
+        frames[i].dirty = false;
+        frames[i].epoch = 0;
+        frames[i].versions = NULL;
+    }
+
+    pager->frames = frames;
+    pager->frames_capacity = new_capacity;
 }
 
-void pager_flush(Pager* pager, uint32_t page_num) {
-    if (pager->pages[page_num] == NULL) {
-        printf("Tried to flush null page.\n");
-        exit(EXIT_FAILURE);
+/**
+ *
+ * Snapshots
+ *
+ * A snapshot sees every page as it was when it was taken, while writers carry on changing
+ * the cached pages. Taking one advances the pager's epoch, and every write stamps the page
+ * with the epoch it happened in. The first write to a page that a live snapshot still reads
+ * copies the old image aside into the page's version list, so a snapshot at epoch s reads
+ * the newest image stamped at or before s. Pages allocated later are only reachable through
+ * pages that changed, so a snapshot never meets them. An image is freed once no live snapshot
+ * falls between its epoch and that of the next newer image.
+ *
+ */
+static bool snapshot_reads_between(Pager* pager, uint64_t from_epoch, uint64_t to_epoch) {
+    for (PagerSnapshot* snapshot = pager->newest_snapshot; snapshot != NULL; snapshot = snapshot->older) {
+        if (snapshot->epoch < from_epoch) {
+            return false;
+        }
+        if (snapshot->epoch < to_epoch) {
+            return true;
+        }
     }
+    return false;
+}
 
-    off_t offset = lseek(pager->file_descriptor, page_num * PAGE_SIZE, SEEK_SET);
-    if (offset == -1) {
-        printf("Error seeking: %d\n", errno);
-        exit(EXIT_FAILURE);
+static void free_page_versions(PageVersion* version) {
+    while (version != NULL) {
+        PageVersion* older = version->older;
+        free(version->data);
+        free(version);
+        version = older;
     }
+}
 
-    ssize_t bytes_written = write(pager->file_descriptor, pager->pages[page_num], PAGE_SIZE);
-    if (bytes_written == -1) {
-        printf("Error writing: %d\n", errno);
-        exit(EXIT_FAILURE);
+static void pager_prune_versions(Pager* pager, PageFrame* frame) {
+    uint64_t newer_epoch = frame->epoch;
+    PageVersion** link = &frame->versions;
+    while (*link != NULL) {
+        PageVersion* version = *link;
+        if (snapshot_reads_between(pager, version->epoch, newer_epoch)) {
+            newer_epoch = version->epoch;
+            link = &version->older;
+        } else {
+            *link = version->older;
+            free(version->data);
+            free(version);
+            pager->num_page_versions--;
+        }
     }
 }
 
+// Called before a cached page is changed in place
+static void pager_preserve_for_snapshots(Pager* pager, PageFrame* frame) {
+    if (frame->epoch == pager->epoch) {
+        return;
+    }
+
+    if (pager->newest_snapshot != NULL && pager->newest_snapshot->epoch >= frame->epoch) {
+        PageVersion* version = malloc(sizeof(PageVersion));
+        uint8_t* data = malloc(PAGE_SIZE);
+        if (version == NULL || data == NULL) {
+            free(version);
+            free(data);
+            pager_fail(pager, SIMPLESQLITE_NO_MEMORY, "Unable to keep a page for a snapshot");
+        }
+        version->data = data;
+        memcpy(version->data, frame->data, PAGE_SIZE);
+        version->epoch = frame->epoch;
+        version->older = frame->versions;
+        frame->versions = version;
+        pager->num_page_versions++;
+        pager->stats.snapshot_page_copies++;
+    }
+    frame->epoch = pager->epoch;
+}
+
+static uint8_t* page_version_at(Pager* pager, PageFrame* frame, uint32_t page_num, uint64_t epoch) {
+    for (PageVersion* version = frame->versions; version != NULL; version = version->older) {
+        if (version->epoch <= epoch) {
+            return version->data;
+        }
+    }
+    pager_fail(pager, SIMPLESQLITE_CORRUPT, "Snapshot has no image of page %" PRIu32 ".", page_num);
+    return NULL;
+}
+
+// Called with the pager lock held, between statements
+PagerSnapshot* pager_take_snapshot(Pager* pager) {
+    PagerSnapshot* snapshot = malloc(sizeof(PagerSnapshot));
+    if (snapshot == NULL) {
+        pager_fail(pager, SIMPLESQLITE_NO_MEMORY, "Unable to take a snapshot");
+    }
+    snapshot->epoch = pager->epoch++;
+    snapshot->newer = NULL;
+    snapshot->older = pager->newest_snapshot;
+    if (pager->newest_snapshot != NULL) {
+        pager->newest_snapshot->newer = snapshot;
+    }
+    pager->newest_snapshot = snapshot;
+    return snapshot;
+}
+
+// Called with the pager lock held, frees the page images only this snapshot still read
+void pager_release_snapshot(Pager* pager, PagerSnapshot* snapshot) {
+    if (snapshot->newer != NULL) {
+        snapshot->newer->older = snapshot->older;
+    } else {
+        pager->newest_snapshot = snapshot->older;
+    }
+    if (snapshot->older != NULL) {
+        snapshot->older->newer = snapshot->newer;
+    }
+    free(snapshot);
+
+    for (uint32_t i = 0; i < pager->frames_capacity && pager->num_page_versions > 0; i++) {
+        if (pager->frames[i].versions != NULL) {
+            pager_prune_versions(pager, &pager->frames[i]);
+        }
+    }
+}
+
+// Unlike the epoch, the change sequence number is part of the page and survives a reopen
+uint64_t* page_change_seq(uint8_t* page) {
+    return (uint64_t*)(page + PAGE_CHANGE_SEQ_OFFSET);
+}
+
+// The header stays cached from when the database is opened, so telling the catalog apart costs no read
+static PageType page_type(Pager* pager, uint32_t page_num, uint8_t* page) {
+    if (page_num == DB_HEADER_PAGE_NUM) {
+        return PAGE_TYPE_HEADER;
+    }
+    uint8_t* header = pager->frames[DB_HEADER_PAGE_NUM].data;
+    if (header != NULL && is_valid_db_header(header) && page_num == *db_header_catalog_page_num(header)) {
+        return PAGE_TYPE_CATALOG;
+    }
+    return get_node_type(page) == NODE_LEAF ? PAGE_TYPE_LEAF : PAGE_TYPE_INTERNAL;
+}
+
+static void trace_page_access(Pager* pager, uint32_t page_num, PageAccessKind kind, uint8_t* page) {
+    PageType type = kind == PAGE_ACCESS_NEW ? PAGE_TYPE_UNKNOWN : page_type(pager, page_num, page);
+    page_trace_record(pager->page_trace, page_num, kind, type);
+}
+
 uint8_t* get_page(Pager* pager, uint32_t page_num) {
     if (page_num >= TABLE_MAX_PAGES) {
-        printf("Tried to fetch page number out of bounds. %d > %d\n", page_num, TABLE_MAX_PAGES);
-        exit(EXIT_FAILURE);
+        pager_fail(pager, SIMPLESQLITE_CORRUPT, "Tried to fetch page number out of bounds. %" PRIu32 " > %" PRIu32, page_num, TABLE_MAX_PAGES);
     }
 
-    if (pager->pages[page_num] == NULL) {
-        uint8_t* page = malloc(PAGE_SIZE);
+    pager_reserve(pager, page_num + 1);
+
+    PageFrame* frame = &pager->frames[page_num];
+    if (pager->read_snapshot != NULL && frame->epoch > pager->read_snapshot->epoch) {
+        pager->stats.cache_hits++;
+        uint8_t* version = page_version_at(pager, frame, page_num, pager->read_snapshot->epoch);
+        if (pager->page_trace != NULL) {
+            trace_page_access(pager, page_num, PAGE_ACCESS_HIT, version);
+        }
+        return version;
+    }
 
-        uint32_t num_pages = pager->file_length / PAGE_SIZE;
+    PageAccessKind access = PAGE_ACCESS_HIT;
+    if (frame->data != NULL) {
+        pager->stats.cache_hits++;
+    } else {
+        pager->stats.cache_misses++;
+        access = PAGE_ACCESS_MISS;
+        uint8_t* page = calloc(1, PAGE_SIZE);
+
+        uint64_t num_pages = pager->file_length / PAGE_SIZE;
         if (pager->file_length % PAGE_SIZE != 0) {
             num_pages += 1;
         }
 
-        // If it is an old page, read from file
+        // If it is an old page, read from file, otherwise it has to be written out eventually
         if (page_num < num_pages) {
-            lseek(pager->file_descriptor, page_num * PAGE_SIZE, SEEK_SET);
-            ssize_t bytes_read = read(pager->file_descriptor, page, PAGE_SIZE);
+            ssize_t bytes_read;
+            if (pager->page_map != NULL) {
+                // The map only changes under the io lock, the sectors of a page that is not cached never do
+                pthread_mutex_lock(&pager->io_lock);
+                PageLocation location = page_map_location(pager->page_map, page_num);
+                pthread_mutex_unlock(&pager->io_lock);
+                bytes_read = read_mapped_page(pager->file_descriptor, location, page);
+            } else {
+                bytes_read = pread(pager->file_descriptor, page, PAGE_SIZE, page_offset(page_num));
+            }
             if (bytes_read == -1) {
-                printf("Error reading file: %d\n", errno);
-                exit(EXIT_FAILURE);
+                free(page);
+                pager_fail(pager, SIMPLESQLITE_IO_ERROR, "Error reading file: %d", errno);
+            }
+            if (!page_checksum_matches(page_num, page)) {
+                free(page);
+                pager_fail(pager, SIMPLESQLITE_CORRUPT, "Checksum mismatch on page %" PRIu32 ".", page_num);
             }
+            pager->stats.pages_read++;
+            pager->stats.bytes_read += bytes_read;
+        } else {
+            access = PAGE_ACCESS_NEW;
+            frame->epoch = pager->epoch;
+            *page_change_seq(page) = pager->change_seq;
+            pager_mark_dirty(pager, frame);
         }
 
-        pager->pages[page_num] = page;
+        frame->data = page;
 
         if (page_num >= pager->num_pages) {
             pager->num_pages = page_num + 1;
         }
     }
 
-    return pager->pages[page_num];
+    if (pager->page_trace != NULL) {
+        trace_page_access(pager, page_num, access, frame->data);
+    }
+    return frame->data;
+}
+
+/**
+ *
+ * Hints that page_num is about to be read, without reading it. A cached page has its header
+ * and the middle of its cells, where a binary search starts, pulled toward the CPU. A page that
+ * is still on disk is handed to the kernel to read ahead, so several pages can be in flight
+ * before the first get_page blocks on one. Pages a snapshot reader sees as older versions are
+ * left alone.
+ *
+ */
+void pager_prefetch(Pager* pager, uint32_t page_num) {
+    if (page_num < pager->frames_capacity) {
+        PageFrame* frame = &pager->frames[page_num];
+        if (pager->read_snapshot != NULL && frame->epoch > pager->read_snapshot->epoch) {
+            return;
+        }
+        if (frame->data != NULL) {
+            __builtin_prefetch(frame->data);
+            __builtin_prefetch(frame->data + PAGE_SIZE / 2);
+            return;
+        }
+    }
+
+    if ((uint64_t)page_offset(page_num) >= pager->file_length) {
+        return;
+    }
+    if (pager->page_map != NULL) {
+        pthread_mutex_lock(&pager->io_lock);
+        PageLocation location = page_map_location(pager->page_map, page_num);
+        pthread_mutex_unlock(&pager->io_lock);
+        if (location.sector != 0) {
+            posix_fadvise(pager->file_descriptor, (off_t)location.sector * SECTOR_SIZE, location.length,
+                          POSIX_FADV_WILLNEED);
+        }
+        return;
+    }
+    posix_fadvise(pager->file_descriptor, page_offset(page_num), PAGE_SIZE, POSIX_FADV_WILLNEED);
+}
+
+/**
+ *
+ * Must be called before a page is modified. Inside a transaction the first write to a page
+ * that existed when the transaction began keeps a before-image, so that rollback can restore it.
+ * The page is stamped with the current change sequence number, which is how a backup finds
+ * the pages written since the previous one.
+ *
+ */
+uint8_t* get_page_for_write(Pager* pager, uint32_t page_num) {
+    uint8_t* page = get_page(pager, page_num);
+    PageFrame* frame = &pager->frames[page_num];
+
+    if (pager->in_transaction && page_num < pager->transaction_num_pages && frame->before_image == NULL) {
+        frame->before_image = malloc(PAGE_SIZE);
+        if (frame->before_image == NULL) {
+            pager_fail(pager, SIMPLESQLITE_NO_MEMORY, "Unable to keep page %" PRIu32 " for rollback", page_num);
+        }
+        memcpy(frame->before_image, page, PAGE_SIZE);
+    }
+    pager_preserve_for_snapshots(pager, frame);
+    *page_change_seq(page) = pager->change_seq;
+    pager_mark_dirty(pager, frame);
+
+    return page;
 }
 
-Table* db_open(const char* filename) {
-    Pager* pager = pager_open(filename);
+void pager_begin_transaction(Pager* pager) {
+    pager->in_transaction = true;
+    pager->transaction_num_pages = pager->num_pages;
+}
+
+static void pager_end_transaction(Pager* pager) {
+    for (uint32_t i = 0; i < pager->frames_capacity; i++) {
+        free(pager->frames[i].before_image);
+        pager->frames[i].before_image = NULL;
+    }
+    pager->in_transaction = false;
+}
+
+/**
+ *
+ * Copies every dirty page and marks it clean. Called with the pager lock held, at a statement
+ * boundary, so the batch is a consistent image of the tree. Returns NULL when nothing is dirty.
+ * When the copy cannot be allocated the pages stay dirty and the pager fails.
+ *
+ */
+DirtyBatch* pager_collect_dirty(Pager* pager) {
+    if (pager->num_dirty_pages == 0) {
+        return NULL;
+    }
+
+    DirtyBatch* batch = malloc(sizeof(DirtyBatch));
+    uint32_t* page_nums = malloc(sizeof(uint32_t) * pager->num_dirty_pages);
+    uint8_t* pages = malloc((size_t)PAGE_SIZE * pager->num_dirty_pages);
+    if (batch == NULL || page_nums == NULL || pages == NULL) {
+        free(batch);
+        free(page_nums);
+        free(pages);
+        pager_fail(pager, SIMPLESQLITE_NO_MEMORY, "Unable to copy %" PRIu32 " dirty pages", pager->num_dirty_pages);
+    }
+    batch->original_file_length = pager->file_length;
+    batch->num_pages = 0;
+    batch->page_nums = page_nums;
+    batch->pages = pages;
+
+    for (uint32_t i = 0; i < pager->frames_capacity && batch->num_pages < pager->num_dirty_pages; i++) {
+        if (!pager->frames[i].dirty) {
+            continue;
+        }
+        batch->page_nums[batch->num_pages] = i;
+        memcpy(batch->pages + (size_t)batch->num_pages * PAGE_SIZE, pager->frames[i].data, PAGE_SIZE);
+        batch->num_pages++;
+    }
+
+    for (uint32_t i = 0; i < batch->num_pages; i++) {
+        pager_mark_clean(pager, &pager->frames[batch->page_nums[i]]);
+    }
+
+    // Pages past the end of the file are in the batch, so the file covers them once it is written
+    if ((uint64_t)pager->num_pages * PAGE_SIZE > pager->file_length) {
+        pager->file_length = (uint64_t)pager->num_pages * PAGE_SIZE;
+    }
+
+    return batch;
+}
+
+static bool pager_write_journaled(Pager* pager, DirtyBatch* batch, int journal_descriptor, DbError* error) {
+    uint32_t original_num_pages = batch->original_file_length / PAGE_SIZE;
+    uint8_t* original_page = malloc(PAGE_SIZE);
+
+    for (uint32_t i = 0; i < batch->num_pages; i++) {
+        uint32_t page_num = batch->page_nums[i];
+        if (page_num >= original_num_pages) {
+            continue;
+        }
+
+        ssize_t bytes_read = pread(pager->file_descriptor, original_page, PAGE_SIZE, page_offset(page_num));
+        if (bytes_read == -1) {
+            set_db_error(error, SIMPLESQLITE_IO_ERROR, "Error reading file: %d", errno);
+            free(original_page);
+            return false;
+        }
+        pager->io_stats.bytes_read += bytes_read;
+        if (!journal_append_block(journal_descriptor, page_offset(page_num), original_page, error)) {
+            free(original_page);
+            return false;
+        }
+        pager->io_stats.journal_pages_written++;
+        pager->io_stats.bytes_written += PAGE_SIZE;
+    }
+    free(original_page);
+
+    if (!journal_sync(journal_descriptor, error)) {
+        return false;
+    }
+    pager->io_stats.syncs++;
+
+    for (uint32_t i = 0; i < batch->num_pages; i++) {
+        uint8_t* page = batch->pages + (size_t)i * PAGE_SIZE;
+        set_page_checksum(batch->page_nums[i], page);
+        ssize_t bytes_written = pwrite(pager->file_descriptor, page, PAGE_SIZE, page_offset(batch->page_nums[i]));
+        if (bytes_written == -1) {
+            set_db_error(error, SIMPLESQLITE_IO_ERROR, "Error writing: %d", errno);
+            return false;
+        }
+        pager->io_stats.pages_written++;
+        pager->io_stats.bytes_written += bytes_written;
+    }
+
+    if (fsync(pager->file_descriptor) == -1) {
+        set_db_error(error, SIMPLESQLITE_IO_ERROR, "Error syncing db file: %d", errno);
+        return false;
+    }
+    pager->io_stats.syncs++;
+
+    return true;
+}
+
+/**
+ *
+ * Writes a batch as one durable unit: the original contents of the pages about to be
+ * overwritten go to the journal, which is synced once, then the pages are written and the
+ * database file is synced once. Deleting the journal marks the write as complete.
+ * Called with the io lock held, the pager lock is not needed. Frees the batch.
+ *
+ * On failure the journal is left in place, so the next open undoes whatever part of the
+ * batch reached the database file.
+ *
+ */
+bool pager_write_batch(Pager* pager, DirtyBatch* batch, DbError* error) {
+    // A compressed file is truncated back to its sectors, not to its logical pages
+    uint64_t original_file_length = pager->page_map != NULL ? page_map_file_length(pager->page_map) : batch->original_file_length;
+    int journal_descriptor = journal_open(pager->journal_filename, original_file_length, error);
+    bool written = journal_descriptor != -1;
+    if (written && pager->page_map != NULL) {
+        written = page_map_write_journaled(pager->page_map, pager->file_descriptor, batch, journal_descriptor,
+                                           &pager->io_stats, error);
+    } else if (written) {
+        written = pager_write_journaled(pager, batch, journal_descriptor, error);
+    }
+
+    if (written) {
+        written = journal_delete(journal_descriptor, pager->journal_filename, error);
+    } else if (journal_descriptor != -1) {
+        close(journal_descriptor);
+    }
+
+    free(batch->page_nums);
+    free(batch->pages);
+    free(batch);
+
+    return written;
+}
+
+void pager_commit(Pager* pager) {
+    DirtyBatch* batch = pager_collect_dirty(pager);
+    if (batch != NULL) {
+        DbError error;
+        pthread_mutex_lock(&pager->io_lock);
+        bool written = pager_write_batch(pager, batch, &error);
+        pthread_mutex_unlock(&pager->io_lock);
+
+        // The batch was marked clean when it was collected, so the cache no longer matches the file
+        if (!written) {
+            pager->error = error;
+            pager_raise(pager);
+        }
+    }
+
+    pager_end_transaction(pager);
+}
+
+void pager_rollback(Pager* pager) {
+    for (uint32_t i = 0; i < pager->frames_capacity; i++) {
+        PageFrame* frame = &pager->frames[i];
+
+        if (i >= pager->transaction_num_pages) {
+            // Pages allocated by the transaction are dropped entirely
+            if (frame->data != NULL) {
+                pager_preserve_for_snapshots(pager, frame);
+            }
+            free(frame->data);
+            frame->data = NULL;
+            pager_mark_clean(pager, frame);
+        } else if (frame->before_image != NULL) {
+            pager_preserve_for_snapshots(pager, frame);
+            memcpy(frame->data, frame->before_image, PAGE_SIZE);
+        }
+    }
+    pager->num_pages = pager->transaction_num_pages;
+    pager->tree_generation++;
+    // The pages the transaction allocated get reused, so entries pointing into them could look valid
+    if (pager->hash_index != NULL) {
+        hash_index_clear(pager->hash_index);
+    }
+
+    pager_end_transaction(pager);
+}
+
+void initialize_db_config(DbConfig* config) {
+    config->key_size = NARROW_KEY_SIZE;
+    config->flush_dirty_pages = 64;
+    config->flush_max_age_ms = 1000;
+    config->flush_pages_per_second = 0;
+    config->sort_memory_kb = 16 * 1024;
+    config->stats_json_path = NULL;
+    config->compress = false;
+    config->hash_index_kb = 0;
+    config->capture_path = NULL;
+    config->page_trace_path = NULL;
+}
+
+static void pager_close(Pager* pager) {
+    for (uint32_t i = 0; i < pager->frames_capacity; i++) {
+        free(pager->frames[i].data);
+        free(pager->frames[i].before_image);
+        free_page_versions(pager->frames[i].versions);
+    }
+
+    close(pager->file_descriptor);
+    page_map_free(pager->page_map);
+    hash_index_free(pager->hash_index);
+    if (pager->page_trace != NULL) {
+        page_trace_close(pager->page_trace, NULL);
+    }
+    pthread_mutex_destroy(&pager->lock);
+    pthread_mutex_destroy(&pager->io_lock);
+    free(pager->frames);
+    free(pager->journal_filename);
+    free(pager);
+}
+
+Table* db_open(const char* filename, const DbConfig* config, DbError* error) {
+    Pager* pager = pager_open(filename, error);
+    if (pager == NULL) {
+        return NULL;
+    }
+
+    if (config->page_trace_path != NULL) {
+        pager->page_trace = page_trace_open(config->page_trace_path, error);
+        if (pager->page_trace == NULL) {
+            pager_close(pager);
+            return NULL;
+        }
+    }
 
     Table* table = (Table*) malloc(sizeof(Table));
     table->pager = pager;
-    table->root_page_num = 0;
-    
+    table->flusher = NULL;
+
+    jmp_buf error_handler;
+    if (setjmp(error_handler) != 0) {
+        *error = pager->error;
+        pager_close(pager);
+        free(table);
+        return NULL;
+    }
+    pager->error_handler = &error_handler;
+
     if (pager->num_pages == 0) {
-        uint8_t* root_node = get_page(pager, 0);
-        initialize_leaf_node(root_node);
+        if (config->compress) {
+            pager->page_map = page_map_create();
+            if (pager->page_map == NULL) {
+                pager_fail(pager, SIMPLESQLITE_NO_MEMORY, "Out of memory");
+            }
+        }
+
+        uint8_t* header = get_page_for_write(pager, DB_HEADER_PAGE_NUM);
+        initialize_db_header(header, config->key_size, config->compress ? DB_FLAG_COMPRESSED : 0);
+
+        uint8_t* root_node = get_page_for_write(pager, *db_header_root_page_num(header));
+        initialize_leaf_node(root_node, config->key_size);
         set_node_root(root_node, true);
     }
 
+    uint8_t* header = get_page(pager, DB_HEADER_PAGE_NUM);
+    if (!is_valid_db_header(header)) {
+        pager_fail(pager, SIMPLESQLITE_CORRUPT, "File is not a simple-sqlite database.");
+    }
+
+    // From here on the pager sees logical pages, wherever the map put them in the file
+    if ((*db_header_flags(header) & DB_FLAG_COMPRESSED) != 0 && pager->page_map == NULL) {
+        pager->page_map = page_map_load(pager->file_descriptor, pager->file_length, error);
+        if (pager->page_map == NULL) {
+            pager->error = *error;
+            pager_raise(pager);
+        }
+        pager->num_pages = pager->page_map->num_pages;
+        pager->file_length = (uint64_t)pager->num_pages * PAGE_SIZE;
+    } else if (pager->page_map == NULL && pager->file_length % PAGE_SIZE != 0) {
+        pager_fail(pager, SIMPLESQLITE_CORRUPT, "DB file is not a whole number of pages. Corrupt file.");
+    }
+
+    pager->change_seq = *db_header_change_seq(header);
+    // A restored backup starts a database of its own, backups of the original no longer apply to it
+    if ((*db_header_flags(header) & DB_FLAG_BACKUP) != 0) {
+        header = get_page_for_write(pager, DB_HEADER_PAGE_NUM);
+        *db_header_flags(header) &= ~DB_FLAG_BACKUP;
+        *db_header_database_id(header) = new_database_id();
+    }
+    pager->error_handler = NULL;
+
+    table->root_page_num = *db_header_root_page_num(header);
+    table->key_size = *db_header_key_size(header);
+    table->sort_memory_bytes = (uint64_t)config->sort_memory_kb * 1024;
+    if (config->hash_index_kb > 0) {
+        pager->hash_index = hash_index_create(config->hash_index_kb);
+    }
+    if (config->flush_dirty_pages > 0) {
+        table->flusher = flusher_start(pager, config, error);
+        if (table->flusher == NULL) {
+            pager_close(pager);
+            free(table);
+            return NULL;
+        }
+    }
+
     return table;
 }
 
-void db_close(Table* table) {
+/**
+ *
+ * Commits whatever is outstanding and frees the table. An open transaction is abandoned,
+ * and nothing is written once the pager has failed. The table is freed either way.
+ *
+ */
+bool db_close(Table* table, DbError* error) {
     Pager* pager = table->pager;
 
-    for (uint32_t i = 0; i < pager->num_pages; i++) {
-        if (pager->pages[i] == NULL) {
-            continue;
-        }
-        pager_flush(pager, i);
-        free(pager->pages[i]);
-        pager->pages[i] = NULL;
+    if (table->flusher != NULL) {
+        flusher_stop(table->flusher);
     }
 
-    int result = close(pager->file_descriptor);
-    if (result == -1) {
-        printf("Error closing db file.\n");
-        exit(EXIT_FAILURE);
+    if (pager->page_trace != NULL) {
+        page_trace_begin(pager->page_trace, PAGE_OPERATION_CLOSE, 0);
     }
 
-    for (uint32_t i = 0; i < TABLE_MAX_PAGES; i++) {
-        uint8_t* page = pager->pages[i];
-        if (page != NULL) {
-            free(page);
-            pager->pages[i] = NULL;
+    jmp_buf error_handler;
+    if (setjmp(error_handler) == 0) {
+        pager->error_handler = &error_handler;
+        if (pager->error.code == SIMPLESQLITE_OK) {
+            if (pager->in_transaction) {
+                pager_rollback(pager);
+            }
+            pager_commit(pager);
         }
     }
+    pager->error_handler = NULL;
 
-    free(pager);
+    *error = pager->error;
+    if (pager->page_trace != NULL) {
+        page_trace_close(pager->page_trace, error->code == SIMPLESQLITE_OK ? error : NULL);
+        pager->page_trace = NULL;
+    }
+    pager_close(pager);
     free(table);
+
+    return error->code == SIMPLESQLITE_OK;
 }
@@ -2,24 +2,158 @@
 #define TABLE_H
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <setjmp.h>
 #include "row.h"
+#include "db_error.h"
+
+struct PageMap;
+struct HashIndex;
+struct PageTrace;
+
+#define MAX_TABLE_NAME_LENGTH 31
+#define FINGER_MAX_DEPTH 32
+#define NUM_FINGERS 8
+
+// An older image of a page, kept while a snapshot can still read it
+typedef struct PageVersion {
+    uint64_t epoch; // Epoch the image was written in, it is what snapshots taken from then on saw
+    uint8_t* data;
+    struct PageVersion* older;
+} PageVersion;
+
+typedef struct {
+    uint8_t* data;
+    uint8_t* before_image; // Contents of the page when the open transaction first wrote it
+    bool dirty;
+    uint64_t epoch; // Epoch of the last write, 0 for a page as it was read from the file
+    PageVersion* versions; // Newest first
+} PageFrame;
+
+// A consistent view of every page as it was between two statements
+typedef struct PagerSnapshot {
+    uint64_t epoch;
+    struct PagerSnapshot* newer;
+    struct PagerSnapshot* older;
+} PagerSnapshot;
+
+// A node on the path to the leaf the last lookup ended in, with the keys that lie below it
+typedef struct {
+    uint32_t page_num;
+    bool has_low;
+    uint64_t low; // Keys below the node are greater than this
+    bool has_high;
+    uint64_t high; // and at most this
+} FingerLevel;
+
+// The path from the root of a table to the leaf the last lookup in it ended in
+typedef struct {
+    uint32_t root_page_num;
+    uint64_t generation; // Tree generation the path was read in
+    uint32_t depth; // Levels in the path including the root, 0 when there is none
+    FingerLevel path[FINGER_MAX_DEPTH];
+} TreeFinger;
+
+// Counted under the pager lock
+typedef struct {
+    uint64_t cache_hits;
+    uint64_t cache_misses;
+    uint64_t pages_read;
+    uint64_t bytes_read;
+    uint64_t snapshot_page_copies; // Pages copied aside before a write because a snapshot still reads them
+} PagerStats;
+
+// Counted under the pager lock
+typedef struct {
+    uint64_t leaf_splits;
+    uint64_t internal_splits;
+    uint64_t root_splits;
+    uint64_t cursor_advances;
+    uint64_t finger_hits; // Lookups that started below the root
+    uint64_t hash_index_hits; // Lookups answered by the hash index without a descent
+    uint64_t batched_keys; // Keys looked up together by table_find_many
+    uint64_t batched_node_visits; // Nodes those lookups read, once per node however many keys pass it
+} TreeStats;
+
+// Counted under the io lock, since the flusher writes without holding the pager lock
+typedef struct {
+    uint64_t pages_written;
+    uint64_t journal_pages_written;
+    uint64_t bytes_written;
+    uint64_t bytes_read; // Original pages read back to be journaled
+    uint64_t syncs;
+} IoStats;
 
 typedef struct {
     int file_descriptor;
-    uint32_t file_length;
+    char* journal_filename;
+    pthread_mutex_t lock; // Held by whoever reads or modifies cached pages
+    pthread_mutex_t io_lock; // Serializes writes to the database file and the journal
+    uint64_t file_length;
     uint32_t num_pages;
-    uint8_t* pages[400];
+    uint32_t frames_capacity;
+    PageFrame* frames;
+    uint32_t num_dirty_pages;
+    uint64_t dirty_since_ns; // When the oldest dirty page became dirty
+    bool in_transaction;
+    uint32_t transaction_num_pages; // num_pages when the open transaction began
+    DbError error; // Set once a read or write fails, the cached pages can no longer be trusted after that
+    jmp_buf* error_handler; // Where pager_fail unwinds to, installed around every call into the tree
+    PagerStats stats;
+    TreeStats tree_stats; // Summed over every table in the file
+    IoStats io_stats;
+    uint64_t epoch; // Stamped on every page written, advanced whenever a snapshot is taken
+    uint64_t change_seq; // Stamped into every page written, advanced by every backup and kept in the header
+    PagerSnapshot* newest_snapshot; // Live snapshots, linked newest to oldest
+    PagerSnapshot* read_snapshot; // Set while a snapshot reader is in the tree, get_page then returns its pages
+    uint32_t num_page_versions;
+    uint64_t tree_generation; // Advanced by every split and rollback, which leaves the fingers stale
+    TreeFinger fingers[NUM_FINGERS]; // Indexed by the root page num of the table
+    struct HashIndex* hash_index; // Hot keys and the leaf cells they were found in, NULL when disabled
+    struct PageMap* page_map; // Where each page lives in a compressed file, NULL otherwise. Guarded by the io lock
+    struct PageTrace* page_trace; // Records every get_page, NULL unless the accesses are traced
 } Pager;
 
+// Copies of dirty pages taken under the pager lock, written out under the io lock only
+typedef struct {
+    uint64_t original_file_length;
+    uint32_t num_pages;
+    uint32_t* page_nums;
+    uint8_t* pages;
+} DirtyBatch;
+
+struct Flusher;
+
+// One B-tree in the file. db_open returns the default table, which owns the pager and the
+// flusher; the tables named in the catalog are views that share them
 typedef struct {
     uint32_t root_page_num;
+    uint32_t key_size;
+    uint64_t sort_memory_bytes;
     Pager* pager;
+    struct Flusher* flusher; // NULL for a named table
 } Table;
 
+typedef SimpleSqliteConfig DbConfig;
+
+uint64_t* page_change_seq(uint8_t* page);
 uint8_t* get_page(Pager* pager, uint32_t page_num);
-Pager* pager_open(const char* filename);
-void pager_flush(Pager* pager, uint32_t page_num);
-Table* db_open(const char* filename);
-void db_close(Table* table);
+uint8_t* get_page_for_write(Pager* pager, uint32_t page_num);
+void pager_prefetch(Pager* pager, uint32_t page_num);
+Pager* pager_open(const char* filename, DbError* error);
+void pager_lock(Pager* pager);
+void pager_unlock(Pager* pager);
+void pager_fail(Pager* pager, SimpleSqliteResult code, const char* format, ...);
+DirtyBatch* pager_collect_dirty(Pager* pager);
+bool pager_write_batch(Pager* pager, DirtyBatch* batch, DbError* error);
+void pager_begin_transaction(Pager* pager);
+void pager_commit(Pager* pager);
+void pager_rollback(Pager* pager);
+PagerSnapshot* pager_take_snapshot(Pager* pager);
+void pager_release_snapshot(Pager* pager, PagerSnapshot* snapshot);
+void initialize_db_config(DbConfig* config);
+Table* db_open(const char* filename, const DbConfig* config, DbError* error);
+bool db_close(Table* table, DbError* error);
 
 #endif
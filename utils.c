@@ -3,6 +3,8 @@
 #include "row.h"
 #include "constants.h"
 #include <stdio.h>
+#include <inttypes.h>
+#include <time.h>
 
 void print_constants(void) {
     printf("ROW_SIZE: %d\n", ROW_SIZE);
@@ -42,7 +44,7 @@ void print_tree_with_level(Pager* pager, uint32_t page_num, uint32_t indentation
             printf("- leaf (size %d)\n", num_keys);
             for (uint32_t i = 0; i < num_keys; i++) {
                 indent(indentation_level + 1);
-                printf("- %d\n", *leaf_node_key(node, i));
+                printf("- %" PRIu64 "\n", leaf_node_key(node, i));
             }
             break;
         case (NODE_INTERNAL):
@@ -55,7 +57,7 @@ void print_tree_with_level(Pager* pager, uint32_t page_num, uint32_t indentation
                     print_tree_with_level(pager, child_page_num, indentation_level + 1);
 
                     indent(indentation_level + 1);
-                    printf("- key %d\n", *internal_node_key(node, i));
+                    printf("- key %" PRIu64 "\n", internal_node_key(node, i));
                 }
                 child_page_num = *internal_node_right_child_page_num(node);
                 print_tree_with_level(pager, child_page_num, indentation_level + 1);
@@ -63,3 +65,33 @@ void print_tree_with_level(Pager* pager, uint32_t page_num, uint32_t indentation
             break;
     }
 }
+
+uint64_t monotonic_time_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// Unsigned LEB128, the encoding of every number in a capture and a page trace
+void write_varint(FILE* file, uint64_t value) {
+    while (value >= 0x80) {
+        putc((int)(value & 0x7F) | 0x80, file);
+        value >>= 7;
+    }
+    putc((int)value, file);
+}
+
+bool read_varint(FILE* file, uint64_t* value) {
+    *value = 0;
+    for (uint32_t shift = 0; shift < 64; shift += 7) {
+        int byte = getc(file);
+        if (byte == EOF) {
+            return false;
+        }
+        *value |= (uint64_t)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
@@ -1,7 +1,9 @@
-#ifndef STATS_H
-#define STATS_H
+#ifndef UTILS_H
+#define UTILS_H
 
+#include <stdio.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include "table.h"
 
 void print_constants(void);
@@ -14,4 +16,10 @@ void print_tree(Pager* pager, uint32_t page_num);
 
 void print_tree_with_level(Pager* pager, uint32_t page_num, uint32_t indentation_level);
 
+uint64_t monotonic_time_ns(void);
+
+void write_varint(FILE* file, uint64_t value);
+// False at the end of the file or on a varint longer than 64 bits
+bool read_varint(FILE* file, uint64_t* value);
+
 #endif